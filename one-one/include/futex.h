@@ -0,0 +1,50 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Raw futex system call, for the kernel protocols that go beyond waiting and
+ * waking on an address: priority inheritance and CLONE_CHILD_CLEARTID. Other
+ * code waits with mthread_wait_on_address() and wakes with
+ * mthread_wake_by_address().
+ */
+
+/**
+ * @brief Fast user-space locking
+ * @param[in] uaddr Pointer to futex word
+ * @param[in] futex_op Operation to be performed
+ * @param[in] val Expected value of the futex word
+ * @param[in] timeout Absolute CLOCK_MONOTONIC deadline for FUTEX_WAIT_BITSET
+ * and FUTEX_LOCK_PI2, relative for FUTEX_WAIT, or NULL to wait forever
+ * @return 0 on success; -1 on error
+ */
+static inline int futex(int *uaddr, int futex_op, int val,
+                        const struct timespec *timeout) {
+    return syscall(SYS_futex, uaddr, futex_op, val, timeout, NULL,
+                   FUTEX_BITSET_MATCH_ANY);
+}
+
+/*
+ * Wait on and wake a futex word with shared futex operations, for words in
+ * memory shared with other processes. Waits return 0 when woken or if the
+ * word did not hold expected, else ETIMEDOUT or EINVAL. Wakes are never
+ * deferred.
+ */
+int futex_wait_shared(int *uaddr, int expected, const struct timespec *abstime);
+
+int futex_wake_shared(int *uaddr, int n);
+
+/*
+ * Wake waiters on a private futex word of the library that never holds a
+ * negative value and is only waited on as a 32-bit word, such as the value
+ * of a mutex, semaphore or condition variable. It is deferred like
+ * mthread_wake_by_address(), and two such wakes flushed together share one
+ * FUTEX_WAKE_OP.
+ */
+int futex_wake_word(int *uaddr, int n);
+
+#endif
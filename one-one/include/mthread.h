@@ -1,6 +1,7 @@
 #ifndef _MTHREAD_H_
 #define _MTHREAD_H_
 
+#include <time.h>
 #include "types.h"
 
 #define MTHREAD_ATTR_DEFAULT    NULL
@@ -107,7 +108,14 @@ int mthread_spin_trylock(mthread_spinlock_t *lock);
  */
 int mthread_spin_unlock(mthread_spinlock_t *lock);
 
-#define MTHREAD_MUTEX_INITIALIZER { 0 }
+enum {
+    MTHREAD_MUTEX_DEFAULT = 0,  /* plain futex mutex                   */
+    MTHREAD_MUTEX_PI      = 1,  /* priority inheritance by the kernel  */
+    MTHREAD_MUTEX_PSHARED = 2,  /* usable from several processes       */
+    MTHREAD_MUTEX_ROBUST  = 4   /* set by mthread_mutex_robust_init()  */
+};
+
+#define MTHREAD_MUTEX_INITIALIZER { 0 , 0 }
 struct mthread_mutex;
 typedef struct mthread_mutex mthread_mutex_t;
 
@@ -116,6 +124,11 @@ typedef struct mthread_mutex mthread_mutex_t;
  */
 int mthread_mutex_init(mthread_mutex_t *mutex);
 
+/*
+ * Initialise the mutex with the given flags
+ */
+int mthread_mutex_init_flags(mthread_mutex_t *mutex, int flags);
+
 /*
  * Try locking the mutex
  */
@@ -126,29 +139,742 @@ int mthread_mutex_trylock(mthread_mutex_t *mutex);
  */
 int mthread_mutex_lock(mthread_mutex_t *mutex);
 
+/*
+ * Lock the mutex, giving up with ETIMEDOUT at the absolute
+ * CLOCK_MONOTONIC deadline abstime
+ */
+int mthread_mutex_timedlock(mthread_mutex_t *mutex, const struct timespec *abstime);
+
 /*
  * Unlock the mutex
  */
 int mthread_mutex_unlock(mthread_mutex_t *mutex);
 
-#define MTHREAD_COND_INITIALIZER { 0 , 0 }
+/*
+ * Mark a robust mutex, taken with EOWNERDEAD, as consistent again. Unlocking
+ * it without doing so makes it unusable.
+ */
+int mthread_mutex_consistent(mthread_mutex_t *mutex);
+
+/*
+ * Mutex recoverable after its owner dies. It carries the link of the robust
+ * list the kernel walks, which plain mutexes do without. Pass &mutex.mutex
+ * to the usual functions.
+ */
+struct mthread_mutex_robust;
+typedef struct mthread_mutex_robust mthread_mutex_robust_t;
+
+int mthread_mutex_robust_init(mthread_mutex_robust_t *mutex, int flags);
+
+/*
+ * Spinlock and mutex padded to a cache line of their own, so that locks
+ * kept next to each other do not false-share. Pass &lock.lock or
+ * &mutex.mutex to the usual functions.
+ */
+#define MTHREAD_SPINLOCK_ALIGNED_INITIALIZER { { 0 } }
+struct mthread_spinlock_aligned;
+typedef struct mthread_spinlock_aligned mthread_spinlock_aligned_t;
+
+#define MTHREAD_MUTEX_ALIGNED_INITIALIZER { MTHREAD_MUTEX_INITIALIZER }
+struct mthread_mutex_aligned;
+typedef struct mthread_mutex_aligned mthread_mutex_aligned_t;
+
+/*
+ * Table of cache-line-padded mutexes, one of which guards each key by its
+ * hash
+ */
+struct mthread_lock_stripes;
+typedef struct mthread_lock_stripes mthread_lock_stripes_t;
+
+/*
+ * Initialise the table with nstripes rounded up to a power of two, or
+ * 4 per CPU if 0
+ */
+int mthread_lock_stripes_init(mthread_lock_stripes_t *stripes, unsigned int nstripes);
+
+int mthread_lock_stripes_destroy(mthread_lock_stripes_t *stripes);
+
+int mthread_lock_stripes_lock_key(mthread_lock_stripes_t *stripes, uint64_t hash);
+
+int mthread_lock_stripes_trylock_key(mthread_lock_stripes_t *stripes, uint64_t hash);
+
+int mthread_lock_stripes_unlock_key(mthread_lock_stripes_t *stripes, uint64_t hash);
+
+/*
+ * Lock the stripes of n keys at once, each once and in ascending order, so
+ * that threads locking overlapping sets can not deadlock
+ */
+int mthread_lock_stripes_lock_keys(mthread_lock_stripes_t *stripes,
+                                   const uint64_t *hashes, int n);
+
+int mthread_lock_stripes_unlock_keys(mthread_lock_stripes_t *stripes,
+                                     const uint64_t *hashes, int n);
+
+/*
+ * Byte-sized lock for embedding in large numbers of small objects. Waiters
+ * park in a global table keyed by the address of the lock.
+ */
+#define MTHREAD_LOCK8_INITIALIZER { 0 }
+struct mthread_lock8;
+typedef struct mthread_lock8 mthread_lock8_t;
+
+int mthread_lock8_init(mthread_lock8_t *lock);
+
+int mthread_lock8_lock(mthread_lock8_t *lock);
+
+int mthread_lock8_trylock(mthread_lock8_t *lock);
+
+int mthread_lock8_unlock(mthread_lock8_t *lock);
+
+enum {
+    MTHREAD_COND_DEFAULT = 0,   /* waiters of this process only        */
+    MTHREAD_COND_PSHARED = 1    /* usable from several processes       */
+};
+
+#define MTHREAD_COND_INITIALIZER { 0 , 0 , 0 }
 struct mthread_cond;
 typedef struct mthread_cond mthread_cond_t;
 
 int mthread_cond_init(mthread_cond_t *cond);
 
+int mthread_cond_init_flags(mthread_cond_t *cond, int flags);
+
 int mthread_cond_wait(mthread_cond_t *cond, mthread_mutex_t *mutex);
 
+int mthread_cond_timedwait(mthread_cond_t *cond, mthread_mutex_t *mutex, const struct timespec *abstime);
+
 int mthread_cond_signal(mthread_cond_t *cond);
 
-#define MTHREAD_SEM_INITIALIZER { 0 }
+int mthread_cond_destroy(mthread_cond_t *cond);
+
+/*
+ * Get an eventfd that becomes readable on a signal after mthread_cond_arm(),
+ * for waiting on the condition variable in epoll(7)
+ */
+int mthread_cond_eventfd(mthread_cond_t *cond, int *fd);
+
+int mthread_cond_arm(mthread_cond_t *cond);
+
+enum {
+    MTHREAD_SEM_DEFAULT = 0,    /* waiters of this process only        */
+    MTHREAD_SEM_PSHARED = 1     /* usable from several processes       */
+};
+
+#define MTHREAD_SEM_INITIALIZER { 0 , 0 }
 struct mthread_sem;
 typedef struct mthread_sem mthread_sem_t;
 
 int mthread_sem_init(mthread_sem_t *sem, uint32_t initval);
 
+int mthread_sem_init_flags(mthread_sem_t *sem, uint32_t initval, int flags);
+
 int mthread_sem_wait(mthread_sem_t *sem);
 
+int mthread_sem_timedwait(mthread_sem_t *sem, const struct timespec *abstime);
+
+int mthread_sem_trywait(mthread_sem_t *sem);
+
 int mthread_sem_post(mthread_sem_t *sem);
 
-#endif
\ No newline at end of file
+int mthread_sem_destroy(mthread_sem_t *sem);
+
+/*
+ * Get an eventfd that becomes readable on a post after mthread_sem_poll()
+ * found the semaphore zero, for waiting on it in epoll(7)
+ */
+int mthread_sem_eventfd(mthread_sem_t *sem, int *fd);
+
+/*
+ * Take the semaphore if it is non-zero; otherwise arm its eventfd and
+ * return EAGAIN
+ */
+int mthread_sem_poll(mthread_sem_t *sem);
+
+/*
+ * Take up to max from the semaphore, blocking while it is zero.
+ * Returns the amount taken.
+ */
+int mthread_sem_wait_upto(mthread_sem_t *sem, uint32_t max);
+
+/*
+ * Add n to the semaphore and wake up to n waiters
+ */
+int mthread_sem_post_n(mthread_sem_t *sem, uint32_t n);
+
+enum {
+    MTHREAD_RWLOCK_PREFER_READER = 0,   /* readers may overtake waiting writers */
+    MTHREAD_RWLOCK_PREFER_WRITER = 1,   /* waiting writers hold off new readers */
+    MTHREAD_RWLOCK_SCALABLE      = 2    /* readers use distributed slots      */
+};
+
+#define MTHREAD_RWLOCK_INITIALIZER { 0 }
+struct mthread_rwlock;
+typedef struct mthread_rwlock mthread_rwlock_t;
+
+/*
+ * Initialise the reader-writer lock with a preference or the scalable
+ * reader mode
+ */
+int mthread_rwlock_init(mthread_rwlock_t *rwlock, int flags);
+
+/*
+ * Destroy the reader-writer lock
+ */
+int mthread_rwlock_destroy(mthread_rwlock_t *rwlock);
+
+/*
+ * Lock the reader-writer lock for reading
+ */
+int mthread_rwlock_rdlock(mthread_rwlock_t *rwlock);
+
+/*
+ * Try locking the reader-writer lock for reading
+ */
+int mthread_rwlock_tryrdlock(mthread_rwlock_t *rwlock);
+
+/*
+ * Lock the reader-writer lock for writing
+ */
+int mthread_rwlock_wrlock(mthread_rwlock_t *rwlock);
+
+/*
+ * Try locking the reader-writer lock for writing
+ */
+int mthread_rwlock_trywrlock(mthread_rwlock_t *rwlock);
+
+/*
+ * Unlock the reader-writer lock held for reading or writing
+ */
+int mthread_rwlock_unlock(mthread_rwlock_t *rwlock);
+
+#define MTHREAD_BARRIER_SERIAL_THREAD (-1)
+struct mthread_barrier;
+typedef struct mthread_barrier mthread_barrier_t;
+
+/*
+ * Initialise the barrier for count threads, spinning up to spin
+ * iterations before sleeping
+ */
+int mthread_barrier_init(mthread_barrier_t *barrier, unsigned int count, unsigned int spin);
+
+/*
+ * Wait until count threads have reached the barrier. One of them gets
+ * MTHREAD_BARRIER_SERIAL_THREAD, the others 0.
+ */
+int mthread_barrier_wait(mthread_barrier_t *barrier);
+
+#define MTHREAD_LATCH_INITIALIZER(count) { (count), 0 }
+struct mthread_latch;
+typedef struct mthread_latch mthread_latch_t;
+
+int mthread_latch_init(mthread_latch_t *latch, unsigned int count);
+
+int mthread_latch_count_down(mthread_latch_t *latch, unsigned int n);
+
+int mthread_latch_wait(mthread_latch_t *latch);
+
+int mthread_latch_trywait(mthread_latch_t *latch);
+
+#define MTHREAD_BIASED_INITIALIZER { 0, 0, 0, { 0, 0 } }
+struct mthread_biased;
+typedef struct mthread_biased mthread_biased_t;
+
+/*
+ * Initialise a lock biased to the thread owner, or to the first thread
+ * that locks it if owner is 0
+ */
+int mthread_biased_init(mthread_biased_t *lock, mthread_t owner);
+
+int mthread_biased_lock(mthread_biased_t *lock);
+
+int mthread_biased_trylock(mthread_biased_t *lock);
+
+int mthread_biased_unlock(mthread_biased_t *lock);
+
+struct mthread_cohort;
+typedef struct mthread_cohort mthread_cohort_t;
+
+/*
+ * Initialise a cohort lock. groups maps each of ncpus CPUs to a group; if
+ * it is NULL, CPUs are grouped by shared last-level cache. A group hands the
+ * lock on within itself up to bound times (0 for a default) before letting
+ * other groups in.
+ */
+int mthread_cohort_init(mthread_cohort_t *lock, const int *groups, int ncpus,
+                        unsigned int bound);
+
+int mthread_cohort_destroy(mthread_cohort_t *lock);
+
+int mthread_cohort_lock(mthread_cohort_t *lock);
+
+int mthread_cohort_trylock(mthread_cohort_t *lock);
+
+int mthread_cohort_unlock(mthread_cohort_t *lock);
+
+/*
+ * Make the calling thread take cohort locks as a member of group, whatever
+ * CPU it runs on; -1 goes back to the group of its CPU
+ */
+int mthread_cohort_set_group(int group);
+
+#define MTHREAD_SEQLOCK_INITIALIZER { 0, { 0, 0 } }
+struct mthread_seqlock;
+typedef struct mthread_seqlock mthread_seqlock_t;
+
+int mthread_seqlock_init(mthread_seqlock_t *seqlock);
+
+/*
+ * Start an optimistic read; returns the sequence to pass to
+ * mthread_seqlock_read_retry(), waiting out a write in progress
+ */
+unsigned int mthread_seqlock_read_begin(mthread_seqlock_t *seqlock);
+
+/*
+ * Whether a write overlapped the read started with seq, in which case the
+ * data read must be discarded and the read started again
+ */
+int mthread_seqlock_read_retry(mthread_seqlock_t *seqlock, unsigned int seq);
+
+int mthread_seqlock_write_lock(mthread_seqlock_t *seqlock);
+
+int mthread_seqlock_write_unlock(mthread_seqlock_t *seqlock);
+
+/*
+ * Copy size bytes of a record guarded by the seqlock from src to dst,
+ * retrying until the copy is consistent
+ */
+int mthread_seqlock_read(mthread_seqlock_t *seqlock, void *dst,
+                         const void *src, size_t size);
+
+/*
+ * Copy size bytes from src into a record guarded by the seqlock at dst
+ */
+int mthread_seqlock_write(mthread_seqlock_t *seqlock, void *dst,
+                          const void *src, size_t size);
+
+struct mthread_combiner;
+typedef struct mthread_combiner mthread_combiner_t;
+
+/*
+ * Initialise a flat-combining lock with nslots operation slots, or a default
+ * number based on the CPU count if nslots is 0
+ */
+int mthread_combiner_init(mthread_combiner_t *combiner, unsigned int nslots);
+
+int mthread_combiner_destroy(mthread_combiner_t *combiner);
+
+/*
+ * Run op(arg) with exclusive access to the data the combiner guards. The
+ * call returns once op has run, possibly on another thread.
+ */
+int mthread_combiner_execute(mthread_combiner_t *combiner,
+                             void (*op)(void *), void *arg);
+
+enum {
+    MTHREAD_EVENT_AUTO_RESET   = 0,     /* a wait consumes the event and wakes one */
+    MTHREAD_EVENT_MANUAL_RESET = 1      /* stays set and wakes all until reset     */
+};
+
+#define MTHREAD_EVENT_INITIALIZER { 0 , 0 , MTHREAD_EVENT_AUTO_RESET }
+struct mthread_event;
+typedef struct mthread_event mthread_event_t;
+
+int mthread_event_init(mthread_event_t *event, int flags);
+
+int mthread_event_set(mthread_event_t *event);
+
+int mthread_event_reset(mthread_event_t *event);
+
+int mthread_event_wait(mthread_event_t *event);
+
+int mthread_event_trywait(mthread_event_t *event);
+
+enum {
+    MTHREAD_WAIT_SEM,
+    MTHREAD_WAIT_MUTEX,
+    MTHREAD_WAIT_EVENT
+};
+
+#define MTHREAD_WAIT_ANY_MAX 128
+struct mthread_wait_object;
+typedef struct mthread_wait_object mthread_wait_object_t;
+
+/*
+ * Wait until one of n semaphores, mutexes or events is available and take
+ * it, as the matching wait or lock would. The index of the object taken is
+ * stored in index. abstime is an absolute CLOCK_MONOTONIC deadline, or NULL.
+ */
+int mthread_wait_any(mthread_wait_object_t *objects, int n,
+                     const struct timespec *abstime, int *index);
+
+/*
+ * Sleep while the naturally aligned word of size 1, 2, 4 or 8 bytes at addr
+ * holds expected, until woken by mthread_wake_by_address() or the absolute
+ * CLOCK_MONOTONIC deadline passes. Wakeups may be spurious.
+ */
+int mthread_wait_on_address(volatile void *addr, uint64_t expected,
+                            size_t size, const struct timespec *abstime);
+
+/*
+ * Wake up to n threads waiting on addr. Returns the number woken. Inside a
+ * deferral scope, while the caller holds a mutex, the wake is deferred until
+ * it unlocks the outermost one, and 0 is returned.
+ */
+int mthread_wake_by_address(volatile void *addr, int n);
+
+/*
+ * Open a scope in which the calling thread defers the wakes it issues while
+ * holding a mutex. Scopes nest; ending the outermost issues the wakes left.
+ */
+int mthread_wake_defer_begin(void);
+
+int mthread_wake_defer_end(void);
+
+struct mthread_percpu_counter;
+typedef struct mthread_percpu_counter mthread_percpu_counter_t;
+
+int mthread_percpu_counter_init(mthread_percpu_counter_t *counter);
+
+int mthread_percpu_counter_destroy(mthread_percpu_counter_t *counter);
+
+/*
+ * Add n to the partial sum of the current CPU, without atomic instructions
+ */
+int mthread_percpu_counter_add(mthread_percpu_counter_t *counter, long n);
+
+/*
+ * Sum of the partial sums; adds in flight may or may not be counted
+ */
+long mthread_percpu_counter_read(mthread_percpu_counter_t *counter);
+
+struct mthread_percpu_node;
+typedef struct mthread_percpu_node mthread_percpu_node_t;
+struct mthread_percpu_freelist;
+typedef struct mthread_percpu_freelist mthread_percpu_freelist_t;
+
+int mthread_percpu_freelist_init(mthread_percpu_freelist_t *list);
+
+int mthread_percpu_freelist_destroy(mthread_percpu_freelist_t *list);
+
+/*
+ * Push node onto the list of the current CPU
+ */
+int mthread_percpu_freelist_push(mthread_percpu_freelist_t *list, mthread_percpu_node_t *node);
+
+/*
+ * Pop a node off the list of the current CPU, or NULL if it is empty
+ */
+mthread_percpu_node_t *mthread_percpu_freelist_pop(mthread_percpu_freelist_t *list);
+
+struct mthread_percpu_slots;
+typedef struct mthread_percpu_slots mthread_percpu_slots_t;
+
+int mthread_percpu_slots_init(mthread_percpu_slots_t *slots);
+
+int mthread_percpu_slots_destroy(mthread_percpu_slots_t *slots);
+
+/*
+ * Take the pointer stored in the slot of the current CPU, leaving it empty;
+ * NULL if it is empty already
+ */
+void *mthread_percpu_slots_take(mthread_percpu_slots_t *slots);
+
+/*
+ * Store ptr in the slot of the current CPU; EBUSY if it is full
+ */
+int mthread_percpu_slots_put(mthread_percpu_slots_t *slots, void *ptr);
+
+enum {
+    MTHREAD_RCU_EPOCH = 0,  /* readers mark their critical sections        */
+    MTHREAD_RCU_QSBR  = 1   /* online threads announce quiescent states    */
+};
+
+struct mthread_rcu_head;
+typedef struct mthread_rcu_head mthread_rcu_head_t;
+
+/*
+ * Load an RCU-protected pointer inside a read-side critical section
+ */
+#define mthread_rcu_dereference(p)      __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/*
+ * Publish an RCU-protected pointer, ordered after the initialisation of
+ * what it points to
+ */
+#define mthread_rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/*
+ * Select the RCU flavor; call it before any thread uses RCU
+ */
+int mthread_rcu_init(int flavor);
+
+int mthread_rcu_read_lock(void);
+
+int mthread_rcu_read_unlock(void);
+
+/*
+ * QSBR: announce that the calling thread holds no RCU-protected reference
+ */
+int mthread_rcu_quiescent_state(void);
+
+/*
+ * QSBR: start or stop taking part in grace periods. Threads are offline
+ * until they call mthread_rcu_thread_online(), and while offline they must
+ * not read RCU-protected data.
+ */
+int mthread_rcu_thread_online(void);
+
+int mthread_rcu_thread_offline(void);
+
+/*
+ * Wait until every read-side critical section that was running when the
+ * call was made has finished
+ */
+int mthread_synchronize_rcu(void);
+
+/*
+ * Have func(head) called by the reclamation thread after a grace period
+ */
+int mthread_call_rcu(mthread_rcu_head_t *head, void (*func)(mthread_rcu_head_t *));
+
+/*
+ * Wait until every callback queued with mthread_call_rcu() so far has run
+ */
+int mthread_rcu_barrier(void);
+
+/*
+ * Work-stealing thread pool: a fixed set of workers, each with a deque of
+ * tasks that the others steal from when idle
+ */
+#define MTHREAD_TASK_GROUP_INITIALIZER { 0 }
+struct mthread_task_group;
+typedef struct mthread_task_group mthread_task_group_t;
+
+struct mthread_pool;
+typedef struct mthread_pool mthread_pool_t;
+
+/*
+ * Start nworkers workers, or one per CPU if 0
+ */
+int mthread_pool_init(mthread_pool_t *pool, int nworkers);
+
+/*
+ * Let the workers run out of tasks and exit, and free the pool
+ */
+int mthread_pool_destroy(mthread_pool_t *pool);
+
+/*
+ * Have func(arg) run by a worker. group, if not NULL, counts the task until
+ * it finishes.
+ */
+int mthread_pool_submit(mthread_pool_t *pool, mthread_task_group_t *group,
+                        void (*func)(void *), void *arg);
+
+/*
+ * Submit func(args[i]) for each of n arguments, waking workers once
+ */
+int mthread_pool_submit_batch(mthread_pool_t *pool, mthread_task_group_t *group,
+                              void (*func)(void *), void **args, int n);
+
+/*
+ * Wait until every task of the group has finished. A worker runs other
+ * tasks meanwhile, so tasks may submit and wait for tasks of their own.
+ */
+int mthread_pool_wait(mthread_pool_t *pool, mthread_task_group_t *group);
+
+/*
+ * Bounded multi-producer multi-consumer channel of pointers. Senders and
+ * receivers block while it is full or empty; once closed, sends fail with
+ * EPIPE and receives drain what is left, then fail with EPIPE.
+ */
+struct mthread_channel;
+typedef struct mthread_channel mthread_channel_t;
+
+/*
+ * Initialise the channel with capacity rounded up to a power of two
+ */
+int mthread_channel_init(mthread_channel_t *channel, unsigned int capacity);
+
+int mthread_channel_destroy(mthread_channel_t *channel);
+
+int mthread_channel_send(mthread_channel_t *channel, void *item);
+
+/*
+ * Send without blocking, failing with EAGAIN if the channel is full
+ */
+int mthread_channel_trysend(mthread_channel_t *channel, void *item);
+
+int mthread_channel_recv(mthread_channel_t *channel, void **item);
+
+/*
+ * Receive without blocking, failing with EAGAIN if the channel is empty
+ */
+int mthread_channel_tryrecv(mthread_channel_t *channel, void **item);
+
+/*
+ * Send as many of n items as fit at once, blocking until at least one
+ * does. The number sent is stored in sent.
+ */
+int mthread_channel_send_batch(mthread_channel_t *channel, void *const *items,
+                               int n, int *sent);
+
+/*
+ * Receive up to n items at once, blocking until at least one is there. The
+ * number received is stored in received.
+ */
+int mthread_channel_recv_batch(mthread_channel_t *channel, void **items,
+                               int n, int *received);
+
+/*
+ * Close the channel, waking every blocked sender and receiver
+ */
+int mthread_channel_close(mthread_channel_t *channel);
+
+/*
+ * Single-producer single-consumer ring of pointers. One thread may push and
+ * one other thread pop, without read-modify-write instructions. With
+ * MTHREAD_SPSC_BLOCKING, mthread_spsc_push() and mthread_spsc_pop() sleep,
+ * and each side wakes the other only if it is asleep; without it, they
+ * yield the CPU while waiting.
+ */
+#define MTHREAD_SPSC_BLOCKING 1
+struct mthread_spsc;
+typedef struct mthread_spsc mthread_spsc_t;
+
+/*
+ * Initialise the ring with capacity rounded up to a power of two
+ */
+int mthread_spsc_init(mthread_spsc_t *spsc, unsigned int capacity, int flags);
+
+int mthread_spsc_destroy(mthread_spsc_t *spsc);
+
+/*
+ * Write an item without making it visible to the consumer, failing with
+ * EAGAIN if the ring is full
+ */
+int mthread_spsc_stage(mthread_spsc_t *spsc, void *item);
+
+/*
+ * Make the items staged so far visible to the consumer at once
+ */
+int mthread_spsc_commit(mthread_spsc_t *spsc);
+
+int mthread_spsc_trypush(mthread_spsc_t *spsc, void *item);
+
+int mthread_spsc_push(mthread_spsc_t *spsc, void *item);
+
+/*
+ * Stage as many of n items as fit and commit them, storing the number in
+ * pushed, or fail with EAGAIN if the ring is full
+ */
+int mthread_spsc_push_batch(mthread_spsc_t *spsc, void *const *items, int n,
+                            int *pushed);
+
+int mthread_spsc_trypop(mthread_spsc_t *spsc, void **item);
+
+int mthread_spsc_pop(mthread_spsc_t *spsc, void **item);
+
+/*
+ * Take up to n items at once, storing the number in popped, or fail with
+ * EAGAIN if the ring is empty
+ */
+int mthread_spsc_pop_batch(mthread_spsc_t *spsc, void **items, int n,
+                           int *popped);
+
+/*
+ * Pipeline of stages, each a function from an item to the item passed on.
+ * The first stage is called with a NULL item and returns the items, then
+ * NULL when there are no more. A later stage may return NULL to drop an
+ * item. At most max_tokens items are in flight, which bounds the memory
+ * taken when a stage is slower than the ones before it.
+ */
+enum {
+    MTHREAD_PIPELINE_PARALLEL,              /* items run at once on any worker  */
+    MTHREAD_PIPELINE_SERIAL_IN_ORDER,       /* one at a time, in input order    */
+    MTHREAD_PIPELINE_SERIAL_OUT_OF_ORDER    /* one at a time, as they arrive    */
+};
+
+struct mthread_pipeline;
+typedef struct mthread_pipeline mthread_pipeline_t;
+
+int mthread_pipeline_init(mthread_pipeline_t *pipeline, int max_tokens);
+
+int mthread_pipeline_destroy(mthread_pipeline_t *pipeline);
+
+/*
+ * Append a stage running func(item, arg). The first stage must be serial.
+ */
+int mthread_pipeline_add_stage(mthread_pipeline_t *pipeline, int mode,
+                               void *(*func)(void *item, void *arg), void *arg);
+
+/*
+ * Run the pipeline on nworkers new threads, or one per CPU if 0, until the
+ * first stage runs out of items and every item has passed the last stage
+ */
+int mthread_pipeline_run(mthread_pipeline_t *pipeline, int nworkers);
+
+/*
+ * Graph of tasks with dependencies. A task runs on a thread pool as soon as
+ * all the tasks it depends on have finished. Of the tasks ready at once,
+ * those with the costliest path to the end of the graph are started first.
+ */
+struct mthread_graph;
+typedef struct mthread_graph mthread_graph_t;
+
+int mthread_graph_init(mthread_graph_t *graph);
+
+int mthread_graph_destroy(mthread_graph_t *graph);
+
+/*
+ * Add a task running func(arg), storing its handle in node
+ */
+int mthread_graph_add_node(mthread_graph_t *graph, void (*func)(void *),
+                           void *arg, int *node);
+
+/*
+ * Make node to wait for node from
+ */
+int mthread_graph_add_edge(mthread_graph_t *graph, int from, int to);
+
+/*
+ * Set the estimated cost of a node, in any unit, used to find the critical
+ * path
+ */
+int mthread_graph_set_cost(mthread_graph_t *graph, int node, long cost);
+
+/*
+ * Run every task of the graph once on the pool, returning when all have
+ * finished. Fails with EDEADLK if the graph has a cycle.
+ */
+int mthread_graph_run(mthread_graph_t *graph, mthread_pool_t *pool);
+
+/*
+ * Parallel loops over a range of indices, split into chunks that the
+ * workers of a pool steal from each other. Workers of a pool run the loops
+ * they call on it; other threads share a default pool.
+ */
+
+/*
+ * Set the number of workers of the default pool, or one per CPU if 0,
+ * before its first use
+ */
+int mthread_parallel_init(int nworkers);
+
+/*
+ * Call func(lo, hi, ctx) over chunks covering [begin, end) of at most grain
+ * indices, or of a size picked from the number of workers if 0
+ */
+int mthread_parallel_for(long begin, long end, long grain,
+                         void (*func)(long lo, long hi, void *ctx), void *ctx);
+
+/*
+ * Accumulate func over chunks of [begin, end) into accumulators of size
+ * bytes, copied from result, and fold them into result in order of the
+ * chunks with combine
+ */
+int mthread_parallel_reduce(long begin, long end, long grain, void *result, size_t size,
+                            void (*func)(long lo, long hi, void *acc, void *ctx),
+                            void (*combine)(void *acc, const void *other, void *ctx),
+                            void *ctx);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _PARKING_H_
+#define _PARKING_H_
+
+#include <time.h>
+
+/*
+ * Parking lot: a global table of wait queues keyed by address, so that a
+ * lock only needs a few bits of state in user memory and no futex word.
+ */
+
+/*
+ * Park the calling thread on addr if validate(addr, arg) returns non-zero,
+ * checked under the bucket lock. Returns 0 once unparked, EAGAIN if
+ * validation failed, or ETIMEDOUT if the absolute CLOCK_MONOTONIC deadline
+ * passed first.
+ */
+int parking_park(const void *addr, int (*validate)(const void *, void *),
+                 void *arg, const struct timespec *abstime);
+
+/*
+ * Unpark up to n threads parked on addr. callback, if given, runs under the
+ * bucket lock with the number unparked and whether threads remain parked.
+ * Returns the number of threads unparked.
+ */
+int parking_unpark(const void *addr, int n,
+                   void (*callback)(const void *, int, int, void *), void *arg);
+
+#endif
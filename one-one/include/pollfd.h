@@ -0,0 +1,35 @@
+#ifndef _POLLFD_H_
+#define _POLLFD_H_
+
+#include "types.h"
+
+/*
+ * Eventfd bridge: lets an event loop wait for a semaphore or condition
+ * variable in epoll(7) alongside its sockets. The eventfd is written only
+ * while a poller has armed it, so posts and signals nobody polls for cost
+ * a single load.
+ */
+
+/*
+ * Get the eventfd, creating it on first use. Returns the file descriptor,
+ * or -1 with errno set.
+ */
+int pollfd_get(struct mthread_pollfd *p);
+
+/*
+ * Clear a readiness left from before and arm the eventfd. The caller checks
+ * its condition again afterwards, as a signal may have come before arming.
+ */
+void pollfd_arm(struct mthread_pollfd *p);
+
+/*
+ * Make the eventfd readable if a poller armed it
+ */
+void pollfd_notify(struct mthread_pollfd *p);
+
+/*
+ * Close the eventfd, if it was created
+ */
+void pollfd_close(struct mthread_pollfd *p);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _TCB_H_
+#define _TCB_H_
+
+#include "types.h"
+
+mthread *mthread_self(void);
+
+/*
+ * Issue the wakes the calling thread deferred while holding mutexes
+ */
+void mthread_wake_flush(void);
+
+/*
+ * Copy the TCB pointers of all threads into a malloc(3)ed array and store
+ * their number in count; returns NULL if memory is short
+ */
+mthread **mthread_registry(int *count);
+
+/*
+ * Register restartable sequences for the calling thread, whose thread
+ * pointer is tp
+ */
+void mthread_rseq_register(mthread *t, void *tp);
+
+/*
+ * CPU the calling thread runs on
+ */
+int mthread_current_cpu(void);
+
+/*
+ * Register the robust mutex list of the calling thread with the kernel
+ */
+void mthread_robust_register(mthread *t);
+
+#endif
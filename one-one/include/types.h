@@ -4,15 +4,52 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <setjmp.h>
+#include <linux/rseq.h>
+#include <linux/futex.h>
 
 /// Maximium length of name of thread
 #define MTHREAD_TCB_NAMELEN     64
 
+/// Bytes reserved below each TCB for libc thread-local variables (errno)
+#define MTHREAD_TLS_RESERVE     4096
+
+/**
+ * Bytes allocated from each TCB up. Past the fields of the TCB, libc reads
+ * and writes its own thread descriptor (cancellation state, for one)
+ * through the thread pointer.
+ */
+#define MTHREAD_TCB_RESERVE     4096
+
+/// Wakes a thread can defer while it holds mutexes
+#define MTHREAD_WAKE_QUEUE_LEN  8
+
 /// Thread Handle
 typedef pid_t mthread_t;
 
+/// A wake deferred until the thread releases its outermost mutex
+struct mthread_wake {
+    /// Address to wake
+    void *addr;
+
+    /// Number of threads to wake
+    int n;
+
+    /// Whether addr is a futex word of the library that is never negative
+    int word;
+};
+
 /// Thread Control Block
 typedef struct mthread {
+    /// Pointer to itself, read through the thread pointer by mthread_self()
+    struct mthread *self;
+
+    /**
+     * Words libc expects after the first one at the thread pointer (dtv,
+     * self pointer, scope flags, stack and pointer guards), some of which it
+     * writes to, so no other field may overlap them
+     */
+    void *libc_reserved[6];
+
     /// Thread ID
     mthread_t tid;
 
@@ -28,9 +65,6 @@ typedef struct mthread {
     /// The result of the thread function
     void *result;
 
-    /// Padding for stack canary
-    int64_t padding;
-
     /// Base pointer to stack
     void *stack_base;
 
@@ -40,6 +74,42 @@ typedef struct mthread {
     /// Detachment type
     int detach_state;
 
+    /// Number of mutexes held; deferred wakes are issued when it drops to 0
+    int lock_depth;
+
+    /// Nesting depth of scopes in which wakes are deferred while holding a
+    /// mutex
+    int wake_defer;
+
+    /// Number of deferred wakes
+    int nwakes;
+
+    /// Deferred wakes, in the order they were requested
+    struct mthread_wake wakes[MTHREAD_WAKE_QUEUE_LEN];
+
+    /// Grace period the thread last reported to RCU; 0 while it holds no
+    /// RCU-protected reference
+    unsigned long rcu_ctr;
+
+    /// Nesting depth of RCU read-side critical sections
+    int rcu_nesting;
+
+    /// Group the thread takes cohort locks in plus one, or 0 to go by its CPU
+    int cohort_group;
+
+    /// Restartable sequences area registered with the kernel for the thread
+    struct rseq rseq_area;
+
+    /// Restartable sequences area in use, or NULL if registration failed
+    struct rseq *rseq;
+
+    /// Pool worker the thread runs, or NULL
+    struct mthread_pool_worker *pool_worker;
+
+    /// Robust mutexes held, which the kernel marks if the thread dies;
+    /// list.next is NULL until the list is registered
+    struct robust_list_head robust_head;
+
     /// Name of process for debugging
     char name[MTHREAD_TCB_NAMELEN];
 
@@ -62,6 +132,9 @@ struct mthread_attr {
     size_t a_stack_size;
 };
 
+/// Size of a cache line in bytes
+#define MTHREAD_CACHE_LINE  64
+
 /// States of a lock
 #define CONTESTED   (2u)
 #define LOCKED      (1u)
@@ -75,8 +148,56 @@ struct mthread_spinlock {
 
 /// Mutex structure
 struct mthread_mutex {
-    /// Value of mutex
+    /// Value of mutex, or TID of the owner for priority inheritance
     int value;
+
+    /// Flags given at initialisation, and whether a robust mutex was left
+    /// inconsistent by an owner that died
+    int flags;
+};
+
+/// Spinlock alone on its cache line
+struct mthread_spinlock_aligned {
+    /// The spinlock
+    struct mthread_spinlock lock;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Mutex alone on its cache line
+struct mthread_mutex_aligned {
+    /// The mutex
+    struct mthread_mutex mutex;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Robust mutex, kept apart so that other mutexes need no list link
+struct mthread_mutex_robust {
+    /// Link in the robust list of the owner, at a fixed offset from the
+    /// futex word so that the kernel can find the word from it
+    struct robust_list robust;
+
+    /// The mutex
+    struct mthread_mutex mutex;
+};
+
+/// Striped Lock Table structure
+struct mthread_lock_stripes {
+    /// Number of stripes, a power of two
+    int nstripes;
+
+    /// Bits of a hash that select a stripe
+    int shift;
+
+    /// Locks, each on a cache line of its own
+    struct mthread_mutex_aligned *locks;
+};
+
+/// Eventfd through which an event loop polls a semaphore or condition
+/// variable
+struct mthread_pollfd {
+    /// The eventfd plus one, or 0 until it is created
+    int fd;
+
+    /// Set while a poller waits for the eventfd to become readable
+    int armed;
 };
 
 /// Condition Variable structure
@@ -86,12 +207,518 @@ struct mthread_cond {
 
     /// Previous value of condition variable
     unsigned int previous;
+
+    /// Number of threads waiting on the condition variable
+    int waiters;
+
+    /// Flags given at initialisation
+    int flags;
+
+    /// Eventfd signalled for an event loop
+    struct mthread_pollfd pollfd;
 };
 
 /// Semaphore structure
 struct mthread_sem {
     /// Value of semaphore
     int value;
+
+    /// Number of threads waiting on the semaphore
+    int waiters;
+
+    /// Flags given at initialisation
+    int flags;
+
+    /// Eventfd signalled for an event loop
+    struct mthread_pollfd pollfd;
+};
+
+/// Reader slot of a scalable reader-writer lock, alone on its cache line
+struct mthread_rwlock_slot {
+    /// Readers that entered through this slot minus those that left by it
+    int count;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Reader-Writer Lock structure
+struct mthread_rwlock {
+    /// Number of readers holding the lock, or WRITER when write locked
+    int value;
+
+    /// Futex word readers sleep on
+    int read_seq;
+
+    /// Futex word writers sleep on
+    int write_seq;
+
+    /// Futex word a writer sleeps on while reader slots drain
+    int drain;
+
+    /// Set while a writer waits for reader slots to drain
+    int draining;
+
+    /// Number of readers waiting
+    int readers_waiting;
+
+    /// Number of writers waiting
+    int writers_waiting;
+
+    /// Preference and mode flags given at initialisation
+    int flags;
+
+    /// Number of reader slots, a power of two (scalable mode only)
+    int nslots;
+
+    /// Distributed reader slots (scalable mode only)
+    struct mthread_rwlock_slot *slots;
+
+    /// Thread holding the lock for writing
+    struct mthread *writer;
+};
+
+/// Barrier structure
+struct mthread_barrier {
+    /// Number of threads yet to arrive in the current phase
+    int count;
+
+    /// Phase number, flipped by the last thread to arrive
+    int phase;
+
+    /// Number of threads sleeping on the phase
+    int waiters;
+
+    /// Number of threads taking part in each phase
+    unsigned int total;
+
+    /// Iterations to spin on the phase before sleeping
+    unsigned int spin;
+};
+
+/// Countdown Latch structure
+struct mthread_latch {
+    /// Count left before the latch opens
+    int count;
+
+    /// Number of threads sleeping on the count
+    int waiters;
+};
+
+/// Byte-sized lock structure
+struct mthread_lock8 {
+    /// Locked and parked bits
+    uint8_t value;
+};
+
+/// Biased Lock structure
+struct mthread_biased {
+    /// Thread the lock is biased to, or 0 until the first thread locks it
+    mthread_t owner;
+
+    /// 1 while the owner holds the lock or is taking it
+    int owner_active;
+
+    /// 1 while a foreign thread holds the lock or is taking it
+    int foreign_active;
+
+    /// Serialises foreign threads
+    struct mthread_mutex foreign_lock;
+};
+
+/// Ticket lock, which may be unlocked by another thread than locked it
+struct mthread_ticket {
+    /// Next ticket to hand out
+    unsigned int next;
+
+    /// Ticket allowed in
+    unsigned int serving;
+
+    /// Number of threads sleeping on serving
+    int waiters;
+};
+
+/// Group of a cohort lock, alone on its cache line
+struct mthread_cohort_node {
+    /// Lock among the threads of the group
+    struct mthread_ticket local;
+
+    /// Whether the group holds the global lock
+    int global_held;
+
+    /// Handoffs within the group since it took the global lock
+    unsigned int batch;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Cohort Lock structure
+struct mthread_cohort {
+    /// Lock among the groups
+    struct mthread_ticket global;
+
+    /// Group of the thread holding the lock
+    int holder;
+
+    /// Handoffs within a group before the global lock is released
+    unsigned int bound;
+
+    /// Number of CPUs mapped
+    int ncpus;
+
+    /// Number of groups
+    int ngroups;
+
+    /// Group of each CPU
+    int *groups;
+
+    /// Groups
+    struct mthread_cohort_node *nodes;
+};
+
+/// Sequence Lock structure
+struct mthread_seqlock {
+    /// Even while the data is stable, odd while a write is in progress
+    unsigned int sequence;
+
+    /// Serialises writers
+    struct mthread_mutex lock;
+};
+
+/// Operation slot of a combining lock, alone on its cache line
+struct mthread_combiner_slot {
+    /// Free, claimed, pending or done
+    int state;
+
+    /// Operation published by the owner of the slot
+    void (*op)(void *);
+
+    /// Argument of the operation
+    void *arg;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Flat-combining Lock structure
+struct mthread_combiner {
+    /// Held by the thread combining the published operations
+    struct mthread_mutex lock;
+
+    /// Number of operation slots, a power of two
+    int nslots;
+
+    /// Operation slots
+    struct mthread_combiner_slot *slots;
+};
+
+/// Event structure
+struct mthread_event {
+    /// 1 when set, 0 when clear
+    int value;
+
+    /// Number of threads sleeping on the value
+    int waiters;
+
+    /// Reset mode given at initialisation
+    int flags;
+};
+
+/// An object for mthread_wait_any() to wait on, tagged with its type
+struct mthread_wait_object {
+    /// MTHREAD_WAIT_SEM, MTHREAD_WAIT_MUTEX or MTHREAD_WAIT_EVENT
+    int type;
+
+    /// Pointer to the semaphore, mutex or event
+    void *object;
+};
+
+/// Value of one CPU, alone on its cache line
+struct mthread_percpu_cell {
+    /// Count, list head or stored pointer
+    intptr_t value;
+
+    /// Guards the value where restartable sequences are unavailable
+    struct mthread_spinlock lock;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Per-CPU Counter structure
+struct mthread_percpu_counter {
+    /// Number of cells, one per possible CPU
+    int ncpus;
+
+    /// Partial sums
+    struct mthread_percpu_cell *cells;
+};
+
+/// Node of a per-CPU freelist, embedded in the free object
+struct mthread_percpu_node {
+    /// Next free node on the same CPU
+    struct mthread_percpu_node *next;
+};
+
+/// Per-CPU Freelist structure
+struct mthread_percpu_freelist {
+    /// Number of cells, one per possible CPU
+    int ncpus;
+
+    /// List heads
+    struct mthread_percpu_cell *cells;
+};
+
+/// Per-CPU Slots structure
+struct mthread_percpu_slots {
+    /// Number of cells, one per possible CPU
+    int ncpus;
+
+    /// Stored pointers, NULL when empty
+    struct mthread_percpu_cell *cells;
+};
+
+/// RCU callback, embedded in the object it reclaims
+struct mthread_rcu_head {
+    /// Next callback queued
+    struct mthread_rcu_head *next;
+
+    /// Function called after a grace period
+    void (*func)(struct mthread_rcu_head *);
+};
+
+/// Group of pool tasks that are waited for together
+struct mthread_task_group {
+    /// Four times the number of tasks submitted and not yet finished, plus
+    /// two while the last of them wakes the waiters, plus one if a thread
+    /// may be sleeping until they are
+    unsigned int state;
+};
+
+/// Worker of a thread pool, with its work-stealing deque
+struct mthread_pool_worker {
+    /// Index of the oldest task, where thieves steal
+    long top;
+
+    /// Index past the newest task, where the worker pushes and pops; on a
+    /// cache line apart from top
+    long bottom __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Circular array of tasks
+    struct mthread_pool_array *array;
+
+    /// Arrays outgrown, freed with the pool, as thieves may still read them
+    struct mthread_pool_array *retired;
+
+    /// Pool the worker belongs to
+    struct mthread_pool *pool;
+
+    /// Thread running the worker
+    mthread_t tid;
+
+    /// State of the generator picking victims to steal from
+    unsigned int seed;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+/// Thread Pool structure
+struct mthread_pool {
+    /// Number of workers
+    int nworkers;
+
+    /// Workers
+    struct mthread_pool_worker *workers;
+
+    /// Tasks submitted from outside the pool, oldest first
+    struct mthread_pool_task *inject_head;
+
+    /// Newest task submitted from outside the pool
+    struct mthread_pool_task *inject_tail;
+
+    /// Number of tasks in the injection queue
+    int injected;
+
+    /// Protects the injection queue
+    struct mthread_mutex inject_lock;
+
+    /// Number of workers parked or about to park
+    int sleepers;
+
+    /// Bumped on every submission that may have to wake a parked worker
+    int epoch;
+
+    /// Set when the workers are to exit once out of tasks
+    int shutdown;
+};
+
+/// Slot of a channel
+struct mthread_channel_slot {
+    /// Position the slot is ready for: p when free for the sender of
+    /// position p, p + 1 once it holds the item of position p
+    uint64_t seq;
+
+    /// Item held
+    void *item;
+};
+
+/// Bounded Multi-producer Multi-consumer Channel structure
+struct mthread_channel {
+    /// Position of the next send, with the top bit set once closed
+    uint64_t head __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Position of the next receive
+    uint64_t tail __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Ring of slots
+    struct mthread_channel_slot *slots __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Number of slots less one, a power of two less one
+    uint64_t mask;
+
+    /// Bumped when an item is sent while a receiver may sleep
+    int recv_seq;
+
+    /// Number of receivers sleeping or about to
+    int recv_waiters;
+
+    /// Bumped when an item is received while a sender may sleep
+    int send_seq;
+
+    /// Number of senders sleeping or about to
+    int send_waiters;
+};
+
+/// Single-producer Single-consumer Ring structure
+struct mthread_spsc {
+    /// Position up to which items are published, written by the producer
+    uint64_t head __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Position of the next item staged, private to the producer
+    uint64_t write;
+
+    /// Copy of tail last read by the producer
+    uint64_t cached_tail;
+
+    /// Position up to which items are taken, written by the consumer
+    uint64_t tail __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Copy of head last read by the consumer
+    uint64_t cached_head;
+
+    /// Set while the producer sleeps because the ring is full
+    int producer_waiting __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Set while the consumer sleeps because the ring is empty
+    int consumer_waiting __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Slots, read-only after initialisation like the fields below
+    void **items __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+    /// Number of slots less one, a power of two less one
+    uint64_t mask;
+
+    /// MTHREAD_SPSC_BLOCKING or 0
+    int flags;
+};
+
+/// Stage of a pipeline
+struct mthread_pipeline_stage {
+    /// MTHREAD_PIPELINE_PARALLEL, _SERIAL_IN_ORDER or _SERIAL_OUT_OF_ORDER
+    int mode;
+
+    /// Function run on each item
+    void *(*func)(void *item, void *arg);
+
+    /// Second argument of func
+    void *arg;
+
+    /// Set while a serial stage runs an item
+    int busy;
+
+    /// Sequence number of the item a serial in-order stage runs next
+    uint64_t next_seq;
+
+    /// Items waiting for the stage, oldest first
+    struct mthread_pipeline_token *head;
+
+    /// Newest item waiting for the stage
+    struct mthread_pipeline_token *tail;
+
+    /// Items waiting for a serial in-order stage, by sequence number modulo
+    /// the number of tokens
+    struct mthread_pipeline_token **reorder;
+};
+
+/// Pipeline structure
+struct mthread_pipeline {
+    /// Stages in order, the first producing the items
+    struct mthread_pipeline_stage *stages;
+
+    /// Number of stages
+    int nstages;
+
+    /// Number of items allowed in flight at once
+    int max_tokens;
+
+    /// Tokens, each carrying an item
+    struct mthread_pipeline_token *tokens;
+
+    /// Tokens not in flight
+    struct mthread_pipeline_token *free;
+
+    /// Sequence number of the next item produced
+    uint64_t next_input;
+
+    /// Set once the first stage has no more items
+    int eof;
+
+    /// Protects the fields above while running
+    struct mthread_mutex lock;
+
+    /// Bumped whenever work may have become available
+    int epoch;
+
+    /// Number of workers sleeping on epoch
+    int sleepers;
+};
+
+/// Node of a task graph
+struct mthread_graph_node {
+    /// Function to call
+    void (*func)(void *);
+
+    /// Argument to call it with
+    void *arg;
+
+    /// Indices of the nodes that depend on this one
+    int *succ;
+
+    /// Number of nodes that depend on this one
+    int nsucc;
+
+    /// Room in succ
+    int succ_cap;
+
+    /// Number of nodes this one depends on
+    int npreds;
+
+    /// Predecessors not yet finished in the current run
+    int pending;
+
+    /// Estimated cost of the node, 1 unless set
+    long cost;
+
+    /// Cost of the longest path from the node to the end of the graph
+    long priority;
+
+    /// Graph the node belongs to
+    struct mthread_graph *graph;
+};
+
+/// Task Graph structure
+struct mthread_graph {
+    /// Nodes, indexed by the handles returned when adding them
+    struct mthread_graph_node *nodes;
+
+    /// Number of nodes
+    int nnodes;
+
+    /// Room in nodes
+    int cap;
+
+    /// Pool running the graph
+    struct mthread_pool *pool;
+
+    /// Tasks of the current run
+    struct mthread_task_group group;
 };
 
-#endif
\ No newline at end of file
+#endif
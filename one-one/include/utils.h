@@ -5,6 +5,12 @@
 
 size_t get_extant_process_limit(void);
 
+int get_possible_cpus(void);
+
+int membarrier_register(void);
+
+int get_cpu_group(int cpu);
+
 char *util_strncpy(char *dst, const char *src, size_t dst_size);
 
 #endif
\ No newline at end of file
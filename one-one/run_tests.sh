@@ -42,4 +42,129 @@ echo "./bin/philosophers"
 echo "2000 steps"
 ./bin/philosophers 2000
 echo ""
-echo ""
\ No newline at end of file
+echo ""
+echo -e "\033[34m**********************RUNNING WAKEUP TEST**********************\033[0m"
+echo "./bin/wakeup_test"
+./bin/wakeup_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING TIMED TEST**********************\033[0m"
+echo "./bin/timed_test"
+./bin/timed_test
+echo ""
+echo ""
+echo -e "\033[34m******************RUNNING SEMAPHORE BATCH TEST*****************\033[0m"
+echo "./bin/sem_batch_test"
+./bin/sem_batch_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING RWLOCK TEST**********************\033[0m"
+echo "./bin/rwlock_test"
+./bin/rwlock_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING BARRIER TEST**********************\033[0m"
+echo "./bin/barrier_test"
+./bin/barrier_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING PI MUTEX TEST**********************\033[0m"
+echo "./bin/pi_test"
+./bin/pi_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING WAIT ANY TEST**********************\033[0m"
+echo "./bin/wait_any_test"
+./bin/wait_any_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING LOCK8 TEST**********************\033[0m"
+echo "./bin/lock8_test"
+./bin/lock8_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING ADDRESS TEST**********************\033[0m"
+echo "./bin/address_test"
+./bin/address_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING WAKE DEFER TEST**********************\033[0m"
+echo "./bin/wake_defer_test"
+./bin/wake_defer_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING COMBINER TEST**********************\033[0m"
+echo "./bin/combiner_test"
+./bin/combiner_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING SEQLOCK TEST**********************\033[0m"
+echo "./bin/seqlock_test"
+./bin/seqlock_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING RCU TEST**********************\033[0m"
+echo "./bin/rcu_test"
+./bin/rcu_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING PERCPU TEST**********************\033[0m"
+echo "./bin/percpu_test"
+./bin/percpu_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING BIASED LOCK TEST**********************\033[0m"
+echo "./bin/biased_test"
+./bin/biased_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING COHORT LOCK TEST**********************\033[0m"
+echo "./bin/cohort_test"
+./bin/cohort_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING PROCESS-SHARED TEST**********************\033[0m"
+echo "./bin/pshared_test"
+./bin/pshared_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING EVENTFD TEST**********************\033[0m"
+echo "./bin/eventfd_test"
+./bin/eventfd_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING LOCK STRIPES TEST**********************\033[0m"
+echo "./bin/stripes_test"
+./bin/stripes_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING THREAD POOL TEST**********************\033[0m"
+echo "./bin/pool_test"
+./bin/pool_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING CHANNEL TEST**********************\033[0m"
+echo "./bin/channel_test"
+./bin/channel_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING SPSC RING TEST**********************\033[0m"
+echo "./bin/spsc_test"
+./bin/spsc_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING PIPELINE TEST**********************\033[0m"
+echo "./bin/pipeline_test"
+./bin/pipeline_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING TASK GRAPH TEST**********************\033[0m"
+echo "./bin/graph_test"
+./bin/graph_test
+echo ""
+echo ""
+echo -e "\033[34m**********************RUNNING PARALLEL LOOPS TEST**********************\033[0m"
+echo "./bin/parallel_test"
+./bin/parallel_test
+echo ""
+echo ""
@@ -0,0 +1,298 @@
+/**
+ * @file address.c
+ * @brief Waiting on and waking by address
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "futex.h"
+#include "parking.h"
+#include "tcb.h"
+
+/// What a parking thread compares the watched word against
+struct expectation {
+    /// Value the word must still hold for the thread to sleep
+    uint64_t value;
+
+    /// Size of the word in bytes
+    size_t size;
+};
+
+/**
+ * @brief Load a word of the given size
+ * @param[in] addr Address of the word
+ * @param[in] size 1, 2 or 8
+ * @return Value of the word
+ */
+static uint64_t load_word(const volatile void *addr, size_t size) {
+    switch(size) {
+    case 1:
+        return atomic_load((const _Atomic uint8_t *)addr);
+    case 2:
+        return atomic_load((const _Atomic uint16_t *)addr);
+    default:
+        return atomic_load((const _Atomic uint64_t *)addr);
+    }
+}
+
+/**
+ * @brief Check, under the bucket lock, that the word is unchanged
+ * @param[in] addr Address of the word
+ * @param[in] arg The expectation
+ * @return Non-zero if the word still holds the expected value
+ */
+static int unchanged(const void *addr, void *arg) {
+    struct expectation *e = arg;
+    return load_word(addr, e->size) == e->value;
+}
+
+/**
+ * @brief Wait for a word in memory to change
+ * @param[in] addr Address of the word, aligned to its size
+ * @param[in] expected Value the word holds while the caller should sleep
+ * @param[in] size Size of the word: 1, 2, 4 or 8 bytes
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @note Returns at once if the word does not hold expected. Otherwise the
+ * thread sleeps until another thread calls mthread_wake_by_address() on
+ * addr. As with a futex, wakeups may be spurious, so callers re-check the
+ * word in a loop. 32-bit words are futex words and wait in the kernel.
+ * Other sizes park in the parking lot, which compares the word under the
+ * lock of its wait queue.
+ * @return 0 when woken or if the word did not hold expected; ETIMEDOUT if the
+ * deadline passed, or EINVAL if the size, alignment or deadline is invalid
+ */
+int mthread_wait_on_address(volatile void *addr, uint64_t expected,
+                            size_t size, const struct timespec *abstime) {
+    struct expectation e = { expected, size };
+    int err;
+
+    if((size != 1 && size != 2 && size != 4 && size != 8) ||
+       (uintptr_t)addr % size != 0)
+        return EINVAL;
+
+    /* A deferred wake may be what lets the word change */
+    mthread_wake_flush();
+
+    if(size == 4) {
+        err = futex((int *)addr, FUTEX_WAIT_BITSET_PRIVATE, (uint32_t)expected,
+                    abstime);
+        if(err == -1 && (errno == ETIMEDOUT || errno == EINVAL))
+            return errno;
+        return 0;
+    }
+
+    if(abstime && (abstime->tv_nsec < 0 || abstime->tv_nsec >= 1000000000))
+        return EINVAL;
+    err = parking_park((const void *)addr, unchanged, &e, abstime);
+    return err == ETIMEDOUT ? ETIMEDOUT : 0;
+}
+
+/**
+ * @brief Wait on a futex word shared with other processes
+ * @param[in] uaddr Address of the futex word
+ * @param[in] expected Value the word holds while the caller should sleep
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @note Private futex operations key the word by the address space, so they
+ * miss waiters in other processes. Shared ones key it by the page it lies
+ * in, at the cost of a lookup of the mapping in the kernel.
+ * @return 0 when woken or if the word did not hold expected; ETIMEDOUT if the
+ * deadline passed, or EINVAL if the deadline is invalid
+ */
+int futex_wait_shared(int *uaddr, int expected, const struct timespec *abstime) {
+    mthread_wake_flush();
+
+    if(futex(uaddr, FUTEX_WAIT_BITSET, expected, abstime) == -1 &&
+       (errno == ETIMEDOUT || errno == EINVAL))
+        return errno;
+    return 0;
+}
+
+/**
+ * @brief Wake waiters on a futex word shared with other processes
+ * @param[in] uaddr Address of the futex word
+ * @param[in] n Most waiters to wake
+ * @return Number of waiters woken
+ */
+int futex_wake_shared(int *uaddr, int n) {
+    int woken = futex(uaddr, FUTEX_WAKE, n, NULL);
+    return woken < 0 ? 0 : woken;
+}
+
+/**
+ * @brief Wake threads waiting on a word in memory, without deferring
+ * @param[in] addr Address of the word
+ * @param[in] n Most threads to wake
+ * @return Number of threads woken
+ */
+static int wake_now(volatile void *addr, int n) {
+    int woken = 0;
+
+    if((uintptr_t)addr % 4 == 0) {
+        woken = futex((int *)addr, FUTEX_WAKE_PRIVATE, n, NULL);
+        if(woken < 0)
+            woken = 0;
+    }
+    if(woken < n)
+        woken += parking_unpark((const void *)addr, n - woken, NULL, NULL);
+    return woken;
+}
+
+/**
+ * @brief Wake the waiters of two futex words of the library with one system
+ * call
+ * @param[in] w1 First wake
+ * @param[in] w2 Second wake
+ * @note FUTEX_WAKE_OP adds 0 to the second word, which leaves it as it is,
+ * and wakes its waiters if its old value is at least 0. Only words given to
+ * futex_wake_word() are paired, and they are never negative, so the
+ * comparison always passes. Their waiters all sleep in the kernel, so the
+ * parking lot is not searched.
+ * @return 0 if both were woken, or -1 if the system call failed
+ */
+static int wake_pair(struct mthread_wake *w1, struct mthread_wake *w2) {
+    if(syscall(SYS_futex, w1->addr, FUTEX_WAKE_OP_PRIVATE, w1->n, (long)w2->n,
+               w2->addr, FUTEX_OP(FUTEX_OP_ADD, 0, FUTEX_OP_CMP_GE, 0)) == -1)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Issue the wakes the calling thread deferred while holding mutexes
+ * @note Wakes are issued in the order they were requested. Two wakes in a
+ * row of futex words of the library share one FUTEX_WAKE_OP; any other
+ * wake takes a FUTEX_WAKE of its own. FUTEX_WAKE_OP only wakes the second
+ * word behind a comparison on its old value, which can only be made
+ * certain to pass for words known never to be negative.
+ */
+void mthread_wake_flush(void) {
+    struct mthread_wake wakes[MTHREAD_WAKE_QUEUE_LEN];
+    mthread *t = mthread_self();
+    int i, n, depth;
+
+    if(t == NULL || t->nwakes == 0)
+        return;
+
+    /*
+     * Unparking a thread wakes by address in turn. Such wakes must not land
+     * in the queue being walked, nor stay queued while the caller goes to
+     * sleep, so the queue is copied out and deferral is off meanwhile.
+     */
+    n = t->nwakes;
+    memcpy(wakes, t->wakes, n * sizeof(struct mthread_wake));
+    t->nwakes = 0;
+    depth = t->wake_defer;
+    t->wake_defer = 0;
+
+    for(i = 0; i < n; i++) {
+        if(i + 1 < n && wakes[i].word && wakes[i + 1].word &&
+           wake_pair(&wakes[i], &wakes[i + 1]) == 0) {
+            i++;
+            continue;
+        }
+        wake_now(wakes[i].addr, wakes[i].n);
+    }
+    t->wake_defer = depth;
+}
+
+/**
+ * @brief Start deferring the wakes the calling thread issues under a mutex
+ * @note Wakes are issued at once outside of a scope. Scopes nest.
+ * @return On success, returns 0; before mthread_init(), EINVAL
+ */
+int mthread_wake_defer_begin(void) {
+    mthread *t = mthread_self();
+
+    if(t == NULL)
+        return EINVAL;
+    t->wake_defer++;
+    return 0;
+}
+
+/**
+ * @brief End a scope opened by mthread_wake_defer_begin()
+ * @note Ending the outermost scope issues the wakes still deferred, such as
+ * those of a mutex that is still held.
+ * @return On success, returns 0; if the thread is not in a scope, EPERM
+ */
+int mthread_wake_defer_end(void) {
+    mthread *t = mthread_self();
+
+    if(t == NULL || t->wake_defer == 0)
+        return EPERM;
+    if(--t->wake_defer == 0)
+        mthread_wake_flush();
+    return 0;
+}
+
+/**
+ * @brief Wake threads waiting on a word in memory, or queue the wake
+ * @param[in] addr Address of the word
+ * @param[in] n Most threads to wake
+ * @param[in] word Whether addr is a futex word of the library
+ * @return Number of threads woken, or 0 if the wake was deferred
+ */
+static int wake_or_defer(volatile void *addr, int n, int word) {
+    mthread *t = mthread_self();
+    int i;
+
+    if(n <= 0)
+        return 0;
+
+    if(t && t->lock_depth > 0 && t->wake_defer > 0) {
+        for(i = 0; i < t->nwakes; i++) {
+            if(t->wakes[i].addr == addr) {
+                t->wakes[i].n = t->wakes[i].n > INT_MAX - n ? INT_MAX
+                                                            : t->wakes[i].n + n;
+                return 0;
+            }
+        }
+        if(t->nwakes < MTHREAD_WAKE_QUEUE_LEN) {
+            t->wakes[t->nwakes].addr = (void *)addr;
+            t->wakes[t->nwakes].n = n;
+            t->wakes[t->nwakes].word = word;
+            t->nwakes++;
+            return 0;
+        }
+    }
+
+    return wake_now(addr, n);
+}
+
+/**
+ * @brief Wake threads waiting on a word in memory
+ * @param[in] addr Address of the word
+ * @param[in] n Most threads to wake; INT_MAX wakes all
+ * @note Change the word before waking. A 4-byte aligned address may have
+ * waiters in the kernel, so it costs a FUTEX_WAKE system call; parked
+ * waiters of other sizes are looked up only if their wait queue is in use.
+ * Inside a scope opened by mthread_wake_defer_begin(), while the calling
+ * thread holds a mutex, the wake is instead queued in its TCB, merged with
+ * an earlier wake of the same address, and issued when the outermost mutex
+ * is unlocked or before the thread blocks or spins. A woken thread then
+ * does not run straight into a mutex we still hold.
+ * @return Number of threads woken, or 0 if the wake was deferred
+ */
+int mthread_wake_by_address(volatile void *addr, int n) {
+    return wake_or_defer(addr, n, 0);
+}
+
+/**
+ * @brief Wake waiters on a futex word of the library
+ * @param[in] uaddr Address of a private futex word that is never negative
+ * and only waited on as a 32-bit word
+ * @param[in] n Most threads to wake
+ * @note As mthread_wake_by_address(), except that a deferred wake may share
+ * a FUTEX_WAKE_OP with the one queued next to it.
+ * @return Number of threads woken, or 0 if the wake was deferred
+ */
+int futex_wake_word(int *uaddr, int n) {
+    return wake_or_defer(uaddr, n, 1);
+}
@@ -0,0 +1,72 @@
+/**
+ * @file barrier.c
+ * @brief Barrier Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/**
+ * @brief Initialise the barrier
+ * @param[in,out] barrier Pointer to barrier
+ * @param[in] count Number of threads that must arrive before any proceeds
+ * @param[in] spin Iterations a waiting thread spins before it sleeps;
+ * useful when all threads have a core of their own and phases are short
+ * @return On success, returns 0; if count is 0, EINVAL
+ */
+int mthread_barrier_init(mthread_barrier_t *barrier, unsigned int count,
+                         unsigned int spin) {
+    assert(barrier);
+    if(count == 0)
+        return EINVAL;
+
+    atomic_init(&barrier->count, count);
+    atomic_init(&barrier->phase, 0);
+    atomic_init(&barrier->waiters, 0);
+    barrier->total = count;
+    barrier->spin  = spin;
+    return 0;
+}
+
+/**
+ * @brief Wait for all threads to reach the barrier
+ * @param[in,out] barrier Pointer to barrier
+ * @note The phase word acts as the sense of a sense-reversing barrier. Each
+ * thread remembers the phase it arrived in, and the last one to arrive
+ * re-arms the count for the next phase, flips the phase and wakes every
+ * sleeper with a single FUTEX_WAKE.
+ * @return MTHREAD_BARRIER_SERIAL_THREAD to the last thread to arrive, and 0
+ * to the others
+ */
+int mthread_barrier_wait(mthread_barrier_t *barrier) {
+    assert(barrier);
+    int phase = atomic_load(&barrier->phase);
+    unsigned int i;
+
+    if(atomic_fetch_sub(&barrier->count, 1) == 1) {
+        atomic_store(&barrier->count, barrier->total);
+        atomic_fetch_add(&barrier->phase, 1);
+        if(atomic_load(&barrier->waiters) > 0)
+            mthread_wake_by_address(&barrier->phase, INT_MAX);
+        return MTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    for(i = 0; i < barrier->spin; i++) {
+        if(atomic_load_explicit(&barrier->phase, memory_order_acquire) != phase)
+            return 0;
+        __builtin_ia32_pause();
+    }
+
+    atomic_fetch_add(&barrier->waiters, 1);
+    while(atomic_load(&barrier->phase) == phase)
+        mthread_wait_on_address(&barrier->phase, phase, sizeof(int), NULL);
+    atomic_fetch_sub(&barrier->waiters, 1);
+
+    return 0;
+}
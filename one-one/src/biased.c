@@ -0,0 +1,187 @@
+/**
+ * @file biased.c
+ * @brief Biased Lock Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#include "mthread.h"
+#include "tcb.h"
+#include "utils.h"
+
+/// Whether membarrier(2) is usable: not yet known, usable, or not
+#define BARRIER_UNKNOWN 0
+#define BARRIER_YES     1
+#define BARRIER_NO      2
+
+static int barrier_state = BARRIER_UNKNOWN;
+
+/**
+ * @brief Find out whether membarrier(2) is usable, registering for it
+ * @return BARRIER_YES or BARRIER_NO
+ */
+static int barrier_resolve(void) {
+    int state = atomic_load(&barrier_state);
+
+    if(state == BARRIER_UNKNOWN) {
+        state = membarrier_register() ? BARRIER_YES : BARRIER_NO;
+        atomic_store(&barrier_state, state);
+    }
+    return state;
+}
+
+/**
+ * @brief Order the store of the owner flag before the load of the foreign
+ * flag, on the side of the owner
+ * @note Once membarrier(2) is known to work, foreign threads issue it, which
+ * forces a barrier on the owner, so the owner only stops the compiler from
+ * reordering. Until then it uses a full fence.
+ */
+static inline void owner_fence(void) {
+    if(atomic_load_explicit(&barrier_state, memory_order_relaxed) == BARRIER_YES)
+        atomic_signal_fence(memory_order_seq_cst);
+    else
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief The same, on the side of a foreign thread
+ */
+static inline void foreign_fence(void) {
+    if(barrier_resolve() == BARRIER_YES)
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    else
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Whether the calling thread is the one the lock is biased to
+ * @note A lock without an owner is biased to the calling thread.
+ */
+static inline int is_owner(mthread_biased_t *lock) {
+    mthread_t self = mthread_self()->tid, owner = 0;
+
+    if(lock->owner == self)
+        return 1;
+    return lock->owner == 0 &&
+           (atomic_compare_exchange_strong(&lock->owner, &owner, self) || owner == self);
+}
+
+/**
+ * @brief Let a foreign thread waiting for the owner go
+ */
+static inline void owner_release(mthread_biased_t *lock) {
+    atomic_store_explicit(&lock->owner_active, 0, memory_order_release);
+    owner_fence();
+    if(atomic_load_explicit(&lock->foreign_active, memory_order_relaxed))
+        mthread_wake_by_address(&lock->owner_active, 1);
+}
+
+/**
+ * @brief Initialise the biased lock
+ * @param[in,out] lock Pointer to lock
+ * @param[in] owner Thread the lock is biased to, or 0 for the first thread
+ * that locks it
+ * @return On success, returns 0
+ */
+int mthread_biased_init(mthread_biased_t *lock, mthread_t owner) {
+    assert(lock);
+    lock->owner = owner;
+    atomic_init(&lock->owner_active, 0);
+    atomic_init(&lock->foreign_active, 0);
+    mthread_mutex_init(&lock->foreign_lock);
+    barrier_resolve();
+    return 0;
+}
+
+/**
+ * @brief Lock the biased lock
+ * @param[in,out] lock Pointer to lock
+ * @note The owner raises its flag with a plain store and checks the flag
+ * of foreign threads; if one is up, it lowers its own and waits for it to
+ * drop. A foreign thread takes the mutex that serialises foreign threads,
+ * raises its flag, forces a barrier on the owner with membarrier(2), and
+ * waits for the flag of the owner to drop.
+ * @return On success, returns 0
+ */
+int mthread_biased_lock(mthread_biased_t *lock) {
+    assert(lock);
+
+    if(is_owner(lock)) {
+        for(;;) {
+            atomic_store_explicit(&lock->owner_active, 1, memory_order_relaxed);
+            owner_fence();
+            if(atomic_load_explicit(&lock->foreign_active, memory_order_acquire) == 0)
+                return 0;
+
+            owner_release(lock);
+            while(atomic_load(&lock->foreign_active) == 1)
+                mthread_wait_on_address(&lock->foreign_active, 1, sizeof(int), NULL);
+        }
+    }
+
+    mthread_mutex_lock(&lock->foreign_lock);
+    atomic_store_explicit(&lock->foreign_active, 1, memory_order_relaxed);
+    foreign_fence();
+    while(atomic_load_explicit(&lock->owner_active, memory_order_acquire) == 1)
+        mthread_wait_on_address(&lock->owner_active, 1, sizeof(int), NULL);
+    return 0;
+}
+
+/**
+ * @brief Try locking the biased lock
+ * @param[in,out] lock Pointer to lock
+ * @note A foreign thread still issues membarrier(2) to find out.
+ * @return On success, returns 0; if the lock is held, EBUSY
+ */
+int mthread_biased_trylock(mthread_biased_t *lock) {
+    assert(lock);
+
+    if(is_owner(lock)) {
+        atomic_store_explicit(&lock->owner_active, 1, memory_order_relaxed);
+        owner_fence();
+        if(atomic_load_explicit(&lock->foreign_active, memory_order_acquire) == 0)
+            return 0;
+        owner_release(lock);
+        return EBUSY;
+    }
+
+    if(mthread_mutex_trylock(&lock->foreign_lock) != 0)
+        return EBUSY;
+    atomic_store_explicit(&lock->foreign_active, 1, memory_order_relaxed);
+    foreign_fence();
+    if(atomic_load_explicit(&lock->owner_active, memory_order_acquire) == 0)
+        return 0;
+
+    atomic_store(&lock->foreign_active, 0);
+    mthread_wake_by_address(&lock->foreign_active, 1);
+    mthread_mutex_unlock(&lock->foreign_lock);
+    return EBUSY;
+}
+
+/**
+ * @brief Unlock the biased lock
+ * @param[in,out] lock Pointer to lock
+ * @note The owner wakes a foreign thread only if its flag is up.
+ * @return On success, returns 0
+ */
+int mthread_biased_unlock(mthread_biased_t *lock) {
+    assert(lock);
+
+    if(lock->owner == mthread_self()->tid) {
+        owner_release(lock);
+        return 0;
+    }
+
+    atomic_store_explicit(&lock->foreign_active, 0, memory_order_release);
+    mthread_wake_by_address(&lock->foreign_active, 1);
+    mthread_mutex_unlock(&lock->foreign_lock);
+    return 0;
+}
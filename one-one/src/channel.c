@@ -0,0 +1,403 @@
+/**
+ * @file channel.c
+ * @brief Bounded Multi-producer Multi-consumer Channel
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/// Bit of the send position set once the channel is closed
+#define CHANNEL_CLOSED      (1ull << 63)
+
+/// Largest capacity accepted
+#define CHANNEL_MAX         (1u << 30)
+
+/// Spins on a slot claimed by a batch before yielding the CPU
+#define CHANNEL_SPIN        64
+
+/// Signature of the non-blocking send and receive
+typedef int (*channel_op)(mthread_channel_t *, void **, int, int *);
+
+/**
+ * @brief Wait for a slot claimed by a batch to reach a sequence number
+ * @param[in] slot Pointer to slot
+ * @param[in] seq Sequence number
+ * @note A batch claims its positions before the thread on the other side
+ * has finished with their slots, which it is then about to do.
+ */
+static void slot_wait(struct mthread_channel_slot *slot, uint64_t seq) {
+    int spins = 0;
+
+    while(atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+        if(++spins > CHANNEL_SPIN)
+            mthread_yield();
+    }
+}
+
+/**
+ * @brief Send items without blocking
+ * @param[in,out] channel Pointer to channel
+ * @param[in] items Items to send
+ * @param[in] n Number of items, at least 1
+ * @param[out] count Number of items sent
+ * @note A single item is sent as in Vyukov's bounded queue: the slot at the
+ * send position tells whether the receiver of the previous round is done
+ * with it, and the position is claimed with one compare-and-swap. A batch
+ * claims as many positions as the receive position leaves free at once.
+ * @return On success, returns 0; if full, EAGAIN; if closed, EPIPE
+ */
+static int try_send(mthread_channel_t *channel, void **items, int n, int *count) {
+    struct mthread_channel_slot *slot;
+    uint64_t pos, tail, k, i;
+    int64_t dif;
+
+    pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+
+    if(n == 1) {
+        for(;;) {
+            if(pos & CHANNEL_CLOSED)
+                return EPIPE;
+            slot = &channel->slots[pos & channel->mask];
+            dif = (int64_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+            if(dif == 0) {
+                if(atomic_compare_exchange_weak_explicit(&channel->head, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0) {
+                return EAGAIN;
+            }
+            else {
+                pos = atomic_load_explicit(&channel->head, memory_order_relaxed);
+            }
+        }
+        slot->item = items[0];
+        atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+        *count = 1;
+        return 0;
+    }
+
+    for(;;) {
+        if(pos & CHANNEL_CLOSED)
+            return EPIPE;
+        tail = atomic_load_explicit(&channel->tail, memory_order_acquire);
+        if((int64_t)(pos - tail) > (int64_t)channel->mask)
+            return EAGAIN;
+        k = channel->mask + 1 - (pos - tail);
+        if(k > (uint64_t)n)
+            k = n;
+        if(atomic_compare_exchange_weak_explicit(&channel->head, &pos, pos + k,
+                memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    for(i = 0; i < k; i++) {
+        slot = &channel->slots[(pos + i) & channel->mask];
+        slot_wait(slot, pos + i);
+        slot->item = items[i];
+        atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+    }
+    *count = k;
+    return 0;
+}
+
+/**
+ * @brief Receive items without blocking
+ * @param[in,out] channel Pointer to channel
+ * @param[out] items Items received
+ * @param[in] n Number of items wanted, at least 1
+ * @param[out] count Number of items received
+ * @note An empty slot at the receive position means either that the
+ * channel is empty or that a sender has claimed the position and not yet
+ * stored its item; only when the send position is closed and equal is the
+ * channel drained for good.
+ * @return On success, returns 0; if empty, EAGAIN; if closed and empty,
+ * EPIPE
+ */
+static int try_recv(mthread_channel_t *channel, void **items, int n, int *count) {
+    struct mthread_channel_slot *slot;
+    uint64_t pos, head, k, i;
+    int64_t dif;
+
+    pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+
+    if(n == 1) {
+        for(;;) {
+            slot = &channel->slots[pos & channel->mask];
+            dif = (int64_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+            if(dif == 0) {
+                if(atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0) {
+                head = atomic_load_explicit(&channel->head, memory_order_acquire);
+                return head == (pos | CHANNEL_CLOSED) ? EPIPE : EAGAIN;
+            }
+            else {
+                pos = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+            }
+        }
+        items[0] = slot->item;
+        atomic_store_explicit(&slot->seq, pos + channel->mask + 1, memory_order_release);
+        *count = 1;
+        return 0;
+    }
+
+    for(;;) {
+        head = atomic_load_explicit(&channel->head, memory_order_acquire);
+        if((head & ~CHANNEL_CLOSED) == pos)
+            return (head & CHANNEL_CLOSED) ? EPIPE : EAGAIN;
+        k = (head & ~CHANNEL_CLOSED) - pos;
+        if(k > (uint64_t)n)
+            k = n;
+        if(atomic_compare_exchange_weak_explicit(&channel->tail, &pos, pos + k,
+                memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+    for(i = 0; i < k; i++) {
+        slot = &channel->slots[(pos + i) & channel->mask];
+        slot_wait(slot, pos + i + 1);
+        items[i] = slot->item;
+        atomic_store_explicit(&slot->seq, pos + i + channel->mask + 1, memory_order_release);
+    }
+    *count = k;
+    return 0;
+}
+
+/**
+ * @brief Wake threads sleeping on the other side of the channel
+ * @param[in,out] seq Pointer to word they sleep on
+ * @param[in] waiters Pointer to their count
+ * @param[in] n Number of items sent or received
+ * @note The fence pairs with the one a thread issues after counting itself
+ * in waiters: either this sees the waiter, or the waiter sees the items when
+ * it tries a last time before sleeping. Without waiters no word is written.
+ */
+static void notify(int *seq, int *waiters, int n) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(seq, 1);
+        mthread_wake_by_address(seq, n);
+    }
+}
+
+/**
+ * @brief Run a send or receive, sleeping while it would block
+ * @param[in,out] channel Pointer to channel
+ * @param[in] op Non-blocking operation
+ * @param[in,out] items Items to send or receive into
+ * @param[in] n Number of items, at least 1
+ * @param[out] count Number of items sent or received
+ * @param[in,out] seq Word the thread sleeps on
+ * @param[in,out] waiters Count of threads sleeping on it
+ * @return On success, returns 0; if closed, EPIPE
+ */
+static int blocking(mthread_channel_t *channel, channel_op op, void **items,
+                    int n, int *count, int *seq, int *waiters) {
+    int ret, value;
+
+    while((ret = op(channel, items, n, count)) == EAGAIN) {
+        atomic_fetch_add(waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        value = atomic_load(seq);
+        if((ret = op(channel, items, n, count)) == EAGAIN)
+            mthread_wait_on_address(seq, (uint64_t)value, sizeof(int), NULL);
+        atomic_fetch_sub(waiters, 1);
+        if(ret != EAGAIN)
+            break;
+    }
+    return ret;
+}
+
+/**
+ * @brief Initialise the channel
+ * @param[in,out] channel Pointer to channel
+ * @param[in] capacity Number of items it holds, rounded up to a power of two
+ * @return On success, returns 0; if capacity is 0 or above 2^30, EINVAL; if
+ * memory is short, ENOMEM
+ */
+int mthread_channel_init(mthread_channel_t *channel, unsigned int capacity) {
+    assert(channel);
+    uint64_t i, n = 1;
+
+    if(capacity == 0 || capacity > CHANNEL_MAX)
+        return EINVAL;
+    while(n < capacity)
+        n <<= 1;
+
+    channel->slots = aligned_alloc(MTHREAD_CACHE_LINE,
+                                   n * sizeof(struct mthread_channel_slot));
+    if(channel->slots == NULL)
+        return ENOMEM;
+
+    for(i = 0; i < n; i++)
+        channel->slots[i].seq = i;
+    channel->mask = n - 1;
+    channel->head = channel->tail = 0;
+    channel->recv_seq = channel->recv_waiters = 0;
+    channel->send_seq = channel->send_waiters = 0;
+    return 0;
+}
+
+/**
+ * @brief Destroy the channel
+ * @param[in,out] channel Pointer to channel
+ * @note Items left in it are dropped.
+ * @return On success, returns 0; if a thread is blocked on it, EBUSY
+ */
+int mthread_channel_destroy(mthread_channel_t *channel) {
+    assert(channel);
+
+    if(atomic_load(&channel->recv_waiters) || atomic_load(&channel->send_waiters))
+        return EBUSY;
+    free(channel->slots);
+    channel->slots = NULL;
+    return 0;
+}
+
+/**
+ * @brief Send an item, blocking while the channel is full
+ * @param[in,out] channel Pointer to channel
+ * @param[in] item Item to send
+ * @return On success, returns 0; if closed, EPIPE
+ */
+int mthread_channel_send(mthread_channel_t *channel, void *item) {
+    assert(channel);
+    int ret, count;
+
+    ret = blocking(channel, try_send, &item, 1, &count,
+                   &channel->send_seq, &channel->send_waiters);
+    if(ret == 0)
+        notify(&channel->recv_seq, &channel->recv_waiters, 1);
+    return ret;
+}
+
+/**
+ * @brief Send an item if there is room
+ * @param[in,out] channel Pointer to channel
+ * @param[in] item Item to send
+ * @return On success, returns 0; if full, EAGAIN; if closed, EPIPE
+ */
+int mthread_channel_trysend(mthread_channel_t *channel, void *item) {
+    assert(channel);
+    int ret, count;
+
+    if((ret = try_send(channel, &item, 1, &count)) == 0)
+        notify(&channel->recv_seq, &channel->recv_waiters, 1);
+    return ret;
+}
+
+/**
+ * @brief Receive an item, blocking while the channel is empty
+ * @param[in,out] channel Pointer to channel
+ * @param[out] item Item received
+ * @return On success, returns 0; if closed and empty, EPIPE
+ */
+int mthread_channel_recv(mthread_channel_t *channel, void **item) {
+    assert(channel && item);
+    int ret, count;
+
+    ret = blocking(channel, try_recv, item, 1, &count,
+                   &channel->recv_seq, &channel->recv_waiters);
+    if(ret == 0)
+        notify(&channel->send_seq, &channel->send_waiters, 1);
+    return ret;
+}
+
+/**
+ * @brief Receive an item if there is one
+ * @param[in,out] channel Pointer to channel
+ * @param[out] item Item received
+ * @return On success, returns 0; if empty, EAGAIN; if closed and empty,
+ * EPIPE
+ */
+int mthread_channel_tryrecv(mthread_channel_t *channel, void **item) {
+    assert(channel && item);
+    int ret, count;
+
+    if((ret = try_recv(channel, item, 1, &count)) == 0)
+        notify(&channel->send_seq, &channel->send_waiters, 1);
+    return ret;
+}
+
+/**
+ * @brief Send several items at once
+ * @param[in,out] channel Pointer to channel
+ * @param[in] items Items to send
+ * @param[in] n Number of items
+ * @param[out] sent Number of items sent, from the start of items
+ * @note Blocks until at least one item fits, then sends as many as do with
+ * one claim of the send position and one wakeup. Call again with the rest.
+ * @return On success, returns 0; if n is not positive, EINVAL; if closed,
+ * EPIPE
+ */
+int mthread_channel_send_batch(mthread_channel_t *channel, void *const *items,
+                               int n, int *sent) {
+    assert(channel && items && sent);
+    int ret;
+
+    *sent = 0;
+    if(n <= 0)
+        return EINVAL;
+
+    ret = blocking(channel, try_send, (void **)items, n, sent,
+                   &channel->send_seq, &channel->send_waiters);
+    if(ret == 0)
+        notify(&channel->recv_seq, &channel->recv_waiters, *sent);
+    return ret;
+}
+
+/**
+ * @brief Receive several items at once
+ * @param[in,out] channel Pointer to channel
+ * @param[out] items Items received
+ * @param[in] n Number of items wanted
+ * @param[out] received Number of items received
+ * @note Blocks until at least one item is there, then receives up to n with
+ * one claim of the receive position and one wakeup.
+ * @return On success, returns 0; if n is not positive, EINVAL; if closed
+ * and empty, EPIPE
+ */
+int mthread_channel_recv_batch(mthread_channel_t *channel, void **items,
+                               int n, int *received) {
+    assert(channel && items && received);
+    int ret;
+
+    *received = 0;
+    if(n <= 0)
+        return EINVAL;
+
+    ret = blocking(channel, try_recv, items, n, received,
+                   &channel->recv_seq, &channel->recv_waiters);
+    if(ret == 0)
+        notify(&channel->send_seq, &channel->send_waiters, *received);
+    return ret;
+}
+
+/**
+ * @brief Close the channel
+ * @param[in,out] channel Pointer to channel
+ * @note The closed bit is set in the send position itself, so a send either
+ * claimed its position before the close, and its item will be received, or
+ * fails.
+ * @return On success, returns 0; if already closed, EPIPE
+ */
+int mthread_channel_close(mthread_channel_t *channel) {
+    assert(channel);
+
+    if(atomic_fetch_or(&channel->head, CHANNEL_CLOSED) & CHANNEL_CLOSED)
+        return EPIPE;
+
+    atomic_fetch_add(&channel->recv_seq, 1);
+    mthread_wake_by_address(&channel->recv_seq, INT_MAX);
+    atomic_fetch_add(&channel->send_seq, 1);
+    mthread_wake_by_address(&channel->send_seq, INT_MAX);
+    return 0;
+}
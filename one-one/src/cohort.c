@@ -0,0 +1,259 @@
+/**
+ * @file cohort.c
+ * @brief Cohort Lock Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+#include "utils.h"
+
+/// Handoffs within a group before the global lock is released, by default
+#define COHORT_BOUND    64
+
+/// Times a lock is checked before sleeping on it
+#define COHORT_SPIN     100
+
+/**
+ * @brief Wait for a ticket to be served
+ * @param[in,out] t Pointer to ticket lock
+ * @param[in] ticket Ticket drawn
+ */
+static void ticket_wait(struct mthread_ticket *t, unsigned int ticket) {
+    unsigned int serving;
+    int i;
+
+    for(i = 0; (serving = atomic_load_explicit(&t->serving, memory_order_acquire)) != ticket; i++) {
+        if(i < COHORT_SPIN) {
+            __builtin_ia32_pause();
+            continue;
+        }
+        atomic_fetch_add(&t->waiters, 1);
+        mthread_wait_on_address(&t->serving, serving, sizeof(int), NULL);
+        atomic_fetch_sub(&t->waiters, 1);
+    }
+}
+
+/**
+ * @brief Lock a ticket lock
+ */
+static void ticket_lock(struct mthread_ticket *t) {
+    ticket_wait(t, atomic_fetch_add(&t->next, 1));
+}
+
+/**
+ * @brief Take a ticket lock if it is free
+ * @return 1 if taken, else 0
+ */
+static int ticket_trylock(struct mthread_ticket *t) {
+    unsigned int serving = atomic_load(&t->serving), next = serving;
+
+    return atomic_compare_exchange_strong(&t->next, &next, serving + 1);
+}
+
+/**
+ * @brief Unlock a ticket lock
+ * @note All sleepers are woken, as the one whose turn it is can not be
+ * singled out, but the system call is skipped when none sleeps.
+ */
+static void ticket_unlock(struct mthread_ticket *t) {
+    atomic_fetch_add(&t->serving, 1);
+    if(atomic_load(&t->waiters) > 0)
+        mthread_wake_by_address(&t->serving, INT_MAX);
+}
+
+/**
+ * @brief Tell whether a thread other than the holder waits for a ticket lock
+ * @param[in] t Pointer to ticket lock, held by the caller
+ * @note Every thread past drawing its ticket counts, whether it spins or
+ * sleeps.
+ * @return Non-zero if a thread waits
+ */
+static int ticket_contended(struct mthread_ticket *t) {
+    return atomic_load(&t->next) - atomic_load(&t->serving) > 1;
+}
+
+/**
+ * @brief Get the group the calling thread takes the lock in
+ * @param[in] lock Pointer to cohort lock
+ * @return Group number
+ */
+static int current_group(mthread_cohort_t *lock) {
+    mthread *self = mthread_self();
+    int cpu;
+
+    if(self != NULL && self->cohort_group > 0)
+        return (self->cohort_group - 1) % lock->ngroups;
+
+    cpu = mthread_current_cpu();
+    return cpu < lock->ncpus ? lock->groups[cpu] : 0;
+}
+
+/**
+ * @brief Initialise the cohort lock
+ * @param[in,out] lock Pointer to cohort lock
+ * @param[in] groups Group of each CPU, or NULL to group CPUs by the
+ * last-level cache they share, as /sys describes it
+ * @param[in] ncpus Number of entries in groups
+ * @param[in] bound Handoffs within a group before it lets the others in, or
+ * 0 for a default of 64
+ * @note Group numbers are compacted, so any distinct integers will do.
+ * @return On success, returns 0; if groups is given with no entries, EINVAL;
+ * if memory is short, ENOMEM
+ */
+int mthread_cohort_init(mthread_cohort_t *lock, const int *groups, int ncpus,
+                        unsigned int bound) {
+    assert(lock);
+    int *ids, i, j;
+
+    if(groups != NULL && ncpus <= 0)
+        return EINVAL;
+    if(groups == NULL)
+        ncpus = get_possible_cpus();
+
+    lock->groups = malloc(ncpus * sizeof(int));
+    ids = malloc(ncpus * sizeof(int));
+    if(lock->groups == NULL || ids == NULL) {
+        free(lock->groups);
+        free(ids);
+        return ENOMEM;
+    }
+
+    lock->ngroups = 0;
+    for(i = 0; i < ncpus; i++) {
+        int id = groups ? groups[i] : get_cpu_group(i);
+        for(j = 0; j < lock->ngroups && ids[j] != id; j++)
+            ;
+        if(j == lock->ngroups)
+            ids[lock->ngroups++] = id;
+        lock->groups[i] = j;
+    }
+    free(ids);
+
+    lock->nodes = aligned_alloc(MTHREAD_CACHE_LINE,
+                                lock->ngroups * sizeof(struct mthread_cohort_node));
+    if(lock->nodes == NULL) {
+        free(lock->groups);
+        return ENOMEM;
+    }
+    memset(lock->nodes, 0, lock->ngroups * sizeof(struct mthread_cohort_node));
+    memset(&lock->global, 0, sizeof(struct mthread_ticket));
+
+    lock->ncpus  = ncpus;
+    lock->bound  = bound ? bound : COHORT_BOUND;
+    lock->holder = 0;
+    return 0;
+}
+
+/**
+ * @brief Destroy the cohort lock
+ * @param[in,out] lock Pointer to cohort lock
+ * @return On success, returns 0; if the lock is held, EBUSY
+ */
+int mthread_cohort_destroy(mthread_cohort_t *lock) {
+    assert(lock);
+    if(atomic_load(&lock->global.next) != atomic_load(&lock->global.serving))
+        return EBUSY;
+
+    free(lock->nodes);
+    free(lock->groups);
+    lock->nodes  = NULL;
+    lock->groups = NULL;
+    return 0;
+}
+
+/**
+ * @brief Lock the cohort lock
+ * @param[in,out] lock Pointer to cohort lock
+ * @note The thread takes the local lock of its group. Once in, it takes
+ * the global lock unless a thread of its group passed it on. Both are FIFO
+ * ticket locks.
+ * @return On success, returns 0
+ */
+int mthread_cohort_lock(mthread_cohort_t *lock) {
+    assert(lock);
+    int group = current_group(lock);
+    struct mthread_cohort_node *node = &lock->nodes[group];
+
+    ticket_lock(&node->local);
+    if(!node->global_held) {
+        ticket_lock(&lock->global);
+        node->global_held = 1;
+        node->batch = 0;
+    }
+    lock->holder = group;
+    return 0;
+}
+
+/**
+ * @brief Try locking the cohort lock
+ * @param[in,out] lock Pointer to cohort lock
+ * @return On success, returns 0; if the lock is held, EBUSY
+ */
+int mthread_cohort_trylock(mthread_cohort_t *lock) {
+    assert(lock);
+    int group = current_group(lock);
+    struct mthread_cohort_node *node = &lock->nodes[group];
+
+    if(!ticket_trylock(&node->local))
+        return EBUSY;
+    if(!node->global_held) {
+        if(!ticket_trylock(&lock->global)) {
+            ticket_unlock(&node->local);
+            return EBUSY;
+        }
+        node->global_held = 1;
+        node->batch = 0;
+    }
+    lock->holder = group;
+    return 0;
+}
+
+/**
+ * @brief Unlock the cohort lock
+ * @param[in,out] lock Pointer to cohort lock
+ * @note If a thread of the same group is waiting and the group has not
+ * used up its bound, the global lock is passed on with the local lock, so
+ * the data stays in the caches of the group. Otherwise the global lock is
+ * released to the other groups. The local lock is first in, first out, so
+ * the holder can not take it straight back from the waiter it passed the
+ * global lock to.
+ * @return On success, returns 0
+ */
+int mthread_cohort_unlock(mthread_cohort_t *lock) {
+    assert(lock);
+    struct mthread_cohort_node *node = &lock->nodes[lock->holder];
+
+    if(ticket_contended(&node->local) && node->batch < lock->bound) {
+        node->batch++;
+    }
+    else {
+        node->global_held = 0;
+        ticket_unlock(&lock->global);
+    }
+    ticket_unlock(&node->local);
+    return 0;
+}
+
+/**
+ * @brief Place the calling thread in a group of every cohort lock
+ * @param[in] group Group number, or -1 to go by the CPU of the thread
+ * @note Group numbers are taken modulo the number of groups of each lock.
+ * Meant for threads pinned to a CPU, and for faking groups in testing.
+ * @return On success, returns 0; if group is below -1, EINVAL
+ */
+int mthread_cohort_set_group(int group) {
+    if(group < -1)
+        return EINVAL;
+
+    mthread_self()->cohort_group = group + 1;
+    return 0;
+}
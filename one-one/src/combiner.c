@@ -0,0 +1,172 @@
+/**
+ * @file combiner.c
+ * @brief Flat-combining Lock
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+
+/// Slot states
+#define SLOT_FREE       0
+#define SLOT_CLAIMED    1
+#define SLOT_PENDING    2
+#define SLOT_DONE       3
+
+/// Passes the combiner makes over the slots while it finds work
+#define COMBINE_PASSES  3
+
+/// Times a waiting thread checks its slot before blocking on the lock
+#define COMBINE_SPIN    200
+
+/**
+ * @brief Claim an operation slot for the calling thread
+ * @param[in,out] combiner Pointer to combining lock
+ * @note Probing starts at a slot picked from the TCB address, so a thread
+ * normally finds the same slot free every time.
+ * @return Pointer to the slot, or NULL if all slots are in use
+ */
+static struct mthread_combiner_slot *claim_slot(mthread_combiner_t *combiner) {
+    uint64_t key = (uintptr_t)mthread_self() >> 4;
+    int i, start = (key * 0x9E3779B97F4A7C15ull) >> 32 & (combiner->nslots - 1);
+    struct mthread_combiner_slot *slot;
+    int expected;
+
+    for(i = 0; i < combiner->nslots; i++) {
+        slot = &combiner->slots[(start + i) & (combiner->nslots - 1)];
+        expected = SLOT_FREE;
+        if(atomic_load_explicit(&slot->state, memory_order_relaxed) == SLOT_FREE &&
+           atomic_compare_exchange_strong(&slot->state, &expected, SLOT_CLAIMED))
+            return slot;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run every published operation; called with the lock held
+ * @param[in,out] combiner Pointer to combining lock
+ * @note The data the operations work on stays in the cache of this thread
+ * for the whole batch.
+ */
+static void combine(mthread_combiner_t *combiner) {
+    struct mthread_combiner_slot *slot;
+    int i, pass, found;
+
+    for(pass = 0; pass < COMBINE_PASSES; pass++) {
+        found = 0;
+        for(i = 0; i < combiner->nslots; i++) {
+            slot = &combiner->slots[i];
+            if(atomic_load_explicit(&slot->state, memory_order_acquire) != SLOT_PENDING)
+                continue;
+            slot->op(slot->arg);
+            atomic_store_explicit(&slot->state, SLOT_DONE, memory_order_release);
+            found = 1;
+        }
+        if(!found)
+            break;
+    }
+}
+
+/**
+ * @brief Initialise the combining lock
+ * @param[in,out] combiner Pointer to combining lock
+ * @param[in] nslots Number of operation slots, rounded up to a power of two;
+ * 0 picks twice the number of CPUs
+ * @note Threads beyond the number of slots still work, by taking the lock
+ * and running their operation themselves. The lock must be released with
+ * mthread_combiner_destroy().
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+int mthread_combiner_init(mthread_combiner_t *combiner, unsigned int nslots) {
+    assert(combiner);
+    int n = 1;
+
+    if(nslots == 0)
+        nslots = 2 * sysconf(_SC_NPROCESSORS_CONF);
+    while(n < (int)nslots)
+        n <<= 1;
+
+    combiner->slots = aligned_alloc(MTHREAD_CACHE_LINE,
+                                    n * sizeof(struct mthread_combiner_slot));
+    if(combiner->slots == NULL)
+        return ENOMEM;
+
+    memset(combiner->slots, 0, n * sizeof(struct mthread_combiner_slot));
+    combiner->nslots = n;
+    mthread_mutex_init(&combiner->lock);
+    return 0;
+}
+
+/**
+ * @brief Destroy the combining lock
+ * @param[in,out] combiner Pointer to combining lock
+ * @return On success, returns 0; if the lock is held, EBUSY
+ */
+int mthread_combiner_destroy(mthread_combiner_t *combiner) {
+    assert(combiner);
+    if(mthread_mutex_trylock(&combiner->lock) != 0)
+        return EBUSY;
+    mthread_mutex_unlock(&combiner->lock);
+
+    free(combiner->slots);
+    combiner->slots  = NULL;
+    combiner->nslots = 0;
+    return 0;
+}
+
+/**
+ * @brief Run an operation under the combining lock
+ * @param[in,out] combiner Pointer to combining lock
+ * @param[in] op Operation, run with exclusive access to the guarded data
+ * @param[in] arg Argument of the operation, which also carries its result
+ * @note The operation is published in a slot. Whichever thread gets the lock
+ * runs all published operations, and the others only watch their slot. A
+ * thread whose operation is still pending after a short spin blocks on the
+ * lock, and then combines in turn unless its operation was run meanwhile.
+ * @return On success, returns 0
+ */
+int mthread_combiner_execute(mthread_combiner_t *combiner,
+                             void (*op)(void *), void *arg) {
+    assert(combiner && op);
+    struct mthread_combiner_slot *slot = claim_slot(combiner);
+    int i;
+
+    if(slot == NULL) {
+        mthread_mutex_lock(&combiner->lock);
+        op(arg);
+        combine(combiner);
+        mthread_mutex_unlock(&combiner->lock);
+        return 0;
+    }
+
+    slot->op  = op;
+    slot->arg = arg;
+    atomic_store_explicit(&slot->state, SLOT_PENDING, memory_order_release);
+
+    for(i = 0; atomic_load_explicit(&slot->state, memory_order_acquire) != SLOT_DONE; i++) {
+        if(atomic_load_explicit(&combiner->lock.value, memory_order_relaxed) == UNLOCKED &&
+           mthread_mutex_trylock(&combiner->lock) == 0) {
+            combine(combiner);
+            mthread_mutex_unlock(&combiner->lock);
+        }
+        else if(i < COMBINE_SPIN) {
+            __builtin_ia32_pause();
+        }
+        else {
+            mthread_mutex_lock(&combiner->lock);
+            combine(combiner);
+            mthread_mutex_unlock(&combiner->lock);
+        }
+    }
+
+    atomic_store_explicit(&slot->state, SLOT_FREE, memory_order_release);
+    return 0;
+}
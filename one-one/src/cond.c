@@ -6,39 +6,140 @@
  */
 
 #define _GNU_SOURCE
-#include <unistd.h>
-#include <sys/time.h>
-#include <sys/syscall.h>
-#include <linux/futex.h>
+#include <errno.h>
+#include <limits.h>
 #include <assert.h>
 #include <stdatomic.h>
 #include "mthread.h"
+#include "futex.h"
+#include "pollfd.h"
 
 /**
- * @brief Fast user-space locking
- * @param[in] uaddr Pointer to futex word
- * @param[in] futex_op Operation to be performed
- * @param[in] val Expected value of the futex word
- * @return 0 on success; -1 on error
+ * @brief Initialise the condition variable
+ * @param[in,out] cond Pointer to condition variable
+ * @return Always returns 0
  */
-static inline int futex(int *uaddr, int futex_op, int val) {
-    return syscall(SYS_futex, uaddr, futex_op, val, NULL, NULL, 0);
+int mthread_cond_init(mthread_cond_t *cond) {
+    return mthread_cond_init_flags(cond, MTHREAD_COND_DEFAULT);
 }
 
 /**
- * @brief Initialise the condition variable
+ * @brief Initialise the condition variable with flags
  * @param[in,out] cond Pointer to condition variable
- * @return Always returns 0
+ * @param[in] flags MTHREAD_COND_DEFAULT or MTHREAD_COND_PSHARED
+ * @note A process-shared condition variable may lie in memory shared with
+ * other processes, and is used with a process-shared mutex.
+ * @return On success, returns 0; if flags are unknown, EINVAL
  */
-int mthread_cond_init(mthread_cond_t *cond) {
+int mthread_cond_init_flags(mthread_cond_t *cond, int flags) {
     assert(cond);
+    if(flags & ~MTHREAD_COND_PSHARED)
+        return EINVAL;
 
     atomic_init(&cond->value, 0);
     atomic_init(&cond->previous, 0);
+    atomic_init(&cond->waiters, 0);
+    cond->flags = flags;
+    cond->pollfd.fd = 0;
+    cond->pollfd.armed = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Destroy the condition variable
+ * @param[in,out] cond Pointer to condition variable
+ * @note Closes the eventfd of the condition variable, if it has one.
+ * @return On success, returns 0; if threads are waiting on it, EBUSY
+ */
+int mthread_cond_destroy(mthread_cond_t *cond) {
+    assert(cond);
+    if(atomic_load(&cond->waiters) > 0)
+        return EBUSY;
+
+    pollfd_close(&cond->pollfd);
+    return 0;
+}
+
+/**
+ * @brief Get an eventfd through which an event loop can wait for the
+ * condition variable
+ * @param[in,out] cond Pointer to condition variable
+ * @param[out] fd The eventfd, to add to an epoll(7) instance for reading
+ * @note The eventfd is created on first use and closed by
+ * mthread_cond_destroy(). It is readable only after mthread_cond_arm() and
+ * a signal that followed.
+ * @return On success, returns 0; for a process-shared condition variable,
+ * EINVAL; if the eventfd can not be created, an error number
+ */
+int mthread_cond_eventfd(mthread_cond_t *cond, int *fd) {
+    assert(cond && fd);
+    if(cond->flags & MTHREAD_COND_PSHARED)
+        return EINVAL;
 
+    if((*fd = pollfd_get(&cond->pollfd)) == -1)
+        return errno;
     return 0;
 }
 
+/**
+ * @brief Arm the eventfd of the condition variable for the next signal
+ * @param[in,out] cond Pointer to condition variable
+ * @note The event loop arms the eventfd, then checks its predicate under the
+ * mutex, and waits for the eventfd only if the predicate is false. A signal
+ * that comes after arming makes the eventfd readable.
+ * @return On success, returns 0; if it has no eventfd, EINVAL
+ */
+int mthread_cond_arm(mthread_cond_t *cond) {
+    assert(cond);
+    if(atomic_load(&cond->pollfd.fd) == 0)
+        return EINVAL;
+
+    pollfd_arm(&cond->pollfd);
+    return 0;
+}
+
+/**
+ * @brief Atomically unlocks the mutex and waits for CV to be signaled or for
+ * an absolute deadline to pass
+ * @param[in,out] cond Pointer to condition variable
+ * @param[in,out] mutex Pointer to associated mutex
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @return On success, returns 0; ETIMEDOUT if the deadline passed, or EINVAL
+ * if the deadline is malformed; EOWNERDEAD or ENOTRECOVERABLE from locking a
+ * robust mutex
+ */
+static int cond_wait_until(mthread_cond_t *cond, mthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+    int err, lock_err;
+
+    /*
+     * Announce ourselves before sampling the value, so that a signaller who
+     * changes the value after our sample is guaranteed to see us waiting.
+     */
+    atomic_fetch_add(&cond->waiters, 1);
+
+    int value = atomic_load(&cond->value);
+    atomic_store(&cond->previous, value);
+
+    mthread_mutex_unlock(mutex);
+    if(cond->flags & MTHREAD_COND_PSHARED)
+        err = futex_wait_shared(&cond->value, value, abstime);
+    else
+        err = mthread_wait_on_address(&cond->value, value, sizeof(int), abstime);
+    atomic_fetch_sub(&cond->waiters, 1);
+
+    /*
+     * The mutex is reacquired even when the deadline has passed. A robust
+     * mutex whose owner died is reported over the result of the wait.
+     */
+    lock_err = mthread_mutex_lock(mutex);
+    if(lock_err == EOWNERDEAD || lock_err == ENOTRECOVERABLE)
+        return lock_err;
+
+    return err;
+}
+
 /**
  * @brief Atomically unlocks the mutex and waits for CV to be signaled
  * @param[in,out] cond Pointer to condition variable
@@ -49,30 +150,45 @@ int mthread_cond_init(mthread_cond_t *cond) {
  */
 int mthread_cond_wait(mthread_cond_t *cond, mthread_mutex_t *mutex) {
     assert(cond && mutex);
+    return cond_wait_until(cond, mutex, NULL);
+}
 
-    int value = atomic_load(&cond->value);
-    atomic_store(&cond->previous, value);
-
-    mthread_mutex_unlock(mutex);
-    futex(&cond->value, FUTEX_WAIT_PRIVATE, value);
-    mthread_mutex_lock(mutex);
-
-    return 0;
+/**
+ * @brief Atomically unlocks the mutex and waits for CV to be signaled, at
+ * most until an absolute deadline
+ * @param[in,out] cond Pointer to condition variable
+ * @param[in,out] mutex Pointer to associated mutex
+ * @param[in] abstime Absolute timeout measured against CLOCK_MONOTONIC
+ * @note The mutex is held again on return, whether or not the wait timed out.
+ * @return On success, returns 0; if the deadline passed, ETIMEDOUT
+ */
+int mthread_cond_timedwait(mthread_cond_t *cond, mthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+    assert(cond && mutex && abstime);
+    return cond_wait_until(cond, mutex, abstime);
 }
 
 /**
  * @brief Restarts one of the threads that are waiting
  * on the condition variable
  * @param[in,out] cond Pointer to condition variable
+ * @note The FUTEX_WAKE system call is skipped when no thread is waiting
  * @return On success, returns 0
  */
 int mthread_cond_signal(mthread_cond_t *cond) {
     assert(cond);
 
-    unsigned value = 1u + atomic_load(&cond->previous);
+    /* Kept non-negative, so that its wake may be paired */
+    int value = (1u + atomic_load(&cond->previous)) & INT_MAX;
     atomic_store(&cond->value, value);
 
-    futex(&cond->value, FUTEX_WAKE_PRIVATE, 1);
+    if(atomic_load(&cond->waiters) > 0) {
+        if(cond->flags & MTHREAD_COND_PSHARED)
+            futex_wake_shared(&cond->value, 1);
+        else
+            futex_wake_word(&cond->value, 1);
+    }
+    pollfd_notify(&cond->pollfd);
 
     return 0;
 }
\ No newline at end of file
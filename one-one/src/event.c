@@ -0,0 +1,94 @@
+/**
+ * @file event.c
+ * @brief Event Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/**
+ * @brief Initialise the event, clear
+ * @param[in,out] event Pointer to event
+ * @param[in] flags MTHREAD_EVENT_AUTO_RESET or MTHREAD_EVENT_MANUAL_RESET
+ * @return On success, returns 0; if flags are unknown, EINVAL
+ */
+int mthread_event_init(mthread_event_t *event, int flags) {
+    assert(event);
+    if(flags & ~MTHREAD_EVENT_MANUAL_RESET)
+        return EINVAL;
+
+    atomic_init(&event->value, 0);
+    atomic_init(&event->waiters, 0);
+    event->flags = flags;
+    return 0;
+}
+
+/**
+ * @brief Set the event
+ * @param[in,out] event Pointer to event
+ * @note An auto-reset event wakes one waiter, which clears it again. A
+ * manual-reset event wakes every waiter and stays set. The FUTEX_WAKE system
+ * call is skipped when no thread is waiting.
+ * @return On success, returns 0
+ */
+int mthread_event_set(mthread_event_t *event) {
+    assert(event);
+    if(atomic_exchange(&event->value, 1) == 1)
+        return 0;
+
+    if(atomic_load(&event->waiters) > 0)
+        mthread_wake_by_address(&event->value,
+                                event->flags & MTHREAD_EVENT_MANUAL_RESET ? INT_MAX : 1);
+    return 0;
+}
+
+/**
+ * @brief Clear the event
+ * @param[in,out] event Pointer to event
+ * @return On success, returns 0
+ */
+int mthread_event_reset(mthread_event_t *event) {
+    assert(event);
+    atomic_store(&event->value, 0);
+    return 0;
+}
+
+/**
+ * @brief Check the event without blocking
+ * @param[in,out] event Pointer to event
+ * @note Clears an auto-reset event that is set
+ * @return If the event is set, returns 0, else EAGAIN
+ */
+int mthread_event_trywait(mthread_event_t *event) {
+    assert(event);
+    int value = 1;
+
+    if(event->flags & MTHREAD_EVENT_MANUAL_RESET)
+        return atomic_load(&event->value) ? 0 : EAGAIN;
+
+    return atomic_compare_exchange_strong(&event->value, &value, 0) ? 0 : EAGAIN;
+}
+
+/**
+ * @brief Wait for the event to be set
+ * @param[in,out] event Pointer to event
+ * @note The calling thread is suspended while the event is clear
+ * @return On success, returns 0
+ */
+int mthread_event_wait(mthread_event_t *event) {
+    assert(event);
+
+    while(mthread_event_trywait(event) != 0) {
+        atomic_fetch_add(&event->waiters, 1);
+        mthread_wait_on_address(&event->value, 0, sizeof(int), NULL);
+        atomic_fetch_sub(&event->waiters, 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file graph.c
+ * @brief Task Graph Executor
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+
+/// Successors made ready at once without allocating
+#define GRAPH_STACK_READY   32
+
+/**
+ * @brief Sort nodes by priority, ascending
+ * @param[in,out] nodes Array of pointers to nodes
+ * @param[in] n Number of nodes
+ * @note Insertion sort, as a task rarely makes more than a few ready.
+ */
+static void sort_by_priority(void **nodes, int n) {
+    struct mthread_graph_node *v;
+    int i, j;
+
+    for(i = 1; i < n; i++) {
+        v = nodes[i];
+        for(j = i; j > 0 && ((struct mthread_graph_node *)nodes[j - 1])->priority > v->priority; j--)
+            nodes[j] = nodes[j - 1];
+        nodes[j] = v;
+    }
+}
+
+/**
+ * @brief Run a node and start the nodes it was the last to hold back
+ * @param[in] arg Pointer to node
+ * @note Each successor has an atomic count of predecessors left; the one
+ * that takes it to zero starts it. The ready successors are submitted in
+ * one batch, in ascending priority, onto the deque of this worker, which
+ * takes the last pushed first: the one with the costliest path ahead.
+ */
+static void node_task(void *arg) {
+    struct mthread_graph_node *node = arg, *succ;
+    mthread_graph_t *graph = node->graph;
+    void *buf[GRAPH_STACK_READY], **ready = buf;
+    int i, n = 0;
+
+    node->func(node->arg);
+
+    if(node->nsucc > GRAPH_STACK_READY &&
+       (ready = malloc(node->nsucc * sizeof(void *))) == NULL) {
+        /* Start them one by one on this thread */
+        for(i = 0; i < node->nsucc; i++) {
+            succ = &graph->nodes[node->succ[i]];
+            if(atomic_fetch_sub(&succ->pending, 1) == 1)
+                node_task(succ);
+        }
+        return;
+    }
+
+    for(i = 0; i < node->nsucc; i++) {
+        succ = &graph->nodes[node->succ[i]];
+        if(atomic_fetch_sub(&succ->pending, 1) == 1)
+            ready[n++] = succ;
+    }
+
+    sort_by_priority(ready, n);
+    if(mthread_pool_submit_batch(graph->pool, &graph->group, node_task, ready, n) != 0) {
+        for(i = n - 1; i >= 0; i--)
+            node_task(ready[i]);
+    }
+
+    if(ready != buf)
+        free(ready);
+}
+
+/**
+ * @brief Reset the predecessor counts and compute the priorities
+ * @param[in,out] graph Pointer to graph
+ * @param[out] order Array of nnodes indices, filled in topological order
+ * @note The priority of a node is its cost plus the highest priority of
+ * its successors, the length of the longest path from it to the end. It is
+ * computed over the nodes in reverse topological order, found by Kahn's
+ * algorithm.
+ * @return On success, returns 0; if the graph has a cycle, EDEADLK
+ */
+static int prepare(mthread_graph_t *graph, int *order) {
+    struct mthread_graph_node *node, *succ;
+    int i, j, head, tail = 0;
+    long best;
+
+    for(i = 0; i < graph->nnodes; i++) {
+        graph->nodes[i].pending = graph->nodes[i].npreds;
+        if(graph->nodes[i].npreds == 0)
+            order[tail++] = i;
+    }
+
+    for(head = 0; head < tail; head++) {
+        node = &graph->nodes[order[head]];
+        for(j = 0; j < node->nsucc; j++) {
+            succ = &graph->nodes[node->succ[j]];
+            if(--succ->pending == 0)
+                order[tail++] = node->succ[j];
+        }
+    }
+    if(tail < graph->nnodes)
+        return EDEADLK;
+
+    for(i = graph->nnodes - 1; i >= 0; i--) {
+        node = &graph->nodes[order[i]];
+        best = 0;
+        for(j = 0; j < node->nsucc; j++)
+            if(graph->nodes[node->succ[j]].priority > best)
+                best = graph->nodes[node->succ[j]].priority;
+        node->priority = node->cost + best;
+        node->pending = node->npreds;
+    }
+    return 0;
+}
+
+/**
+ * @brief Initialise the task graph
+ * @param[in,out] graph Pointer to graph
+ * @return On success, returns 0
+ */
+int mthread_graph_init(mthread_graph_t *graph) {
+    assert(graph);
+
+    graph->nodes = NULL;
+    graph->nnodes = graph->cap = 0;
+    graph->pool = NULL;
+    graph->group.state = 0;
+    return 0;
+}
+
+/**
+ * @brief Destroy the task graph
+ * @param[in,out] graph Pointer to graph
+ * @return On success, returns 0
+ */
+int mthread_graph_destroy(mthread_graph_t *graph) {
+    assert(graph);
+    int i;
+
+    for(i = 0; i < graph->nnodes; i++)
+        free(graph->nodes[i].succ);
+    free(graph->nodes);
+    graph->nodes = NULL;
+    graph->nnodes = graph->cap = 0;
+    return 0;
+}
+
+/**
+ * @brief Add a task to the graph
+ * @param[in,out] graph Pointer to graph
+ * @param[in] func Function to call
+ * @param[in] arg Argument to call it with
+ * @param[out] node Handle of the node, numbered from 0 in order of addition
+ * @return On success, returns 0; if func is NULL, EINVAL; if memory is
+ * short, ENOMEM
+ */
+int mthread_graph_add_node(mthread_graph_t *graph, void (*func)(void *),
+                           void *arg, int *node) {
+    assert(graph && node);
+    struct mthread_graph_node *nodes, *n;
+    int cap;
+
+    if(func == NULL)
+        return EINVAL;
+
+    if(graph->nnodes == graph->cap) {
+        cap = graph->cap ? 2 * graph->cap : 16;
+        if((nodes = realloc(graph->nodes, cap * sizeof(struct mthread_graph_node))) == NULL)
+            return ENOMEM;
+        graph->nodes = nodes;
+        graph->cap = cap;
+    }
+
+    n = &graph->nodes[graph->nnodes];
+    n->func = func;
+    n->arg = arg;
+    n->succ = NULL;
+    n->nsucc = n->succ_cap = 0;
+    n->npreds = n->pending = 0;
+    n->cost = 1;
+    n->priority = 0;
+    n->graph = graph;
+    *node = graph->nnodes++;
+    return 0;
+}
+
+/**
+ * @brief Add a dependency between two tasks
+ * @param[in,out] graph Pointer to graph
+ * @param[in] from Handle of the node that must finish first
+ * @param[in] to Handle of the node that waits for it
+ * @return On success, returns 0; if a handle is invalid or they are equal,
+ * EINVAL; if memory is short, ENOMEM
+ */
+int mthread_graph_add_edge(mthread_graph_t *graph, int from, int to) {
+    assert(graph);
+    struct mthread_graph_node *n;
+    int *succ, cap;
+
+    if(from < 0 || from >= graph->nnodes || to < 0 || to >= graph->nnodes || from == to)
+        return EINVAL;
+
+    n = &graph->nodes[from];
+    if(n->nsucc == n->succ_cap) {
+        cap = n->succ_cap ? 2 * n->succ_cap : 4;
+        if((succ = realloc(n->succ, cap * sizeof(int))) == NULL)
+            return ENOMEM;
+        n->succ = succ;
+        n->succ_cap = cap;
+    }
+    n->succ[n->nsucc++] = to;
+    graph->nodes[to].npreds++;
+    return 0;
+}
+
+/**
+ * @brief Set the estimated cost of a task
+ * @param[in,out] graph Pointer to graph
+ * @param[in] node Handle of the node
+ * @param[in] cost Cost, in any unit consistent across the graph
+ * @return On success, returns 0; if the handle is invalid or cost is
+ * negative, EINVAL
+ */
+int mthread_graph_set_cost(mthread_graph_t *graph, int node, long cost) {
+    assert(graph);
+
+    if(node < 0 || node >= graph->nnodes || cost < 0)
+        return EINVAL;
+    graph->nodes[node].cost = cost;
+    return 0;
+}
+
+/**
+ * @brief Run the task graph
+ * @param[in,out] graph Pointer to graph
+ * @param[in,out] pool Pointer to thread pool running the tasks
+ * @note The nodes without predecessors are submitted in one batch, the
+ * costliest path first. The graph may be run again once this returns, but
+ * not changed while it runs.
+ * @return On success, returns 0; if the graph has a cycle, EDEADLK; if
+ * memory is short, ENOMEM
+ */
+int mthread_graph_run(mthread_graph_t *graph, mthread_pool_t *pool) {
+    assert(graph && pool);
+    struct mthread_pool_worker *w = mthread_self()->pool_worker;
+    void **sources, *tmp;
+    int *order, i, n = 0, ret;
+
+    if(graph->nnodes == 0)
+        return 0;
+    if((order = malloc(graph->nnodes * sizeof(int))) == NULL)
+        return ENOMEM;
+    if((ret = prepare(graph, order)) != 0) {
+        free(order);
+        return ret;
+    }
+
+    /* order starts with the sources */
+    for(i = 0; i < graph->nnodes && graph->nodes[order[i]].npreds == 0; i++)
+        n++;
+    if((sources = malloc(n * sizeof(void *))) == NULL) {
+        free(order);
+        return ENOMEM;
+    }
+    for(i = 0; i < n; i++)
+        sources[i] = &graph->nodes[order[i]];
+    free(order);
+
+    /*
+     * A worker of the pool pushes them onto its deque, which it takes newest
+     * first, as node_task() does. Other threads append them to the
+     * injection queue, which runs them first in, first out.
+     */
+    sort_by_priority(sources, n);
+    for(i = 0; (w == NULL || w->pool != pool) && i < n / 2; i++) {
+        tmp = sources[i];
+        sources[i] = sources[n - 1 - i];
+        sources[n - 1 - i] = tmp;
+    }
+
+    graph->pool = pool;
+    ret = mthread_pool_submit_batch(pool, &graph->group, node_task, sources, n);
+    free(sources);
+    if(ret != 0)
+        return ret;
+    return mthread_pool_wait(pool, &graph->group);
+}
@@ -0,0 +1,84 @@
+/**
+ * @file latch.c
+ * @brief Countdown Latch Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/**
+ * @brief Initialise the latch
+ * @param[in,out] latch Pointer to latch
+ * @param[in] count Count the latch opens at after counting down to zero
+ * @return On success, returns 0; if count does not fit, EINVAL
+ */
+int mthread_latch_init(mthread_latch_t *latch, unsigned int count) {
+    assert(latch);
+    if(count > INT_MAX)
+        return EINVAL;
+
+    atomic_init(&latch->count, count);
+    atomic_init(&latch->waiters, 0);
+    return 0;
+}
+
+/**
+ * @brief Count the latch down
+ * @param[in,out] latch Pointer to latch
+ * @param[in] n Amount to count down by
+ * @note The thread that brings the count to zero wakes all waiters with a
+ * single FUTEX_WAKE. The latch can not be reset.
+ * @return On success, returns 0; if n exceeds the remaining count, EINVAL
+ */
+int mthread_latch_count_down(mthread_latch_t *latch, unsigned int n) {
+    assert(latch);
+    int count = atomic_load(&latch->count);
+
+    do {
+        if(n > (unsigned int)count)
+            return EINVAL;
+    } while(!atomic_compare_exchange_weak(&latch->count, &count, count - n));
+
+    if(count - n == 0 && atomic_load(&latch->waiters) > 0)
+        mthread_wake_by_address(&latch->count, INT_MAX);
+
+    return 0;
+}
+
+/**
+ * @brief Wait for the latch to open
+ * @param[in,out] latch Pointer to latch
+ * @note The calling thread is suspended until the count reaches zero
+ * @return On success, returns 0
+ */
+int mthread_latch_wait(mthread_latch_t *latch) {
+    assert(latch);
+    int count;
+
+    if(atomic_load(&latch->count) == 0)
+        return 0;
+
+    atomic_fetch_add(&latch->waiters, 1);
+    while((count = atomic_load(&latch->count)) != 0)
+        mthread_wait_on_address(&latch->count, count, sizeof(int), NULL);
+    atomic_fetch_sub(&latch->waiters, 1);
+
+    return 0;
+}
+
+/**
+ * @brief Check whether the latch is open
+ * @param[in] latch Pointer to latch
+ * @note Does not block the calling thread
+ * @return If the count has reached zero, returns 0, else EBUSY
+ */
+int mthread_latch_trywait(mthread_latch_t *latch) {
+    assert(latch);
+    return atomic_load(&latch->count) == 0 ? 0 : EBUSY;
+}
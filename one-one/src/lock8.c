@@ -0,0 +1,146 @@
+/**
+ * @file lock8.c
+ * @brief Byte-sized Lock on top of the parking lot
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <errno.h>
+#include "mthread.h"
+#include "parking.h"
+
+/// Set while the lock is held
+#define LOCK8_LOCKED    (1u)
+
+/// Set while threads may be parked on the lock
+#define LOCK8_PARKED    (2u)
+
+/// Times to retry a held lock before parking
+#define LOCK8_SPIN      40
+
+/**
+ * @brief Atomic Compare and Swap on a byte
+ * @param[in,out] lock_addr Pointer to lock byte
+ * @param[in,out] expected Expected value, overwritten with the current value
+ * on failure
+ * @param[in] desired Desired value
+ * @return Upon success, returns true, else false
+ */
+static inline int atomic_cas8(uint8_t *lock_addr, uint8_t *expected,
+                              uint8_t desired) {
+    return atomic_compare_exchange_weak((_Atomic uint8_t *)lock_addr,
+                                        expected, desired);
+}
+
+/**
+ * @brief Check, under the bucket lock, that the thread should still park
+ * @param[in] addr Address of lock byte
+ * @param[in] arg Unused
+ * @return Non-zero if the lock is held with the parked bit set
+ */
+static int still_locked(const void *addr, void *arg) {
+    return atomic_load((_Atomic uint8_t *)addr) == (LOCK8_LOCKED | LOCK8_PARKED);
+}
+
+/**
+ * @brief Release the lock while the bucket is locked
+ * @param[in] addr Address of lock byte
+ * @param[in] unparked Number of threads unparked
+ * @param[in] more Whether threads remain parked
+ * @param[in] arg Unused
+ * @note Parking threads validate under the same bucket lock, so nobody can
+ * set the parked bit in between; the released state is stored directly.
+ */
+static void release(const void *addr, int unparked, int more, void *arg) {
+    atomic_store((_Atomic uint8_t *)addr, more ? LOCK8_PARKED : 0);
+}
+
+/**
+ * @brief Initialise the lock
+ * @param[in,out] lock Pointer to lock
+ * @return Always returns 0
+ */
+int mthread_lock8_init(mthread_lock8_t *lock) {
+    assert(lock);
+    atomic_store((_Atomic uint8_t *)&lock->value, 0);
+    return 0;
+}
+
+/**
+ * @brief Lock the lock
+ * @param[in,out] lock Pointer to lock
+ * @note The lock is a single byte. The uncontended case is one compare and
+ * swap. Otherwise the thread retries a few times, then sets the parked bit
+ * and parks in the global wait-queue table under the address of the lock.
+ * Woken threads compete with newly arriving ones for the lock.
+ * @return On success, returns 0
+ */
+int mthread_lock8_lock(mthread_lock8_t *lock) {
+    assert(lock);
+    uint8_t state = 0;
+    int spin = 0;
+
+    if(atomic_cas8(&lock->value, &state, LOCK8_LOCKED))
+        return 0;
+
+    for(;;) {
+        if(!(state & LOCK8_LOCKED)) {
+            if(atomic_cas8(&lock->value, &state, state | LOCK8_LOCKED))
+                return 0;
+            continue;
+        }
+
+        if(!(state & LOCK8_PARKED)) {
+            if(spin++ < LOCK8_SPIN) {
+                __builtin_ia32_pause();
+                state = atomic_load((_Atomic uint8_t *)&lock->value);
+                continue;
+            }
+            if(!atomic_cas8(&lock->value, &state, state | LOCK8_PARKED))
+                continue;
+        }
+
+        parking_park(lock, still_locked, NULL, NULL);
+        spin = 0;
+        state = atomic_load((_Atomic uint8_t *)&lock->value);
+    }
+}
+
+/**
+ * @brief Try locking the lock
+ * @param[in,out] lock Pointer to lock
+ * @note Does not block the calling thread
+ * @return On locking returns 0, else EBUSY
+ */
+int mthread_lock8_trylock(mthread_lock8_t *lock) {
+    assert(lock);
+    uint8_t state = atomic_load((_Atomic uint8_t *)&lock->value);
+
+    while(!(state & LOCK8_LOCKED)) {
+        if(atomic_cas8(&lock->value, &state, state | LOCK8_LOCKED))
+            return 0;
+    }
+    return EBUSY;
+}
+
+/**
+ * @brief Unlock the lock
+ * @param[in,out] lock Pointer to lock
+ * @note With the parked bit clear this is one compare and swap. Otherwise
+ * one parked thread is unparked, and the parked bit is kept if others remain.
+ * @return On success, returns 0
+ */
+int mthread_lock8_unlock(mthread_lock8_t *lock) {
+    assert(lock);
+    uint8_t state = LOCK8_LOCKED;
+
+    if(atomic_compare_exchange_strong((_Atomic uint8_t *)&lock->value,
+                                      &state, 0))
+        return 0;
+
+    parking_unpark(lock, 1, release, NULL);
+    return 0;
+}
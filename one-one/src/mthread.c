@@ -8,56 +8,80 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <sched.h>
-#include <linux/futex.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/resource.h>
-#include <asm/prctl.h>
-#include <sys/prctl.h>
 #include "queue.h"
 #include "stack.h"
 #include "mthread.h"
 #include "utils.h"
+#include "tcb.h"
+#include "futex.h"
+
+/*
+ * Threads are cloned with the TCB as thread pointer through the x86-64
+ * CLONE_SETTLS convention. libc keeps its locks off until the process has
+ * a second thread; from glibc 2.36 that is a single process-wide switch,
+ * flipped by the first pthread_create(3), while older versions also read a
+ * flag from the thread descriptor of the calling thread, which the TCB of
+ * this library does not carry.
+ */
+#if !defined(__x86_64__)
+#error "mthread supports x86-64 only"
+#endif
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 36)
+#error "mthread needs glibc 2.36 or later"
+#endif
 
 static size_t   nproc;          ///< Number of extant processes allowed
 static size_t   stack_size;     ///< Stack size
 static size_t   page_size;      ///< Page size
 static queue *  task_q;         ///< Queue containing tasks for all threads
 static mthread_spinlock_t lock; ///< Lock for task queue
+static mthread *main_thread;    ///< TCB of the main thread
+static void *   main_tp;        ///< First word at the main thread's pointer
 
 /**
- * @brief Fast user-space locking
- * @param[in] uaddr Pointer to futex word
- * @param[in] futex_op Operation to be performed
- * @param[in] val Expected value of the futex word
+ * @brief Sends a signal to a thread
+ * @param[in] tgid Thread Group ID
+ * @param[in] tid Thread ID
+ * @param[in] sig Signal number
  * @return 0 on success; -1 on error
  */
-static inline int futex(int *uaddr, int futex_op, int val) {
-    return syscall(SYS_futex, uaddr, futex_op, val, NULL, NULL, 0);
+static inline int tgkill(int tgid, int tid, int sig) {
+    return syscall(SYS_tgkill, tgid, tid, sig);
 }
 
 /**
- * @brief Get/Set architecture-specific thread state
- * @param[in] code Subfunction
- * @param[in/out] Address of value to "set" or "get"
- * @return On success, returns 0; on error, -1 is returned, and errno is set to indicate the error.
+ * @brief Allocate a zeroed thread control block
+ * @note The TCB doubles as the thread pointer, and libc addresses its
+ * thread-local variables (errno, for one) at negative offsets from it. Room is
+ * reserved below the TCB so those accesses stay within memory of the thread,
+ * and above it for the rest of the thread descriptor of libc. The TCB is
+ * cache-line aligned, as the rseq area in it must be 32-byte aligned.
+ * @return Pointer to TCB on success, and NULL on failure
  */
-static inline int arch_prctl(int code, unsigned long *addr) {
-    return syscall(SYS_arch_prctl, code, addr);
+static mthread *tcb_alloc(void) {
+    char *base;
+    _Static_assert(sizeof(mthread) <= MTHREAD_TCB_RESERVE, "TCB too large");
+    if(posix_memalign((void **)&base, MTHREAD_CACHE_LINE, MTHREAD_TLS_RESERVE + MTHREAD_TCB_RESERVE) != 0)
+        return NULL;
+
+    memset(base, 0, MTHREAD_TLS_RESERVE + MTHREAD_TCB_RESERVE);
+    return (mthread *)(base + MTHREAD_TLS_RESERVE);
 }
 
 /**
- * @brief Sends a signal to a thread
- * @param[in] tgid Thread Group ID
- * @param[in] tid Thread ID
- * @param[in] sig Signal number
- * @return 0 on success; -1 on error
+ * @brief Free a thread control block allocated by tcb_alloc()
+ * @param[in] t Pointer to TCB
  */
-static inline int tgkill(int tgid, int tid, int sig) {
-    return syscall(SYS_tgkill, tgid, tid, sig);
+static void tcb_free(mthread *t) {
+    free((char *)t - MTHREAD_TLS_RESERVE);
 }
 
 /**
@@ -70,7 +94,7 @@ static void cleanup_handler(void) {
         t = dequeue(task_q);
         if(t->detach_state == JOINED) {
             deallocate_stack(t->stack_base, t->stack_size);
-            free(t);
+            tcb_free(t);
         }
     }
     free(task_q);
@@ -78,22 +102,46 @@ static void cleanup_handler(void) {
 
 /**
  * @brief Obtain information about calling thread
- * @return Pointer to thread handle on success, and NULL on failure
+ * @note Threads are cloned with their TCB as thread pointer, and the first
+ * word of the TCB points to itself, so it is read with a single instruction
+ * instead of an arch_prctl(2) system call. The main thread keeps the thread
+ * pointer libc set up for it and is recognised by that word.
+ * @return Pointer to thread handle on success, and NULL on failure or
+ * before mthread_init()
  */
-static mthread *mthread_self(void) {
-    uint64_t ptr;
-    pid_t tid = gettid();
-    if(tid == getpid()){
-        return NULL;
-    }
+mthread *mthread_self(void) {
+    void *ptr;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(ptr));
 
-    int err = arch_prctl(ARCH_GET_FS, &ptr);
-    if(err == -1)
-        return NULL;
+    if(ptr == main_tp || main_tp == NULL)
+        return main_thread;
 
     return (mthread *)ptr;
 }
 
+/**
+ * @brief Snapshot the threads of the library
+ * @param[out] count Number of threads
+ * @note TCBs are freed only at exit, so the pointers stay valid after the
+ * lock is dropped, though threads may have exited meanwhile.
+ * @return malloc(3)ed array of TCB pointers on success, and NULL on failure
+ */
+mthread **mthread_registry(int *count) {
+    mthread **threads;
+    node *runner;
+    int n = 0;
+
+    mthread_spin_lock(&lock);
+    threads = malloc(getcount(task_q) * sizeof(mthread *));
+    if(threads != NULL)
+        for(runner = task_q->head; runner; runner = runner->next)
+            threads[n++] = runner->thd;
+    mthread_spin_unlock(&lock);
+
+    *count = n;
+    return threads;
+}
+
 /**
  * @brief Wrapper around user start function
  * @return On success, returns 0
@@ -101,12 +149,68 @@ static mthread *mthread_self(void) {
 static int mthread_start(void *thread) {
     mthread *t = (mthread *)thread;
 
+    /*
+     * The creator only stores the TID once clone(2) returns to it, which may
+     * be after this thread has started running and taking locks.
+     */
+    t->tid = gettid();
+    mthread_rseq_register(t, t);
+    mthread_robust_register(t);
+
     if(sigsetjmp(t->context, 0) == 0)
         t->result = t->start_routine(t->arg);
 
+    /* Wakes deferred by a thread that exits holding a mutex are not lost */
+    mthread_wake_flush();
+
+    /* An exited thread must not hold up RCU grace periods */
+    mthread_rcu_thread_offline();
     return 0;
 }
 
+/**
+ * @brief Start routine of the thread libc is told about
+ * @param[in] arg Unused
+ * @return arg
+ */
+static void *libc_thread(void *arg) {
+    return arg;
+}
+
+/**
+ * @brief Tell libc that the process runs several threads
+ * @note clone(2) goes around libc, so malloc(3), for one, would go on
+ * skipping the lock of its arena, and threads allocating at once corrupt
+ * the heap. A thread created and joined through pthread_create(3) makes
+ * libc switch to its thread-safe paths for good.
+ * @return On success, returns 0; on error, it returns an error number
+ */
+static int mark_multiple_threads(void) {
+    pthread_t t;
+    int err;
+
+    if((err = pthread_create(&t, NULL, libc_thread, NULL)) != 0)
+        return err;
+    return pthread_join(t, NULL);
+}
+
+/**
+ * @brief Bring the TCB of the thread that called fork(2) up to date in the
+ * child
+ * @note The child runs with a TID of its own, which robust and priority
+ * inheritance mutexes store as their owner, and without the robust list
+ * registration of the parent. Its list is registered again by its first
+ * robust mutex, as for the main thread.
+ */
+static void fork_child(void) {
+    mthread *self = mthread_self();
+
+    if(self == NULL)
+        return;
+    self->tid = gettid();
+    self->robust_head.list.next = NULL;
+}
+
 /**
  * @brief Initialise the mthread library
  * @note It has to be the first mthread API function call in an application,
@@ -114,6 +218,11 @@ static int mthread_start(void *thread) {
  * @return On success, returns 0; on error, it returns an error number
  */
 int mthread_init(void) {
+    int err;
+
+    if((err = mark_multiple_threads()) != 0)
+        return err;
+
     mthread_spin_init(&lock);
 
     task_q = calloc(1, sizeof(queue));
@@ -121,12 +230,16 @@ int mthread_init(void) {
 
     atexit(cleanup_handler);
 
-    mthread *main_thread = (mthread *) calloc(1, sizeof(mthread));
+    main_thread = tcb_alloc();
+    main_thread->self = main_thread;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(main_tp));
     main_thread->start_routine = main_thread->arg = main_thread->result = NULL;
     main_thread->detach_state  = JOINABLE;
     main_thread->stack_base    = NULL;
     main_thread->stack_size    = 0;
     main_thread->tid           = gettid();
+    mthread_rseq_register(main_thread, main_tp);
+    pthread_atfork(NULL, NULL, fork_child);
     enqueue(task_q, main_thread);
 
     stack_size  = get_stack_size();
@@ -157,12 +270,14 @@ int mthread_create(mthread_t *thread, mthread_attr_t *attr, void *(*start_routin
         return EINVAL;
     }
 
-    mthread *t = (mthread *) calloc(1, sizeof(mthread));
+    mthread *t = tcb_alloc();
     if(t == NULL) {
         mthread_spin_unlock(&lock);
         return EAGAIN;
     }
 
+    t->self          = t;
+    t->libc_reserved[1] = t;
     t->start_routine = start_routine;
     t->arg           = arg;
     t->detach_state  = (attr == NULL ? JOINABLE     : attr->a_detach_state);
@@ -171,7 +286,7 @@ int mthread_create(mthread_t *thread, mthread_attr_t *attr, void *(*start_routin
     if(t->stack_base == NULL) {
         t->stack_base = allocate_stack(t->stack_size);
         if(t->stack_base == NULL) {
-            free(t);
+            tcb_free(t);
             mthread_spin_unlock(&lock);
             return ENOMEM;
         }
@@ -193,7 +308,7 @@ int mthread_create(mthread_t *thread, mthread_attr_t *attr, void *(*start_routin
                    &t->futex);
     if(t->tid == -1) {
         deallocate_stack(t->stack_base, t->stack_size);
-        free(t);
+        tcb_free(t);
         mthread_spin_unlock(&lock);
         return errno;
     }
@@ -229,7 +344,8 @@ int mthread_join(mthread_t thread, void **retval) {
     target->detach_state = JOINED;
     mthread_spin_unlock(&lock);
 
-    int err = futex(&target->futex, FUTEX_WAIT, target->tid);
+    mthread_wake_flush();
+    int err = futex(&target->futex, FUTEX_WAIT, target->tid, NULL);
     if(err == -1 && errno != EAGAIN)
         return err;
 
@@ -256,7 +372,7 @@ void mthread_yield(void) {
 void mthread_exit(void *retval) {
     mthread_spin_lock(&lock);
     mthread *self = mthread_self();
-    if(self == NULL) {
+    if(self == NULL || self == main_thread) {
         mthread_spin_unlock(&lock);
         return;
     }
@@ -6,14 +6,29 @@
  */
 
 #define _GNU_SOURCE
+#include <stddef.h>
+#include <limits.h>
 #include <stdatomic.h>
 #include <assert.h>
 #include <errno.h>
-#include <sys/time.h>
-#include <linux/futex.h>
-#include <unistd.h>
-#include <sys/syscall.h>
 #include "mthread.h"
+#include "futex.h"
+#include "tcb.h"
+
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2 13
+#endif
+
+/// Flags a mutex may be initialised with
+#define MUTEX_FLAGS         (MTHREAD_MUTEX_PI | MTHREAD_MUTEX_PSHARED | \
+                             MTHREAD_MUTEX_ROBUST)
+
+/// Set in the flags of a robust mutex whose owner died, until it is marked
+/// consistent
+#define MUTEX_INCONSISTENT  (1 << 16)
+
+/// Futex word of a robust mutex unlocked while inconsistent; no TID matches
+#define MUTEX_NOTRECOVERABLE FUTEX_TID_MASK
 
 /**
  * @brief Atomic Compare and Swap
@@ -28,17 +43,6 @@ static inline int atomic_cas(int *lock_addr, int expected, int desired) {
     return atomic_compare_exchange_strong(lock_addr, &expected, desired);
 }
 
-/**
- * @brief Fast user-space locking
- * @param[in] uaddr Pointer to futex word
- * @param[in] futex_op Operation to be performed
- * @param[in] val Expected value of the futex word
- * @return 0 on success; -1 on error
- */
-static inline int futex(int *uaddr, int futex_op, int val) {
-    return syscall(SYS_futex, uaddr, futex_op, val, NULL, NULL, 0);
-}
-
 /**
  * @brief Atomic Compare and Exchange
  * Atomically performs the equivalent of:
@@ -55,27 +59,179 @@ static inline int cmpxchg(int *lock_addr, int expected, int desired) {
   return *ep;
 }
 
+/**
+ * @brief Count a mutex taken by the calling thread
+ * @param[in] err Result of the locking operation
+ * @return err
+ */
+static inline int acquired(int err) {
+    mthread *t;
+
+    if((err == 0 || err == EOWNERDEAD) && (t = mthread_self()) != NULL)
+        t->lock_depth++;
+    return err;
+}
+
+/**
+ * @brief Count a mutex released by the calling thread
+ * @note Wakes requested while holding mutexes are deferred in the TCB, and
+ * are issued together once the outermost mutex is released.
+ */
+static inline void released(void) {
+    mthread *t = mthread_self();
+
+    if(t && t->lock_depth > 0 && --t->lock_depth == 0)
+        mthread_wake_flush();
+}
+
+/**
+ * @brief Sleep on the futex word of the mutex while it holds expected
+ * @note Private mutexes take the fast private futex operations, and
+ * process-shared ones the shared operations.
+ */
+static inline int mutex_sleep(mthread_mutex_t *mutex, int expected,
+                              const struct timespec *abstime) {
+    if(mutex->flags & MTHREAD_MUTEX_PSHARED)
+        return futex_wait_shared(&mutex->value, expected, abstime);
+    return mthread_wait_on_address(&mutex->value, expected, sizeof(int), abstime);
+}
+
+/**
+ * @brief Wake a waiter on the futex word of the mutex
+ */
+static inline void mutex_wake(mthread_mutex_t *mutex) {
+    if(mutex->flags & MTHREAD_MUTEX_PSHARED)
+        futex_wake_shared(&mutex->value, 1);
+    else
+        futex_wake_word(&mutex->value, 1);
+}
+
+/**
+ * @brief Get the robust list link of a robust mutex
+ * @param[in] mutex Pointer to the mutex of a mthread_mutex_robust_t
+ * @return Pointer to the link in front of it
+ */
+static inline struct robust_list *robust_link(mthread_mutex_t *mutex) {
+    return &((struct mthread_mutex_robust *)
+             ((char *)mutex - offsetof(struct mthread_mutex_robust, mutex)))->robust;
+}
+
+/**
+ * @brief Register the robust mutex list of the calling thread
+ * @param[in,out] t Pointer to TCB of the calling thread
+ * @note When a thread dies, the kernel walks its list, sets FUTEX_OWNER_DIED
+ * in the futex word of every robust mutex it still holds and wakes a
+ * waiter. A thread has a single list, so threads of the library register
+ * theirs as they start, but the main thread and a child of fork(2) only
+ * register on their first robust lock. From then on, the list of libc is
+ * gone for that thread, and robust pthread mutexes it holds are no longer
+ * recovered when it dies.
+ */
+void mthread_robust_register(mthread *t) {
+    t->robust_head.list.next = &t->robust_head.list;
+    t->robust_head.futex_offset = offsetof(struct mthread_mutex_robust, mutex.value) -
+                                  offsetof(struct mthread_mutex_robust, robust);
+    t->robust_head.list_op_pending = NULL;
+    syscall(SYS_set_robust_list, &t->robust_head, sizeof(struct robust_list_head));
+}
+
 /**
  * @brief Initialise the mutex
  * @param[in,out] mutex Pointer to mutex
  * @return Always returns 0
  */
 int mthread_mutex_init(mthread_mutex_t *mutex) {
+    return mthread_mutex_init_flags(mutex, MTHREAD_MUTEX_DEFAULT);
+}
+
+/**
+ * @brief Initialise the mutex with flags
+ * @param[in,out] mutex Pointer to mutex
+ * @param[in] flags MTHREAD_MUTEX_DEFAULT, or an OR of MTHREAD_MUTEX_PI and
+ * MTHREAD_MUTEX_PSHARED
+ * @note A priority inheritance mutex keeps the TID of its owner in the futex
+ * word and lets the kernel queue waiters, so that it can boost the owner to
+ * the priority of the highest priority waiter. A process-shared mutex may
+ * lie in memory shared with other processes, such as a MAP_SHARED mapping
+ * of a memfd. A robust mutex needs a list link and is initialised with
+ * mthread_mutex_robust_init() instead.
+ * @return On success, returns 0; if flags are unknown or include
+ * MTHREAD_MUTEX_ROBUST, EINVAL
+ */
+int mthread_mutex_init_flags(mthread_mutex_t *mutex, int flags) {
     assert(mutex);
+    if(flags & ~(MUTEX_FLAGS & ~MTHREAD_MUTEX_ROBUST))
+        return EINVAL;
+
     mutex->value = UNLOCKED;
+    mutex->flags = flags;
     return 0;
 }
 
 /**
- * @brief Lock the mutex
- * @param[in,out] mutex Pointer to mutex
- * @note If the mutex is already locked by another thread, the
- * calling thread is suspended until the mutex is unlocked.
- * @return On success, returns 0
+ * @brief Initialise the robust mutex
+ * @param[in,out] mutex Pointer to robust mutex
+ * @param[in] flags MTHREAD_MUTEX_DEFAULT or MTHREAD_MUTEX_PSHARED
+ * @note A robust mutex keeps the TID of its owner in the futex word; if the
+ * owner dies holding it, the next thread to lock it gets EOWNERDEAD. Robust
+ * mutexes always use shared futex operations, as the kernel wakes their
+ * waiters with one when the owner dies.
+ * @return On success, returns 0; if flags are unknown or ask for priority
+ * inheritance, EINVAL
  */
-int mthread_mutex_lock(mthread_mutex_t *mutex) {
+int mthread_mutex_robust_init(mthread_mutex_robust_t *mutex, int flags) {
     assert(mutex);
-    
+    if(flags & ~(MTHREAD_MUTEX_PSHARED | MTHREAD_MUTEX_ROBUST))
+        return EINVAL;
+
+    mutex->robust.next = NULL;
+    mutex->mutex.value = UNLOCKED;
+    mutex->mutex.flags = flags | MTHREAD_MUTEX_ROBUST;
+    return 0;
+}
+
+/**
+ * @brief Lock a priority inheritance mutex, giving up at an absolute deadline
+ * @param[in,out] mutex Pointer to mutex
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @note The uncontended case is a single compare and swap of 0 to our TID.
+ * Otherwise the kernel takes over: it sets FUTEX_WAITERS in the futex word,
+ * boosts the owner and hands the mutex over directly on unlock.
+ * @return On success, returns 0; ETIMEDOUT if the deadline passed, EDEADLK if
+ * the caller already owns the mutex
+ */
+static int pi_lock_until(mthread_mutex_t *mutex,
+                         const struct timespec *abstime) {
+    pid_t tid = mthread_self()->tid;
+    int private = mutex->flags & MTHREAD_MUTEX_PSHARED ? 0 : FUTEX_PRIVATE_FLAG;
+
+    if(cmpxchg(&mutex->value, UNLOCKED, tid) == UNLOCKED)
+        return 0;
+
+    mthread_wake_flush();
+
+    /*
+     * FUTEX_LOCK_PI measures its timeout against CLOCK_REALTIME, whereas
+     * FUTEX_LOCK_PI2 uses CLOCK_MONOTONIC like the rest of the library.
+     */
+    while(futex(&mutex->value,
+                (abstime ? FUTEX_LOCK_PI2 : FUTEX_LOCK_PI) | private,
+                0, abstime) == -1) {
+        if(errno != EINTR && errno != EAGAIN)
+            return errno;
+    }
+    return 0;
+}
+
+/**
+ * @brief Lock the mutex, giving up at an absolute deadline
+ * @param[in,out] mutex Pointer to mutex
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @return On success, returns 0; ETIMEDOUT if the deadline passed, or EINVAL
+ * if the deadline is malformed
+ */
+static int mutex_lock_until(mthread_mutex_t *mutex,
+                            const struct timespec *abstime) {
     int c = cmpxchg(&mutex->value, UNLOCKED, LOCKED);
     
     /*
@@ -98,8 +254,12 @@ int mthread_mutex_lock(mthread_mutex_t *mutex) {
                  * syscall;
                  * A spurious wakeup will do no harm since we only exit the 
                  * do...while loop when mutex->value is indeed 0. 
+                 * The deadline is absolute, so retrying after a wakeup does
+                 * not extend it.
                  */
-                futex(&mutex->value, FUTEX_WAIT, CONTESTED);
+                int err = mutex_sleep(mutex, CONTESTED, abstime);
+                if(err == ETIMEDOUT || err == EINVAL)
+                    return err;
             }
             
             /*
@@ -116,28 +276,223 @@ int mthread_mutex_lock(mthread_mutex_t *mutex) {
     return 0;
 }
 
+/**
+ * @brief Lock a robust mutex, giving up at an absolute deadline
+ * @param[in,out] mutex Pointer to mutex
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @param[in] try Give up with EBUSY instead of sleeping
+ * @note The futex word holds the TID of the owner, with FUTEX_WAITERS set
+ * while threads may be sleeping on it. The mutex is announced in
+ * list_op_pending while it is being taken, so that the kernel finds it even
+ * if the thread dies before linking it into its robust list. A thread that
+ * has not registered its list yet registers it here. Once it has slept, it
+ * takes the mutex with FUTEX_WAITERS set, as other threads may still be
+ * asleep and its unlock has to wake one.
+ * @return On success, returns 0; if the previous owner died holding it,
+ * EOWNERDEAD with the mutex held; ENOTRECOVERABLE if it was unlocked while
+ * inconsistent; ETIMEDOUT if the deadline passed, EINVAL if the deadline is
+ * malformed, or EBUSY if try is set and the mutex is held
+ */
+static int robust_lock_until(mthread_mutex_t *mutex,
+                             const struct timespec *abstime, int try) {
+    struct robust_list *link = robust_link(mutex);
+    mthread *self = mthread_self();
+    int v = UNLOCKED, mine = self->tid, err = 0;
+
+    if(self->robust_head.list.next == NULL)
+        mthread_robust_register(self);
+    self->robust_head.list_op_pending = link;
+    atomic_signal_fence(memory_order_seq_cst);
+
+    while(!atomic_compare_exchange_strong(&mutex->value, &v, mine)) {
+        if(v == MUTEX_NOTRECOVERABLE) {
+            err = ENOTRECOVERABLE;
+            break;
+        }
+
+        /* The kernel cleared the TID of the owner as it died */
+        if(v & FUTEX_OWNER_DIED) {
+            if(atomic_compare_exchange_strong(&mutex->value, &v,
+                                              mine | (v & FUTEX_WAITERS))) {
+                atomic_fetch_or(&mutex->flags, MUTEX_INCONSISTENT);
+                err = EOWNERDEAD;
+                break;
+            }
+            continue;
+        }
+
+        if(try) {
+            err = EBUSY;
+            break;
+        }
+        if(!(v & FUTEX_WAITERS) &&
+           !atomic_compare_exchange_strong(&mutex->value, &v, v | FUTEX_WAITERS))
+            continue;
+
+        err = futex_wait_shared(&mutex->value, v | FUTEX_WAITERS, abstime);
+        if(err == ETIMEDOUT || err == EINVAL)
+            break;
+        err = 0;
+        mine = self->tid | FUTEX_WAITERS;
+        v = UNLOCKED;
+    }
+
+    if(err == 0 || err == EOWNERDEAD) {
+        link->next = self->robust_head.list.next;
+        self->robust_head.list.next = link;
+    }
+    atomic_signal_fence(memory_order_seq_cst);
+    self->robust_head.list_op_pending = NULL;
+    return err;
+}
+
+/**
+ * @brief Unlock a robust mutex
+ * @param[in,out] mutex Pointer to mutex
+ * @note A mutex still inconsistent is left unrecoverable, and all of its
+ * waiters are woken to find that out.
+ * @return On success, returns 0; if the caller does not own the mutex, EPERM
+ */
+static int robust_unlock(mthread_mutex_t *mutex) {
+    struct robust_list *robust = robust_link(mutex);
+    mthread *self = mthread_self();
+    struct robust_list **link = &self->robust_head.list.next;
+    int v, next = UNLOCKED;
+
+    if((atomic_load(&mutex->value) & FUTEX_TID_MASK) != self->tid)
+        return EPERM;
+
+    self->robust_head.list_op_pending = robust;
+    atomic_signal_fence(memory_order_seq_cst);
+
+    /* Mutexes are mostly unlocked in the reverse order of locking */
+    while(*link != robust && *link != &self->robust_head.list)
+        link = &(*link)->next;
+    if(*link == robust)
+        *link = robust->next;
+
+    if(atomic_fetch_and(&mutex->flags, ~MUTEX_INCONSISTENT) & MUTEX_INCONSISTENT)
+        next = MUTEX_NOTRECOVERABLE;
+    v = atomic_exchange(&mutex->value, next);
+
+    atomic_signal_fence(memory_order_seq_cst);
+    self->robust_head.list_op_pending = NULL;
+
+    if(v & FUTEX_WAITERS)
+        futex_wake_shared(&mutex->value, next == UNLOCKED ? 1 : INT_MAX);
+    return 0;
+}
+
+/**
+ * @brief Lock the mutex
+ * @param[in,out] mutex Pointer to mutex
+ * @note If the mutex is already locked by another thread, the
+ * calling thread is suspended until the mutex is unlocked.
+ * @return On success, returns 0; for a robust mutex, EOWNERDEAD if the
+ * previous owner died holding it, which leaves it locked, or
+ * ENOTRECOVERABLE if it was unlocked without being made consistent
+ */
+int mthread_mutex_lock(mthread_mutex_t *mutex) {
+    assert(mutex);
+    if(mutex->flags & MTHREAD_MUTEX_PI)
+        return acquired(pi_lock_until(mutex, NULL));
+    if(mutex->flags & MTHREAD_MUTEX_ROBUST)
+        return acquired(robust_lock_until(mutex, NULL, 0));
+
+    return acquired(mutex_lock_until(mutex, NULL));
+}
+
+/**
+ * @brief Lock the mutex with a deadline
+ * @param[in,out] mutex Pointer to mutex
+ * @param[in] abstime Absolute timeout measured against CLOCK_MONOTONIC
+ * @note If the mutex is already locked by another thread, the calling
+ * thread is suspended until the mutex is unlocked or the deadline passes.
+ * @return On success, returns 0; if the deadline passed, ETIMEDOUT; for a
+ * robust mutex also EOWNERDEAD or ENOTRECOVERABLE, as for mthread_mutex_lock()
+ */
+int mthread_mutex_timedlock(mthread_mutex_t *mutex,
+                            const struct timespec *abstime) {
+    assert(mutex && abstime);
+    if(mutex->flags & MTHREAD_MUTEX_PI)
+        return acquired(pi_lock_until(mutex, abstime));
+    if(mutex->flags & MTHREAD_MUTEX_ROBUST)
+        return acquired(robust_lock_until(mutex, abstime, 0));
+
+    return acquired(mutex_lock_until(mutex, abstime));
+}
+
 /**
  * @brief Try locking the mutex
  * @param[in,out] mutex Pointer to mutex
  * @note does not block the calling  thread  if  the  mutex  is
  * already locked  by  another  thread
- * @return On locking returns 0, else EBUSY
+ * @return On locking returns 0, else EBUSY; for a robust mutex also
+ * EOWNERDEAD or ENOTRECOVERABLE, as for mthread_mutex_lock()
  */
 int mthread_mutex_trylock(mthread_mutex_t *mutex) {
     assert(mutex);
-    return atomic_cas(&mutex->value, UNLOCKED, UNLOCKED) ? 0 : EBUSY;
+    if(mutex->flags & MTHREAD_MUTEX_PI)
+        return acquired(atomic_cas(&mutex->value, UNLOCKED,
+                                   mthread_self()->tid) ? 0 : EBUSY);
+    if(mutex->flags & MTHREAD_MUTEX_ROBUST)
+        return acquired(robust_lock_until(mutex, NULL, 1));
+
+    return acquired(atomic_cas(&mutex->value, UNLOCKED, LOCKED) ? 0 : EBUSY);
 }
 
 /**
  * @brief Unlock the mutex
  * @param[in,out] mutex Pointer to mutex
- * @return On success, returns 0
+ * @return On success, returns 0; for a priority inheritance or robust mutex
+ * the caller does not own, EPERM
  */
 int mthread_mutex_unlock(mthread_mutex_t *mutex) {
     assert(mutex);
+    if(mutex->flags & MTHREAD_MUTEX_PI) {
+        /*
+         * With waiters queued the kernel has set FUTEX_WAITERS, so the swap
+         * fails and the kernel must pass the mutex on to the top waiter.
+         */
+        pid_t tid = mthread_self()->tid;
+        int private = mutex->flags & MTHREAD_MUTEX_PSHARED ? 0 : FUTEX_PRIVATE_FLAG;
+        if(!atomic_cas(&mutex->value, tid, UNLOCKED) &&
+           futex(&mutex->value, FUTEX_UNLOCK_PI | private, 0, NULL) == -1)
+            return errno;
+        released();
+        return 0;
+    }
+    if(mutex->flags & MTHREAD_MUTEX_ROBUST) {
+        int err = robust_unlock(mutex);
+        if(err == 0)
+            released();
+        return err;
+    }
+
     if(atomic_fetch_sub(&mutex->value, 1) != 1) {
         atomic_store(&mutex->value, UNLOCKED);
-        futex(&mutex->value, FUTEX_WAKE, 1);
+        mutex_wake(mutex);
     }
+    released();
+    return 0;
+}
+
+/**
+ * @brief Mark a robust mutex as consistent again
+ * @param[in,out] mutex Pointer to mutex
+ * @note Called by the thread that got EOWNERDEAD, once it has repaired the
+ * state the mutex guards, and before unlocking it.
+ * @return On success, returns 0; if the mutex is not robust or not
+ * inconsistent, EINVAL; if the caller does not own it, EPERM
+ */
+int mthread_mutex_consistent(mthread_mutex_t *mutex) {
+    assert(mutex);
+    if(!(mutex->flags & MTHREAD_MUTEX_ROBUST) ||
+       !(atomic_load(&mutex->flags) & MUTEX_INCONSISTENT))
+        return EINVAL;
+    if((atomic_load(&mutex->value) & FUTEX_TID_MASK) != mthread_self()->tid)
+        return EPERM;
+
+    atomic_fetch_and(&mutex->flags, ~MUTEX_INCONSISTENT);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,345 @@
+/**
+ * @file parallel.c
+ * @brief Parallel Loops and Reductions
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+
+/// Chunks per thread the range is split into when no grain is given
+#define PARALLEL_CHUNKS_PER_THREAD  8
+
+/// States of the default pool
+enum { POOL_NONE, POOL_STARTING, POOL_READY };
+
+static mthread_pool_t default_pool;         ///< Pool of threads not in one
+static int default_state = POOL_NONE;       ///< Whether it is started
+static int default_workers;                 ///< Its workers, 0 for one per CPU
+
+/// Loop or reduction in progress
+struct parallel_job {
+    /// Pool running the chunks
+    mthread_pool_t *pool;
+
+    /// Ranges of at most grain indices are not split
+    long grain;
+
+    /// Body of a loop, called with no accumulator
+    void (*loop)(long lo, long hi, void *ctx);
+
+    /// Body of a reduction, accumulating into acc
+    void (*reduce)(long lo, long hi, void *acc, void *ctx);
+
+    /// Fold the accumulator of the range to the right into acc
+    void (*combine)(void *acc, const void *other, void *ctx);
+
+    /// Third argument of the functions above
+    void *ctx;
+
+    /// Value accumulators start from, and its size; 0 for a loop
+    const void *identity;
+    size_t size;
+};
+
+/// Right half split off a range, run as a task
+struct parallel_range {
+    struct parallel_job *job;
+    long lo, hi;
+
+    /// Accumulator of the half, or NULL for a loop
+    void *acc;
+};
+
+static void run_range(struct parallel_job *job, long lo, long hi, void *acc);
+
+/**
+ * @brief Get the number of indices in a range
+ * @note Computed unsigned, as it overflows a long for ranges wider than
+ * half of its values
+ */
+static inline unsigned long span(long lo, long hi) {
+    return (unsigned long)hi - (unsigned long)lo;
+}
+
+/**
+ * @brief Get the index a range is halved at
+ */
+static inline long halve(long lo, long hi) {
+    return lo + (long)(span(lo, hi) / 2);
+}
+
+/**
+ * @brief Run a range split off another
+ * @param[in] arg Pointer to range
+ */
+static void range_task(void *arg) {
+    struct parallel_range *r = arg;
+
+    run_range(r->job, r->lo, r->hi, r->acc);
+}
+
+/**
+ * @brief Run the two halves of a range here, one after the other
+ * @param[in] job Pointer to job
+ * @param[in] lo First index
+ * @param[in] hi One past the last index
+ * @param[in,out] acc Accumulator of the range, or NULL for a loop
+ * @note Used when memory for a batch is short. Halving at the first split
+ * and running each half as a range splits it exactly where run_range()
+ * does, and folds the accumulators in the same order, so a reduction
+ * still gives the same result. The accumulator of the right half is on
+ * the stack.
+ */
+static void run_halves(struct parallel_job *job, long lo, long hi, void *acc) {
+    max_align_t right[job->size / sizeof(max_align_t) + 1];
+    long mid = halve(lo, hi);
+
+    run_range(job, lo, mid, acc);
+    if(job->size > 0) {
+        memcpy(right, job->identity, job->size);
+        run_range(job, mid, hi, right);
+        job->combine(acc, right, job->ctx);
+    }
+    else {
+        run_range(job, mid, hi, NULL);
+    }
+}
+
+/**
+ * @brief Run the body over a range, splitting it among the pool
+ * @param[in] job Pointer to job
+ * @param[in] lo First index
+ * @param[in] hi One past the last index
+ * @param[in,out] acc Accumulator of the range, or NULL for a loop
+ * @note The range is halved until the left part is within the grain, and
+ * the right halves, largest first, are submitted in one batch while the
+ * left part runs here. Submitted from a worker, they go onto its deque,
+ * where it takes the smallest back first and idle workers steal the
+ * largest, which they split in turn. So the chunks go where the time is,
+ * however uneven the cost of the indices. Where the range is split does
+ * not depend on who runs it, and the accumulators are folded left to
+ * right, so a reduction gives the same result on every run.
+ */
+static void run_range(struct parallel_job *job, long lo, long hi, void *acc) {
+    mthread_task_group_t group = MTHREAD_TASK_GROUP_INITIALIZER;
+    struct parallel_range *halves = NULL;
+    size_t stride = (job->size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    char *accs = NULL;
+    void **args;
+    long mid;
+    int i, n = 0;
+
+    for(mid = hi; span(lo, mid) > (unsigned long)job->grain; mid = halve(lo, mid))
+        n++;
+
+    /* Accumulators first, where malloc(3) aligns them */
+    if(n > 0) {
+        accs = malloc(n * (stride + sizeof(struct parallel_range) + sizeof(void *)));
+        if(accs == NULL) {
+            run_halves(job, lo, hi, acc);
+            return;
+        }
+    }
+
+    if(n > 0) {
+        halves = (struct parallel_range *)(accs + n * stride);
+        args = (void **)(halves + n);
+        for(i = 0, mid = hi; i < n; i++) {
+            halves[i].job = job;
+            halves[i].hi = mid;
+            halves[i].lo = mid = halve(lo, mid);
+            halves[i].acc = NULL;
+            if(job->size > 0) {
+                halves[i].acc = accs + i * stride;
+                memcpy(halves[i].acc, job->identity, job->size);
+            }
+            args[i] = &halves[i];
+        }
+        hi = mid;
+
+        if(mthread_pool_submit_batch(job->pool, &group, range_task, args, n) != 0) {
+            for(i = n - 1; i >= 0; i--)
+                range_task(&halves[i]);
+        }
+    }
+
+    if(job->loop != NULL)
+        job->loop(lo, hi, job->ctx);
+    else
+        job->reduce(lo, hi, acc, job->ctx);
+
+    if(n > 0) {
+        mthread_pool_wait(job->pool, &group);
+        if(job->size > 0) {
+            for(i = n - 1; i >= 0; i--)
+                job->combine(acc, halves[i].acc, job->ctx);
+        }
+        free(accs);
+    }
+}
+
+/**
+ * @brief Get the pool a parallel loop called from this thread runs on
+ * @param[out] pool Pointer to pool
+ * @note A worker of some pool, running a task or an outer loop, uses its
+ * own pool, where it runs other chunks while it waits. Any other thread
+ * uses the default pool, started by the first call.
+ * @return On success, returns 0; if the default pool can not be started,
+ * the error of mthread_pool_init()
+ */
+static int get_pool(mthread_pool_t **pool) {
+    struct mthread_pool_worker *w = mthread_self()->pool_worker;
+    int state, expected, err;
+
+    if(w != NULL) {
+        *pool = w->pool;
+        return 0;
+    }
+
+    while((state = atomic_load(&default_state)) != POOL_READY) {
+        expected = POOL_NONE;
+        if(state == POOL_NONE &&
+           atomic_compare_exchange_strong(&default_state, &expected, POOL_STARTING)) {
+            err = mthread_pool_init(&default_pool, default_workers);
+            atomic_store(&default_state, err == 0 ? POOL_READY : POOL_NONE);
+            mthread_wake_by_address(&default_state, INT_MAX);
+            if(err != 0)
+                return err;
+            break;
+        }
+        if(state == POOL_STARTING)
+            mthread_wait_on_address(&default_state, POOL_STARTING, sizeof(int), NULL);
+    }
+
+    *pool = &default_pool;
+    return 0;
+}
+
+/**
+ * @brief Start the job over a range
+ * @param[in,out] job Pointer to job, without its pool
+ * @param[in] begin First index
+ * @param[in] end One past the last index
+ * @param[in] grain Largest chunk run without splitting, or 0 to pick one
+ * @param[in,out] acc Accumulator of the whole range, or NULL for a loop
+ * @return On success, returns 0; if end is before begin or grain is
+ * negative, EINVAL; if the default pool can not be started, its error
+ */
+static int run_job(struct parallel_job *job, long begin, long end, long grain, void *acc) {
+    int err;
+
+    if(end < begin || grain < 0)
+        return EINVAL;
+    if(end == begin)
+        return 0;
+    if((err = get_pool(&job->pool)) != 0)
+        return err;
+
+    if(grain == 0) {
+        grain = span(begin, end) / (PARALLEL_CHUNKS_PER_THREAD * (job->pool->nworkers + 1));
+        if(grain < 1)
+            grain = 1;
+    }
+    job->grain = grain;
+
+    run_range(job, begin, end, acc);
+    return 0;
+}
+
+/**
+ * @brief Set the number of workers of the default pool
+ * @param[in] nworkers Number of workers, or 0 for one per online CPU
+ * @note The default pool runs the loops of threads that are not workers of
+ * a pool. It is started by the first such loop, with one worker per online
+ * CPU unless this was called before.
+ * @return On success, returns 0; if nworkers is negative, EINVAL; if the
+ * default pool was already started, EBUSY
+ */
+int mthread_parallel_init(int nworkers) {
+    int expected = POOL_NONE, err;
+
+    if(nworkers < 0)
+        return EINVAL;
+    if(!atomic_compare_exchange_strong(&default_state, &expected, POOL_STARTING))
+        return EBUSY;
+
+    default_workers = nworkers;
+    err = mthread_pool_init(&default_pool, nworkers);
+    atomic_store(&default_state, err == 0 ? POOL_READY : POOL_NONE);
+    mthread_wake_by_address(&default_state, INT_MAX);
+    return err;
+}
+
+/**
+ * @brief Run a function over a range of indices in parallel
+ * @param[in] begin First index
+ * @param[in] end One past the last index
+ * @param[in] grain Largest chunk run without splitting, or 0 to pick one
+ * @param[in] func Function called with disjoint chunks [lo, hi) covering the
+ * range, in no particular order
+ * @param[in] ctx Third argument of func
+ * @note The calling thread runs chunks too, and returns once all have run.
+ * func may itself run parallel loops.
+ * @return On success, returns 0; if func is NULL, end is before begin or
+ * grain is negative, EINVAL; if the default pool can not be started, the
+ * error of mthread_pool_init()
+ */
+int mthread_parallel_for(long begin, long end, long grain,
+                         void (*func)(long lo, long hi, void *ctx), void *ctx) {
+    struct parallel_job job = { .loop = func, .ctx = ctx, .size = 0 };
+
+    if(func == NULL)
+        return EINVAL;
+    return run_job(&job, begin, end, grain, NULL);
+}
+
+/**
+ * @brief Reduce a range of indices in parallel
+ * @param[in] begin First index
+ * @param[in] end One past the last index
+ * @param[in] grain Largest chunk run without splitting, or 0 to pick one
+ * @param[in,out] result Accumulator of size bytes, holding the identity of
+ * combine on entry and the result on return
+ * @param[in] size Size of the accumulator
+ * @param[in] func Function accumulating chunk [lo, hi) into acc
+ * @param[in] combine Function folding the accumulator of the chunks to the
+ * right of those of acc into acc
+ * @param[in] ctx Last argument of func and combine
+ * @note Each chunk split off starts from a copy of the identity, and the
+ * accumulators are folded in the order of the chunks, so combine must be
+ * associative but need not be commutative. The split only depends on the
+ * range and the grain, so floating-point results are the same on every run
+ * with the same arguments.
+ * @return On success, returns 0; if a function is NULL, size is 0, end is
+ * before begin or grain is negative, EINVAL; if memory is short, ENOMEM;
+ * if the default pool can not be started, the error of mthread_pool_init()
+ */
+int mthread_parallel_reduce(long begin, long end, long grain, void *result, size_t size,
+                            void (*func)(long lo, long hi, void *acc, void *ctx),
+                            void (*combine)(void *acc, const void *other, void *ctx),
+                            void *ctx) {
+    struct parallel_job job = { .reduce = func, .combine = combine, .ctx = ctx, .size = size };
+    void *identity;
+    int err;
+
+    if(result == NULL || size == 0 || func == NULL || combine == NULL)
+        return EINVAL;
+    if((identity = malloc(size)) == NULL)
+        return ENOMEM;
+
+    memcpy(identity, result, size);
+    job.identity = identity;
+    err = run_job(&job, begin, end, grain, result);
+    free(identity);
+    return err;
+}
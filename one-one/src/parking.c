@@ -0,0 +1,186 @@
+/**
+ * @file parking.c
+ * @brief Parking lot: wait queues hashed by address
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "parking.h"
+
+/// Number of buckets in the table is 2^PARKING_BITS
+#define PARKING_BITS        10
+#define PARKING_BUCKETS     (1 << PARKING_BITS)
+
+/// A thread parked on an address, living on the stack of that thread
+struct parked {
+    /// Address the thread is parked on
+    const void *addr;
+
+    /// Next thread in the same bucket
+    struct parked *next;
+
+    /// Futex word the thread sleeps on, set to 1 when unparked
+    int unparked;
+};
+
+/// Wait queue for all the addresses that hash to it
+struct bucket {
+    /// Protects the queue
+    mthread_mutex_t lock;
+
+    /// First parked thread
+    struct parked *head;
+
+    /// Last parked thread
+    struct parked *tail;
+
+    /// Number of parked threads, read without the lock by unparkers
+    int parked;
+} __attribute__((aligned(MTHREAD_CACHE_LINE)));
+
+static struct bucket table[PARKING_BUCKETS];
+
+/**
+ * @brief Find the bucket of an address
+ * @param[in] addr Address
+ * @return Pointer to bucket
+ */
+static inline struct bucket *bucket_of(const void *addr) {
+    uint64_t h = (uintptr_t)addr * 0x9E3779B97F4A7C15ull;
+    return &table[h >> (64 - PARKING_BITS)];
+}
+
+/**
+ * @brief Remove a thread from its bucket
+ * @param[in,out] b Bucket, locked by the caller
+ * @param[in] p Parked thread
+ * @param[in] prev Thread before p in the bucket, or NULL
+ */
+static void unlink_parked(struct bucket *b, struct parked *p,
+                          struct parked *prev) {
+    if(prev)
+        prev->next = p->next;
+    else
+        b->head = p->next;
+    if(b->tail == p)
+        b->tail = prev;
+    atomic_fetch_sub(&b->parked, 1);
+}
+
+/**
+ * @brief Park the calling thread on an address
+ * @param[in] addr Address to park on; it is only used as a key
+ * @param[in] validate Called under the bucket lock, the thread parks only
+ * if it returns non-zero. An unparker holds the same lock, so a state change
+ * made before unparking can not be missed.
+ * @param[in] arg Argument to validate
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @return Returns 0 once unparked; EAGAIN if validation failed, or ETIMEDOUT
+ * if the deadline passed
+ */
+int parking_park(const void *addr, int (*validate)(const void *, void *),
+                 void *arg, const struct timespec *abstime) {
+    struct bucket *b = bucket_of(addr);
+    struct parked self = { addr, NULL, 0 };
+    struct parked *p, *prev;
+
+    /*
+     * Count ourselves in before validating, so that an unparker which changed
+     * the state after our check can not miss us in the count.
+     */
+    mthread_mutex_lock(&b->lock);
+    atomic_fetch_add(&b->parked, 1);
+    if(validate && !validate(addr, arg)) {
+        atomic_fetch_sub(&b->parked, 1);
+        mthread_mutex_unlock(&b->lock);
+        return EAGAIN;
+    }
+    if(b->tail)
+        b->tail->next = &self;
+    else
+        b->head = &self;
+    b->tail = &self;
+    mthread_mutex_unlock(&b->lock);
+
+    while(atomic_load(&self.unparked) == 0) {
+        if(mthread_wait_on_address(&self.unparked, 0, sizeof(int), abstime)
+           == ETIMEDOUT)
+            break;
+    }
+    if(atomic_load(&self.unparked))
+        return 0;
+
+    /* Timed out, but an unparker may have dequeued us in the meantime */
+    mthread_mutex_lock(&b->lock);
+    for(prev = NULL, p = b->head; p && p != &self; prev = p, p = p->next);
+    if(p)
+        unlink_parked(b, p, prev);
+    mthread_mutex_unlock(&b->lock);
+    if(!p) {
+        /* The wakeup is on its way and refers to our stack, so wait for it */
+        while(atomic_load(&self.unparked) == 0)
+            mthread_wait_on_address(&self.unparked, 0, sizeof(int), NULL);
+        return 0;
+    }
+    return ETIMEDOUT;
+}
+
+/**
+ * @brief Unpark threads parked on an address
+ * @param[in] addr Address the threads are parked on
+ * @param[in] n Most threads to unpark
+ * @param[in] callback Called under the bucket lock, after the threads are
+ * dequeued but before they are woken, with the number unparked and whether
+ * any remain parked on addr. It can update the state validated by parkers.
+ * @param[in] arg Argument to callback
+ * @note Threads are unparked in the order they parked. Without a callback,
+ * an empty bucket is detected without taking its lock.
+ * @return Number of threads unparked
+ */
+int parking_unpark(const void *addr, int n,
+                   void (*callback)(const void *, int, int, void *), void *arg) {
+    struct bucket *b = bucket_of(addr);
+    struct parked *p, *prev = NULL, *next, *woken = NULL;
+    int count = 0, more = 0;
+
+    if(!callback && atomic_load(&b->parked) == 0)
+        return 0;
+
+    mthread_mutex_lock(&b->lock);
+    for(p = b->head; p; p = next) {
+        next = p->next;
+        if(p->addr != addr) {
+            prev = p;
+            continue;
+        }
+        if(count == n) {
+            more = 1;
+            break;
+        }
+        unlink_parked(b, p, prev);
+        p->next = woken;
+        woken = p;
+        count++;
+    }
+    if(callback)
+        callback(addr, count, more, arg);
+    mthread_mutex_unlock(&b->lock);
+
+    /*
+     * The parked thread may return and reuse its stack as soon as it sees
+     * the flag, so the next pointer is read first. A wakeup that hits a
+     * reused address at worst causes a spurious wakeup.
+     */
+    for(p = woken; p; p = next) {
+        next = p->next;
+        atomic_store(&p->unparked, 1);
+        mthread_wake_by_address(&p->unparked, 1);
+    }
+    return count;
+}
@@ -0,0 +1,520 @@
+/**
+ * @file percpu.c
+ * @brief Per-CPU Data Structures on Restartable Sequences
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <sys/rseq.h>
+#include <linux/membarrier.h>
+#include "mthread.h"
+#include "tcb.h"
+#include "utils.h"
+
+#define STR_(x) #x
+#define STR(x)  STR_(x)
+
+/// Set once some thread runs without rseq, which puts every thread on locks
+static int rseq_off;
+
+/// Whether restarts of the sequences of other threads were asked for yet
+static int rseq_fenced;
+
+/**
+ * Descriptor of a restartable sequence starting at label start, committing
+ * with the instruction before label post_commit, and restarting at label
+ * abort. It is placed at label table, which the sequence stores in the
+ * rseq_cs field of the rseq area before its first instruction.
+ */
+#define RSEQ_CS_TABLE(table, start, post_commit, abort)                        \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                        \
+    ".balign 32\n\t"                                                            \
+    STR(table) ":\n\t"                                                          \
+    ".long 0, 0\n\t"                                                            \
+    ".quad " STR(start) ", (" STR(post_commit) " - " STR(start) "), " STR(abort) "\n\t" \
+    ".popsection\n\t"
+
+/**
+ * Entry of a restartable sequence: publish the descriptor, then give up if
+ * the thread is no longer on the CPU whose data it is about to touch, or if
+ * the threads were all put on locks
+ */
+#define RSEQ_CS_ENTER(table, start, abort)                                      \
+    "leaq " STR(table) "(%%rip), %%rax\n\t"                                     \
+    "movq %%rax, %[rseq_cs]\n\t"                                                \
+    STR(start) ":\n\t"                                                          \
+    "cmpl %[cpu], %[cpu_id]\n\t"                                                \
+    "jnz " STR(abort) "\n\t"                                                    \
+    "cmpl $0, %[off]\n\t"                                                       \
+    "jnz " STR(abort) "\n\t"
+
+/**
+ * Abort handler, preceded by the signature the kernel checks before it
+ * restarts a sequence. The signature encodes an undefined instruction.
+ */
+#define RSEQ_CS_ABORT(label, target)                                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                                   \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                                \
+    ".long " STR(RSEQ_SIG) "\n\t"                                               \
+    STR(label) ":\n\t"                                                          \
+    "jmp %l[" STR(target) "]\n\t"                                               \
+    ".popsection\n\t"
+
+/**
+ * @brief Add to a word of a CPU, if the thread still runs on it
+ * @return 0 if the add was done, -1 if the thread was preempted or migrated
+ */
+static inline int rseq_add(struct rseq *rs, int cpu, intptr_t *v, intptr_t n) {
+    __asm__ __volatile__ goto(
+        RSEQ_CS_TABLE(3, 1f, 2f, 4f)
+        RSEQ_CS_ENTER(3b, 1, 4f)
+        "addq %[n], %[v]\n\t"
+        "2:\n\t"
+        RSEQ_CS_ABORT(4, abort)
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [off] "m" (rseq_off),
+          [v] "m" (*v), [n] "er" (n)
+        : "memory", "cc", "rax"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+/**
+ * @brief Push a node onto a list of a CPU, if the thread still runs on it
+ * @return 0 if the node was pushed, -1 if the thread was preempted or migrated
+ */
+static inline int rseq_push(struct rseq *rs, int cpu, intptr_t *head, intptr_t node) {
+    __asm__ __volatile__ goto(
+        RSEQ_CS_TABLE(3, 1f, 2f, 4f)
+        RSEQ_CS_ENTER(3b, 1, 4f)
+        "movq %[head], %%rbx\n\t"
+        "movq %%rbx, (%[node])\n\t"
+        "movq %[node], %[head]\n\t"
+        "2:\n\t"
+        RSEQ_CS_ABORT(4, abort)
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [off] "m" (rseq_off),
+          [head] "m" (*head), [node] "r" (node)
+        : "memory", "cc", "rax", "rbx"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+/**
+ * @brief Pop a node off a list of a CPU, if the thread still runs on it
+ * @note The next pointer of the head is read inside the sequence, where no
+ * other thread can pop the head, so the pop is immune to ABA.
+ * @return 0 with the node in *node, or NULL if the list is empty; -1 if the
+ * thread was preempted or migrated
+ */
+static inline int rseq_pop(struct rseq *rs, int cpu, intptr_t *head, intptr_t *node) {
+    __asm__ __volatile__ goto(
+        RSEQ_CS_TABLE(3, 1f, 2f, 4f)
+        RSEQ_CS_ENTER(3b, 1, 4f)
+        "movq %[head], %%rbx\n\t"
+        "movq %%rbx, %[node]\n\t"
+        "testq %%rbx, %%rbx\n\t"
+        "jz %l[done]\n\t"
+        "movq (%%rbx), %%rbx\n\t"
+        "movq %%rbx, %[head]\n\t"
+        "2:\n\t"
+        RSEQ_CS_ABORT(4, abort)
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [off] "m" (rseq_off),
+          [head] "m" (*head), [node] "m" (*node)
+        : "memory", "cc", "rax", "rbx"
+        : abort, done);
+done:
+    return 0;
+abort:
+    return -1;
+}
+
+/**
+ * @brief Take the word of a CPU and leave 0, if the thread still runs on it
+ * @return 0 with the word in *old; -1 if the thread was preempted or migrated
+ */
+static inline int rseq_take(struct rseq *rs, int cpu, intptr_t *v, intptr_t *old) {
+    __asm__ __volatile__ goto(
+        RSEQ_CS_TABLE(3, 1f, 2f, 4f)
+        RSEQ_CS_ENTER(3b, 1, 4f)
+        "movq %[v], %%rbx\n\t"
+        "movq %%rbx, %[old]\n\t"
+        "movq $0, %[v]\n\t"
+        "2:\n\t"
+        RSEQ_CS_ABORT(4, abort)
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [off] "m" (rseq_off),
+          [v] "m" (*v), [old] "m" (*old)
+        : "memory", "cc", "rax", "rbx"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+
+/**
+ * @brief Store into the word of a CPU if it is 0, if the thread still runs
+ * on it
+ * @return 0 if stored, 1 if the word is not 0; -1 if the thread was preempted
+ * or migrated
+ */
+static inline int rseq_put(struct rseq *rs, int cpu, intptr_t *v, intptr_t newv) {
+    __asm__ __volatile__ goto(
+        RSEQ_CS_TABLE(3, 1f, 2f, 4f)
+        RSEQ_CS_ENTER(3b, 1, 4f)
+        "cmpq $0, %[v]\n\t"
+        "jnz %l[full]\n\t"
+        "movq %[newv], %[v]\n\t"
+        "2:\n\t"
+        RSEQ_CS_ABORT(4, abort)
+        :
+        : [cpu] "r" (cpu), [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [off] "m" (rseq_off),
+          [v] "m" (*v), [newv] "r" (newv)
+        : "memory", "cc", "rax"
+        : abort, full);
+    return 0;
+full:
+    return 1;
+abort:
+    return -1;
+}
+
+/**
+ * @brief Put every thread on the locked paths of the per-CPU structures
+ * @note The plain stores of a sequence would race with the atomics and
+ * spinlocks of a thread without rseq on the same cell. So once there is
+ * such a thread, the sequences check the flag and abort, and membarrier(2)
+ * restarts those already past the check before the caller takes a lock.
+ */
+static void rseq_disable(void) {
+    atomic_store(&rseq_off, 1);
+    syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ, 0, 0);
+}
+
+/**
+ * @brief Register restartable sequences for the calling thread
+ * @param[in,out] t Pointer to TCB of the calling thread
+ * @param[in] tp Thread pointer of the calling thread
+ * @note A thread can register a single rseq area. glibc registers one for
+ * the main thread, which is found through __rseq_offset and shared. Threads
+ * of the library register the area in their TCB. If registration fails,
+ * t->rseq stays NULL and the per-CPU structures fall back to locks in every
+ * thread, as they do if the kernel can not restart the sequences of other
+ * threads.
+ */
+void mthread_rseq_register(mthread *t, void *tp) {
+    struct rseq *rs;
+
+    /* First called by mthread_init(), before there are other threads */
+    if(!rseq_fenced) {
+        rseq_fenced = 1;
+        if(syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) != 0)
+            atomic_store(&rseq_off, 1);
+    }
+
+    if(__rseq_size > 0 && tp != t) {
+        rs = (struct rseq *)((char *)tp + __rseq_offset);
+        if((int)rs->cpu_id >= 0)
+            t->rseq = rs;
+    }
+    else {
+        t->rseq_area.cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+        if(syscall(SYS_rseq, &t->rseq_area, sizeof(struct rseq), 0, RSEQ_SIG) == 0)
+            t->rseq = &t->rseq_area;
+    }
+
+    if(t->rseq == NULL)
+        rseq_disable();
+}
+
+/**
+ * @brief Get the rseq area of the calling thread and the CPU it runs on
+ * @param[out] cpu Number of the current CPU
+ * @return Pointer to the rseq area, or NULL if the thread has none or the
+ * threads were put on locks, in which case cpu comes from getcpu(2)
+ */
+static inline struct rseq *current_cpu(int *cpu) {
+    mthread *self = mthread_self();
+    unsigned int c;
+
+    if(self != NULL && self->rseq != NULL &&
+       !atomic_load_explicit(&rseq_off, memory_order_relaxed)) {
+        *cpu = __atomic_load_n(&self->rseq->cpu_id_start, __ATOMIC_RELAXED);
+        return self->rseq;
+    }
+    getcpu(&c, NULL);
+    *cpu = c;
+    return NULL;
+}
+
+/**
+ * @brief Get the CPU the calling thread runs on
+ * @note From the rseq area, without a system call, where there is one
+ * @return CPU number, which may be stale by the time it is used
+ */
+int mthread_current_cpu(void) {
+    int cpu;
+
+    current_cpu(&cpu);
+    return cpu;
+}
+
+/**
+ * @brief Allocate one zeroed cell per possible CPU
+ * @param[out] cells Array of cells
+ * @return Number of cells on success, and 0 if memory is short
+ */
+static int cells_alloc(struct mthread_percpu_cell **cells) {
+    int ncpus = get_possible_cpus();
+
+    *cells = aligned_alloc(MTHREAD_CACHE_LINE, ncpus * sizeof(struct mthread_percpu_cell));
+    if(*cells == NULL)
+        return 0;
+
+    memset(*cells, 0, ncpus * sizeof(struct mthread_percpu_cell));
+    return ncpus;
+}
+
+/**
+ * @brief Initialise the per-CPU counter to 0
+ * @param[in,out] counter Pointer to counter
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+int mthread_percpu_counter_init(mthread_percpu_counter_t *counter) {
+    assert(counter);
+    counter->ncpus = cells_alloc(&counter->cells);
+    return counter->ncpus ? 0 : ENOMEM;
+}
+
+/**
+ * @brief Destroy the per-CPU counter
+ * @param[in,out] counter Pointer to counter
+ * @return On success, returns 0
+ */
+int mthread_percpu_counter_destroy(mthread_percpu_counter_t *counter) {
+    assert(counter);
+    free(counter->cells);
+    counter->cells = NULL;
+    counter->ncpus = 0;
+    return 0;
+}
+
+/**
+ * @brief Add to the counter
+ * @param[in,out] counter Pointer to counter
+ * @param[in] n Amount to add, which may be negative
+ * @note A plain add to the partial sum of the current CPU. If the thread is
+ * preempted or migrated before it, the kernel restarts it on the new CPU.
+ * @return On success, returns 0
+ */
+int mthread_percpu_counter_add(mthread_percpu_counter_t *counter, long n) {
+    assert(counter);
+    struct rseq *rs;
+    int cpu;
+
+    for(;;) {
+        rs = current_cpu(&cpu);
+        if(rs == NULL) {
+            atomic_fetch_add(&counter->cells[cpu].value, n);
+            return 0;
+        }
+        if(rseq_add(rs, cpu, &counter->cells[cpu].value, n) == 0)
+            return 0;
+    }
+}
+
+/**
+ * @brief Read the counter
+ * @param[in,out] counter Pointer to counter
+ * @return Sum of the partial sums of all CPUs
+ */
+long mthread_percpu_counter_read(mthread_percpu_counter_t *counter) {
+    assert(counter);
+    long sum = 0;
+    int i;
+
+    for(i = 0; i < counter->ncpus; i++)
+        sum += atomic_load_explicit(&counter->cells[i].value, memory_order_relaxed);
+    return sum;
+}
+
+/**
+ * @brief Initialise the per-CPU freelist, empty
+ * @param[in,out] list Pointer to freelist
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+int mthread_percpu_freelist_init(mthread_percpu_freelist_t *list) {
+    assert(list);
+    list->ncpus = cells_alloc(&list->cells);
+    return list->ncpus ? 0 : ENOMEM;
+}
+
+/**
+ * @brief Destroy the per-CPU freelist
+ * @param[in,out] list Pointer to freelist
+ * @note Nodes still on the list are not touched
+ * @return On success, returns 0
+ */
+int mthread_percpu_freelist_destroy(mthread_percpu_freelist_t *list) {
+    assert(list);
+    free(list->cells);
+    list->cells = NULL;
+    list->ncpus = 0;
+    return 0;
+}
+
+/**
+ * @brief Push a node onto the freelist of the current CPU
+ * @param[in,out] list Pointer to freelist
+ * @param[in,out] node Pointer to node
+ * @return On success, returns 0
+ */
+int mthread_percpu_freelist_push(mthread_percpu_freelist_t *list, mthread_percpu_node_t *node) {
+    assert(list && node);
+    struct mthread_percpu_cell *cell;
+    struct rseq *rs;
+    int cpu;
+
+    for(;;) {
+        rs = current_cpu(&cpu);
+        cell = &list->cells[cpu];
+        if(rs == NULL) {
+            mthread_spin_lock(&cell->lock);
+            node->next = (mthread_percpu_node_t *)cell->value;
+            cell->value = (intptr_t)node;
+            mthread_spin_unlock(&cell->lock);
+            return 0;
+        }
+        if(rseq_push(rs, cpu, &cell->value, (intptr_t)node) == 0)
+            return 0;
+    }
+}
+
+/**
+ * @brief Pop a node off the freelist of the current CPU
+ * @param[in,out] list Pointer to freelist
+ * @note Nodes pushed on other CPUs are not looked at
+ * @return Pointer to node, or NULL if the freelist of the CPU is empty
+ */
+mthread_percpu_node_t *mthread_percpu_freelist_pop(mthread_percpu_freelist_t *list) {
+    assert(list);
+    struct mthread_percpu_cell *cell;
+    struct rseq *rs;
+    intptr_t node;
+    int cpu;
+
+    for(;;) {
+        rs = current_cpu(&cpu);
+        cell = &list->cells[cpu];
+        if(rs == NULL) {
+            mthread_spin_lock(&cell->lock);
+            node = cell->value;
+            if(node)
+                cell->value = (intptr_t)((mthread_percpu_node_t *)node)->next;
+            mthread_spin_unlock(&cell->lock);
+            return (mthread_percpu_node_t *)node;
+        }
+        if(rseq_pop(rs, cpu, &cell->value, &node) == 0)
+            return (mthread_percpu_node_t *)node;
+    }
+}
+
+/**
+ * @brief Initialise the per-CPU slots, empty
+ * @param[in,out] slots Pointer to slots
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+int mthread_percpu_slots_init(mthread_percpu_slots_t *slots) {
+    assert(slots);
+    slots->ncpus = cells_alloc(&slots->cells);
+    return slots->ncpus ? 0 : ENOMEM;
+}
+
+/**
+ * @brief Destroy the per-CPU slots
+ * @param[in,out] slots Pointer to slots
+ * @note Pointers still stored are not touched
+ * @return On success, returns 0
+ */
+int mthread_percpu_slots_destroy(mthread_percpu_slots_t *slots) {
+    assert(slots);
+    free(slots->cells);
+    slots->cells = NULL;
+    slots->ncpus = 0;
+    return 0;
+}
+
+/**
+ * @brief Take the pointer stored in the slot of the current CPU
+ * @param[in,out] slots Pointer to slots
+ * @return Pointer stored, or NULL if the slot is empty
+ */
+void *mthread_percpu_slots_take(mthread_percpu_slots_t *slots) {
+    assert(slots);
+    struct mthread_percpu_cell *cell;
+    struct rseq *rs;
+    intptr_t old;
+    int cpu;
+
+    for(;;) {
+        rs = current_cpu(&cpu);
+        cell = &slots->cells[cpu];
+        if(rs == NULL) {
+            mthread_spin_lock(&cell->lock);
+            old = cell->value;
+            cell->value = 0;
+            mthread_spin_unlock(&cell->lock);
+            return (void *)old;
+        }
+        if(rseq_take(rs, cpu, &cell->value, &old) == 0)
+            return (void *)old;
+    }
+}
+
+/**
+ * @brief Store a pointer in the slot of the current CPU
+ * @param[in,out] slots Pointer to slots
+ * @param[in] ptr Pointer to store, not NULL
+ * @note Used as a one-object cache per CPU, in front of a slower allocator
+ * @return On success, returns 0; if the slot is full, EBUSY
+ */
+int mthread_percpu_slots_put(mthread_percpu_slots_t *slots, void *ptr) {
+    assert(slots && ptr);
+    struct mthread_percpu_cell *cell;
+    struct rseq *rs;
+    int cpu, err;
+
+    for(;;) {
+        rs = current_cpu(&cpu);
+        cell = &slots->cells[cpu];
+        if(rs == NULL) {
+            mthread_spin_lock(&cell->lock);
+            err = cell->value ? EBUSY : 0;
+            if(!err)
+                cell->value = (intptr_t)ptr;
+            mthread_spin_unlock(&cell->lock);
+            return err;
+        }
+        if((err = rseq_put(rs, cpu, &cell->value, (intptr_t)ptr)) >= 0)
+            return err ? EBUSY : 0;
+    }
+}
@@ -0,0 +1,345 @@
+/**
+ * @file pipeline.c
+ * @brief Pipeline of Serial and Parallel Stages
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/// Item in flight, and the right to have one in flight
+struct mthread_pipeline_token {
+    /// Item as returned by the last stage run
+    void *item;
+
+    /// Position of the item in the output of the first stage
+    uint64_t seq;
+
+    /// Set once a stage dropped the item
+    int dropped;
+
+    /// Next token waiting for the same stage, or next free token
+    struct mthread_pipeline_token *next;
+};
+
+/**
+ * @brief Hand a token to a stage
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[in] s Index of the stage
+ * @param[in] token Pointer to token
+ * @note A serial in-order stage files the token by its sequence number, so
+ * that it can pick the next one in order whatever order they arrive in. As
+ * at most max_tokens are in flight, they never collide.
+ */
+static void hand_to(mthread_pipeline_t *pipeline, int s,
+                    struct mthread_pipeline_token *token) {
+    struct mthread_pipeline_stage *stage = &pipeline->stages[s];
+
+    if(stage->mode == MTHREAD_PIPELINE_SERIAL_IN_ORDER) {
+        stage->reorder[token->seq % pipeline->max_tokens] = token;
+        return;
+    }
+
+    token->next = NULL;
+    if(stage->tail != NULL)
+        stage->tail->next = token;
+    else
+        stage->head = token;
+    stage->tail = token;
+}
+
+/**
+ * @brief Take a token some stage can run now
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[out] s Index of the stage
+ * @note Later stages are tried first, so that items leave the pipeline and
+ * free their tokens before the first stage brings in new ones.
+ * @return Pointer to token, or NULL if no stage can run
+ */
+static struct mthread_pipeline_token *take(mthread_pipeline_t *pipeline, int *s) {
+    struct mthread_pipeline_stage *stage;
+    struct mthread_pipeline_token *token, **slot;
+    int i;
+
+    for(i = pipeline->nstages - 1; i > 0; i--) {
+        stage = &pipeline->stages[i];
+        if(stage->mode != MTHREAD_PIPELINE_PARALLEL && stage->busy)
+            continue;
+
+        if(stage->mode == MTHREAD_PIPELINE_SERIAL_IN_ORDER) {
+            slot = &stage->reorder[stage->next_seq % pipeline->max_tokens];
+            if((token = *slot) == NULL)
+                continue;
+            *slot = NULL;
+        }
+        else {
+            if((token = stage->head) == NULL)
+                continue;
+            if((stage->head = token->next) == NULL)
+                stage->tail = NULL;
+        }
+
+        if(stage->mode != MTHREAD_PIPELINE_PARALLEL)
+            stage->busy = 1;
+        *s = i;
+        return token;
+    }
+
+    stage = &pipeline->stages[0];
+    if(stage->busy || pipeline->eof || (token = pipeline->free) == NULL)
+        return NULL;
+    pipeline->free = token->next;
+    stage->busy = 1;
+    *s = 0;
+    return token;
+}
+
+/**
+ * @brief Pass a token on after a stage ran its item
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[in] s Index of the stage
+ * @param[in,out] token Pointer to token
+ * @param[in] result Item returned by the stage
+ * @note A dropped item still goes through the later stages, which skip it,
+ * so that serial in-order stages do not wait for it. Sequence numbers are
+ * given as the first stage returns items, so running out of items leaves
+ * no gap.
+ * @return Number of workers to wake
+ */
+static int pass_on(mthread_pipeline_t *pipeline, int s,
+                   struct mthread_pipeline_token *token, void *result) {
+    struct mthread_pipeline_stage *stage = &pipeline->stages[s];
+
+    stage->busy = 0;
+    if(stage->mode == MTHREAD_PIPELINE_SERIAL_IN_ORDER)
+        stage->next_seq++;
+
+    if(s == 0) {
+        if(result == NULL) {
+            pipeline->eof = 1;
+            token->next = pipeline->free;
+            pipeline->free = token;
+            return INT_MAX;
+        }
+        token->seq = pipeline->next_input++;
+        token->dropped = 0;
+    }
+    token->item = result;
+    if(result == NULL)
+        token->dropped = 1;
+
+    if(s + 1 < pipeline->nstages) {
+        hand_to(pipeline, s + 1, token);
+        return 2;
+    }
+
+    token->next = pipeline->free;
+    pipeline->free = token;
+    return pipeline->eof ? INT_MAX : 1;
+}
+
+/**
+ * @brief Check whether every item has left the pipeline for good
+ * @param[in] pipeline Pointer to pipeline
+ * @return Non-zero once done
+ */
+static int done(mthread_pipeline_t *pipeline) {
+    struct mthread_pipeline_token *token;
+    int n = 0;
+
+    if(!pipeline->eof || pipeline->stages[0].busy)
+        return 0;
+    for(token = pipeline->free; token != NULL; token = token->next)
+        n++;
+    return n == pipeline->max_tokens;
+}
+
+/**
+ * @brief Body of a worker thread
+ * @param[in] arg Pointer to pipeline
+ * @note A worker takes whatever stage can run, runs it without the lock and
+ * passes the item on. It sleeps on the epoch when no stage can run: serial
+ * stages are busy, their next items are not there yet, or all tokens are
+ * in flight, which is what holds back the first stage.
+ */
+static void *worker_main(void *arg) {
+    mthread_pipeline_t *pipeline = arg;
+    struct mthread_pipeline_stage *stage;
+    struct mthread_pipeline_token *token;
+    void *result;
+    int s, n, epoch;
+
+    mthread_mutex_lock(&pipeline->lock);
+    for(;;) {
+        if((token = take(pipeline, &s)) != NULL) {
+            mthread_mutex_unlock(&pipeline->lock);
+
+            stage = &pipeline->stages[s];
+            if(s == 0)
+                result = stage->func(NULL, stage->arg);
+            else if(token->dropped)
+                result = NULL;
+            else
+                result = stage->func(token->item, stage->arg);
+
+            mthread_mutex_lock(&pipeline->lock);
+            n = pass_on(pipeline, s, token, result);
+            if(atomic_load_explicit(&pipeline->sleepers, memory_order_relaxed) > 0) {
+                atomic_fetch_add(&pipeline->epoch, 1);
+                mthread_wake_by_address(&pipeline->epoch, n);
+            }
+            continue;
+        }
+
+        if(done(pipeline))
+            break;
+
+        epoch = atomic_load(&pipeline->epoch);
+        atomic_fetch_add(&pipeline->sleepers, 1);
+        mthread_mutex_unlock(&pipeline->lock);
+        mthread_wait_on_address(&pipeline->epoch, (uint64_t)epoch, sizeof(int), NULL);
+        mthread_mutex_lock(&pipeline->lock);
+        atomic_fetch_sub(&pipeline->sleepers, 1);
+    }
+    mthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+/**
+ * @brief Initialise the pipeline
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[in] max_tokens Number of items allowed in flight at once
+ * @return On success, returns 0; if max_tokens is not positive, EINVAL; if
+ * memory is short, ENOMEM
+ */
+int mthread_pipeline_init(mthread_pipeline_t *pipeline, int max_tokens) {
+    assert(pipeline);
+
+    if(max_tokens <= 0)
+        return EINVAL;
+
+    pipeline->tokens = malloc(max_tokens * sizeof(struct mthread_pipeline_token));
+    if(pipeline->tokens == NULL)
+        return ENOMEM;
+
+    pipeline->max_tokens = max_tokens;
+    pipeline->stages = NULL;
+    pipeline->nstages = 0;
+    pipeline->epoch = pipeline->sleepers = 0;
+    mthread_mutex_init(&pipeline->lock);
+    return 0;
+}
+
+/**
+ * @brief Destroy the pipeline
+ * @param[in,out] pipeline Pointer to pipeline
+ * @return On success, returns 0
+ */
+int mthread_pipeline_destroy(mthread_pipeline_t *pipeline) {
+    assert(pipeline);
+    int i;
+
+    for(i = 0; i < pipeline->nstages; i++)
+        free(pipeline->stages[i].reorder);
+    free(pipeline->stages);
+    free(pipeline->tokens);
+    pipeline->stages = NULL;
+    pipeline->tokens = NULL;
+    pipeline->nstages = 0;
+    return 0;
+}
+
+/**
+ * @brief Append a stage to the pipeline
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[in] mode MTHREAD_PIPELINE_PARALLEL, MTHREAD_PIPELINE_SERIAL_IN_ORDER
+ * or MTHREAD_PIPELINE_SERIAL_OUT_OF_ORDER
+ * @param[in] func Function run on each item
+ * @param[in] arg Second argument of func
+ * @note The first stage produces the items, so it must be serial; either
+ * serial mode gives the same result there.
+ * @return On success, returns 0; if mode is unknown, func is NULL or the
+ * first stage is parallel, EINVAL; if memory is short, ENOMEM
+ */
+int mthread_pipeline_add_stage(mthread_pipeline_t *pipeline, int mode,
+                               void *(*func)(void *item, void *arg), void *arg) {
+    assert(pipeline);
+    struct mthread_pipeline_stage *stages, *stage;
+
+    if(func == NULL || mode < MTHREAD_PIPELINE_PARALLEL ||
+       mode > MTHREAD_PIPELINE_SERIAL_OUT_OF_ORDER ||
+       (pipeline->nstages == 0 && mode == MTHREAD_PIPELINE_PARALLEL))
+        return EINVAL;
+
+    stages = realloc(pipeline->stages,
+                     (pipeline->nstages + 1) * sizeof(struct mthread_pipeline_stage));
+    if(stages == NULL)
+        return ENOMEM;
+    pipeline->stages = stages;
+
+    stage = &stages[pipeline->nstages];
+    stage->mode = mode;
+    stage->func = func;
+    stage->arg = arg;
+    stage->reorder = NULL;
+    if(mode == MTHREAD_PIPELINE_SERIAL_IN_ORDER && pipeline->nstages > 0) {
+        stage->reorder = calloc(pipeline->max_tokens, sizeof(struct mthread_pipeline_token *));
+        if(stage->reorder == NULL)
+            return ENOMEM;
+    }
+    pipeline->nstages++;
+    return 0;
+}
+
+/**
+ * @brief Run the pipeline until all items are through
+ * @param[in,out] pipeline Pointer to pipeline
+ * @param[in] nworkers Number of worker threads, or 0 for one per online CPU
+ * @note The workers are created for the run and joined before it returns.
+ * If only some could be created, the run completes on those.
+ * @return On success, returns 0; if there are no stages or nworkers is
+ * negative, EINVAL; if memory is short, ENOMEM; if no worker could be
+ * created, the error of mthread_create()
+ */
+int mthread_pipeline_run(mthread_pipeline_t *pipeline, int nworkers) {
+    assert(pipeline);
+    mthread_t *tids;
+    int i, created, ret = 0;
+
+    if(pipeline->nstages == 0 || nworkers < 0)
+        return EINVAL;
+    if(nworkers == 0 && (nworkers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        nworkers = 1;
+    if((tids = malloc(nworkers * sizeof(mthread_t))) == NULL)
+        return ENOMEM;
+
+    pipeline->free = NULL;
+    for(i = pipeline->max_tokens - 1; i >= 0; i--) {
+        pipeline->tokens[i].next = pipeline->free;
+        pipeline->free = &pipeline->tokens[i];
+    }
+    for(i = 0; i < pipeline->nstages; i++) {
+        pipeline->stages[i].busy = 0;
+        pipeline->stages[i].next_seq = 0;
+        pipeline->stages[i].head = pipeline->stages[i].tail = NULL;
+    }
+    pipeline->next_input = 0;
+    pipeline->eof = 0;
+
+    for(created = 0; created < nworkers; created++) {
+        if((ret = mthread_create(&tids[created], NULL, worker_main, pipeline)) != 0)
+            break;
+    }
+    for(i = 0; i < created; i++)
+        mthread_join(tids[i], NULL);
+
+    free(tids);
+    return created > 0 ? 0 : ret;
+}
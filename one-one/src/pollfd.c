@@ -0,0 +1,84 @@
+/**
+ * @file pollfd.c
+ * @brief Eventfd bridge to event loops
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include "pollfd.h"
+
+/**
+ * @brief Get the eventfd, creating it on first use
+ * @param[in,out] p Pointer to eventfd bridge
+ * @note The eventfd is non-blocking, so that draining it never blocks the
+ * event loop. Of two threads creating it at once, one closes its own.
+ * @return File descriptor on success; -1 with errno set on failure
+ */
+int pollfd_get(struct mthread_pollfd *p) {
+    int fd, expected = 0;
+
+    if((fd = atomic_load(&p->fd)) != 0)
+        return fd - 1;
+
+    if((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        return -1;
+    if(!atomic_compare_exchange_strong(&p->fd, &expected, fd + 1)) {
+        close(fd);
+        return expected - 1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Clear a readiness left from before and arm the eventfd
+ * @param[in,out] p Pointer to eventfd bridge
+ * @note The eventfd is drained on every arming. A notification racing with
+ * the previous arming can leave it readable while armed, which would keep
+ * a level-triggered epoll(7) returning at once.
+ */
+void pollfd_arm(struct mthread_pollfd *p) {
+    int fd = atomic_load(&p->fd);
+    uint64_t count;
+
+    if(fd == 0)
+        return;
+
+    if(read(fd - 1, &count, sizeof(count)) == -1) {
+        /* EAGAIN: nothing to drain */
+    }
+    atomic_store(&p->armed, 1);
+}
+
+/**
+ * @brief Make the eventfd readable if a poller armed it
+ * @param[in,out] p Pointer to eventfd bridge
+ * @note Called after the state the poller checks has changed. The poller
+ * stores armed before checking the state, so either it sees the change or
+ * this sees armed. Only the first notification after arming writes.
+ */
+void pollfd_notify(struct mthread_pollfd *p) {
+    uint64_t one = 1;
+
+    if(atomic_load(&p->armed) && atomic_exchange(&p->armed, 0)) {
+        if(write(atomic_load(&p->fd) - 1, &one, sizeof(one)) == -1) {
+            /* The counter can not overflow with one write per arming */
+        }
+    }
+}
+
+/**
+ * @brief Close the eventfd, if it was created
+ * @param[in,out] p Pointer to eventfd bridge
+ */
+void pollfd_close(struct mthread_pollfd *p) {
+    int fd = atomic_exchange(&p->fd, 0);
+
+    if(fd != 0)
+        close(fd - 1);
+    atomic_store(&p->armed, 0);
+}
@@ -0,0 +1,634 @@
+/**
+ * @file pool.c
+ * @brief Work-stealing Thread Pool
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+
+/// Slots in the deque of a worker when the pool starts
+#define POOL_DEQUE_SIZE     256
+
+/// Tasks a worker moves from the injection queue to its deque at once
+#define POOL_INJECT_BATCH   16
+
+/// Rounds a waiting worker looks for tasks to run before sleeping
+#define POOL_WAIT_SPIN      64
+
+/// Bits of the state of a task group: a thread may sleep on it, the last
+/// task is waking them, and one unfinished task
+#define GROUP_WAITERS       1u
+#define GROUP_WAKING        2u
+#define GROUP_TASK          4u
+
+/// Task to run
+struct mthread_pool_task {
+    /// Function to call
+    void (*func)(void *);
+
+    /// Argument to call it with
+    void *arg;
+
+    /// Group counting the task, or NULL
+    mthread_task_group_t *group;
+
+    /// Next task in the injection queue
+    struct mthread_pool_task *next;
+};
+
+/// Circular array backing a deque
+struct mthread_pool_array {
+    /// Number of slots less one, a power of two less one
+    long mask;
+
+    /// Next retired array
+    struct mthread_pool_array *next;
+
+    /// Slots
+    struct mthread_pool_task *tasks[];
+};
+
+/**
+ * @brief Allocate an array for a deque
+ * @param[in] size Number of slots, a power of two
+ * @return Pointer to array, or NULL if memory is short
+ */
+static struct mthread_pool_array *array_new(long size) {
+    struct mthread_pool_array *a;
+
+    a = malloc(sizeof(struct mthread_pool_array) + size * sizeof(a->tasks[0]));
+    if(a == NULL)
+        return NULL;
+    a->mask = size - 1;
+    a->next = NULL;
+    return a;
+}
+
+/**
+ * @brief Push a task at the bottom of the deque of a worker
+ * @param[in,out] w Pointer to worker, which must be the calling thread
+ * @param[in] task Pointer to task
+ * @note When full, the deque moves to an array twice the size. The old
+ * one is kept until the pool is destroyed, as a thief may be reading it.
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+static int deque_push(struct mthread_pool_worker *w, struct mthread_pool_task *task) {
+    struct mthread_pool_array *a, *bigger;
+    long b, t, i;
+
+    b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+    t = atomic_load_explicit(&w->top, memory_order_acquire);
+    a = atomic_load_explicit(&w->array, memory_order_relaxed);
+
+    if(b - t > a->mask) {
+        if((bigger = array_new(2 * (a->mask + 1))) == NULL)
+            return ENOMEM;
+        for(i = t; i < b; i++)
+            bigger->tasks[i & bigger->mask] = a->tasks[i & a->mask];
+        a->next = w->retired;
+        w->retired = a;
+        atomic_store_explicit(&w->array, bigger, memory_order_release);
+        a = bigger;
+    }
+
+    atomic_store_explicit(&a->tasks[b & a->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Take the newest task from the bottom of the deque of a worker
+ * @param[in,out] w Pointer to worker, which must be the calling thread
+ * @note The worker claims the slot by moving bottom before reading top.
+ * Only when a single task is left can a thief want it too, and then the
+ * two race on top.
+ * @return Pointer to task, or NULL if the deque is empty
+ */
+static struct mthread_pool_task *deque_take(struct mthread_pool_worker *w) {
+    struct mthread_pool_array *a;
+    struct mthread_pool_task *task = NULL;
+    long b, t;
+
+    b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1;
+    a = atomic_load_explicit(&w->array, memory_order_relaxed);
+    atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+    if(t <= b) {
+        task = atomic_load_explicit(&a->tasks[b & a->mask], memory_order_relaxed);
+        if(t == b) {
+            if(!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                task = NULL;
+            atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/**
+ * @brief Steal the oldest task from the top of the deque of a worker
+ * @param[in,out] w Pointer to victim worker
+ * @param[out] task Pointer to task stolen, or NULL if the deque is empty
+ * @return On success or empty deque, returns 0; if another thread won the
+ * task, EAGAIN
+ */
+static int deque_steal(struct mthread_pool_worker *w, struct mthread_pool_task **task) {
+    struct mthread_pool_array *a;
+    long b, t;
+
+    *task = NULL;
+    t = atomic_load_explicit(&w->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+
+    if(t < b) {
+        a = atomic_load_explicit(&w->array, memory_order_acquire);
+        *task = atomic_load_explicit(&a->tasks[t & a->mask], memory_order_relaxed);
+        if(!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            *task = NULL;
+            return EAGAIN;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Get the worker of a pool the calling thread runs
+ * @param[in] pool Pointer to pool
+ * @return Pointer to worker, or NULL if the thread is not one of the pool
+ */
+static inline struct mthread_pool_worker *current_worker(mthread_pool_t *pool) {
+    struct mthread_pool_worker *w = mthread_self()->pool_worker;
+
+    return (w != NULL && w->pool == pool) ? w : NULL;
+}
+
+/**
+ * @brief Take a task from the injection queue
+ * @param[in,out] w Pointer to worker taking it
+ * @note Up to POOL_INJECT_BATCH more tasks move to the deque of the
+ * worker, where idle workers can steal them, so that a batch submitted from
+ * outside spreads without every worker taking the lock. They are pushed
+ * last first, so that the worker, which takes its deque newest first, still
+ * runs them in the order they were submitted.
+ * @return Pointer to task, or NULL if the queue is empty
+ */
+static struct mthread_pool_task *inject_take(struct mthread_pool_worker *w) {
+    mthread_pool_t *pool = w->pool;
+    struct mthread_pool_task *task, *extra[POOL_INJECT_BATCH];
+    int i, n = 0, moved = 0;
+
+    if(atomic_load_explicit(&pool->injected, memory_order_relaxed) == 0)
+        return NULL;
+
+    mthread_mutex_lock(&pool->inject_lock);
+    if((task = pool->inject_head) != NULL) {
+        /* Once pushed, a task may be stolen and freed at once */
+        pool->inject_head = task->next;
+        while(n < POOL_INJECT_BATCH && pool->inject_head != NULL) {
+            extra[n++] = pool->inject_head;
+            pool->inject_head = pool->inject_head->next;
+        }
+        for(i = n - 1; i >= 0; i--) {
+            if(deque_push(w, extra[i]) != 0) {
+                /* The rest stay queued, still linked in order */
+                extra[i]->next = pool->inject_head;
+                pool->inject_head = extra[0];
+                break;
+            }
+        }
+        moved = n - i;
+        if(pool->inject_head == NULL)
+            pool->inject_tail = NULL;
+        atomic_fetch_sub(&pool->injected, moved);
+    }
+    mthread_mutex_unlock(&pool->inject_lock);
+    return task;
+}
+
+/**
+ * @brief Find a task for a worker to run
+ * @param[in,out] w Pointer to worker
+ * @note The worker looks in its own deque, then in the injection queue,
+ * then in the deques of the others, starting from a random one so that
+ * thieves do not all pile on the same victim.
+ * @return Pointer to task, or NULL if none was found
+ */
+static struct mthread_pool_task *find_task(struct mthread_pool_worker *w) {
+    mthread_pool_t *pool = w->pool;
+    struct mthread_pool_task *task;
+    int i, start, victim, busy;
+
+    if((task = deque_take(w)) != NULL || (task = inject_take(w)) != NULL)
+        return task;
+    if(pool->nworkers == 1)
+        return NULL;
+
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    start = w->seed % pool->nworkers;
+
+    do {
+        busy = 0;
+        for(i = 0; i < pool->nworkers; i++) {
+            victim = (start + i) % pool->nworkers;
+            if(&pool->workers[victim] == w)
+                continue;
+            if(deque_steal(&pool->workers[victim], &task) == EAGAIN)
+                busy = 1;
+            else if(task != NULL)
+                return task;
+        }
+    } while(busy);
+    return NULL;
+}
+
+/**
+ * @brief Run a task and count it off its group
+ * @param[in,out] pool Pointer to pool
+ * @param[in] task Pointer to task, freed after
+ * @note When the last task of a group someone sleeps on finishes, it marks
+ * the group as being woken in place of its count, wakes the waiters and
+ * clears the mark last: the waiters do not return before, as the group may
+ * live on the stack of one of them. The epoch is bumped too, as a worker
+ * waiting for the group parks there to be woken by new tasks as well.
+ */
+static void run_task(mthread_pool_t *pool, struct mthread_pool_task *task) {
+    mthread_task_group_t *group = task->group;
+    unsigned int state, next;
+
+    task->func(task->arg);
+    free(task);
+
+    if(group == NULL)
+        return;
+
+    state = atomic_load(&group->state);
+    do {
+        next = state == (GROUP_TASK | GROUP_WAITERS) ? GROUP_WAKING
+                                                     : state - GROUP_TASK;
+    } while(!atomic_compare_exchange_weak(&group->state, &state, next));
+
+    if(next == GROUP_WAKING) {
+        mthread_wake_by_address(&group->state, INT_MAX);
+        atomic_fetch_sub(&group->state, GROUP_WAKING);
+        atomic_fetch_add(&pool->epoch, 1);
+        mthread_wake_by_address(&pool->epoch, INT_MAX);
+    }
+}
+
+/**
+ * @brief Wake parked workers after tasks were queued
+ * @param[in,out] pool Pointer to pool
+ * @param[in] n Number of tasks queued
+ * @note The fence pairs with the one a worker issues after counting itself
+ * in sleepers: either the submitter sees the sleeper, or the worker sees
+ * the task when it looks again before parking. The epoch is only bumped
+ * when someone sleeps, so busy pools do not bounce it between caches.
+ */
+static void notify(mthread_pool_t *pool, int n) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&pool->epoch, 1);
+        mthread_wake_by_address(&pool->epoch, n);
+    }
+}
+
+/**
+ * @brief Body of a worker thread
+ * @param[in] arg Pointer to worker
+ * @note An idle worker parks on the epoch of the pool. It reads the epoch
+ * before looking for work a last time, so a submission in between changes
+ * the epoch and the wait returns at once.
+ */
+static void *worker_main(void *arg) {
+    struct mthread_pool_worker *w = arg;
+    mthread_pool_t *pool = w->pool;
+    struct mthread_pool_task *task;
+    int epoch;
+
+    mthread_self()->pool_worker = w;
+
+    for(;;) {
+        if((task = find_task(w)) != NULL) {
+            run_task(pool, task);
+            continue;
+        }
+
+        atomic_fetch_add(&pool->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        epoch = atomic_load(&pool->epoch);
+
+        if((task = find_task(w)) != NULL) {
+            atomic_fetch_sub(&pool->sleepers, 1);
+            run_task(pool, task);
+            continue;
+        }
+        if(atomic_load(&pool->shutdown)) {
+            atomic_fetch_sub(&pool->sleepers, 1);
+            break;
+        }
+
+        mthread_wait_on_address(&pool->epoch, (uint64_t)epoch, sizeof(int), NULL);
+        atomic_fetch_sub(&pool->sleepers, 1);
+    }
+
+    mthread_self()->pool_worker = NULL;
+    return NULL;
+}
+
+/**
+ * @brief Free the deques of the workers
+ * @param[in,out] pool Pointer to pool
+ * @param[in] n Number of workers whose deques were allocated
+ */
+static void free_workers(mthread_pool_t *pool, int n) {
+    struct mthread_pool_array *a, *next;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        free(pool->workers[i].array);
+        for(a = pool->workers[i].retired; a != NULL; a = next) {
+            next = a->next;
+            free(a);
+        }
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+/**
+ * @brief Initialise the thread pool and start its workers
+ * @param[in,out] pool Pointer to pool
+ * @param[in] nworkers Number of workers, or 0 for one per online CPU
+ * @return On success, returns 0; if nworkers is negative, EINVAL; if memory
+ * is short, ENOMEM; if a worker could not be created, the error of
+ * mthread_create()
+ */
+int mthread_pool_init(mthread_pool_t *pool, int nworkers) {
+    assert(pool);
+    int i, j, ret;
+
+    if(nworkers < 0)
+        return EINVAL;
+    if(nworkers == 0 && (nworkers = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        nworkers = 1;
+
+    pool->workers = aligned_alloc(MTHREAD_CACHE_LINE,
+                                  nworkers * sizeof(struct mthread_pool_worker));
+    if(pool->workers == NULL)
+        return ENOMEM;
+
+    pool->nworkers = nworkers;
+    pool->inject_head = pool->inject_tail = NULL;
+    pool->injected = 0;
+    pool->sleepers = 0;
+    pool->epoch = 0;
+    pool->shutdown = 0;
+    mthread_mutex_init(&pool->inject_lock);
+
+    for(i = 0; i < nworkers; i++) {
+        pool->workers[i].top = pool->workers[i].bottom = 0;
+        pool->workers[i].retired = NULL;
+        pool->workers[i].pool = pool;
+        pool->workers[i].seed = 2463534242u + i * 7919u;
+        if((pool->workers[i].array = array_new(POOL_DEQUE_SIZE)) == NULL) {
+            free_workers(pool, i);
+            return ENOMEM;
+        }
+    }
+
+    for(i = 0; i < nworkers; i++) {
+        ret = mthread_create(&pool->workers[i].tid, NULL, worker_main, &pool->workers[i]);
+        if(ret != 0) {
+            atomic_store(&pool->shutdown, 1);
+            atomic_fetch_add(&pool->epoch, 1);
+            mthread_wake_by_address(&pool->epoch, INT_MAX);
+            for(j = 0; j < i; j++)
+                mthread_join(pool->workers[j].tid, NULL);
+            free_workers(pool, nworkers);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Destroy the thread pool
+ * @param[in,out] pool Pointer to pool
+ * @note Tasks already submitted, and those they submit, run before the
+ * workers exit.
+ * @return On success, returns 0; if called from a worker of the pool,
+ * EDEADLK
+ */
+int mthread_pool_destroy(mthread_pool_t *pool) {
+    assert(pool);
+    int i;
+
+    if(current_worker(pool) != NULL)
+        return EDEADLK;
+
+    atomic_store(&pool->shutdown, 1);
+    atomic_fetch_add(&pool->epoch, 1);
+    mthread_wake_by_address(&pool->epoch, INT_MAX);
+
+    for(i = 0; i < pool->nworkers; i++)
+        mthread_join(pool->workers[i].tid, NULL);
+    free_workers(pool, pool->nworkers);
+    return 0;
+}
+
+/**
+ * @brief Allocate a task
+ * @return Pointer to task, or NULL if memory is short
+ */
+static struct mthread_pool_task *task_new(mthread_task_group_t *group,
+                                          void (*func)(void *), void *arg) {
+    struct mthread_pool_task *task = malloc(sizeof(struct mthread_pool_task));
+
+    if(task != NULL) {
+        task->func = func;
+        task->arg = arg;
+        task->group = group;
+        task->next = NULL;
+    }
+    return task;
+}
+
+/**
+ * @brief Queue a chain of tasks
+ * @param[in,out] pool Pointer to pool
+ * @param[in] head First task of the chain, linked through next
+ * @param[in] n Number of tasks in the chain
+ * @note A worker pushes on its own deque, where it finds them first and
+ * idle workers steal them; other threads append to the injection queue.
+ */
+static void enqueue(mthread_pool_t *pool, struct mthread_pool_task *head, int n) {
+    struct mthread_pool_worker *w = current_worker(pool);
+    struct mthread_pool_task *task, *tail = head;
+
+    if(w != NULL) {
+        for(task = head; task != NULL; task = tail) {
+            tail = task->next;
+            if(deque_push(w, task) != 0)
+                break;
+        }
+        if(task == NULL)
+            goto wake;
+        /* Out of memory to grow the deque: inject the rest */
+        head = task;
+    }
+
+    for(tail = head, n = 1; tail->next != NULL; tail = tail->next)
+        n++;
+
+    mthread_mutex_lock(&pool->inject_lock);
+    if(pool->inject_tail != NULL)
+        pool->inject_tail->next = head;
+    else
+        pool->inject_head = head;
+    pool->inject_tail = tail;
+    atomic_fetch_add(&pool->injected, n);
+    mthread_mutex_unlock(&pool->inject_lock);
+
+wake:
+    notify(pool, n);
+}
+
+/**
+ * @brief Submit a task to the thread pool
+ * @param[in,out] pool Pointer to pool
+ * @param[in,out] group Pointer to group counting the task, or NULL
+ * @param[in] func Function to call
+ * @param[in] arg Argument to call it with
+ * @note Tasks may submit tasks and wait for them; see mthread_pool_wait().
+ * @return On success, returns 0; if func is NULL or the pool is shutting
+ * down, EINVAL; if memory is short, ENOMEM
+ */
+int mthread_pool_submit(mthread_pool_t *pool, mthread_task_group_t *group,
+                        void (*func)(void *), void *arg) {
+    assert(pool);
+    return mthread_pool_submit_batch(pool, group, func, &arg, 1);
+}
+
+/**
+ * @brief Submit a batch of tasks to the thread pool
+ * @param[in,out] pool Pointer to pool
+ * @param[in,out] group Pointer to group counting the tasks, or NULL
+ * @param[in] func Function to call
+ * @param[in] args Arguments to call it with, one task each
+ * @param[in] n Number of tasks
+ * @note The injection queue is locked and sleeping workers are woken once
+ * for the whole batch.
+ * @return On success, returns 0; if func is NULL, n is negative or the
+ * pool is shutting down, EINVAL; if memory is short, ENOMEM and no task is
+ * submitted
+ */
+int mthread_pool_submit_batch(mthread_pool_t *pool, mthread_task_group_t *group,
+                              void (*func)(void *), void **args, int n) {
+    assert(pool && (args || n == 0));
+    struct mthread_pool_task *head = NULL, *task;
+    int i;
+
+    if(func == NULL || n < 0 ||
+       (atomic_load(&pool->shutdown) && current_worker(pool) == NULL))
+        return EINVAL;
+    if(n == 0)
+        return 0;
+
+    for(i = n - 1; i >= 0; i--) {
+        if((task = task_new(group, func, args[i])) == NULL) {
+            while((task = head) != NULL) {
+                head = task->next;
+                free(task);
+            }
+            return ENOMEM;
+        }
+        task->next = head;
+        head = task;
+    }
+
+    if(group != NULL)
+        atomic_fetch_add(&group->state, GROUP_TASK * n);
+    enqueue(pool, head, n);
+    return 0;
+}
+
+/**
+ * @brief Wait until every task of a group has finished
+ * @param[in,out] pool Pointer to pool
+ * @param[in,out] group Pointer to group
+ * @note A worker of the pool runs other tasks while it waits, so a task can
+ * wait for tasks it submitted without holding up a worker. Once out of tasks
+ * to run it parks like an idle worker, to be woken by new tasks or by the
+ * group finishing; other threads sleep on the group. Neither returns while
+ * the last task is still waking the waiters.
+ * @return On success, returns 0
+ */
+int mthread_pool_wait(mthread_pool_t *pool, mthread_task_group_t *group) {
+    assert(pool && group);
+    struct mthread_pool_worker *w = current_worker(pool);
+    struct mthread_pool_task *task;
+    unsigned int state, idle = 0, expected = GROUP_WAITERS;
+    int epoch = 0;
+
+    while((state = atomic_load(&group->state)) & ~GROUP_WAITERS) {
+        if(state & GROUP_WAKING) {
+            mthread_yield();
+            continue;
+        }
+        if(w != NULL) {
+            if((task = find_task(w)) != NULL) {
+                run_task(pool, task);
+                idle = 0;
+            }
+            else if(++idle < POOL_WAIT_SPIN) {
+                mthread_yield();
+            }
+            else {
+                atomic_fetch_add(&pool->sleepers, 1);
+                atomic_thread_fence(memory_order_seq_cst);
+                epoch = atomic_load(&pool->epoch);
+                atomic_fetch_or(&group->state, GROUP_WAITERS);
+                task = NULL;
+                if((atomic_load(&group->state) & ~GROUP_WAITERS) &&
+                   (task = find_task(w)) == NULL)
+                    mthread_wait_on_address(&pool->epoch, (uint64_t)epoch,
+                                            sizeof(int), NULL);
+                atomic_fetch_sub(&pool->sleepers, 1);
+                if(task != NULL)
+                    run_task(pool, task);
+                idle = 0;
+            }
+            continue;
+        }
+
+        if(!(state & GROUP_WAITERS) &&
+           !atomic_compare_exchange_strong(&group->state, &state,
+                                           state | GROUP_WAITERS))
+            continue;
+        mthread_wait_on_address(&group->state, state | GROUP_WAITERS,
+                                sizeof(int), NULL);
+    }
+
+    /* Clear the flag, unless tasks were added meanwhile */
+    atomic_compare_exchange_strong(&group->state, &expected, 0);
+    return 0;
+}
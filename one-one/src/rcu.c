@@ -0,0 +1,345 @@
+/**
+ * @file rcu.c
+ * @brief Read-Copy-Update
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#include "mthread.h"
+#include "tcb.h"
+#include "utils.h"
+
+/// Times a grace period checks a reader before sleeping on it
+#define RCU_SPIN    100
+
+static unsigned long gp_ctr = 1;    ///< Current grace period
+static int gp_futex;                ///< -1 while a grace period sleeps on a reader
+static mthread_mutex_t gp_lock = MTHREAD_MUTEX_INITIALIZER; ///< Serialises grace periods
+static int flavor = MTHREAD_RCU_EPOCH;  ///< Flavor chosen by mthread_rcu_init()
+static int has_membarrier;          ///< Whether readers may skip memory fences
+
+static mthread_rcu_head_t *callbacks;   ///< Callbacks queued, newest first
+static mthread_event_t work = MTHREAD_EVENT_INITIALIZER; ///< Set when callbacks are queued
+static int reclaimer_started;       ///< Whether the reclamation thread runs
+
+/**
+ * @brief Order the memory accesses of a reader
+ * @note With membarrier(2) the grace period forces a barrier on every CPU
+ * running a thread of the process, so readers need only stop the compiler
+ * from reordering.
+ */
+static inline void reader_fence(void) {
+    if(has_membarrier)
+        atomic_signal_fence(memory_order_seq_cst);
+    else
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Order the memory accesses of a grace period against all readers
+ */
+static inline void updater_fence(void) {
+    if(has_membarrier)
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    else
+        atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Wake a grace period sleeping on readers
+ * @note Called by a reader once it stops holding references. The system call
+ * is skipped unless a grace period is asleep.
+ */
+static inline void wake_gp(void) {
+    if(atomic_load_explicit(&gp_futex, memory_order_relaxed) == -1) {
+        atomic_store(&gp_futex, 0);
+        mthread_wake_by_address(&gp_futex, 1);
+    }
+}
+
+/**
+ * @brief Whether a thread may still hold a reference from before grace
+ * period gp started
+ */
+static inline int active(mthread *t, unsigned long gp) {
+    unsigned long ctr = atomic_load_explicit(&t->rcu_ctr, memory_order_relaxed);
+    return ctr != 0 && ctr < gp;
+}
+
+/**
+ * @brief Wait for a thread to leave the critical section it may be in
+ * @param[in] t Pointer to TCB
+ * @param[in] gp Grace period being waited for
+ */
+static void wait_for(mthread *t, unsigned long gp) {
+    int i;
+
+    for(i = 0; active(t, gp); i++) {
+        if(i < RCU_SPIN) {
+            __builtin_ia32_pause();
+            continue;
+        }
+        atomic_store(&gp_futex, -1);
+        updater_fence();
+        if(active(t, gp))
+            mthread_wait_on_address(&gp_futex, (uint32_t)-1, sizeof(int), NULL);
+        atomic_store(&gp_futex, 0);
+    }
+}
+
+/**
+ * @brief Run queued callbacks after grace periods
+ * @note Callbacks queued while a grace period runs are taken together by the
+ * next one, so a single grace period serves a whole batch.
+ */
+static void *reclaim(void *arg) {
+    mthread_rcu_head_t *batch, *fifo, *next;
+
+    for(;;) {
+        mthread_event_wait(&work);
+        batch = atomic_exchange(&callbacks, NULL);
+        if(batch == NULL)
+            continue;
+
+        for(fifo = NULL; batch; batch = next) {
+            next = batch->next;
+            batch->next = fifo;
+            fifo = batch;
+        }
+
+        while(mthread_synchronize_rcu() == ENOMEM)
+            usleep(1000);
+        for(; fifo; fifo = next) {
+            next = fifo->next;
+            fifo->func(fifo);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Select the RCU flavor
+ * @param[in] rcu_flavor MTHREAD_RCU_EPOCH or MTHREAD_RCU_QSBR
+ * @note In the epoch flavor readers mark their critical sections. In the QSBR
+ * flavor mthread_rcu_read_lock() and mthread_rcu_read_unlock() do nothing,
+ * and online threads instead call mthread_rcu_quiescent_state() now and then.
+ * The expedited membarrier(2) command is registered if the kernel has it.
+ * @return On success, returns 0; if the flavor is unknown, EINVAL
+ */
+int mthread_rcu_init(int rcu_flavor) {
+    if(rcu_flavor != MTHREAD_RCU_EPOCH && rcu_flavor != MTHREAD_RCU_QSBR)
+        return EINVAL;
+
+    has_membarrier = membarrier_register();
+    flavor = rcu_flavor;
+    return 0;
+}
+
+/**
+ * @brief Enter a read-side critical section
+ * @note Critical sections nest. Only the outermost one publishes the current
+ * grace period in the TCB, with a plain store.
+ * @return On success, returns 0
+ */
+int mthread_rcu_read_lock(void) {
+    mthread *self;
+
+    if(flavor == MTHREAD_RCU_QSBR)
+        return 0;
+
+    self = mthread_self();
+    if(self->rcu_nesting++ == 0) {
+        atomic_store_explicit(&self->rcu_ctr,
+                              atomic_load_explicit(&gp_ctr, memory_order_relaxed),
+                              memory_order_relaxed);
+        reader_fence();
+    }
+    return 0;
+}
+
+/**
+ * @brief Leave a read-side critical section
+ * @return On success, returns 0
+ */
+int mthread_rcu_read_unlock(void) {
+    mthread *self;
+
+    if(flavor == MTHREAD_RCU_QSBR)
+        return 0;
+
+    self = mthread_self();
+    if(--self->rcu_nesting == 0) {
+        atomic_store_explicit(&self->rcu_ctr, 0, memory_order_release);
+        reader_fence();
+        wake_gp();
+    }
+    return 0;
+}
+
+/**
+ * @brief Announce a quiescent state in the QSBR flavor
+ * @note The store is skipped if no grace period started since the last one.
+ * @return On success, returns 0
+ */
+int mthread_rcu_quiescent_state(void) {
+    mthread *self = mthread_self();
+    unsigned long gp = atomic_load_explicit(&gp_ctr, memory_order_relaxed);
+
+    if(self->rcu_ctr == 0 || self->rcu_ctr == gp)
+        return 0;
+
+    reader_fence();
+    atomic_store_explicit(&self->rcu_ctr, gp, memory_order_release);
+    reader_fence();
+    wake_gp();
+    return 0;
+}
+
+/**
+ * @brief Start taking part in grace periods in the QSBR flavor
+ * @return On success, returns 0
+ */
+int mthread_rcu_thread_online(void) {
+    mthread *self = mthread_self();
+
+    atomic_store_explicit(&self->rcu_ctr,
+                          atomic_load_explicit(&gp_ctr, memory_order_relaxed),
+                          memory_order_relaxed);
+    reader_fence();
+    return 0;
+}
+
+/**
+ * @brief Stop taking part in grace periods
+ * @note Called for every thread as it exits. A thread that is about to block
+ * for a long time should call it too.
+ * @return On success, returns 0
+ */
+int mthread_rcu_thread_offline(void) {
+    mthread *self = mthread_self();
+
+    if(self == NULL || self->rcu_ctr == 0)
+        return 0;
+
+    reader_fence();
+    self->rcu_nesting = 0;
+    atomic_store_explicit(&self->rcu_ctr, 0, memory_order_release);
+    reader_fence();
+    wake_gp();
+    return 0;
+}
+
+/**
+ * @brief Wait for a grace period
+ * @note The grace period counter is advanced, and every thread in the thread
+ * registry that last reported an older grace period is waited for. A
+ * reader is spun on briefly, then slept on until it reports. In the QSBR
+ * flavor the call is a quiescent state of the caller.
+ * @return On success, returns 0; if called inside a read-side critical
+ * section, EDEADLK; if memory is short, ENOMEM
+ */
+int mthread_synchronize_rcu(void) {
+    mthread *self = mthread_self();
+    mthread **threads;
+    unsigned long gp;
+    int i, n;
+
+    if(self->rcu_nesting > 0)
+        return EDEADLK;
+
+    threads = mthread_registry(&n);
+    if(threads == NULL)
+        return ENOMEM;
+
+    mthread_mutex_lock(&gp_lock);
+    updater_fence();
+    gp = atomic_fetch_add(&gp_ctr, 1) + 1;
+    updater_fence();
+    for(i = 0; i < n; i++)
+        if(threads[i] != self)
+            wait_for(threads[i], gp);
+    updater_fence();
+    mthread_mutex_unlock(&gp_lock);
+
+    if(self->rcu_ctr != 0)
+        atomic_store_explicit(&self->rcu_ctr, gp, memory_order_release);
+
+    free(threads);
+    return 0;
+}
+
+/**
+ * @brief Queue a callback to run after a grace period
+ * @param[in,out] head Callback, usually embedded in the object to reclaim
+ * @param[in] func Function called with head by the reclamation thread
+ * @note The reclamation thread is created by the first call.
+ * @return On success, returns 0; if the reclamation thread can not be
+ * created, an error number
+ */
+int mthread_call_rcu(mthread_rcu_head_t *head, void (*func)(mthread_rcu_head_t *)) {
+    assert(head && func);
+    mthread_t tid;
+    int err, expected = 0;
+
+    if(!atomic_load(&reclaimer_started) &&
+       atomic_compare_exchange_strong(&reclaimer_started, &expected, 1)) {
+        if((err = mthread_create(&tid, NULL, reclaim, NULL)) != 0) {
+            atomic_store(&reclaimer_started, 0);
+            return err;
+        }
+        mthread_detach(tid);
+    }
+
+    head->func = func;
+    head->next = atomic_load_explicit(&callbacks, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak(&callbacks, &head->next, head));
+
+    mthread_event_set(&work);
+    return 0;
+}
+
+/// Callback queued by mthread_rcu_barrier()
+struct rcu_barrier {
+    /// Callback, first so that it converts to the barrier
+    mthread_rcu_head_t head;
+
+    /// Set once the callback ran
+    int passed;
+};
+
+/**
+ * @brief Mark an RCU barrier as passed
+ */
+static void barrier_passed(mthread_rcu_head_t *head) {
+    struct rcu_barrier *barrier = (struct rcu_barrier *)head;
+
+    atomic_store(&barrier->passed, 1);
+    mthread_wake_by_address(&barrier->passed, INT_MAX);
+}
+
+/**
+ * @brief Wait for queued callbacks
+ * @note A callback of its own is queued behind the others, and callbacks run
+ * in the order they were queued.
+ * @return On success, returns 0; on error, it returns an error number
+ */
+int mthread_rcu_barrier(void) {
+    struct rcu_barrier barrier = { .passed = 0 };
+    int err;
+
+    if((err = mthread_call_rcu(&barrier.head, barrier_passed)) != 0)
+        return err;
+
+    while(atomic_load(&barrier.passed) == 0)
+        mthread_wait_on_address(&barrier.passed, 0, sizeof(int), NULL);
+    return 0;
+}
@@ -0,0 +1,332 @@
+/**
+ * @file rwlock.c
+ * @brief Reader-Writer Lock Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+#include "tcb.h"
+
+/// Value of the lock word while a writer holds (or is draining) the lock
+#define WRITER      (1 << 30)
+
+/**
+ * @brief Pick the reader slot of the calling thread
+ * @param[in] rwlock Pointer to reader-writer lock
+ * @note The TCB address is hashed, so a thread keeps using the same slot and
+ * threads spread over all of them.
+ * @return Index of the slot
+ */
+static inline int slot_index(mthread_rwlock_t *rwlock) {
+    uint64_t key = (uintptr_t)mthread_self() >> 4;
+    return (key * 0x9E3779B97F4A7C15ull) >> 32 & (rwlock->nslots - 1);
+}
+
+/**
+ * @brief Count readers present in the slots of a scalable lock
+ * @param[in] rwlock Pointer to reader-writer lock
+ * @note Only meaningful while WRITER is set, as no new reader stays in
+ * then and the sum can only overestimate the readers left.
+ * @return Number of readers
+ */
+static int slots_readers(mthread_rwlock_t *rwlock) {
+    int i, sum = 0;
+    for(i = 0; i < rwlock->nslots; i++)
+        sum += atomic_load(&rwlock->slots[i].count);
+    return sum;
+}
+
+/**
+ * @brief Check whether a new reader has to wait
+ * @param[in] rwlock Pointer to reader-writer lock
+ * @return 1 if a writer holds the lock, or is waiting and preferred; else 0
+ */
+static inline int reader_blocked(mthread_rwlock_t *rwlock) {
+    if(atomic_load(&rwlock->value) & WRITER)
+        return 1;
+
+    return (rwlock->flags & MTHREAD_RWLOCK_PREFER_WRITER) &&
+           atomic_load(&rwlock->writers_waiting) > 0;
+}
+
+/**
+ * @brief Sleep until a writer releases the lock
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note The waiter registers itself before sampling the sequence and checking
+ * the lock, so a writer that releases afterwards is bound to wake it up.
+ */
+static void reader_sleep(mthread_rwlock_t *rwlock) {
+    atomic_fetch_add(&rwlock->readers_waiting, 1);
+    int seq = atomic_load(&rwlock->read_seq);
+    if(reader_blocked(rwlock))
+        mthread_wait_on_address(&rwlock->read_seq, seq, sizeof(int), NULL);
+    atomic_fetch_sub(&rwlock->readers_waiting, 1);
+}
+
+/**
+ * @brief Wake up all sleeping readers
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ */
+static inline void wake_readers(mthread_rwlock_t *rwlock) {
+    if(atomic_load(&rwlock->readers_waiting) > 0) {
+        atomic_fetch_add(&rwlock->read_seq, 1);
+        mthread_wake_by_address(&rwlock->read_seq, INT_MAX);
+    }
+}
+
+/**
+ * @brief Wake up one sleeping writer
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ */
+static inline void wake_writer(mthread_rwlock_t *rwlock) {
+    if(atomic_load(&rwlock->writers_waiting) > 0) {
+        atomic_fetch_add(&rwlock->write_seq, 1);
+        mthread_wake_by_address(&rwlock->write_seq, 1);
+    }
+}
+
+/**
+ * @brief Wake up the writer waiting for reader slots to drain
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note The reader left its slot with a sequentially consistent update
+ * before reading the flag, and the writer sets the flag before it sums the
+ * slots, so either the writer sees the slot drained or the reader sees the
+ * flag.
+ */
+static inline void wake_drainer(mthread_rwlock_t *rwlock) {
+    if(atomic_load(&rwlock->draining)) {
+        atomic_fetch_add(&rwlock->drain, 1);
+        mthread_wake_by_address(&rwlock->drain, 1);
+    }
+}
+
+/**
+ * @brief Enter a scalable lock as a reader, without waiting
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note The reader marks its own slot first and only then looks for a
+ * writer. A writer sets WRITER first and only then sums the slots, so at
+ * least one of them sees the other.
+ * @return On success, returns 0; if a writer is present, EBUSY
+ */
+static int scalable_tryrdlock(mthread_rwlock_t *rwlock) {
+    int i = slot_index(rwlock);
+
+    atomic_fetch_add(&rwlock->slots[i].count, 1);
+    if(!(atomic_load(&rwlock->value) & WRITER))
+        return 0;
+
+    atomic_fetch_sub(&rwlock->slots[i].count, 1);
+    wake_drainer(rwlock);
+    return EBUSY;
+}
+
+/**
+ * @brief Enter a reader-counting lock as a reader, without waiting
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @return On success, returns 0; if a writer holds or is preferred, EBUSY
+ */
+static int counting_tryrdlock(mthread_rwlock_t *rwlock) {
+    int value = atomic_load(&rwlock->value);
+
+    while(!reader_blocked(rwlock)) {
+        if(atomic_compare_exchange_weak(&rwlock->value, &value, value + 1))
+            return 0;
+    }
+
+    return EBUSY;
+}
+
+/**
+ * @brief Initialise the reader-writer lock
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @param[in] flags MTHREAD_RWLOCK_PREFER_READER or MTHREAD_RWLOCK_PREFER_WRITER,
+ * optionally or'ed with MTHREAD_RWLOCK_SCALABLE
+ * @note In scalable mode readers only touch a slot picked per thread, each on
+ * its own cache line, so they do not contend on a shared counter. Writers then
+ * always take precedence over new readers and have to wait for all the slots
+ * to drain. The lock must be released with mthread_rwlock_destroy().
+ * @return On success, returns 0; on error, it returns an error number
+ */
+int mthread_rwlock_init(mthread_rwlock_t *rwlock, int flags) {
+    assert(rwlock);
+    long ncpu;
+    int n = 1;
+
+    memset(rwlock, 0, sizeof(mthread_rwlock_t));
+    rwlock->flags = flags;
+
+    if(flags & MTHREAD_RWLOCK_SCALABLE) {
+        ncpu = sysconf(_SC_NPROCESSORS_CONF);
+        while(n < 2 * ncpu)
+            n <<= 1;
+
+        rwlock->slots = aligned_alloc(MTHREAD_CACHE_LINE,
+                                      n * sizeof(struct mthread_rwlock_slot));
+        if(rwlock->slots == NULL)
+            return ENOMEM;
+
+        memset(rwlock->slots, 0, n * sizeof(struct mthread_rwlock_slot));
+        rwlock->nslots = n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Destroy the reader-writer lock
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @return On success, returns 0; if the lock is held, EBUSY
+ */
+int mthread_rwlock_destroy(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+    if(atomic_load(&rwlock->value) != 0)
+        return EBUSY;
+
+    free(rwlock->slots);
+    rwlock->slots  = NULL;
+    rwlock->nslots = 0;
+    return 0;
+}
+
+/**
+ * @brief Lock the reader-writer lock for reading
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note Any number of readers may hold the lock at once. The calling thread
+ * is suspended while a writer holds it (or, preferring writers, waits for it).
+ * @return On success, returns 0
+ */
+int mthread_rwlock_rdlock(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+
+    if(rwlock->flags & MTHREAD_RWLOCK_SCALABLE) {
+        while(scalable_tryrdlock(rwlock) != 0)
+            reader_sleep(rwlock);
+    }
+    else {
+        while(counting_tryrdlock(rwlock) != 0)
+            reader_sleep(rwlock);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Try locking the reader-writer lock for reading
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note Does not block the calling thread
+ * @return On locking returns 0, else EBUSY
+ */
+int mthread_rwlock_tryrdlock(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+
+    if(rwlock->flags & MTHREAD_RWLOCK_SCALABLE)
+        return scalable_tryrdlock(rwlock);
+
+    return counting_tryrdlock(rwlock);
+}
+
+/**
+ * @brief Lock the reader-writer lock for writing
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note The calling thread is suspended until no reader or writer holds the
+ * lock. In scalable mode, WRITER is claimed first, which turns new readers
+ * away, and the writer then sleeps until the reader slots have drained.
+ * @return On success, returns 0
+ */
+int mthread_rwlock_wrlock(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+    int expected = 0;
+    int seq;
+
+    while(!atomic_compare_exchange_strong(&rwlock->value, &expected, WRITER)) {
+        atomic_fetch_add(&rwlock->writers_waiting, 1);
+        seq = atomic_load(&rwlock->write_seq);
+        if(atomic_load(&rwlock->value) != 0)
+            mthread_wait_on_address(&rwlock->write_seq, seq, sizeof(int), NULL);
+        atomic_fetch_sub(&rwlock->writers_waiting, 1);
+        expected = 0;
+    }
+
+    if(rwlock->flags & MTHREAD_RWLOCK_SCALABLE) {
+        atomic_store(&rwlock->draining, 1);
+        for(;;) {
+            seq = atomic_load(&rwlock->drain);
+            if(slots_readers(rwlock) == 0)
+                break;
+            mthread_wait_on_address(&rwlock->drain, seq, sizeof(int), NULL);
+        }
+        atomic_store(&rwlock->draining, 0);
+    }
+
+    atomic_store_explicit(&rwlock->writer, mthread_self(), memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Try locking the reader-writer lock for writing
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note Does not block the calling thread
+ * @return On locking returns 0, else EBUSY
+ */
+int mthread_rwlock_trywrlock(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+    int expected = 0;
+
+    if(!atomic_compare_exchange_strong(&rwlock->value, &expected, WRITER))
+        return EBUSY;
+
+    if((rwlock->flags & MTHREAD_RWLOCK_SCALABLE) && slots_readers(rwlock) != 0) {
+        atomic_store(&rwlock->value, 0);
+        wake_writer(rwlock);
+        wake_readers(rwlock);
+        return EBUSY;
+    }
+
+    atomic_store_explicit(&rwlock->writer, mthread_self(), memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @brief Unlock the reader-writer lock
+ * @param[in,out] rwlock Pointer to reader-writer lock
+ * @note The calling thread must hold the lock, either for reading or writing.
+ * @return On success, returns 0
+ */
+int mthread_rwlock_unlock(mthread_rwlock_t *rwlock) {
+    assert(rwlock);
+    mthread *self = mthread_self();
+
+    if(atomic_load_explicit(&rwlock->writer, memory_order_relaxed) == self) {
+        atomic_store_explicit(&rwlock->writer, NULL, memory_order_relaxed);
+        atomic_store(&rwlock->value, 0);
+
+        /*
+         * Readers held off only by a waiting writer would go straight back
+         * to sleep, so they are left alone while writers are preferred.
+         */
+        wake_writer(rwlock);
+        if(!(rwlock->flags & MTHREAD_RWLOCK_PREFER_WRITER) ||
+           atomic_load(&rwlock->writers_waiting) == 0)
+            wake_readers(rwlock);
+    }
+    else if(rwlock->flags & MTHREAD_RWLOCK_SCALABLE) {
+        atomic_fetch_sub(&rwlock->slots[slot_index(rwlock)].count, 1);
+        if(atomic_load(&rwlock->value) & WRITER)
+            wake_drainer(rwlock);
+    }
+    else {
+        if(atomic_fetch_sub(&rwlock->value, 1) == 1)
+            wake_writer(rwlock);
+    }
+
+    return 0;
+}
@@ -6,23 +6,33 @@
  */
 
 #define _GNU_SOURCE
-#include <unistd.h>
-#include <sys/time.h>
-#include <sys/syscall.h>
-#include <linux/futex.h>
+#include <errno.h>
+#include <limits.h>
 #include <assert.h>
 #include <stdatomic.h>
 #include "mthread.h"
+#include "futex.h"
+#include "pollfd.h"
 
 /**
- * @brief Fast user-space locking
- * @param[in] uaddr Pointer to futex word
- * @param[in] futex_op Operation to be performed
- * @param[in] val Expected value of the futex word
- * @return 0 on success; -1 on error
+ * @brief Sleep on the value of the semaphore while it is zero
+ * @note Private semaphores take the fast private futex operations, and
+ * process-shared ones the shared operations.
  */
-static inline int futex(int *uaddr, int futex_op, int val) {
-    return syscall(SYS_futex, uaddr, futex_op, val, NULL, NULL, 0);
+static inline int sem_sleep(mthread_sem_t *sem, const struct timespec *abstime) {
+    if(sem->flags & MTHREAD_SEM_PSHARED)
+        return futex_wait_shared(&sem->value, 0, abstime);
+    return mthread_wait_on_address(&sem->value, 0, sizeof(int), abstime);
+}
+
+/**
+ * @brief Wake up to n waiters on the value of the semaphore
+ */
+static inline void sem_wake(mthread_sem_t *sem, int n) {
+    if(sem->flags & MTHREAD_SEM_PSHARED)
+        futex_wake_shared(&sem->value, n);
+    else
+        futex_wake_word(&sem->value, n);
 }
 
 /**
@@ -32,28 +42,112 @@ static inline int futex(int *uaddr, int futex_op, int val) {
  * @return On success, returns 0
  */
 int mthread_sem_init(mthread_sem_t *sem, uint32_t initval) {
+    return mthread_sem_init_flags(sem, initval, MTHREAD_SEM_DEFAULT);
+}
+
+/**
+ * @brief Initialise the semaphore with flags
+ * @param[in,out] sem Pointer to semaphore
+ * @param[in] initval Value to be initialised to
+ * @param[in] flags MTHREAD_SEM_DEFAULT or MTHREAD_SEM_PSHARED
+ * @note A process-shared semaphore may lie in memory shared with other
+ * processes, such as a MAP_SHARED mapping of a memfd. The value is kept in
+ * an int, which must not go negative.
+ * @return On success, returns 0; if flags are unknown or initval is above
+ * INT_MAX, EINVAL
+ */
+int mthread_sem_init_flags(mthread_sem_t *sem, uint32_t initval, int flags) {
     assert(sem);
+    if((flags & ~MTHREAD_SEM_PSHARED) || initval > INT_MAX)
+        return EINVAL;
+
     atomic_init(&sem->value, initval);
+    atomic_init(&sem->waiters, 0);
+    sem->flags = flags;
+    sem->pollfd.fd = 0;
+    sem->pollfd.armed = 0;
     return 0;
 }
 
 /**
- * @brief Decrements (locks) the semaphore
+ * @brief Destroy the semaphore
  * @param[in,out] sem Pointer to semaphore
- * @note If the semaphore currently has the value zero, then the
- * call blocks  until it becomes possible to perform the decrement
- * @return On success, returns 0
+ * @note Closes the eventfd of the semaphore, if it has one.
+ * @return On success, returns 0; if threads are waiting on it, EBUSY
  */
-int mthread_sem_wait(mthread_sem_t *sem) {
+int mthread_sem_destroy(mthread_sem_t *sem) {
+    assert(sem);
+    if(atomic_load(&sem->waiters) > 0)
+        return EBUSY;
+
+    pollfd_close(&sem->pollfd);
+    return 0;
+}
+
+/**
+ * @brief Get an eventfd through which an event loop can wait for the
+ * semaphore
+ * @param[in,out] sem Pointer to semaphore
+ * @param[out] fd The eventfd, to add to an epoll(7) instance for reading
+ * @note The eventfd is created on first use and closed by
+ * mthread_sem_destroy(). It is readable only after mthread_sem_poll() found
+ * the semaphore zero and armed it, and a post followed, so posts pay a
+ * write(2) only while the event loop waits for them.
+ * @return On success, returns 0; for a process-shared semaphore, EINVAL; if
+ * the eventfd can not be created, an error number
+ */
+int mthread_sem_eventfd(mthread_sem_t *sem, int *fd) {
+    assert(sem && fd);
+    if(sem->flags & MTHREAD_SEM_PSHARED)
+        return EINVAL;
+
+    if((*fd = pollfd_get(&sem->pollfd)) == -1)
+        return errno;
+    return 0;
+}
+
+/**
+ * @brief Decrement the semaphore if it is non-zero, else arm its eventfd
+ * @param[in,out] sem Pointer to semaphore
+ * @note The call never blocks. An event loop calls it until it returns
+ * EAGAIN, and then waits for the eventfd to become readable.
+ * @return On success, returns 0; if the semaphore is zero, EAGAIN
+ */
+int mthread_sem_poll(mthread_sem_t *sem) {
     assert(sem);
-    uint32_t value = 1;
+    if(mthread_sem_trywait(sem) == 0)
+        return 0;
+
+    pollfd_arm(&sem->pollfd);
+    return mthread_sem_trywait(sem);
+}
+
+/**
+ * @brief Decrements (locks) the semaphore, giving up at an absolute deadline
+ * @param[in,out] sem Pointer to semaphore
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @return On success, returns 0; ETIMEDOUT if the deadline passed, or EINVAL
+ * if the deadline is malformed
+ */
+static int sem_wait_until(mthread_sem_t *sem, const struct timespec *abstime) {
+    int value = 1;
+    int err;
 
     while(!atomic_compare_exchange_weak_explicit(&sem->value,
                                                     &value, value - 1,
                                                     memory_order_acquire,
                                                     memory_order_relaxed)) {
         if(value == 0) {
-            futex(&sem->value, FUTEX_WAIT_PRIVATE, 0);
+            /*
+             * Register as a waiter before sleeping. The kernel re-checks the
+             * value after our increment, so a post that missed us in the
+             * waiter count makes FUTEX_WAIT return immediately.
+             */
+            atomic_fetch_add(&sem->waiters, 1);
+            err = sem_sleep(sem, abstime);
+            atomic_fetch_sub(&sem->waiters, 1);
+            if(err == ETIMEDOUT || err == EINVAL)
+                return err;
             value = 1;
         }
     }
@@ -61,14 +155,122 @@ int mthread_sem_wait(mthread_sem_t *sem) {
     return 0;
 }
 
+/**
+ * @brief Decrements (locks) the semaphore
+ * @param[in,out] sem Pointer to semaphore
+ * @note If the semaphore currently has the value zero, then the
+ * call blocks  until it becomes possible to perform the decrement
+ * @return On success, returns 0
+ */
+int mthread_sem_wait(mthread_sem_t *sem) {
+    assert(sem);
+    return sem_wait_until(sem, NULL);
+}
+
+/**
+ * @brief Decrements (locks) the semaphore with a deadline
+ * @param[in,out] sem Pointer to semaphore
+ * @param[in] abstime Absolute timeout measured against CLOCK_MONOTONIC
+ * @note If the semaphore currently has the value zero, then the call blocks
+ * until it becomes possible to perform the decrement or the deadline passes
+ * @return On success, returns 0; if the deadline passed, ETIMEDOUT
+ */
+int mthread_sem_timedwait(mthread_sem_t *sem, const struct timespec *abstime) {
+    assert(sem && abstime);
+    return sem_wait_until(sem, abstime);
+}
+
+/**
+ * @brief Decrements (locks) the semaphore if it is non-zero
+ * @param[in,out] sem Pointer to semaphore
+ * @note The call never blocks
+ * @return On success, returns 0; if the semaphore is zero, EAGAIN
+ */
+int mthread_sem_trywait(mthread_sem_t *sem) {
+    assert(sem);
+    int value = atomic_load(&sem->value);
+
+    while(value > 0) {
+        if(atomic_compare_exchange_weak_explicit(&sem->value,
+                                                 &value, value - 1,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed))
+            return 0;
+    }
+
+    return EAGAIN;
+}
+
 /**
  * @brief Increments (unlocks) the semaphore
  * @param[in,out] sem Pointer to semaphore
+ * @note The FUTEX_WAKE system call is skipped when no thread is waiting,
+ * and the eventfd is written only if an event loop armed it
  * @return On success, returns 0
  */
 int mthread_sem_post(mthread_sem_t *sem) {
     assert(sem);
-    atomic_fetch_add_explicit(&sem->value, 1, memory_order_release);
-    futex(&sem->value, FUTEX_WAKE_PRIVATE, 1);
+    atomic_fetch_add(&sem->value, 1);
+    if(atomic_load(&sem->waiters) > 0)
+        sem_wake(sem, 1);
+    pollfd_notify(&sem->pollfd);
+    return 0;
+}
+
+/**
+ * @brief Decrements the semaphore by up to max at once
+ * @param[in,out] sem Pointer to semaphore
+ * @param[in] max Largest amount to take
+ * @note If the semaphore currently has the value zero, then the call blocks
+ * until it becomes non-zero. It then takes as much of the value as it can,
+ * but no more than max, with a single atomic operation.
+ * @return Amount the semaphore was decremented by
+ */
+int mthread_sem_wait_upto(mthread_sem_t *sem, uint32_t max) {
+    assert(sem);
+    int value = atomic_load(&sem->value);
+    int take;
+
+    if(max == 0)
+        return 0;
+
+    for(;;) {
+        if(value == 0) {
+            atomic_fetch_add(&sem->waiters, 1);
+            sem_sleep(sem, NULL);
+            atomic_fetch_sub(&sem->waiters, 1);
+            value = atomic_load(&sem->value);
+            continue;
+        }
+
+        take = (uint32_t)value < max ? value : (int)max;
+        if(atomic_compare_exchange_weak_explicit(&sem->value,
+                                                 &value, value - take,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed))
+            return take;
+    }
+}
+
+/**
+ * @brief Increments (unlocks) the semaphore by n at once
+ * @param[in,out] sem Pointer to semaphore
+ * @param[in] n Amount to add
+ * @note A single atomic addition is performed, followed by at most one
+ * FUTEX_WAKE system call for min(n, waiters) threads.
+ * @return On success, returns 0
+ */
+int mthread_sem_post_n(mthread_sem_t *sem, uint32_t n) {
+    assert(sem);
+    int waiters;
+
+    if(n == 0)
+        return 0;
+
+    atomic_fetch_add(&sem->value, n);
+    waiters = atomic_load(&sem->waiters);
+    if(waiters > 0)
+        sem_wake(sem, (uint32_t)waiters < n ? waiters : (int)n);
+    pollfd_notify(&sem->pollfd);
     return 0;
-}
\ No newline at end of file
+}
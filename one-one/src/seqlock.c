@@ -0,0 +1,179 @@
+/**
+ * @file seqlock.c
+ * @brief Sequence Lock Synchronisation Primitive
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/// Times a reader checks for the end of a write before yielding the CPU
+#define SEQLOCK_SPIN    100
+
+/**
+ * @brief Whether the pointers and size allow copying whole 64-bit words
+ */
+static inline int word_aligned(const void *dst, const void *src, size_t size) {
+    return (((uintptr_t)dst | (uintptr_t)src | size) & (sizeof(uint64_t) - 1)) == 0;
+}
+
+/**
+ * @brief Copy out of a record that a writer may be changing
+ * @note Every access is a relaxed atomic, so a torn copy is merely discarded
+ * by the sequence check rather than being a data race.
+ */
+static void copy_from(void *dst, const void *src, size_t size) {
+    size_t i;
+
+    if(word_aligned(dst, src, size)) {
+        for(i = 0; i < size / sizeof(uint64_t); i++)
+            ((uint64_t *)dst)[i] = __atomic_load_n((const uint64_t *)src + i, __ATOMIC_RELAXED);
+        return;
+    }
+    for(i = 0; i < size; i++)
+        ((uint8_t *)dst)[i] = __atomic_load_n((const uint8_t *)src + i, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Copy into a record that readers may be copying out of
+ */
+static void copy_to(void *dst, const void *src, size_t size) {
+    size_t i;
+
+    if(word_aligned(dst, src, size)) {
+        for(i = 0; i < size / sizeof(uint64_t); i++)
+            __atomic_store_n((uint64_t *)dst + i, ((const uint64_t *)src)[i], __ATOMIC_RELAXED);
+        return;
+    }
+    for(i = 0; i < size; i++)
+        __atomic_store_n((uint8_t *)dst + i, ((const uint8_t *)src)[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Initialise the sequence lock
+ * @param[in,out] seqlock Pointer to sequence lock
+ * @return On success, returns 0
+ */
+int mthread_seqlock_init(mthread_seqlock_t *seqlock) {
+    assert(seqlock);
+    atomic_init(&seqlock->sequence, 0);
+    mthread_mutex_init(&seqlock->lock);
+    return 0;
+}
+
+/**
+ * @brief Start an optimistic read
+ * @param[in,out] seqlock Pointer to sequence lock
+ * @note Readers write nothing shared, so they do not take the cache line of
+ * the lock away from each other. While a write is in progress the reader
+ * spins, and then yields the CPU to let a preempted writer finish.
+ * @return Sequence number to check the read against
+ */
+unsigned int mthread_seqlock_read_begin(mthread_seqlock_t *seqlock) {
+    assert(seqlock);
+    unsigned int seq;
+    int i = 0;
+
+    while((seq = atomic_load_explicit(&seqlock->sequence, memory_order_acquire)) & 1) {
+        if(++i < SEQLOCK_SPIN) {
+            __builtin_ia32_pause();
+        }
+        else {
+            mthread_yield();
+            i = 0;
+        }
+    }
+    return seq;
+}
+
+/**
+ * @brief Check whether a read has to be retried
+ * @param[in,out] seqlock Pointer to sequence lock
+ * @param[in] seq Sequence number returned by mthread_seqlock_read_begin()
+ * @return 1 if a write overlapped the read, else 0
+ */
+int mthread_seqlock_read_retry(mthread_seqlock_t *seqlock, unsigned int seq) {
+    assert(seqlock);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&seqlock->sequence, memory_order_relaxed) != seq;
+}
+
+/**
+ * @brief Start a write
+ * @param[in,out] seqlock Pointer to sequence lock
+ * @note Writers are serialised by the mutex of the lock. The sequence is
+ * odd until mthread_seqlock_write_unlock(), which sends readers back.
+ * @return On success, returns 0
+ */
+int mthread_seqlock_write_lock(mthread_seqlock_t *seqlock) {
+    assert(seqlock);
+    mthread_mutex_lock(&seqlock->lock);
+    atomic_store_explicit(&seqlock->sequence,
+                          atomic_load_explicit(&seqlock->sequence, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Finish a write
+ * @param[in,out] seqlock Pointer to sequence lock
+ * @return On success, returns 0
+ */
+int mthread_seqlock_write_unlock(mthread_seqlock_t *seqlock) {
+    assert(seqlock);
+    atomic_store_explicit(&seqlock->sequence,
+                          atomic_load_explicit(&seqlock->sequence, memory_order_relaxed) + 1,
+                          memory_order_release);
+    mthread_mutex_unlock(&seqlock->lock);
+    return 0;
+}
+
+/**
+ * @brief Read a consistent copy of a record
+ * @param[in,out] seqlock Pointer to sequence lock guarding the record
+ * @param[out] dst Buffer the record is copied to
+ * @param[in] src Record
+ * @param[in] size Size of the record in bytes
+ * @note Records that are 8-byte aligned and sized are copied a word at a
+ * time, others a byte at a time.
+ * @return On success, returns 0
+ */
+int mthread_seqlock_read(mthread_seqlock_t *seqlock, void *dst,
+                         const void *src, size_t size) {
+    assert(seqlock && dst && src);
+    unsigned int seq;
+
+    do {
+        seq = atomic_load_explicit(&seqlock->sequence, memory_order_acquire);
+        if(seq & 1)
+            seq = mthread_seqlock_read_begin(seqlock);
+        copy_from(dst, src, size);
+        atomic_thread_fence(memory_order_acquire);
+    } while(atomic_load_explicit(&seqlock->sequence, memory_order_relaxed) != seq);
+
+    return 0;
+}
+
+/**
+ * @brief Replace a record
+ * @param[in,out] seqlock Pointer to sequence lock guarding the record
+ * @param[out] dst Record
+ * @param[in] src New contents of the record
+ * @param[in] size Size of the record in bytes
+ * @return On success, returns 0
+ */
+int mthread_seqlock_write(mthread_seqlock_t *seqlock, void *dst,
+                          const void *src, size_t size) {
+    assert(seqlock && dst && src);
+
+    mthread_seqlock_write_lock(seqlock);
+    copy_to(dst, src, size);
+    mthread_seqlock_write_unlock(seqlock);
+    return 0;
+}
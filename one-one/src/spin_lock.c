@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <errno.h>
 #include "mthread.h"
+#include "tcb.h"
 
 /**
  * @brief Atomic Compare and Swap
@@ -39,11 +40,17 @@ int mthread_spin_init(mthread_spinlock_t *lock) {
 /**
  * @brief Lock a spinlock
  * @param[in,out] lock Pointer to the spinlock
- * @note The call is blocking and will return only if the lock is acquired
+ * @note The call is blocking and will return only if the lock is acquired.
+ * Wakes the caller deferred are issued before it spins, as the holder may
+ * be waiting for one of them.
  * @return On success, returns 0; on error, it returns an error number
  */
 int mthread_spin_lock(mthread_spinlock_t *lock) {
     assert(lock);
+    if(atomic_cas(&lock->value, UNLOCKED, LOCKED))
+        return 0;
+
+    mthread_wake_flush();
     while (!atomic_cas(&lock->value, UNLOCKED, LOCKED));
     return 0;
 }
@@ -0,0 +1,302 @@
+/**
+ * @file spsc.c
+ * @brief Single-producer Single-consumer Ring
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "mthread.h"
+
+/// Largest capacity accepted
+#define SPSC_MAX    (1u << 30)
+
+/**
+ * @brief Number of slots the producer can still fill
+ * @param[in,out] spsc Pointer to ring
+ * @note The tail of the consumer is read only when the copy cached from the
+ * last read says the ring is full, so while there is room the producer
+ * does not touch the cache line the consumer writes.
+ * @return Number of free slots
+ */
+static inline uint64_t room(mthread_spsc_t *spsc) {
+    uint64_t used = spsc->write - spsc->cached_tail;
+
+    if(used > spsc->mask) {
+        spsc->cached_tail = atomic_load_explicit(&spsc->tail, memory_order_acquire);
+        used = spsc->write - spsc->cached_tail;
+    }
+    return spsc->mask + 1 - used;
+}
+
+/**
+ * @brief Number of items the consumer can take
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] want Number of items wanted
+ * @note The head of the producer is read again only when the cached copy
+ * has fewer items than wanted.
+ * @return Number of items ready
+ */
+static inline uint64_t ready(mthread_spsc_t *spsc, uint64_t want) {
+    uint64_t tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+    uint64_t avail = spsc->cached_head - tail;
+
+    if(avail < want) {
+        spsc->cached_head = atomic_load_explicit(&spsc->head, memory_order_acquire);
+        avail = spsc->cached_head - tail;
+    }
+    return avail;
+}
+
+/**
+ * @brief Wake the other side if it is asleep
+ * @param[in,out] spsc Pointer to ring
+ * @param[in,out] waiting Flag the other side sleeps on
+ * @note The fence pairs with the one the sleeper issues after setting its
+ * flag and before looking at the ring a last time: either this sees the
+ * flag, or the sleeper sees the change and does not sleep.
+ */
+static inline void wake_peer(mthread_spsc_t *spsc, int *waiting) {
+    if(!(spsc->flags & MTHREAD_SPSC_BLOCKING))
+        return;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(waiting, memory_order_relaxed)) {
+        atomic_store_explicit(waiting, 0, memory_order_relaxed);
+        mthread_wake_by_address(waiting, 1);
+    }
+}
+
+/**
+ * @brief Wait for the other side to make progress
+ * @param[in,out] spsc Pointer to ring
+ * @param[in,out] waiting Flag to sleep on
+ * @param[in] check Returns non-zero once the wait is over
+ */
+static void wait_peer(mthread_spsc_t *spsc, int *waiting,
+                      uint64_t (*check)(mthread_spsc_t *, uint64_t)) {
+    if(!(spsc->flags & MTHREAD_SPSC_BLOCKING)) {
+        mthread_yield();
+        return;
+    }
+
+    atomic_store_explicit(waiting, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(check(spsc, 1) == 0)
+        mthread_wait_on_address(waiting, 1, sizeof(int), NULL);
+    atomic_store_explicit(waiting, 0, memory_order_relaxed);
+}
+
+/**
+ * @brief Adapt room() to the check of wait_peer()
+ */
+static uint64_t has_room(mthread_spsc_t *spsc, uint64_t unused) {
+    return room(spsc);
+}
+
+/**
+ * @brief Initialise the ring
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] capacity Number of items it holds, rounded up to a power of two
+ * @param[in] flags MTHREAD_SPSC_BLOCKING or 0
+ * @return On success, returns 0; if capacity is 0 or above 2^30, or flags
+ * are unknown, EINVAL; if memory is short, ENOMEM
+ */
+int mthread_spsc_init(mthread_spsc_t *spsc, unsigned int capacity, int flags) {
+    assert(spsc);
+    uint64_t n = 1;
+
+    if(capacity == 0 || capacity > SPSC_MAX || (flags & ~MTHREAD_SPSC_BLOCKING))
+        return EINVAL;
+    while(n < capacity)
+        n <<= 1;
+
+    if((spsc->items = malloc(n * sizeof(void *))) == NULL)
+        return ENOMEM;
+    spsc->mask = n - 1;
+    spsc->flags = flags;
+    spsc->head = spsc->write = spsc->cached_tail = 0;
+    spsc->tail = spsc->cached_head = 0;
+    spsc->producer_waiting = spsc->consumer_waiting = 0;
+    return 0;
+}
+
+/**
+ * @brief Destroy the ring
+ * @param[in,out] spsc Pointer to ring
+ * @note Items left in it are dropped.
+ * @return On success, returns 0
+ */
+int mthread_spsc_destroy(mthread_spsc_t *spsc) {
+    assert(spsc);
+
+    free(spsc->items);
+    spsc->items = NULL;
+    return 0;
+}
+
+/**
+ * @brief Write an item into the ring without publishing it
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] item Item to write
+ * @note Only the producer may call this. The consumer sees the item after
+ * the next mthread_spsc_commit().
+ * @return On success, returns 0; if full, EAGAIN
+ */
+int mthread_spsc_stage(mthread_spsc_t *spsc, void *item) {
+    assert(spsc);
+
+    if(room(spsc) == 0)
+        return EAGAIN;
+    spsc->items[spsc->write & spsc->mask] = item;
+    spsc->write++;
+    return 0;
+}
+
+/**
+ * @brief Publish the items staged so far
+ * @param[in,out] spsc Pointer to ring
+ * @note A single release store covers the whole batch, and in blocking mode
+ * the consumer is woken only if it is asleep.
+ * @return On success, returns 0
+ */
+int mthread_spsc_commit(mthread_spsc_t *spsc) {
+    assert(spsc);
+
+    if(atomic_load_explicit(&spsc->head, memory_order_relaxed) == spsc->write)
+        return 0;
+    atomic_store_explicit(&spsc->head, spsc->write, memory_order_release);
+    wake_peer(spsc, &spsc->consumer_waiting);
+    return 0;
+}
+
+/**
+ * @brief Push an item if there is room
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] item Item to push
+ * @return On success, returns 0; if full, EAGAIN
+ */
+int mthread_spsc_trypush(mthread_spsc_t *spsc, void *item) {
+    assert(spsc);
+    int ret;
+
+    if((ret = mthread_spsc_stage(spsc, item)) == 0)
+        mthread_spsc_commit(spsc);
+    return ret;
+}
+
+/**
+ * @brief Push an item, waiting while the ring is full
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] item Item to push
+ * @note Items staged before are committed before waiting, as the consumer
+ * may need them to make room.
+ * @return On success, returns 0
+ */
+int mthread_spsc_push(mthread_spsc_t *spsc, void *item) {
+    assert(spsc);
+
+    while(mthread_spsc_trypush(spsc, item) == EAGAIN) {
+        mthread_spsc_commit(spsc);
+        wait_peer(spsc, &spsc->producer_waiting, has_room);
+    }
+    return 0;
+}
+
+/**
+ * @brief Push several items at once
+ * @param[in,out] spsc Pointer to ring
+ * @param[in] items Items to push
+ * @param[in] n Number of items
+ * @param[out] pushed Number of items pushed, from the start of items
+ * @return On success, returns 0; if n is negative, EINVAL; if full, EAGAIN
+ */
+int mthread_spsc_push_batch(mthread_spsc_t *spsc, void *const *items, int n,
+                            int *pushed) {
+    assert(spsc && (items || n == 0) && pushed);
+    uint64_t k, i;
+
+    *pushed = 0;
+    if(n < 0)
+        return EINVAL;
+    if((k = room(spsc)) == 0)
+        return EAGAIN;
+    if(k > (uint64_t)n)
+        k = n;
+
+    for(i = 0; i < k; i++)
+        spsc->items[(spsc->write + i) & spsc->mask] = items[i];
+    spsc->write += k;
+    mthread_spsc_commit(spsc);
+    *pushed = k;
+    return 0;
+}
+
+/**
+ * @brief Pop an item if there is one
+ * @param[in,out] spsc Pointer to ring
+ * @param[out] item Item popped
+ * @note Only the consumer may call this.
+ * @return On success, returns 0; if empty, EAGAIN
+ */
+int mthread_spsc_trypop(mthread_spsc_t *spsc, void **item) {
+    assert(spsc && item);
+    uint64_t tail;
+
+    if(ready(spsc, 1) == 0)
+        return EAGAIN;
+    tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+    *item = spsc->items[tail & spsc->mask];
+    atomic_store_explicit(&spsc->tail, tail + 1, memory_order_release);
+    wake_peer(spsc, &spsc->producer_waiting);
+    return 0;
+}
+
+/**
+ * @brief Pop an item, waiting while the ring is empty
+ * @param[in,out] spsc Pointer to ring
+ * @param[out] item Item popped
+ * @return On success, returns 0
+ */
+int mthread_spsc_pop(mthread_spsc_t *spsc, void **item) {
+    assert(spsc && item);
+
+    while(mthread_spsc_trypop(spsc, item) == EAGAIN)
+        wait_peer(spsc, &spsc->consumer_waiting, ready);
+    return 0;
+}
+
+/**
+ * @brief Pop several items at once
+ * @param[in,out] spsc Pointer to ring
+ * @param[out] items Items popped
+ * @param[in] n Number of items wanted
+ * @param[out] popped Number of items popped
+ * @note The slots are handed back to the producer with one store.
+ * @return On success, returns 0; if n is negative, EINVAL; if empty, EAGAIN
+ */
+int mthread_spsc_pop_batch(mthread_spsc_t *spsc, void **items, int n,
+                           int *popped) {
+    assert(spsc && (items || n == 0) && popped);
+    uint64_t tail, k, i;
+
+    *popped = 0;
+    if(n < 0)
+        return EINVAL;
+    if((k = ready(spsc, n)) == 0)
+        return EAGAIN;
+    if(k > (uint64_t)n)
+        k = n;
+
+    tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+    for(i = 0; i < k; i++)
+        items[i] = spsc->items[(tail + i) & spsc->mask];
+    atomic_store_explicit(&spsc->tail, tail + k, memory_order_release);
+    wake_peer(spsc, &spsc->producer_waiting);
+    *popped = k;
+    return 0;
+}
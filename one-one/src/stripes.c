@@ -0,0 +1,241 @@
+/**
+ * @file stripes.c
+ * @brief Striped Lock Table
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include "mthread.h"
+
+/// Fibonacci hashing multiplier, 2^64 divided by the golden ratio
+#define GOLDEN_RATIO_64     0x9e3779b97f4a7c15ull
+
+/// Keys locked at once without allocating, and sorted by insertion
+#define STRIPES_STACK_KEYS  32
+
+/// Stripes marked at once in the bitmap on the stack when unlocking keys
+#define STRIPES_UNLOCK_WINDOW   1024
+
+/// Bits in a word of that bitmap
+#define WORD_BITS           (8 * (int)sizeof(unsigned long))
+
+/**
+ * @brief Get the stripe guarding a key
+ * @param[in] stripes Pointer to lock table
+ * @param[in] hash Hash of the key
+ * @note The hash is multiplied by a constant and the top bits are kept, so
+ * that hashes differing only in their high bits, or in steps of a power of
+ * two as pointers do, still spread over the stripes.
+ * @return Index of the stripe
+ */
+static inline int stripe_of(mthread_lock_stripes_t *stripes, uint64_t hash) {
+    if(stripes->nstripes == 1)
+        return 0;
+    return (int)((hash * GOLDEN_RATIO_64) >> stripes->shift);
+}
+
+/**
+ * @brief Compare two stripe indices for qsort(3)
+ */
+static int compare(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief Get the distinct stripes guarding a set of keys, in ascending order
+ * @param[in] stripes Pointer to lock table
+ * @param[in] hashes Hashes of the keys
+ * @param[in] n Number of keys
+ * @param[in,out] buf Array of STRIPES_STACK_KEYS indices to use if n fits
+ * @param[out] count Number of distinct stripes
+ * @return Array of indices, buf or malloc(3)ed, or NULL if memory is short
+ */
+static int *sorted_stripes(mthread_lock_stripes_t *stripes,
+                           const uint64_t *hashes, int n, int *buf, int *count) {
+    int *idx = buf, i, j, v;
+
+    if(n > STRIPES_STACK_KEYS && (idx = malloc(n * sizeof(int))) == NULL)
+        return NULL;
+
+    for(i = 0; i < n; i++)
+        idx[i] = stripe_of(stripes, hashes[i]);
+
+    if(n > STRIPES_STACK_KEYS) {
+        qsort(idx, n, sizeof(int), compare);
+    }
+    else {
+        for(i = 1; i < n; i++) {
+            v = idx[i];
+            for(j = i; j > 0 && idx[j - 1] > v; j--)
+                idx[j] = idx[j - 1];
+            idx[j] = v;
+        }
+    }
+
+    for(i = j = 0; i < n; i++)
+        if(j == 0 || idx[j - 1] != idx[i])
+            idx[j++] = idx[i];
+    *count = j;
+    return idx;
+}
+
+/**
+ * @brief Initialise the striped lock table
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] nstripes Number of locks, rounded up to a power of two, or 0
+ * for 4 per CPU
+ * @note Each mutex is padded to a cache line of its own, so that threads
+ * locking unrelated keys do not move one line between their caches.
+ * @return On success, returns 0; if memory is short, ENOMEM
+ */
+int mthread_lock_stripes_init(mthread_lock_stripes_t *stripes, unsigned int nstripes) {
+    assert(stripes);
+    int i, n = 1, bits = 0;
+
+    if(nstripes == 0)
+        nstripes = 4 * sysconf(_SC_NPROCESSORS_CONF);
+    while(n < (int)nstripes) {
+        n <<= 1;
+        bits++;
+    }
+
+    stripes->locks = aligned_alloc(MTHREAD_CACHE_LINE,
+                                   n * sizeof(struct mthread_mutex_aligned));
+    if(stripes->locks == NULL)
+        return ENOMEM;
+
+    for(i = 0; i < n; i++)
+        mthread_mutex_init(&stripes->locks[i].mutex);
+    stripes->nstripes = n;
+    stripes->shift = 64 - bits;
+    return 0;
+}
+
+/**
+ * @brief Destroy the striped lock table
+ * @param[in,out] stripes Pointer to lock table
+ * @return On success, returns 0; if a stripe is locked, EBUSY
+ */
+int mthread_lock_stripes_destroy(mthread_lock_stripes_t *stripes) {
+    assert(stripes);
+    int i;
+
+    for(i = 0; i < stripes->nstripes; i++)
+        if(stripes->locks[i].mutex.value != UNLOCKED)
+            return EBUSY;
+
+    free(stripes->locks);
+    stripes->locks = NULL;
+    return 0;
+}
+
+/**
+ * @brief Lock the stripe guarding a key
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] hash Hash of the key
+ * @note Keys of the same stripe share its lock, so a thread holding one
+ * must not lock another key alone; mthread_lock_stripes_lock_keys() locks
+ * several at once.
+ * @return On success, returns 0
+ */
+int mthread_lock_stripes_lock_key(mthread_lock_stripes_t *stripes, uint64_t hash) {
+    assert(stripes);
+    return mthread_mutex_lock(&stripes->locks[stripe_of(stripes, hash)].mutex);
+}
+
+/**
+ * @brief Try locking the stripe guarding a key
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] hash Hash of the key
+ * @return On success, returns 0; if the stripe is locked, EBUSY
+ */
+int mthread_lock_stripes_trylock_key(mthread_lock_stripes_t *stripes, uint64_t hash) {
+    assert(stripes);
+    return mthread_mutex_trylock(&stripes->locks[stripe_of(stripes, hash)].mutex);
+}
+
+/**
+ * @brief Unlock the stripe guarding a key
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] hash Hash of the key
+ * @return On success, returns 0
+ */
+int mthread_lock_stripes_unlock_key(mthread_lock_stripes_t *stripes, uint64_t hash) {
+    assert(stripes);
+    return mthread_mutex_unlock(&stripes->locks[stripe_of(stripes, hash)].mutex);
+}
+
+/**
+ * @brief Lock the stripes guarding several keys
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] hashes Hashes of the keys
+ * @param[in] n Number of keys
+ * @note The stripes are sorted and duplicates dropped, so that each is
+ * locked once, and all threads lock in the same order and can not deadlock
+ * however their sets overlap.
+ * @return On success, returns 0; if n is negative, EINVAL; if memory is
+ * short, ENOMEM
+ */
+int mthread_lock_stripes_lock_keys(mthread_lock_stripes_t *stripes,
+                                   const uint64_t *hashes, int n) {
+    assert(stripes && (hashes || n == 0));
+    int buf[STRIPES_STACK_KEYS], *idx, count, i;
+
+    if(n < 0)
+        return EINVAL;
+    if((idx = sorted_stripes(stripes, hashes, n, buf, &count)) == NULL)
+        return ENOMEM;
+
+    for(i = 0; i < count; i++)
+        mthread_mutex_lock(&stripes->locks[idx[i]].mutex);
+
+    if(idx != buf)
+        free(idx);
+    return 0;
+}
+
+/**
+ * @brief Unlock the stripes guarding several keys
+ * @param[in,out] stripes Pointer to lock table
+ * @param[in] hashes Hashes of the keys, as passed to
+ * mthread_lock_stripes_lock_keys()
+ * @param[in] n Number of keys
+ * @note Unlocking can not fail for want of memory. The order does not
+ * matter, so rather than sorting, the stripes of the keys are marked in a
+ * bitmap on the stack, STRIPES_UNLOCK_WINDOW stripes at a time, and each
+ * marked stripe is unlocked once. Tables of up to that many stripes take a
+ * single pass over the keys.
+ * @return On success, returns 0; if n is negative, EINVAL
+ */
+int mthread_lock_stripes_unlock_keys(mthread_lock_stripes_t *stripes,
+                                     const uint64_t *hashes, int n) {
+    assert(stripes && (hashes || n == 0));
+    unsigned long mark[STRIPES_UNLOCK_WINDOW / WORD_BITS], word;
+    int base, s, i;
+
+    if(n < 0)
+        return EINVAL;
+
+    for(base = 0; base < stripes->nstripes; base += STRIPES_UNLOCK_WINDOW) {
+        memset(mark, 0, sizeof(mark));
+        for(i = 0; i < n; i++) {
+            s = stripe_of(stripes, hashes[i]) - base;
+            if(s >= 0 && s < STRIPES_UNLOCK_WINDOW)
+                mark[s / WORD_BITS] |= 1ul << (s % WORD_BITS);
+        }
+
+        for(i = 0; i < STRIPES_UNLOCK_WINDOW / WORD_BITS; i++) {
+            for(word = mark[i]; word != 0; word &= word - 1) {
+                s = base + i * WORD_BITS + __builtin_ctzl(word);
+                mthread_mutex_unlock(&stripes->locks[s].mutex);
+            }
+        }
+    }
+    return 0;
+}
@@ -5,7 +5,11 @@
  * @bug No known bugs
  */
 
+#include <stdio.h>
+#include <unistd.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
 #include "utils.h"
 
 /**
@@ -18,6 +22,69 @@ size_t get_extant_process_limit(void) {
     return limit.rlim_cur;
 }
 
+/**
+ * @brief Get the number of CPU numbers the kernel may hand out
+ * @note Taken from the highest possible CPU, since CPU numbers need not be
+ * contiguous, so an array indexed by CPU number covers every CPU
+ * @return Highest possible CPU number plus one
+ */
+int get_possible_cpus(void) {
+    FILE *fp = fopen("/sys/devices/system/cpu/possible", "r");
+    int cpu, last = -1;
+    char sep;
+
+    if(fp != NULL) {
+        while(fscanf(fp, "%d%c", &cpu, &sep) == 2 && (last = cpu) >= 0 && sep != '\n')
+            ;
+        fclose(fp);
+    }
+    if(last < 0)
+        return sysconf(_SC_NPROCESSORS_CONF);
+    return last + 1;
+}
+
+/**
+ * @brief Get the topology group of a CPU
+ * @param[in] cpu CPU number
+ * @note CPUs sharing a last-level cache form a group. Where the cache is
+ * not described, CPUs of the same package do.
+ * @return ID of the L3 cache or the package, or 0 if neither is known
+ */
+int get_cpu_group(int cpu) {
+    const char *paths[] = {
+        "/sys/devices/system/cpu/cpu%d/cache/index3/id",
+        "/sys/devices/system/cpu/cpu%d/topology/physical_package_id"
+    };
+    char path[128];
+    FILE *fp;
+    int i, id;
+
+    for(i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), paths[i], cpu);
+        if((fp = fopen(path, "r")) == NULL)
+            continue;
+        if(fscanf(fp, "%d", &id) != 1)
+            id = -1;
+        fclose(fp);
+        if(id >= 0)
+            return id;
+    }
+    return 0;
+}
+
+/**
+ * @brief Register the process for expedited private membarrier(2)
+ * @note Registering again is harmless
+ * @return 1 if MEMBARRIER_CMD_PRIVATE_EXPEDITED can be used, else 0
+ */
+int membarrier_register(void) {
+    int cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+
+    return cmds != -1 &&
+           (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+           syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+}
+
 /**
  * @brief Copy a string of length atmost n bytes including '\0' character
  * @param[in,out] dst String to be copied into
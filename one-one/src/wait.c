@@ -0,0 +1,200 @@
+/**
+ * @file wait.c
+ * @brief Waiting on several synchronisation primitives at once
+ * @author Mayank Jain
+ * @bug No known bugs
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "mthread.h"
+#include "tcb.h"
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+/// Longest sleep between polls when the kernel has no futex_waitv
+#define POLL_MAX_NS     1000000L
+
+/// Set once futex_waitv has failed with ENOSYS
+static int waitv_missing;
+
+/**
+ * @brief Take the object if it is available, without blocking
+ * @param[in,out] obj Object to take
+ * @param[in] contended Mark a mutex taken as contested, since this thread may
+ * have been sleeping on it along with others
+ * @return If the object was taken, returns 0, else EAGAIN
+ */
+static int try_take(mthread_wait_object_t *obj, int contended) {
+    mthread_mutex_t *mutex;
+    int expected = LOCKED;
+
+    switch(obj->type) {
+    case MTHREAD_WAIT_SEM:
+        return mthread_sem_trywait(obj->object);
+    case MTHREAD_WAIT_EVENT:
+        return mthread_event_trywait(obj->object);
+    default:
+        /* Locked as mthread_mutex_lock() would, so the TCB counts it */
+        mutex = obj->object;
+        if(mthread_mutex_trylock(mutex) != 0)
+            return EAGAIN;
+        if(contended)
+            atomic_compare_exchange_strong(&mutex->value, &expected, CONTESTED);
+        return 0;
+    }
+}
+
+/**
+ * @brief Register as a waiter on the object and describe its futex word
+ * @param[in,out] obj Object to wait on
+ * @param[out] w Entry of the futex_waitv vector
+ * @note The kernel compares the futex word with the value we expect while
+ * the object is unavailable, so if it became available after try_take(),
+ * futex_waitv returns at once with EAGAIN.
+ */
+static void prepare(mthread_wait_object_t *obj, struct futex_waitv *w) {
+    mthread_mutex_t *mutex;
+    int expected = LOCKED;
+
+    switch(obj->type) {
+    case MTHREAD_WAIT_SEM:
+        atomic_fetch_add(&((mthread_sem_t *)obj->object)->waiters, 1);
+        w->uaddr = (uintptr_t)&((mthread_sem_t *)obj->object)->value;
+        w->val   = 0;
+        w->flags = FUTEX_32 |
+                   (((mthread_sem_t *)obj->object)->flags & MTHREAD_SEM_PSHARED
+                    ? 0 : FUTEX_PRIVATE_FLAG);
+        break;
+    case MTHREAD_WAIT_EVENT:
+        atomic_fetch_add(&((mthread_event_t *)obj->object)->waiters, 1);
+        w->uaddr = (uintptr_t)&((mthread_event_t *)obj->object)->value;
+        w->val   = 0;
+        w->flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+        break;
+    default:
+        /* Mark the mutex contested so that its unlock issues a FUTEX_WAKE */
+        mutex = obj->object;
+        atomic_compare_exchange_strong(&mutex->value, &expected, CONTESTED);
+        w->uaddr = (uintptr_t)&mutex->value;
+        w->val   = CONTESTED;
+        w->flags = FUTEX_32 |
+                   (mutex->flags & MTHREAD_MUTEX_PSHARED ? 0 : FUTEX_PRIVATE_FLAG);
+        break;
+    }
+    w->__reserved = 0;
+}
+
+/**
+ * @brief Deregister as a waiter on the object
+ * @param[in,out] obj Object waited on
+ */
+static void finish(mthread_wait_object_t *obj) {
+    if(obj->type == MTHREAD_WAIT_SEM)
+        atomic_fetch_sub(&((mthread_sem_t *)obj->object)->waiters, 1);
+    else if(obj->type == MTHREAD_WAIT_EVENT)
+        atomic_fetch_sub(&((mthread_event_t *)obj->object)->waiters, 1);
+}
+
+/**
+ * @brief Sleep for a growing interval, for kernels without futex_waitv
+ * @param[in,out] ns Interval to sleep, doubled for the next call
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL
+ * @return 0, or ETIMEDOUT if the deadline has passed
+ */
+static int poll_sleep(long *ns, const struct timespec *abstime) {
+    struct timespec now, ts = { 0, *ns };
+
+    if(abstime) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec > abstime->tv_sec ||
+           (now.tv_sec == abstime->tv_sec && now.tv_nsec >= abstime->tv_nsec))
+            return ETIMEDOUT;
+    }
+
+    nanosleep(&ts, NULL);
+    if(*ns < POLL_MAX_NS)
+        *ns *= 2;
+    return 0;
+}
+
+/**
+ * @brief Wait until one of several objects is available and take it
+ * @param[in,out] objects Semaphores, mutexes and events to wait on
+ * @param[in] n Number of objects, at most MTHREAD_WAIT_ANY_MAX
+ * @param[in] abstime Absolute CLOCK_MONOTONIC deadline, or NULL to wait forever
+ * @param[out] index Index of the object that was taken
+ * @note Exactly one object is taken: a semaphore is decremented, a mutex is
+ * locked and an auto-reset event is cleared. The thread sleeps on all of the
+ * futex words at once with futex_waitv (Linux 5.16). The object whose wakeup
+ * ended the sleep is tried first, so that the wakeup is not spent on another
+ * object while a waiter of this one stays asleep. Without futex_waitv the
+ * objects are polled with a backoff of up to 1 ms.
+ * @return On success, returns 0; ETIMEDOUT if the deadline passed, or EINVAL
+ * if n is out of range, an object is of unknown type or a priority
+ * inheritance or robust mutex
+ */
+int mthread_wait_any(mthread_wait_object_t *objects, int n,
+                     const struct timespec *abstime, int *index) {
+    assert(objects && index);
+    struct futex_waitv waiters[MTHREAD_WAIT_ANY_MAX];
+    int i, j, start = 0, slept = 0, woken;
+    long poll_ns = 1000;
+
+    if(n < 1 || n > MTHREAD_WAIT_ANY_MAX)
+        return EINVAL;
+
+    for(i = 0; i < n; i++) {
+        if(objects[i].type == MTHREAD_WAIT_MUTEX &&
+           (((mthread_mutex_t *)objects[i].object)->flags &
+            (MTHREAD_MUTEX_PI | MTHREAD_MUTEX_ROBUST)))
+            return EINVAL;
+        if(objects[i].type != MTHREAD_WAIT_SEM &&
+           objects[i].type != MTHREAD_WAIT_MUTEX &&
+           objects[i].type != MTHREAD_WAIT_EVENT)
+            return EINVAL;
+    }
+
+    for(;;) {
+        for(i = 0; i < n; i++) {
+            j = (start + i) % n;
+            if(try_take(&objects[j], slept) == 0) {
+                *index = j;
+                return 0;
+            }
+        }
+
+        if(waitv_missing) {
+            if(poll_sleep(&poll_ns, abstime) == ETIMEDOUT)
+                return ETIMEDOUT;
+            continue;
+        }
+
+        mthread_wake_flush();
+        for(i = 0; i < n; i++)
+            prepare(&objects[i], &waiters[i]);
+        woken = syscall(SYS_futex_waitv, waiters, n, 0, abstime,
+                        CLOCK_MONOTONIC);
+        if(woken == -1)
+            woken = -errno;
+        for(i = 0; i < n; i++)
+            finish(&objects[i]);
+
+        slept = 1;
+        if(woken >= 0)
+            start = woken;
+        else if(woken == -ETIMEDOUT || woken == -EINVAL)
+            return -woken;
+        else if(woken == -ENOSYS)
+            waitv_missing = 1;
+    }
+}
@@ -0,0 +1,151 @@
+/**
+ * Example code for waiting on and waking by address. For each word size, a
+ * consumer sleeps on a sequence number until a producer bumps it and wakes
+ * it, and checks that it saw every bump in order. The 64-bit sequence is
+ * bumped by 2^32, which changes only its upper half, so a 32-bit futex on
+ * it would not notice. Deadlines and misaligned addresses are checked too.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define ROUNDS 20000
+
+/* Sequence numbers of every size, and the consumer's acknowledgement */
+struct {
+    _Atomic uint8_t  seq8;
+    _Atomic uint16_t seq16;
+    _Atomic uint32_t seq32;
+    _Atomic uint64_t seq64;
+    _Atomic uint32_t ack;
+} words;
+
+size_t size;
+uint64_t initial;
+int errors;
+
+uint64_t load(void) {
+    switch(size) {
+    case 1:  return atomic_load(&words.seq8);
+    case 2:  return atomic_load(&words.seq16);
+    case 4:  return atomic_load(&words.seq32);
+    default: return atomic_load(&words.seq64);
+    }
+}
+
+void *address_of(void) {
+    switch(size) {
+    case 1:  return &words.seq8;
+    case 2:  return &words.seq16;
+    case 4:  return &words.seq32;
+    default: return &words.seq64;
+    }
+}
+
+void bump(void) {
+    switch(size) {
+    case 1:  atomic_fetch_add(&words.seq8, 1);  break;
+    case 2:  atomic_fetch_add(&words.seq16, 1); break;
+    case 4:  atomic_fetch_add(&words.seq32, 1); break;
+    default: atomic_fetch_add(&words.seq64, 1ull << 32); break;
+    }
+}
+
+void *consumer(void *arg) {
+    uint64_t seen = initial, now;
+    int i;
+
+    for(i = 0; i < ROUNDS; i++) {
+        while((now = load()) == seen)
+            mthread_wait_on_address(address_of(), seen, size, NULL);
+        if(size == 8 ? now != seen + (1ull << 32)
+                     : ((now - seen) & ((1ull << (8 * size)) - 1)) != 1)
+            errors++;
+        seen = now;
+
+        atomic_fetch_add(&words.ack, 1);
+        mthread_wake_by_address(&words.ack, 1);
+    }
+    return NULL;
+}
+
+void producer(void) {
+    uint32_t ack;
+    int i;
+
+    for(i = 0; i < ROUNDS; i++) {
+        ack = atomic_load(&words.ack);
+        bump();
+        mthread_wake_by_address(address_of(), 1);
+        while(atomic_load(&words.ack) == ack)
+            mthread_wait_on_address(&words.ack, ack, sizeof(uint32_t), NULL);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct timespec start, end, ts;
+    mthread_t tid;
+    double us;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Waiting on and Waking by Address\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    atomic_store(&words.seq64, 0xffff0000ull);
+
+    for(size = 1; size <= 8; size *= 2) {
+        initial = load();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        MCHECK(mthread_create(&tid, NULL, consumer, NULL));
+        producer();
+        MCHECK(mthread_join(tid, NULL));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        us = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+             / ROUNDS / 1000;
+        fprintf(stdout, "%zu-byte word: %6.2f us per round trip\n", size, us);
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += 10000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        if(mthread_wait_on_address(address_of(), load(), size, &ts) != ETIMEDOUT)
+            errors++;
+        if(mthread_wait_on_address(address_of(), load() + 1, size, NULL) != 0)
+            errors++;
+    }
+
+    if(mthread_wait_on_address((char *)&words.seq32 + 1, 0, 2, NULL) != EINVAL ||
+       mthread_wait_on_address(&words.seq32, 0, 3, NULL) != EINVAL ||
+       mthread_wake_by_address(&words.seq64, 1) != 0)
+        errors++;
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Waiting on and Waking by Address\n");
+    return 0;
+}
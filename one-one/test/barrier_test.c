@@ -0,0 +1,148 @@
+/**
+ * Example code and benchmark for barriers and latches. A number of threads
+ * run through phases, and every thread counts itself into the current phase
+ * before waiting at the barrier. After the barrier, the count must include
+ * every thread. The phase turnaround of the native barrier, with and without
+ * spinning, is compared against a barrier built from a mutex and a condition
+ * variable, in which each woken thread has to signal the next one. A latch is
+ * used by the main thread to wait for all the threads to finish.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_THREADS 64
+#define SPIN        1000
+
+enum { NATIVE, SPINNING, CONDVAR, NKINDS };
+
+const char *kind_names[NKINDS] = {
+    "mthread_barrier_t", "mthread_barrier_t (spin)", "mutex + condvar"
+};
+
+/* Barrier hand-rolled from a mutex and a condition variable */
+struct cv_barrier {
+    mthread_mutex_t mutex;
+    mthread_cond_t cond;
+    int arrived;
+    int phase;
+} cv;
+
+mthread_barrier_t barrier;
+mthread_latch_t done;
+atomic_int *arrivals;
+atomic_int errors, serial;
+int kind, phases = 1000;
+
+void cv_barrier_wait(struct cv_barrier *b) {
+    mthread_mutex_lock(&b->mutex);
+    int phase = b->phase;
+    if(++b->arrived == NUM_THREADS) {
+        b->arrived = 0;
+        b->phase++;
+        mthread_cond_signal(&b->cond);
+    }
+    else {
+        while(phase == b->phase)
+            mthread_cond_wait(&b->cond, &b->mutex);
+        /* Pass the wakeup on to the next waiter */
+        mthread_cond_signal(&b->cond);
+    }
+    mthread_mutex_unlock(&b->mutex);
+}
+
+void *worker(void *arg) {
+    int p;
+
+    for(p = 0; p < phases; p++) {
+        atomic_fetch_add(&arrivals[p], 1);
+
+        if(kind == CONDVAR)
+            cv_barrier_wait(&cv);
+        else if(mthread_barrier_wait(&barrier) == MTHREAD_BARRIER_SERIAL_THREAD)
+            atomic_fetch_add(&serial, 1);
+
+        if(atomic_load(&arrivals[p]) != NUM_THREADS)
+            atomic_fetch_add(&errors, 1);
+    }
+
+    mthread_latch_count_down(&done, 1);
+    return NULL;
+}
+
+double run(int k) {
+    struct timespec start, end;
+    mthread_t tid[NUM_THREADS];
+    int i;
+
+    kind = k;
+    memset(arrivals, 0, phases * sizeof(atomic_int));
+    MCHECK(mthread_barrier_init(&barrier, NUM_THREADS, k == SPINNING ? SPIN : 0));
+    MCHECK(mthread_latch_init(&done, NUM_THREADS));
+    mthread_mutex_init(&cv.mutex);
+    mthread_cond_init(&cv.cond);
+    cv.arrived = cv.phase = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, worker, NULL));
+
+    mthread_latch_wait(&done);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+           / phases / 1000;
+}
+
+int main(int argc, char **argv) {
+    int k;
+
+    if(argc == 2)
+        phases = atoi(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Thread Barriers and Latches\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Threads = %d, Phases = %d\n", NUM_THREADS, phases);
+
+    mthread_init();
+    arrivals = calloc(phases, sizeof(atomic_int));
+
+    for(k = 0; k < NKINDS; k++)
+        fprintf(stdout, "%-26s: %10.2f us per phase\n", kind_names[k], run(k));
+
+    if(mthread_latch_trywait(&done) != 0 ||
+       mthread_latch_count_down(&done, 1) != EINVAL)
+        atomic_fetch_add(&errors, 1);
+
+    fprintf(stdout, "Serial threads = %d, Expected %d\n", serial, 2 * phases);
+    if(errors == 0 && serial == 2 * phases) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    free(arrivals);
+    fprintf(stdout, "Exit Testcases - Thread Barriers and Latches\n");
+    return 0;
+}
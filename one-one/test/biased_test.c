@@ -0,0 +1,143 @@
+/**
+ * Benchmark of biased locks against mutexes for data locked almost only
+ * by one thread. First the owner locks and unlocks each kind of lock on
+ * its own, to measure the cost of its path. Then an owner thread
+ * increments a counter under the biased lock while two collector threads
+ * now and then take the lock to increment it too; the counter must come
+ * out exact and no two threads may be inside at once.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define OWNER_OPS       10000000
+#define SHARED_OPS      2000000
+#define COLLECTOR_OPS   200
+#define NUM_COLLECTORS  2
+
+mthread_biased_t biased;
+mthread_mutex_t mutex;
+long counter;
+int inside, errors;
+
+static inline void enter(void) {
+    if(__atomic_exchange_n(&inside, 1, __ATOMIC_RELAXED) != 0)
+        errors++;
+    counter++;
+    __atomic_store_n(&inside, 0, __ATOMIC_RELAXED);
+}
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *owner(void *arg) {
+    int i;
+
+    for(i = 0; i < SHARED_OPS; i++) {
+        mthread_biased_lock(&biased);
+        enter();
+        mthread_biased_unlock(&biased);
+    }
+    return NULL;
+}
+
+void *collector(void *arg) {
+    int i;
+
+    for(i = 0; i < COLLECTOR_OPS; i++) {
+        if(i & 1) {
+            mthread_biased_lock(&biased);
+        }
+        else {
+            while(mthread_biased_trylock(&biased) == EBUSY)
+                mthread_yield();
+        }
+        enter();
+        mthread_biased_unlock(&biased);
+        usleep(100);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    struct timespec start, end;
+    mthread_t owner_tid, tid[NUM_COLLECTORS];
+    int i;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Biased Locks\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    MCHECK(mthread_biased_init(&biased, 0));
+    mthread_mutex_init(&mutex);
+
+    /* Owner path, uncontended */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < OWNER_OPS; i++) {
+        mthread_biased_lock(&biased);
+        counter++;
+        mthread_biased_unlock(&biased);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-18s: %6.2f ns per lock/unlock\n", "mthread_biased_t",
+            seconds(&start, &end) * 1e9 / OWNER_OPS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < OWNER_OPS; i++) {
+        mthread_mutex_lock(&mutex);
+        counter++;
+        mthread_mutex_unlock(&mutex);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-18s: %6.2f ns per lock/unlock\n", "mthread_mutex_t",
+            seconds(&start, &end) * 1e9 / OWNER_OPS);
+
+    /* The main thread took the bias, so a trylock of its own succeeds */
+    MCHECK(mthread_biased_trylock(&biased));
+    MCHECK(mthread_biased_unlock(&biased));
+
+    /* Owner with occasional collectors */
+    counter = 0;
+    MCHECK(mthread_biased_init(&biased, 0));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&owner_tid, NULL, owner, NULL));
+    for(i = 0; i < NUM_COLLECTORS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, collector, NULL));
+    MCHECK(mthread_join(owner_tid, NULL));
+    for(i = 0; i < NUM_COLLECTORS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Owner and %d collectors: %.3f s, counter = %ld\n",
+            NUM_COLLECTORS, seconds(&start, &end), counter);
+
+    if(counter != SHARED_OPS + NUM_COLLECTORS * COLLECTOR_OPS)
+        errors++;
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Biased Locks\n");
+    return 0;
+}
@@ -0,0 +1,259 @@
+/**
+ * Bounded MPMC channel. Producers send numbered items through the channel
+ * to consumers, one at a time and then in batches, against a queue built
+ * from a mutex and two condition variables; every item must arrive once.
+ * A small channel is then filled and drained without blocking to check
+ * its order and bounds, and closed: sends must fail, the items left must
+ * still be received, and a receiver blocked on it must be woken.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_PRODUCERS   4
+#define NUM_CONSUMERS   4
+#define NUM_ITEMS       400000
+#define CAPACITY        1024
+#define BATCH           32
+
+enum { QUEUE, CHANNEL, CHANNEL_BATCH };
+
+/// Queue built from a mutex and condition variables
+struct queue {
+    mthread_mutex_t mutex;
+    mthread_cond_t not_full, not_empty;
+    void *items[CAPACITY];
+    int head, count, closed;
+};
+
+mthread_channel_t channel;
+struct queue queue;
+long sums[NUM_CONSUMERS][8];
+int mode, errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void queue_send(struct queue *q, void *item) {
+    mthread_mutex_lock(&q->mutex);
+    while(q->count == CAPACITY)
+        mthread_cond_wait(&q->not_full, &q->mutex);
+    q->items[(q->head + q->count++) % CAPACITY] = item;
+    mthread_cond_signal(&q->not_empty);
+    mthread_mutex_unlock(&q->mutex);
+}
+
+int queue_recv(struct queue *q, void **item) {
+    mthread_mutex_lock(&q->mutex);
+    while(q->count == 0 && !q->closed)
+        mthread_cond_wait(&q->not_empty, &q->mutex);
+    if(q->count == 0) {
+        mthread_mutex_unlock(&q->mutex);
+        return EPIPE;
+    }
+    *item = q->items[q->head];
+    q->head = (q->head + 1) % CAPACITY;
+    q->count--;
+    mthread_cond_signal(&q->not_full);
+    mthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+void queue_close(struct queue *q) {
+    int i;
+
+    mthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    for(i = 0; i < NUM_CONSUMERS; i++)
+        mthread_cond_signal(&q->not_empty);
+    mthread_mutex_unlock(&q->mutex);
+}
+
+/**
+ * Send the items id + 1, id + 1 + NUM_PRODUCERS, ... up to NUM_ITEMS, so
+ * that all producers together send 1 to NUM_ITEMS
+ */
+void *produce(void *arg) {
+    long id = (long)arg, i = id + 1;
+    void *items[BATCH];
+    int n, done, sent;
+
+    while(i <= NUM_ITEMS) {
+        if(mode == CHANNEL_BATCH) {
+            for(n = 0; n < BATCH && i <= NUM_ITEMS; n++, i += NUM_PRODUCERS)
+                items[n] = (void *)i;
+            for(done = 0; done < n; done += sent)
+                MCHECK(mthread_channel_send_batch(&channel, items + done, n - done, &sent));
+        }
+        else if(mode == CHANNEL) {
+            MCHECK(mthread_channel_send(&channel, (void *)i));
+            i += NUM_PRODUCERS;
+        }
+        else {
+            queue_send(&queue, (void *)i);
+            i += NUM_PRODUCERS;
+        }
+    }
+    return NULL;
+}
+
+void *consume(void *arg) {
+    long id = (long)arg;
+    void *items[BATCH];
+    int i, n, ret;
+
+    for(;;) {
+        if(mode == CHANNEL_BATCH) {
+            if((ret = mthread_channel_recv_batch(&channel, items, BATCH, &n)) != 0)
+                break;
+        }
+        else if(mode == CHANNEL) {
+            ret = mthread_channel_recv(&channel, items);
+            n = 1;
+        }
+        else {
+            ret = queue_recv(&queue, items);
+            n = 1;
+        }
+        if(ret != 0)
+            break;
+        for(i = 0; i < n; i++)
+            sums[id][0] += (long)items[i];
+    }
+    if(ret != EPIPE)
+        errors++;
+    return NULL;
+}
+
+void *blocked_recv(void *arg) {
+    void *item;
+
+    if(mthread_channel_recv(&channel, &item) != EPIPE)
+        errors++;
+    return NULL;
+}
+
+void run(const char *name, int m) {
+    mthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+    struct timespec start, end;
+    long i, total = 0;
+
+    mode = m;
+    memset(sums, 0, sizeof(sums));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_CONSUMERS; i++)
+        MCHECK(mthread_create(&consumers[i], NULL, consume, (void *)i));
+    for(i = 0; i < NUM_PRODUCERS; i++)
+        MCHECK(mthread_create(&producers[i], NULL, produce, (void *)i));
+    for(i = 0; i < NUM_PRODUCERS; i++)
+        MCHECK(mthread_join(producers[i], NULL));
+    if(mode == QUEUE)
+        queue_close(&queue);
+    else
+        MCHECK(mthread_channel_close(&channel));
+    for(i = 0; i < NUM_CONSUMERS; i++)
+        MCHECK(mthread_join(consumers[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for(i = 0; i < NUM_CONSUMERS; i++)
+        total += sums[i][0];
+    fprintf(stdout, "%-20s: %.3f s, %.2f M items/s\n", name,
+            seconds(&start, &end), NUM_ITEMS / seconds(&start, &end) / 1e6);
+    if(total != (long)NUM_ITEMS * (NUM_ITEMS + 1) / 2)
+        errors++;
+}
+
+int main(int argc, char **argv) {
+    void *items[8];
+    mthread_t tid;
+    long i;
+    int n;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Bounded MPMC Channel\n");
+    fprintf(stdout, "%d producers, %d consumers, %d items, capacity %d\n",
+            NUM_PRODUCERS, NUM_CONSUMERS, NUM_ITEMS, CAPACITY);
+
+    /* Throughput */
+    MCHECK(mthread_mutex_init(&queue.mutex));
+    MCHECK(mthread_cond_init(&queue.not_full));
+    MCHECK(mthread_cond_init(&queue.not_empty));
+    run("Mutex and condvars", QUEUE);
+    MCHECK(mthread_channel_init(&channel, CAPACITY));
+    run("Channel", CHANNEL);
+    MCHECK(mthread_channel_destroy(&channel));
+    MCHECK(mthread_channel_init(&channel, CAPACITY));
+    run("Channel, batches", CHANNEL_BATCH);
+    MCHECK(mthread_channel_destroy(&channel));
+
+    /* Bounds and order */
+    if(mthread_channel_init(&channel, 0) != EINVAL)
+        errors++;
+    MCHECK(mthread_channel_init(&channel, 3));
+    for(i = 0; i < 4; i++)
+        MCHECK(mthread_channel_trysend(&channel, (void *)i));
+    if(mthread_channel_trysend(&channel, (void *)i) != EAGAIN)
+        errors++;
+    for(i = 0; i < 2; i++)
+        if(mthread_channel_tryrecv(&channel, items) != 0 || items[0] != (void *)i)
+            errors++;
+    items[0] = (void *)4;
+    items[1] = (void *)5;
+    items[2] = (void *)6;
+    MCHECK(mthread_channel_send_batch(&channel, items, 3, &n));
+    if(n != 2)
+        errors++;
+    MCHECK(mthread_channel_recv_batch(&channel, items, 8, &n));
+    if(n != 4 || items[0] != (void *)2 || items[3] != (void *)5)
+        errors++;
+    if(mthread_channel_tryrecv(&channel, items) != EAGAIN ||
+       mthread_channel_recv_batch(&channel, items, 0, &n) != EINVAL)
+        errors++;
+
+    /* Close */
+    MCHECK(mthread_channel_send(&channel, (void *)7));
+    MCHECK(mthread_channel_close(&channel));
+    if(mthread_channel_send(&channel, (void *)8) != EPIPE ||
+       mthread_channel_close(&channel) != EPIPE)
+        errors++;
+    if(mthread_channel_recv(&channel, items) != 0 || items[0] != (void *)7 ||
+       mthread_channel_recv(&channel, items) != EPIPE ||
+       mthread_channel_recv_batch(&channel, items, 8, &n) != EPIPE)
+        errors++;
+    MCHECK(mthread_channel_destroy(&channel));
+
+    MCHECK(mthread_channel_init(&channel, 16));
+    MCHECK(mthread_create(&tid, NULL, blocked_recv, NULL));
+    mthread_yield();
+    MCHECK(mthread_channel_close(&channel));
+    MCHECK(mthread_join(tid, NULL));
+    MCHECK(mthread_channel_destroy(&channel));
+    fprintf(stdout, "Closing woke the blocked receiver\n");
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Bounded MPMC Channel\n");
+    return 0;
+}
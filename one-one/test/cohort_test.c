@@ -0,0 +1,161 @@
+/**
+ * Benchmark of cohort locks against mutexes. Threads are split into two
+ * groups with mthread_cohort_set_group(), faking a machine with two
+ * last-level caches, and each increments a counter and touches a shared
+ * buffer under the lock. For each lock the number of handoffs between
+ * threads, and the share of them within a group, is reported along with
+ * the time; the counter must come out exact and no two threads may be
+ * inside at once. The cohort lock must keep at least 90% of its handoffs
+ * within a group, well above the share of the mutex.
+ * A lock grouped by an explicit CPU map and trylock are checked too.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_THREADS 8
+#define NUM_GROUPS  2
+#define NUM_OPS     100000
+#define BUF_WORDS   64
+
+mthread_cohort_t cohort;
+mthread_mutex_t mutex;
+long counter, handoffs, local_handoffs, buf[BUF_WORDS];
+int inside, last_id, errors, use_cohort;
+
+static inline void enter(int id) {
+    int i;
+
+    if(__atomic_exchange_n(&inside, 1, __ATOMIC_RELAXED) != 0)
+        errors++;
+    if(last_id != id) {
+        handoffs++;
+        if(last_id % NUM_GROUPS == id % NUM_GROUPS)
+            local_handoffs++;
+        last_id = id;
+    }
+    for(i = 0; i < BUF_WORDS; i++)
+        buf[i]++;
+    counter++;
+    __atomic_store_n(&inside, 0, __ATOMIC_RELAXED);
+}
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *worker(void *arg) {
+    int i, id = (int)(long)arg;
+
+    MCHECK(mthread_cohort_set_group(id % NUM_GROUPS));
+    for(i = 0; i < NUM_OPS; i++) {
+        if(use_cohort) {
+            mthread_cohort_lock(&cohort);
+            enter(id);
+            mthread_cohort_unlock(&cohort);
+        }
+        else {
+            mthread_mutex_lock(&mutex);
+            enter(id);
+            mthread_mutex_unlock(&mutex);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Run the workers on the lock
+ * @return Share of handoffs within a group, in percent
+ */
+double run(const char *name) {
+    struct timespec start, end;
+    mthread_t tid[NUM_THREADS];
+    double share;
+    long i;
+
+    counter = handoffs = local_handoffs = 0;
+    last_id = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, worker, (void *)i));
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    share = 100.0 * local_handoffs / (handoffs ? handoffs : 1);
+    fprintf(stdout, "%-8s: %.3f s, %ld handoffs, %5.1f%% within a group, counter = %ld\n",
+            name, seconds(&start, &end), handoffs, share, counter);
+    if(counter != (long)NUM_THREADS * NUM_OPS)
+        errors++;
+    return share;
+}
+
+int main(int argc, char **argv) {
+    int map[4] = { 7, 7, 3, 3 };
+    double mutex_share, cohort_share;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Cohort Locks\n");
+    fprintf(stdout, "%d threads in %d groups, %d lock operations each\n",
+            NUM_THREADS, NUM_GROUPS, NUM_OPS);
+
+    /* Explicit map, trylock */
+    MCHECK(mthread_cohort_init(&cohort, map, 4, 0));
+    if(cohort.ngroups != 2 || cohort.groups[1] != 0 || cohort.groups[2] != 1)
+        errors++;
+    if(mthread_cohort_init(&cohort, map, 0, 0) != EINVAL)
+        errors++;
+    MCHECK(mthread_cohort_trylock(&cohort));
+    if(mthread_cohort_destroy(&cohort) != EBUSY)
+        errors++;
+    MCHECK(mthread_cohort_unlock(&cohort));
+    MCHECK(mthread_cohort_destroy(&cohort));
+    if(mthread_cohort_set_group(-2) != EINVAL)
+        errors++;
+
+    /* Mutex */
+    use_cohort = 0;
+    MCHECK(mthread_mutex_init(&mutex));
+    mutex_share = run("Mutex");
+
+    /* Cohort lock, groups faked over the topology of the machine */
+    use_cohort = 1;
+    MCHECK(mthread_cohort_init(&cohort, map, 4, 0));
+    cohort_share = run("Cohort");
+    MCHECK(mthread_cohort_destroy(&cohort));
+    if(cohort_share < 90 || cohort_share <= mutex_share)
+        errors++;
+
+    /* Cohort lock grouped by the topology in /sys */
+    MCHECK(mthread_cohort_init(&cohort, NULL, 0, 16));
+    fprintf(stdout, "Groups of the machine = %d\n", cohort.ngroups);
+    MCHECK(mthread_cohort_lock(&cohort));
+    MCHECK(mthread_cohort_unlock(&cohort));
+    MCHECK(mthread_cohort_destroy(&cohort));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Cohort Locks\n");
+    return 0;
+}
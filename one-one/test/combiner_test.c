@@ -0,0 +1,220 @@
+/**
+ * Example code and benchmark for the flat-combining lock. Threads push random
+ * keys onto a shared binary min-heap and pop the smallest, half of the time
+ * each. The same workload runs under a mutex, where every thread brings the
+ * heap into its own cache, and under the combining lock, where one thread
+ * runs a batch of operations for everyone. Afterwards the heap must hold
+ * exactly the keys pushed and not popped, in heap order.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define MAX_THREADS 8
+#define HEAP_SIZE   (1 << 16)
+#define PREFILL     1024
+
+enum { MUTEX, COMBINER, NLOCKS };
+
+const char *lock_names[NLOCKS] = { "mthread_mutex_t", "mthread_combiner_t" };
+
+/* Shared priority queue */
+struct heap {
+    unsigned keys[HEAP_SIZE];
+    int size;
+} heap;
+
+/* Operation passed to the combiner; it carries its own result */
+struct heap_op {
+    int push;
+    unsigned key;
+    int done;
+};
+
+/* Per-thread counters, each on its own cache line */
+struct worker {
+    long ops;
+    long pushed;
+    long popped;
+    unsigned seed;
+    int lock;
+} __attribute__((aligned(64)));
+
+struct worker workers[MAX_THREADS];
+volatile int running;
+mthread_mutex_t mutex;
+mthread_combiner_t combiner;
+
+static inline unsigned next_rand(unsigned *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+void heap_push(unsigned key) {
+    int i = heap.size++, parent;
+    unsigned tmp;
+
+    heap.keys[i] = key;
+    while(i > 0 && heap.keys[parent = (i - 1) / 2] > heap.keys[i]) {
+        tmp = heap.keys[parent];
+        heap.keys[parent] = heap.keys[i];
+        heap.keys[i] = tmp;
+        i = parent;
+    }
+}
+
+unsigned heap_pop(void) {
+    unsigned top = heap.keys[0], tmp;
+    int i = 0, child;
+
+    heap.keys[0] = heap.keys[--heap.size];
+    while((child = 2 * i + 1) < heap.size) {
+        if(child + 1 < heap.size && heap.keys[child + 1] < heap.keys[child])
+            child++;
+        if(heap.keys[i] <= heap.keys[child])
+            break;
+        tmp = heap.keys[child];
+        heap.keys[child] = heap.keys[i];
+        heap.keys[i] = tmp;
+        i = child;
+    }
+    return top;
+}
+
+/* Runs under the lock; a push onto a full heap or a pop off an empty heap
+ * is not done */
+void heap_apply(void *arg) {
+    struct heap_op *op = arg;
+
+    op->done = 0;
+    if(op->push && heap.size < HEAP_SIZE) {
+        heap_push(op->key);
+        op->done = 1;
+    }
+    else if(!op->push && heap.size > 0) {
+        op->key = heap_pop();
+        op->done = 1;
+    }
+}
+
+void *worker(void *arg) {
+    struct worker *w = arg;
+    struct heap_op op;
+
+    while(running) {
+        op.push = next_rand(&w->seed) & 1;
+        op.key  = next_rand(&w->seed);
+
+        if(w->lock == MUTEX) {
+            mthread_mutex_lock(&mutex);
+            heap_apply(&op);
+            mthread_mutex_unlock(&mutex);
+        }
+        else {
+            mthread_combiner_execute(&combiner, heap_apply, &op);
+        }
+
+        if(op.done && op.push)
+            w->pushed++;
+        else if(op.done)
+            w->popped++;
+        w->ops++;
+    }
+    return NULL;
+}
+
+long run(int lock, int nthreads, int ms, int *errors) {
+    mthread_t tid[MAX_THREADS];
+    long ops = 0, expected = PREFILL;
+    unsigned seed = 12345;
+    int i;
+
+    heap.size = 0;
+    for(i = 0; i < PREFILL; i++)
+        heap_push(next_rand(&seed));
+
+    running = 1;
+    for(i = 0; i < nthreads; i++) {
+        memset(&workers[i], 0, sizeof(struct worker));
+        workers[i].seed = i + 1;
+        workers[i].lock = lock;
+        MCHECK(mthread_create(&tid[i], NULL, worker, &workers[i]));
+    }
+
+    usleep(ms * 1000);
+    running = 0;
+
+    for(i = 0; i < nthreads; i++) {
+        MCHECK(mthread_join(tid[i], NULL));
+        ops      += workers[i].ops;
+        expected += workers[i].pushed - workers[i].popped;
+    }
+
+    if(heap.size != expected)
+        (*errors)++;
+    for(i = 1; i < heap.size; i++)
+        if(heap.keys[(i - 1) / 2] > heap.keys[i])
+            (*errors)++;
+
+    return ops * 1000 / ms;
+}
+
+int main(int argc, char **argv) {
+    int ms = 200, lock, n, errors = 0;
+
+    if(argc == 2)
+        ms = atoi(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Flat-combining Lock\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Online CPUs = %ld, %d ms per run\n",
+            sysconf(_SC_NPROCESSORS_ONLN), ms);
+
+    mthread_init();
+    mthread_mutex_init(&mutex);
+    MCHECK(mthread_combiner_init(&combiner, MAX_THREADS));
+
+    fprintf(stdout, "%-20s", "Threads");
+    for(n = 1; n <= MAX_THREADS; n *= 2)
+        fprintf(stdout, "%12d", n);
+    fprintf(stdout, "\n");
+
+    for(lock = 0; lock < NLOCKS; lock++) {
+        fprintf(stdout, "%-20s", lock_names[lock]);
+        for(n = 1; n <= MAX_THREADS; n *= 2) {
+            fprintf(stdout, "%12ld", run(lock, n, ms, &errors));
+            fflush(stdout);
+        }
+        fprintf(stdout, "  ops/s\n");
+    }
+
+    MCHECK(mthread_combiner_destroy(&combiner));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Flat-combining Lock\n");
+    return 0;
+}
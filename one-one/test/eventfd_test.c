@@ -0,0 +1,190 @@
+/**
+ * Event loop waiting on mthread primitives in epoll. A producer thread
+ * posts items to a semaphore in bursts; the loop waits on the eventfd of
+ * the semaphore and takes items with mthread_sem_poll(). The same is timed
+ * with a relay thread that waits on the semaphore and writes a pipe the
+ * loop waits on, as done before the bridge. Posts while nothing is armed
+ * must leave the eventfd unreadable, and a signal on a condition variable
+ * after arming must make its eventfd readable.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_ITEMS   200000
+#define BURST       16
+
+mthread_sem_t sem;
+mthread_mutex_t mutex;
+mthread_cond_t cond;
+int relay_pipe[2], ready, errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *producer(void *arg) {
+    int i;
+
+    for(i = 0; i < NUM_ITEMS; i += BURST) {
+        mthread_sem_post_n(&sem, BURST);
+        mthread_yield();
+    }
+    return NULL;
+}
+
+void *relay(void *arg) {
+    char c = 0;
+    int i;
+
+    for(i = 0; i < NUM_ITEMS; i++) {
+        mthread_sem_wait(&sem);
+        if(write(relay_pipe[1], &c, 1) != 1)
+            errors++;
+    }
+    return NULL;
+}
+
+void *signaller(void *arg) {
+    usleep(10000);
+    mthread_mutex_lock(&mutex);
+    ready = 1;
+    mthread_cond_signal(&cond);
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/**
+ * Add fd to a new epoll instance
+ */
+int watch(int fd) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+
+    if(ep == -1 || epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1)
+        exit(-1);
+    return ep;
+}
+
+int main(int argc, char **argv) {
+    struct timespec start, end;
+    struct epoll_event ev;
+    mthread_t tid[2];
+    long consumed, wakeups;
+    int ep, fd, n;
+    char buf[4096];
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Eventfd Bridge\n");
+    fprintf(stdout, "%d items posted in bursts of %d\n", NUM_ITEMS, BURST);
+
+    /* Posts without an armed poller do not touch the eventfd */
+    MCHECK(mthread_sem_init(&sem, 0));
+    MCHECK(mthread_sem_eventfd(&sem, &fd));
+    ep = watch(fd);
+    MCHECK(mthread_sem_post(&sem));
+    if(epoll_wait(ep, &ev, 1, 0) != 0)
+        errors++;
+    MCHECK(mthread_sem_poll(&sem));
+    if(mthread_sem_poll(&sem) != EAGAIN)
+        errors++;
+    MCHECK(mthread_sem_post(&sem));
+    if(epoll_wait(ep, &ev, 1, 0) != 1)
+        errors++;
+    MCHECK(mthread_sem_poll(&sem));
+
+    /* Event loop on the eventfd */
+    consumed = wakeups = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&tid[0], NULL, producer, NULL));
+    while(consumed < NUM_ITEMS) {
+        while(mthread_sem_poll(&sem) == 0)
+            consumed++;
+        if(consumed < NUM_ITEMS && epoll_wait(ep, &ev, 1, -1) == 1)
+            wakeups++;
+    }
+    MCHECK(mthread_join(tid[0], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Eventfd     : %.3f s, %ld epoll wakeups\n",
+            seconds(&start, &end), wakeups);
+    close(ep);
+    MCHECK(mthread_sem_destroy(&sem));
+    if(fcntl(fd, F_GETFD) != -1)
+        errors++;
+
+    /* Event loop on a pipe fed by a relay thread */
+    MCHECK(mthread_sem_init(&sem, 0));
+    if(pipe2(relay_pipe, O_NONBLOCK) == -1)
+        exit(-1);
+    ep = watch(relay_pipe[0]);
+    consumed = wakeups = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&tid[0], NULL, producer, NULL));
+    MCHECK(mthread_create(&tid[1], NULL, relay, NULL));
+    while(consumed < NUM_ITEMS) {
+        while((n = read(relay_pipe[0], buf, sizeof(buf))) > 0)
+            consumed += n;
+        if(consumed < NUM_ITEMS && epoll_wait(ep, &ev, 1, -1) == 1)
+            wakeups++;
+    }
+    MCHECK(mthread_join(tid[0], NULL));
+    MCHECK(mthread_join(tid[1], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Relay thread: %.3f s, %ld epoll wakeups\n",
+            seconds(&start, &end), wakeups);
+    close(ep);
+    close(relay_pipe[0]);
+    close(relay_pipe[1]);
+    MCHECK(mthread_sem_destroy(&sem));
+
+    /* Condition variable */
+    MCHECK(mthread_mutex_init(&mutex));
+    MCHECK(mthread_cond_init(&cond));
+    if(mthread_cond_arm(&cond) != EINVAL)
+        errors++;
+    MCHECK(mthread_cond_eventfd(&cond, &fd));
+    ep = watch(fd);
+    MCHECK(mthread_create(&tid[0], NULL, signaller, NULL));
+    for(;;) {
+        MCHECK(mthread_cond_arm(&cond));
+        mthread_mutex_lock(&mutex);
+        n = ready;
+        mthread_mutex_unlock(&mutex);
+        if(n)
+            break;
+        epoll_wait(ep, &ev, 1, -1);
+    }
+    MCHECK(mthread_join(tid[0], NULL));
+    fprintf(stdout, "Condition variable signalled through its eventfd\n");
+    close(ep);
+    MCHECK(mthread_cond_destroy(&cond));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Eventfd Bridge\n");
+    return 0;
+}
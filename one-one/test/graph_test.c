@@ -0,0 +1,210 @@
+/**
+ * Task graph. A wide and deep synthetic DAG, layers of tasks of 2 to 20 us
+ * each depending on random tasks of the layer before, is run through the
+ * graph, and layer by layer on the same pool with a wait between layers.
+ * Every task must run once and only after all its predecessors. On a pool
+ * of one worker, the head of a long chain must start before independent
+ * tasks added ahead of it, sources of distinct costs must run costliest
+ * first, whether the graph is run from outside the pool or from one of its
+ * tasks, and a cycle must be refused.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_WORKERS     4
+#define LAYERS          50
+#define WIDTH           64
+#define NUM_PREDS       3
+#define NUM_NODES       (LAYERS * WIDTH)
+#define CHAIN           10
+#define SOURCES         24
+
+/// Task of the synthetic graph
+struct task {
+    int id, us, npreds;
+    int preds[NUM_PREDS];
+};
+
+struct task tasks[NUM_NODES];
+int done[NUM_NODES];
+int order[SOURCES], executed, errors;
+mthread_pool_t pool;
+mthread_graph_t sources;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void work(void *arg) {
+    struct task *t = arg;
+    struct timespec start, now;
+    int i;
+
+    for(i = 0; i < t->npreds; i++)
+        if(!__atomic_load_n(&done[t->preds[i]], __ATOMIC_ACQUIRE))
+            errors++;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while(seconds(&start, &now) < t->us / 1e6);
+
+    if(__atomic_fetch_add(&done[t->id], 1, __ATOMIC_RELEASE) != 0)
+        errors++;
+}
+
+void record(void *arg) {
+    order[executed++] = (long)arg;
+}
+
+/**
+ * Run the graph of sources on the pool, from one of its workers
+ */
+void run_sources(void *arg) {
+    MCHECK(mthread_graph_run(&sources, &pool));
+}
+
+/**
+ * Check that the sources ran once each, costliest first
+ * @return Number of sources out of order
+ */
+int check_sources(void) {
+    int i, wrong = executed != SOURCES;
+
+    for(i = 0; i < executed; i++)
+        if(order[i] * 7 % SOURCES != SOURCES - 1 - i)
+            wrong++;
+    executed = 0;
+    return wrong;
+}
+
+/**
+ * Check that each task ran once, and clear the marks
+ */
+void check(void) {
+    int i;
+
+    for(i = 0; i < NUM_NODES; i++) {
+        if(done[i] != 1)
+            errors++;
+        done[i] = 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    mthread_task_group_t group = MTHREAD_TASK_GROUP_INITIALIZER;
+    struct timespec start, end;
+    mthread_graph_t graph;
+    unsigned int seed = 1;
+    int i, j, node;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Task Graph\n");
+    fprintf(stdout, "%d layers of %d tasks, %d predecessors each, %d workers\n",
+            LAYERS, WIDTH, NUM_PREDS, NUM_WORKERS);
+
+    MCHECK(mthread_pool_init(&pool, NUM_WORKERS));
+    MCHECK(mthread_graph_init(&graph));
+    for(i = 0; i < NUM_NODES; i++) {
+        tasks[i].id = i;
+        tasks[i].us = 2 + rand_r(&seed) % 19;
+        MCHECK(mthread_graph_add_node(&graph, work, &tasks[i], &node));
+        MCHECK(mthread_graph_set_cost(&graph, node, tasks[i].us));
+        if(node != i)
+            errors++;
+        if(i < WIDTH)
+            continue;
+        tasks[i].npreds = NUM_PREDS;
+        for(j = 0; j < NUM_PREDS; j++) {
+            tasks[i].preds[j] = (i / WIDTH - 1) * WIDTH + rand_r(&seed) % WIDTH;
+            MCHECK(mthread_graph_add_edge(&graph, tasks[i].preds[j], i));
+        }
+    }
+
+    /* Layer by layer */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < LAYERS; i++) {
+        for(j = 0; j < WIDTH; j++)
+            MCHECK(mthread_pool_submit(&pool, &group, work, &tasks[i * WIDTH + j]));
+        MCHECK(mthread_pool_wait(&pool, &group));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Layer by layer: %.3f s\n", seconds(&start, &end));
+    check();
+
+    /* Graph, twice */
+    for(i = 0; i < 2; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        MCHECK(mthread_graph_run(&graph, &pool));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stdout, "Graph         : %.3f s\n", seconds(&start, &end));
+        check();
+    }
+    MCHECK(mthread_graph_destroy(&graph));
+    MCHECK(mthread_pool_destroy(&pool));
+
+    /* Critical path first: nodes 0-7 independent, 8 heads a chain */
+    MCHECK(mthread_pool_init(&pool, 1));
+    MCHECK(mthread_graph_init(&graph));
+    for(i = 0; i < CHAIN + 8; i++)
+        MCHECK(mthread_graph_add_node(&graph, record, (void *)(long)i, &node));
+    for(i = 8; i < CHAIN + 7; i++)
+        MCHECK(mthread_graph_add_edge(&graph, i, i + 1));
+    MCHECK(mthread_graph_run(&graph, &pool));
+    fprintf(stdout, "First task run: %d\n", order[0]);
+    if(executed != CHAIN + 8 || order[0] != 8)
+        errors++;
+    executed = 0;
+
+    /* More sources than a worker moves from the injection queue at once */
+    MCHECK(mthread_graph_init(&sources));
+    for(i = 0; i < SOURCES; i++) {
+        MCHECK(mthread_graph_add_node(&sources, record, (void *)(long)i, &node));
+        MCHECK(mthread_graph_set_cost(&sources, node, 1 + i * 7 % SOURCES));
+    }
+    MCHECK(mthread_graph_run(&sources, &pool));
+    j = check_sources();
+    MCHECK(mthread_pool_submit(&pool, &group, run_sources, NULL));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    j += check_sources();
+    fprintf(stdout, "Sources out of priority order: %d\n", j);
+    errors += j;
+    MCHECK(mthread_graph_destroy(&sources));
+
+    /* Cycle and bad edges */
+    if(mthread_graph_add_edge(&graph, 3, 3) != EINVAL ||
+       mthread_graph_add_edge(&graph, 0, CHAIN + 8) != EINVAL)
+        errors++;
+    MCHECK(mthread_graph_add_edge(&graph, CHAIN + 7, 8));
+    if(mthread_graph_run(&graph, &pool) != EDEADLK)
+        errors++;
+    MCHECK(mthread_graph_destroy(&graph));
+    MCHECK(mthread_pool_destroy(&pool));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Task Graph\n");
+    return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * Memory and throughput comparison of byte-sized locks and mutexes. First,
+ * threads increment a shared counter under a single lock, now and then
+ * yielding the CPU while holding it so that the others have to park; the
+ * counter must come out exact. Then an array of 10M locks, one per small
+ * object, is allocated for each kind of lock, and threads lock and unlock
+ * random entries of it.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_THREADS 4
+#define HOT_OPS     200000
+#define ARRAY_OPS   2000000
+
+enum { LOCK8, MUTEX, NKINDS };
+
+const char *kind_names[NKINDS] = { "mthread_lock8_t", "mthread_mutex_t" };
+
+mthread_lock8_t hot_lock8;
+mthread_mutex_t hot_mutex;
+mthread_lock8_t *locks8;
+mthread_mutex_t *mutexes;
+long counter, n_locks = 10000000;
+int kind;
+
+static inline unsigned next_rand(unsigned *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+void *hot(void *arg) {
+    int i;
+
+    for(i = 0; i < HOT_OPS; i++) {
+        if(kind == LOCK8) {
+            mthread_lock8_lock(&hot_lock8);
+            counter++;
+            if(i % 64 == 0)
+                mthread_yield();
+            mthread_lock8_unlock(&hot_lock8);
+        }
+        else {
+            mthread_mutex_lock(&hot_mutex);
+            counter++;
+            if(i % 64 == 0)
+                mthread_yield();
+            mthread_mutex_unlock(&hot_mutex);
+        }
+    }
+    return NULL;
+}
+
+void *random_access(void *arg) {
+    unsigned seed = (unsigned)(long)arg + 1;
+    long idx;
+    int i;
+
+    for(i = 0; i < ARRAY_OPS; i++) {
+        idx = next_rand(&seed) % n_locks;
+        if(kind == LOCK8) {
+            mthread_lock8_lock(&locks8[idx]);
+            mthread_lock8_unlock(&locks8[idx]);
+        }
+        else {
+            mthread_mutex_lock(&mutexes[idx]);
+            mthread_mutex_unlock(&mutexes[idx]);
+        }
+    }
+    return NULL;
+}
+
+double run(int k, void *(*f)(void *)) {
+    struct timespec start, end;
+    mthread_t tid[NUM_THREADS];
+    long i;
+
+    kind = k;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, f, (void *)i));
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long i;
+    int k, errors = 0;
+    double t;
+
+    if(argc == 2)
+        n_locks = atol(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Byte-sized Locks and the Parking Lot\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    mthread_lock8_init(&hot_lock8);
+    mthread_mutex_init(&hot_mutex);
+
+    MCHECK(mthread_lock8_trylock(&hot_lock8));
+    if(mthread_lock8_trylock(&hot_lock8) != EBUSY)
+        errors++;
+    MCHECK(mthread_lock8_unlock(&hot_lock8));
+
+    fprintf(stdout, "Single lock, %d threads x %d increments\n", NUM_THREADS, HOT_OPS);
+    for(k = 0; k < NKINDS; k++) {
+        counter = 0;
+        t = run(k, hot);
+        fprintf(stdout, "%-16s: %12.0f ops/s\n", kind_names[k],
+                NUM_THREADS * HOT_OPS / t);
+        if(counter != (long)NUM_THREADS * HOT_OPS)
+            errors++;
+    }
+
+    locks8 = malloc(n_locks * sizeof(mthread_lock8_t));
+    mutexes = malloc(n_locks * sizeof(mthread_mutex_t));
+    if(!locks8 || !mutexes) {
+        fprintf(stderr, "FATAL: out of memory\n");
+        exit(-1);
+    }
+    for(i = 0; i < n_locks; i++) {
+        mthread_lock8_init(&locks8[i]);
+        mthread_mutex_init(&mutexes[i]);
+    }
+
+    fprintf(stdout, "%ld locks, %d threads x %d random lock/unlock\n",
+            n_locks, NUM_THREADS, ARRAY_OPS);
+    fprintf(stdout, "%-16s: %8.1f MB %12.0f ops/s\n", kind_names[LOCK8],
+            n_locks * sizeof(mthread_lock8_t) / 1e6,
+            NUM_THREADS * ARRAY_OPS / run(LOCK8, random_access));
+    fprintf(stdout, "%-16s: %8.1f MB %12.0f ops/s\n", kind_names[MUTEX],
+            n_locks * sizeof(mthread_mutex_t) / 1e6,
+            NUM_THREADS * ARRAY_OPS / run(MUTEX, random_access));
+
+    for(i = 0; i < n_locks; i++)
+        if(locks8[i].value != 0)
+            errors++;
+    free(locks8);
+    free(mutexes);
+
+    if(errors == 0 && sizeof(mthread_lock8_t) == 1) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Byte-sized Locks and the Parking Lot\n");
+    return 0;
+}
@@ -0,0 +1,231 @@
+/**
+ * Parallel loops. Items whose cost grows with their index, so that a
+ * static split into one slice per thread leaves the last thread with most
+ * of the work, are computed by threads with static slices, the way
+ * matrix_test does it, and by parallel_for. Both must match a plain loop.
+ * A reduction of the results must be exact, and a floating-point one the
+ * same on every run. A nested loop must visit every cell once, and the
+ * chunks of a loop over every long must split it and cover it exactly.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_WORKERS 4
+#define NUM_ITEMS   4096
+#define SCALE       64
+#define ROWS        64
+#define COLS        256
+
+unsigned long values[NUM_ITEMS], expected[NUM_ITEMS];
+int cells[ROWS][COLS];
+unsigned long covered;
+int nchunks;
+double busy[NUM_WORKERS];
+int errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Hash the index i * SCALE times over, so that item i costs O(i)
+ */
+unsigned long item(long i) {
+    unsigned long h = i;
+    long j;
+
+    for(j = 0; j < i * SCALE; j++)
+        h = h * 6364136223846793005UL + 1442695040888963407UL;
+    return h;
+}
+
+void *slice(void *arg) {
+    long t = (long)arg, i;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = t * NUM_ITEMS / NUM_WORKERS; i < (t + 1) * NUM_ITEMS / NUM_WORKERS; i++)
+        values[i] = item(i);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    busy[t] = seconds(&start, &end);
+    return NULL;
+}
+
+void chunk(long lo, long hi, void *ctx) {
+    long i;
+
+    for(i = lo; i < hi; i++)
+        values[i] = item(i);
+}
+
+void sum(long lo, long hi, void *acc, void *ctx) {
+    long i;
+
+    for(i = lo; i < hi; i++)
+        *(unsigned long *)acc += values[i] % 1000;
+}
+
+void add(void *acc, const void *other, void *ctx) {
+    *(unsigned long *)acc += *(const unsigned long *)other;
+}
+
+void fsum(long lo, long hi, void *acc, void *ctx) {
+    long i;
+
+    for(i = lo; i < hi; i++)
+        *(double *)acc += 1.0 / (values[i] % 1000 + 1);
+}
+
+void fadd(void *acc, const void *other, void *ctx) {
+    *(double *)acc += *(const double *)other;
+}
+
+void row(long lo, long hi, void *ctx) {
+    long r = (long)ctx, c;
+
+    for(c = lo; c < hi; c++)
+        __atomic_fetch_add(&cells[r][c], 1, __ATOMIC_RELAXED);
+}
+
+void rows(long lo, long hi, void *ctx) {
+    long r;
+
+    for(r = lo; r < hi; r++)
+        MCHECK(mthread_parallel_for(0, COLS, 16, row, (void *)r));
+}
+
+/**
+ * Add up the width of the chunk, without visiting its indices
+ */
+void widths(long lo, long hi, void *ctx) {
+    if(hi <= lo)
+        __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&covered, (unsigned long)hi - (unsigned long)lo, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&nchunks, 1, __ATOMIC_RELAXED);
+}
+
+void never(long lo, long hi, void *ctx) {
+    errors++;
+}
+
+int main(int argc, char **argv) {
+    mthread_t tid[NUM_WORKERS];
+    struct timespec start, end;
+    unsigned long total, check;
+    double fresult, fagain;
+    long i, r, c;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Parallel Loops\n");
+    fprintf(stdout, "%d items costing up to %d hashes, %d workers\n",
+            NUM_ITEMS, NUM_ITEMS * SCALE, NUM_WORKERS);
+
+    MCHECK(mthread_parallel_init(NUM_WORKERS));
+    if(mthread_parallel_init(1) != EBUSY)
+        errors++;
+
+    /* Plain loop */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_ITEMS; i++)
+        expected[i] = item(i);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s\n", "Loop", seconds(&start, &end));
+
+    /* Static slices, one thread each */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_WORKERS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, slice, (void *)i));
+    for(i = 0; i < NUM_WORKERS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s, slices busy", "Static slices", seconds(&start, &end));
+    for(i = 0; i < NUM_WORKERS; i++)
+        fprintf(stdout, " %.3f", busy[i]);
+    fprintf(stdout, " s\n");
+    if(memcmp(values, expected, sizeof(values)))
+        errors++;
+
+    /* Work stealing, picked grain and fixed one */
+    memset(values, 0, sizeof(values));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_parallel_for(0, NUM_ITEMS, 0, chunk, NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s\n", "parallel_for", seconds(&start, &end));
+    if(memcmp(values, expected, sizeof(values)))
+        errors++;
+
+    memset(values, 0, sizeof(values));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_parallel_for(0, NUM_ITEMS, 1, chunk, NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s\n", "Grain of 1", seconds(&start, &end));
+    if(memcmp(values, expected, sizeof(values)))
+        errors++;
+
+    /* Reductions */
+    for(i = 0, check = 0; i < NUM_ITEMS; i++)
+        check += values[i] % 1000;
+    total = 0;
+    MCHECK(mthread_parallel_reduce(0, NUM_ITEMS, 0, &total, sizeof(total), sum, add, NULL));
+    fprintf(stdout, "Sum = %lu, expected %lu\n", total, check);
+    if(total != check)
+        errors++;
+
+    fresult = 0;
+    MCHECK(mthread_parallel_reduce(0, NUM_ITEMS, 7, &fresult, sizeof(double), fsum, fadd, NULL));
+    for(i = 0; i < 10; i++) {
+        fagain = 0;
+        MCHECK(mthread_parallel_reduce(0, NUM_ITEMS, 7, &fagain, sizeof(double), fsum, fadd, NULL));
+        if(memcmp(&fagain, &fresult, sizeof(double)))
+            errors++;
+    }
+
+    /* Nested */
+    MCHECK(mthread_parallel_for(0, ROWS, 1, rows, NULL));
+    for(r = 0; r < ROWS; r++)
+        for(c = 0; c < COLS; c++)
+            if(cells[r][c] != 1)
+                errors++;
+
+    /* Range wider than a long can count */
+    MCHECK(mthread_parallel_for(LONG_MIN, LONG_MAX, 0, widths, NULL));
+    fprintf(stdout, "Every long in %d chunks\n", nchunks);
+    if(covered != ULONG_MAX || nchunks < 2)
+        errors++;
+
+    /* Empty and bad ranges */
+    MCHECK(mthread_parallel_for(5, 5, 0, never, NULL));
+    if(mthread_parallel_for(5, 4, 0, never, NULL) != EINVAL ||
+       mthread_parallel_for(0, 4, -1, never, NULL) != EINVAL ||
+       mthread_parallel_for(0, 4, 0, NULL, NULL) != EINVAL ||
+       mthread_parallel_reduce(0, 4, 0, &total, 0, sum, add, NULL) != EINVAL)
+        errors++;
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Parallel Loops\n");
+    return 0;
+}
@@ -0,0 +1,261 @@
+/**
+ * Benchmark of per-CPU data structures on restartable sequences against
+ * their atomic counterparts. Threads, more of them than CPUs so that they
+ * are preempted in the middle of operations, increment a per-CPU counter
+ * and a shared atomic counter, cycle nodes through a per-CPU freelist and
+ * a mutex-guarded list, and cycle objects through per-CPU slots and a
+ * single slot swapped atomically. Counts must be exact, and no node or
+ * object may be handed to two threads at once or get lost.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define MAX_THREADS 64
+#define OPS         1000000
+#define NODES       256
+
+enum { COUNTER, FREELIST, SLOTS, NTESTS };
+enum { PERCPU, ATOMIC, NKINDS };
+
+const char *test_names[NTESTS] = { "counter add", "freelist pop/push", "slot take/put" };
+const char *kind_names[NKINDS] = { "per-CPU", "atomic" };
+
+/* Node or object, flagged while a thread holds it */
+struct object {
+    mthread_percpu_node_t node;
+    atomic_int held;
+    struct object *next;
+};
+
+struct object objects[NODES];
+mthread_percpu_counter_t percpu_counter;
+atomic_long atomic_counter;
+mthread_percpu_freelist_t percpu_list;
+struct object *locked_list;
+mthread_mutex_t list_lock;
+mthread_percpu_slots_t percpu_slots;
+struct object *_Atomic shared_slot;
+struct object *pool;
+mthread_mutex_t pool_lock;
+atomic_int errors;
+int test, kind;
+
+void hold(struct object *o) {
+    if(atomic_exchange(&o->held, 1) != 0)
+        atomic_fetch_add(&errors, 1);
+    atomic_store(&o->held, 0);
+}
+
+/* Objects neither thread-held nor in a slot live in the pool */
+struct object *pool_get(void) {
+    struct object *o;
+
+    mthread_mutex_lock(&pool_lock);
+    if((o = pool) != NULL)
+        pool = o->next;
+    mthread_mutex_unlock(&pool_lock);
+    return o;
+}
+
+void pool_put(struct object *o) {
+    mthread_mutex_lock(&pool_lock);
+    o->next = pool;
+    pool = o;
+    mthread_mutex_unlock(&pool_lock);
+}
+
+void *worker(void *arg) {
+    struct object *o, *expected;
+    int i;
+
+    for(i = 0; i < OPS; i++) {
+        if(test == COUNTER) {
+            if(kind == PERCPU)
+                mthread_percpu_counter_add(&percpu_counter, 1);
+            else
+                atomic_fetch_add(&atomic_counter, 1);
+        }
+        else if(test == FREELIST) {
+            if(kind == PERCPU) {
+                o = (struct object *)mthread_percpu_freelist_pop(&percpu_list);
+                if(o == NULL)
+                    continue;
+                hold(o);
+                mthread_percpu_freelist_push(&percpu_list, &o->node);
+            }
+            else {
+                mthread_mutex_lock(&list_lock);
+                if((o = locked_list) != NULL)
+                    locked_list = o->next;
+                mthread_mutex_unlock(&list_lock);
+                if(o == NULL)
+                    continue;
+                hold(o);
+                mthread_mutex_lock(&list_lock);
+                o->next = locked_list;
+                locked_list = o;
+                mthread_mutex_unlock(&list_lock);
+            }
+        }
+        else {
+            if(kind == PERCPU) {
+                if((o = mthread_percpu_slots_take(&percpu_slots)) == NULL &&
+                   (o = pool_get()) == NULL)
+                    continue;
+                hold(o);
+                if(mthread_percpu_slots_put(&percpu_slots, o) == EBUSY)
+                    pool_put(o);
+            }
+            else {
+                if((o = atomic_exchange(&shared_slot, NULL)) == NULL &&
+                   (o = pool_get()) == NULL)
+                    continue;
+                hold(o);
+                expected = NULL;
+                if(!atomic_compare_exchange_strong(&shared_slot, &expected, o))
+                    pool_put(o);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Counts the objects in every place they may rest, and checks each once */
+void check_objects(void) {
+    int seen[NODES] = { 0 }, i;
+    struct object *o;
+    mthread_percpu_node_t *n;
+
+    for(i = 0; i < percpu_list.ncpus; i++)
+        for(n = (mthread_percpu_node_t *)percpu_list.cells[i].value; n; n = n->next)
+            seen[(struct object *)n - objects]++;
+    for(o = locked_list; o; o = o->next)
+        seen[o - objects]++;
+    for(i = 0; i < percpu_slots.ncpus; i++)
+        if((o = (struct object *)percpu_slots.cells[i].value) != NULL)
+            seen[o - objects]++;
+    if((o = shared_slot) != NULL)
+        seen[o - objects]++;
+    for(o = pool; o; o = o->next)
+        seen[o - objects]++;
+
+    for(i = 0; i < NODES; i++)
+        if(seen[i] != 1)
+            atomic_fetch_add(&errors, 1);
+}
+
+double run(int t, int k, int nthreads) {
+    struct timespec start, end;
+    mthread_t tid[MAX_THREADS];
+    int i;
+
+    test = t;
+    kind = k;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < nthreads; i++)
+        MCHECK(mthread_create(&tid[i], NULL, worker, NULL));
+    for(i = 0; i < nthreads; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)nthreads * OPS /
+           ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int t, k, n, i, max_threads;
+    long total;
+
+    max_threads = 2 * cpus < 8 ? 8 : 2 * cpus;
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Per-CPU Data Structures\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Online CPUs = %ld, %d ops per thread\n", cpus, OPS);
+
+    mthread_init();
+    mthread_mutex_init(&list_lock);
+    mthread_mutex_init(&pool_lock);
+    MCHECK(mthread_percpu_counter_init(&percpu_counter));
+    MCHECK(mthread_percpu_freelist_init(&percpu_list));
+    MCHECK(mthread_percpu_slots_init(&percpu_slots));
+
+    for(i = 0; i < NODES / 2; i++)
+        MCHECK(mthread_percpu_freelist_push(&percpu_list, &objects[i].node));
+    for(; i < NODES; i++)
+        pool_put(&objects[i]);
+
+    if(mthread_percpu_slots_put(&percpu_slots, &objects[0]) != 0 ||
+       mthread_percpu_slots_put(&percpu_slots, &objects[1]) != EBUSY ||
+       mthread_percpu_slots_take(&percpu_slots) != &objects[0])
+        atomic_fetch_add(&errors, 1);
+
+    fprintf(stdout, "%-28s", "Threads");
+    for(n = 1; n <= max_threads; n *= 2)
+        fprintf(stdout, "%12d", n);
+    fprintf(stdout, "\n");
+
+    for(t = 0; t < NTESTS; t++) {
+        for(k = 0; k < NKINDS; k++) {
+            fprintf(stdout, "%-18s%-10s", test_names[t], kind_names[k]);
+            for(n = 1; n <= max_threads; n *= 2) {
+                fprintf(stdout, "%12.0f", run(t, k, n));
+                fflush(stdout);
+            }
+            fprintf(stdout, "  ops/s\n");
+
+            if(t == FREELIST && k == PERCPU) {
+                /* Move the nodes to the locked list for the other kind */
+                for(i = 0; i < percpu_list.ncpus; i++)
+                    percpu_list.cells[i].value = 0;
+                for(i = 0; i < NODES / 2; i++) {
+                    objects[i].next = locked_list;
+                    locked_list = &objects[i];
+                }
+            }
+            check_objects();
+        }
+    }
+
+    total = 0;
+    for(n = 1; n <= max_threads; n *= 2)
+        total += (long)n * OPS;
+    if(mthread_percpu_counter_read(&percpu_counter) != total ||
+       atomic_load(&atomic_counter) != total)
+        atomic_fetch_add(&errors, 1);
+
+    MCHECK(mthread_percpu_counter_destroy(&percpu_counter));
+    MCHECK(mthread_percpu_freelist_destroy(&percpu_list));
+    MCHECK(mthread_percpu_slots_destroy(&percpu_slots));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", atomic_load(&errors));
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Per-CPU Data Structures\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * Priority inversion scenario for priority inheritance mutexes. All threads
+ * are SCHED_FIFO and pinned to one CPU. A low priority thread takes the mutex
+ * for a short critical section, a high priority thread then blocks on it, and
+ * a medium priority thread starts burning the CPU. With a plain mutex the
+ * medium thread keeps the owner off the CPU, so the high priority thread waits
+ * for as long as the medium one spins. With priority inheritance the kernel
+ * boosts the owner, and the wait is bounded by the critical section.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define PRIO_LOW        10
+#define PRIO_MEDIUM     20
+#define PRIO_HIGH       30
+#define PRIO_MAIN       40
+#define CRITICAL_MS     20
+#define SPIN_MS         300
+#define BOUND_MS        (3 * CRITICAL_MS)
+
+mthread_mutex_t mutex;
+volatile int holding, blocking;
+long latency_ms;
+
+int set_fifo(int priority) {
+    struct sched_param param = { .sched_priority = priority };
+    return sched_setscheduler(0, SCHED_FIFO, &param);
+}
+
+long now_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Spins for ms of CPU time of its own, so preemption stretches it */
+void *low(void *arg) {
+    set_fifo(PRIO_LOW);
+    mthread_mutex_lock(&mutex);
+    holding = 1;
+    long start = now_ms(CLOCK_THREAD_CPUTIME_ID);
+    while(now_ms(CLOCK_THREAD_CPUTIME_ID) - start < CRITICAL_MS);
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+void *medium(void *arg) {
+    set_fifo(PRIO_MEDIUM);
+    long start = now_ms(CLOCK_MONOTONIC);
+    while(now_ms(CLOCK_MONOTONIC) - start < SPIN_MS);
+    return NULL;
+}
+
+void *high(void *arg) {
+    set_fifo(PRIO_HIGH);
+    blocking = 1;
+    long start = now_ms(CLOCK_MONOTONIC);
+    mthread_mutex_lock(&mutex);
+    latency_ms = now_ms(CLOCK_MONOTONIC) - start;
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+long run(int flags) {
+    mthread_t l, m, h;
+
+    MCHECK(mthread_mutex_init_flags(&mutex, flags));
+    holding = blocking = 0;
+
+    MCHECK(mthread_create(&l, NULL, low, NULL));
+    while(!holding)
+        usleep(1000);
+
+    MCHECK(mthread_create(&h, NULL, high, NULL));
+    while(!blocking)
+        usleep(1000);
+    usleep(1000);
+
+    MCHECK(mthread_create(&m, NULL, medium, NULL));
+
+    MCHECK(mthread_join(h, NULL));
+    MCHECK(mthread_join(m, NULL));
+    MCHECK(mthread_join(l, NULL));
+    return latency_ms;
+}
+
+int main(int argc, char **argv) {
+    long plain, pi;
+    cpu_set_t cpus;
+    struct timespec ts;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Priority Inheritance Mutex\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+
+    MCHECK(mthread_mutex_init_flags(&mutex, MTHREAD_MUTEX_PI));
+    MCHECK(mthread_mutex_lock(&mutex));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec++;
+    if(mthread_mutex_trylock(&mutex) != EBUSY ||
+       mthread_mutex_timedlock(&mutex, &ts) != EDEADLK) {
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    MCHECK(mthread_mutex_unlock(&mutex));
+
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    if(sched_setaffinity(0, sizeof(cpus), &cpus) == -1 || set_fifo(PRIO_MAIN) == -1) {
+        fprintf(stdout, "SCHED_FIFO not permitted, skipping\n");
+        fprintf(stdout, "TEST PASSED\n");
+        return 0;
+    }
+
+    plain = run(MTHREAD_MUTEX_DEFAULT);
+    fprintf(stdout, "Plain mutex    : high priority thread waited %4ld ms\n", plain);
+    pi = run(MTHREAD_MUTEX_PI);
+    fprintf(stdout, "PI mutex       : high priority thread waited %4ld ms\n", pi);
+    fprintf(stdout, "Critical section = %d ms, Medium spin = %d ms\n",
+            CRITICAL_MS, SPIN_MS);
+
+    if(pi <= BOUND_MS) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Priority Inheritance Mutex\n");
+    return 0;
+}
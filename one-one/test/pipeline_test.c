@@ -0,0 +1,213 @@
+/**
+ * Pipeline. A compression-style job reads a buffer in chunks in a serial
+ * stage, compresses them with run-length encoding in a parallel stage and
+ * writes them out in a serial in-order stage. The output must match that
+ * of a plain loop, which is timed too, and the chunks in flight must never
+ * exceed the tokens. A second pipeline drops every third item in a parallel
+ * stage and counts the rest in a serial out-of-order stage.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define INPUT_SIZE  (16 << 20)
+#define CHUNK_SIZE  (64 << 10)
+#define NUM_TOKENS  8
+#define NUM_WORKERS 4
+#define NUM_ITEMS   10000
+
+/// Chunk of the input and its compressed form
+struct chunk {
+    long index;
+    unsigned char *data, *out;
+    size_t size, out_size;
+};
+
+unsigned char *input, *output, *expected;
+size_t read_pos, output_size, expected_size;
+long next_index, written, in_flight, max_in_flight, counted;
+int errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Run-length encode size bytes of src into dst as (count, byte) pairs,
+ * several times over to make the work heavier
+ */
+size_t compress(const unsigned char *src, size_t size, unsigned char *dst) {
+    size_t i, j, n = 0;
+    int pass;
+
+    for(pass = 0; pass < 4; pass++) {
+        for(i = 0, n = 0; i < size; i = j) {
+            for(j = i + 1; j < size && j - i < 255 && src[j] == src[i]; j++)
+                ;
+            dst[n++] = j - i;
+            dst[n++] = src[i];
+        }
+    }
+    return n;
+}
+
+void *read_chunk(void *item, void *arg) {
+    struct chunk *c;
+
+    if(read_pos == INPUT_SIZE)
+        return NULL;
+    c = malloc(sizeof(struct chunk));
+    c->index = next_index++;
+    c->data = input + read_pos;
+    c->size = CHUNK_SIZE;
+    read_pos += CHUNK_SIZE;
+    if(__atomic_add_fetch(&in_flight, 1, __ATOMIC_RELAXED) > max_in_flight)
+        max_in_flight = in_flight;
+    return c;
+}
+
+void *compress_chunk(void *item, void *arg) {
+    struct chunk *c = item;
+
+    c->out = malloc(2 * c->size);
+    c->out_size = compress(c->data, c->size, c->out);
+    return c;
+}
+
+void *write_chunk(void *item, void *arg) {
+    struct chunk *c = item;
+
+    if(c->index != written++)
+        errors++;
+    memcpy(output + output_size, c->out, c->out_size);
+    output_size += c->out_size;
+    free(c->out);
+    free(c);
+    __atomic_sub_fetch(&in_flight, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void *generate(void *item, void *arg) {
+    if(next_index == NUM_ITEMS)
+        return NULL;
+    return (void *)++next_index;
+}
+
+void *drop_thirds(void *item, void *arg) {
+    return (long)item % 3 == 0 ? NULL : item;
+}
+
+void *count(void *item, void *arg) {
+    counted += (long)item;
+    return NULL;
+}
+
+void run(const char *name, int nworkers) {
+    mthread_pipeline_t pipeline;
+    struct timespec start, end;
+
+    read_pos = output_size = 0;
+    next_index = written = max_in_flight = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_pipeline_init(&pipeline, NUM_TOKENS));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_SERIAL_IN_ORDER,
+                                      read_chunk, NULL));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_PARALLEL,
+                                      compress_chunk, NULL));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_SERIAL_IN_ORDER,
+                                      write_chunk, NULL));
+    MCHECK(mthread_pipeline_run(&pipeline, nworkers));
+    MCHECK(mthread_pipeline_destroy(&pipeline));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stdout, "%-20s: %.3f s, at most %ld chunks in flight\n", name,
+            seconds(&start, &end), max_in_flight);
+    if(output_size != expected_size || memcmp(output, expected, output_size) ||
+       written != INPUT_SIZE / CHUNK_SIZE || max_in_flight > NUM_TOKENS)
+        errors++;
+}
+
+int main(int argc, char **argv) {
+    mthread_pipeline_t pipeline;
+    struct timespec start, end;
+    unsigned int seed = 1;
+    size_t i;
+    long sum, n;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Pipeline\n");
+    fprintf(stdout, "%d MB in %d KB chunks, %d tokens\n",
+            INPUT_SIZE >> 20, CHUNK_SIZE >> 10, NUM_TOKENS);
+
+    input = malloc(INPUT_SIZE);
+    output = malloc(2 * INPUT_SIZE);
+    expected = malloc(2 * INPUT_SIZE);
+    for(i = 0; i < INPUT_SIZE; i++)
+        input[i] = rand_r(&seed) % 16 < 12 && i > 0 ? input[i - 1] : rand_r(&seed);
+
+    /* Plain loop */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0, expected_size = 0; i < INPUT_SIZE; i += CHUNK_SIZE)
+        expected_size += compress(input + i, CHUNK_SIZE, expected + expected_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-20s: %.3f s, %zu bytes out\n", "Loop",
+            seconds(&start, &end), expected_size);
+
+    /* Pipelines */
+    run("Pipeline, 1 worker", 1);
+    run("Pipeline, 4 workers", NUM_WORKERS);
+
+    /* Dropped items, out-of-order stage */
+    next_index = 0;
+    MCHECK(mthread_pipeline_init(&pipeline, NUM_TOKENS));
+    if(mthread_pipeline_run(&pipeline, 1) != EINVAL ||
+       mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_PARALLEL, generate, NULL) != EINVAL ||
+       mthread_pipeline_add_stage(&pipeline, 3, generate, NULL) != EINVAL)
+        errors++;
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_SERIAL_OUT_OF_ORDER,
+                                      generate, NULL));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_PARALLEL,
+                                      drop_thirds, NULL));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_SERIAL_IN_ORDER,
+                                      drop_thirds, NULL));
+    MCHECK(mthread_pipeline_add_stage(&pipeline, MTHREAD_PIPELINE_SERIAL_OUT_OF_ORDER,
+                                      count, NULL));
+    MCHECK(mthread_pipeline_run(&pipeline, NUM_WORKERS));
+    MCHECK(mthread_pipeline_destroy(&pipeline));
+    for(n = 1, sum = 0; n <= NUM_ITEMS; n++)
+        if(n % 3 != 0)
+            sum += n;
+    fprintf(stdout, "Sum of items kept = %ld, expected %ld\n", counted, sum);
+    if(counted != sum)
+        errors++;
+
+    free(input);
+    free(output);
+    free(expected);
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Pipeline\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * Work-stealing thread pool. Fine-grained tasks of 1 to 10 us each are run
+ * through the pool, one submission at a time and then as a batch, and
+ * against creating and joining a thread per task. Every task must run once.
+ * Tasks then compute Fibonacci numbers recursively, each submitting its two
+ * halves and waiting for them, which must neither deadlock nor lose a task.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_WORKERS     4
+#define NUM_TASKS       20000
+#define NUM_THREADS     5000
+#define FIB_N           20
+#define FIB_RESULT      6765
+
+mthread_pool_t pool;
+int done[NUM_TASKS];
+int errors;
+
+/// Argument of a Fibonacci task
+struct fib {
+    int n;
+    long result;
+};
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Spin for 1 to 10 us, depending on the task
+ */
+void work(void *arg) {
+    long id = (long)arg;
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while(seconds(&start, &now) < (1 + id % 10) / 1e6);
+    __atomic_fetch_add(&done[id], 1, __ATOMIC_RELAXED);
+}
+
+void *work_thread(void *arg) {
+    work(arg);
+    return NULL;
+}
+
+void fib(void *arg) {
+    struct fib *f = arg, left, right;
+    mthread_task_group_t group = MTHREAD_TASK_GROUP_INITIALIZER;
+
+    if(f->n < 2) {
+        f->result = f->n;
+        return;
+    }
+    left.n = f->n - 1;
+    right.n = f->n - 2;
+    MCHECK(mthread_pool_submit(&pool, &group, fib, &left));
+    MCHECK(mthread_pool_submit(&pool, &group, fib, &right));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    f->result = left.result + right.result;
+}
+
+void destroy_from_worker(void *arg) {
+    if(mthread_pool_destroy(&pool) != EDEADLK)
+        errors++;
+}
+
+/**
+ * Check that each of the first n tasks ran once, and clear the counts
+ */
+void check(int n) {
+    int i;
+
+    for(i = 0; i < n; i++) {
+        if(done[i] != 1)
+            errors++;
+        done[i] = 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    mthread_task_group_t group = MTHREAD_TASK_GROUP_INITIALIZER;
+    struct timespec start, end;
+    static void *args[NUM_TASKS];
+    mthread_t tid;
+    struct fib f;
+    long i;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Thread Pool\n");
+    fprintf(stdout, "%d workers, tasks of 1 to 10 us\n", NUM_WORKERS);
+
+    MCHECK(mthread_pool_init(&pool, NUM_WORKERS));
+    if(mthread_pool_submit(&pool, NULL, NULL, NULL) != EINVAL ||
+       mthread_pool_submit_batch(&pool, NULL, work, args, -1) != EINVAL)
+        errors++;
+
+    /* One submission per task */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_TASKS; i++)
+        MCHECK(mthread_pool_submit(&pool, &group, work, (void *)i));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Pool, submit      : %.3f s, %.2f us per task\n",
+            seconds(&start, &end), seconds(&start, &end) * 1e6 / NUM_TASKS);
+    check(NUM_TASKS);
+
+    /* One batch */
+    for(i = 0; i < NUM_TASKS; i++)
+        args[i] = (void *)i;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_pool_submit_batch(&pool, &group, work, args, NUM_TASKS));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Pool, batch       : %.3f s, %.2f us per task\n",
+            seconds(&start, &end), seconds(&start, &end) * 1e6 / NUM_TASKS);
+    check(NUM_TASKS);
+
+    /* A thread per task */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_THREADS; i++) {
+        MCHECK(mthread_create(&tid, NULL, work_thread, (void *)i));
+        MCHECK(mthread_join(tid, NULL));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "Create and join   : %.3f s, %.2f us per task\n",
+            seconds(&start, &end), seconds(&start, &end) * 1e6 / NUM_THREADS);
+    check(NUM_THREADS);
+
+    /* Nested submission */
+    f.n = FIB_N;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_pool_submit(&pool, &group, fib, &f));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "fib(%d) = %ld in %.3f s\n", FIB_N, f.result, seconds(&start, &end));
+    if(f.result != FIB_RESULT)
+        errors++;
+
+    MCHECK(mthread_pool_submit(&pool, &group, destroy_from_worker, NULL));
+    MCHECK(mthread_pool_wait(&pool, &group));
+    MCHECK(mthread_pool_destroy(&pool));
+
+    /* Tasks left at destruction still run */
+    MCHECK(mthread_pool_init(&pool, 0));
+    for(i = 0; i < 100; i++)
+        MCHECK(mthread_pool_submit(&pool, NULL, work, (void *)i));
+    MCHECK(mthread_pool_destroy(&pool));
+    check(100);
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Thread Pool\n");
+    return 0;
+}
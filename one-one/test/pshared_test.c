@@ -0,0 +1,324 @@
+/**
+ * Process-shared primitives in a memfd mapped by a parent and a forked
+ * child. The two play ping-pong with a pair of semaphores, and then with a
+ * mutex and condition variable, against the same over a pair of pipes, to
+ * measure round trips. A child then dies holding a robust mutex: the
+ * parent must get EOWNERDEAD, and the mutex must work again once made
+ * consistent, or refuse with ENOTRECOVERABLE if it was not. The same is
+ * checked for a thread that exits holding one. Before that, robust mutexes
+ * are contended by several threads, and the shared one by several
+ * processes, which must all get through without losing a count.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define ROUNDS  50000
+#define CONTENDERS  4
+#define LOCKS       20000
+
+/// State shared by the processes
+struct shared {
+    mthread_sem_t ping, pong;
+    mthread_mutex_t mutex;
+    mthread_cond_t cond;
+    mthread_mutex_robust_t robust;
+    int turn;
+    long counter;
+};
+
+struct shared *shm;
+int errors;
+long count;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void report(const char *name, struct timespec *start, struct timespec *end) {
+    fprintf(stdout, "%-18s: %.3f s, %.2f us per round trip\n", name,
+            seconds(start, end), seconds(start, end) * 1e6 / ROUNDS);
+}
+
+/**
+ * Wait for the child and check that it exited cleanly
+ */
+void reap(pid_t pid) {
+    int status;
+
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errors++;
+}
+
+void sem_pingpong(void) {
+    struct timespec start, end;
+    pid_t pid;
+    int i;
+
+    shm->counter = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((pid = fork()) == 0) {
+        for(i = 0; i < ROUNDS; i++) {
+            mthread_sem_wait(&shm->ping);
+            shm->counter++;
+            mthread_sem_post(&shm->pong);
+        }
+        _exit(0);
+    }
+    for(i = 0; i < ROUNDS; i++) {
+        mthread_sem_post(&shm->ping);
+        mthread_sem_wait(&shm->pong);
+    }
+    reap(pid);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report("Semaphores", &start, &end);
+    if(shm->counter != ROUNDS)
+        errors++;
+}
+
+void cond_pingpong(void) {
+    struct timespec start, end;
+    pid_t pid;
+    int i;
+
+    shm->turn = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((pid = fork()) == 0) {
+        for(i = 0; i < ROUNDS; i++) {
+            mthread_mutex_lock(&shm->mutex);
+            while(shm->turn != 1)
+                mthread_cond_wait(&shm->cond, &shm->mutex);
+            shm->turn = 0;
+            mthread_cond_signal(&shm->cond);
+            mthread_mutex_unlock(&shm->mutex);
+        }
+        _exit(0);
+    }
+    for(i = 0; i < ROUNDS; i++) {
+        mthread_mutex_lock(&shm->mutex);
+        shm->turn = 1;
+        mthread_cond_signal(&shm->cond);
+        while(shm->turn != 0)
+            mthread_cond_wait(&shm->cond, &shm->mutex);
+        mthread_mutex_unlock(&shm->mutex);
+    }
+    reap(pid);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    report("Mutex and condvar", &start, &end);
+}
+
+void pipe_pingpong(void) {
+    struct timespec start, end;
+    int ping[2], pong[2], i;
+    char c = 0;
+    pid_t pid;
+
+    if(pipe(ping) == -1 || pipe(pong) == -1)
+        exit(-1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((pid = fork()) == 0) {
+        for(i = 0; i < ROUNDS; i++) {
+            if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+                _exit(1);
+        }
+        _exit(0);
+    }
+    for(i = 0; i < ROUNDS; i++) {
+        if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+            errors++;
+    }
+    reap(pid);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(ping[0]); close(ping[1]); close(pong[0]); close(pong[1]);
+
+    report("Pipes", &start, &end);
+}
+
+/**
+ * Lock and unlock the robust mutex in a loop, yielding now and then while
+ * holding it so that the others have to sleep
+ */
+void contend(mthread_mutex_t *mutex, long *counter) {
+    int i;
+
+    for(i = 0; i < LOCKS; i++) {
+        if(mthread_mutex_lock(mutex) != 0)
+            _exit(1);
+        (*counter)++;
+        if(i % 64 == 0)
+            mthread_yield();
+        mthread_mutex_unlock(mutex);
+    }
+}
+
+void *thread_contend(void *arg) {
+    contend(arg, &count);
+    return NULL;
+}
+
+/**
+ * Contend for a private robust mutex with threads, and for the shared one
+ * with processes
+ */
+void robust_contention(mthread_mutex_robust_t *local) {
+    mthread_t tids[CONTENDERS];
+    pid_t pids[CONTENDERS];
+    int i;
+
+    count = 0;
+    for(i = 0; i < CONTENDERS; i++)
+        MCHECK(mthread_create(&tids[i], NULL, thread_contend, &local->mutex));
+    for(i = 0; i < CONTENDERS; i++)
+        MCHECK(mthread_join(tids[i], NULL));
+    if(count != CONTENDERS * LOCKS)
+        errors++;
+
+    shm->counter = 0;
+    for(i = 0; i < CONTENDERS; i++) {
+        if((pids[i] = fork()) == 0) {
+            contend(&shm->robust.mutex, &shm->counter);
+            _exit(0);
+        }
+    }
+    for(i = 0; i < CONTENDERS; i++)
+        reap(pids[i]);
+    if(shm->counter != CONTENDERS * LOCKS)
+        errors++;
+    fprintf(stdout, "Robust mutexes contended by %d threads and %d processes\n",
+            CONTENDERS, CONTENDERS);
+}
+
+/**
+ * Die in a child process holding the robust mutex
+ */
+void die_holding(void) {
+    pid_t pid;
+
+    if((pid = fork()) == 0) {
+        if(mthread_mutex_lock(&shm->robust.mutex) != 0)
+            _exit(1);
+        shm->counter = -1;
+        _exit(0);
+    }
+    reap(pid);
+}
+
+void *thread_die_holding(void *arg) {
+    mthread_mutex_lock(arg);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    mthread_mutex_robust_t local;
+    mthread_t tid;
+    int fd;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Process-shared Primitives\n");
+    fprintf(stdout, "%d round trips between two processes\n", ROUNDS);
+
+    fd = memfd_create("pshared_test", 0);
+    if(fd == -1 || ftruncate(fd, sizeof(struct shared)) == -1)
+        exit(-1);
+    shm = mmap(NULL, sizeof(struct shared), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if(shm == MAP_FAILED)
+        exit(-1);
+
+    MCHECK(mthread_sem_init_flags(&shm->ping, 0, MTHREAD_SEM_PSHARED));
+    MCHECK(mthread_sem_init_flags(&shm->pong, 0, MTHREAD_SEM_PSHARED));
+    MCHECK(mthread_mutex_init_flags(&shm->mutex, MTHREAD_MUTEX_PSHARED));
+    MCHECK(mthread_cond_init_flags(&shm->cond, MTHREAD_COND_PSHARED));
+    MCHECK(mthread_mutex_robust_init(&shm->robust, MTHREAD_MUTEX_PSHARED));
+
+    /* Flags */
+    if(mthread_sem_init_flags(&shm->ping, 0, 2) != EINVAL ||
+       mthread_cond_init_flags(&shm->cond, 2) != EINVAL ||
+       mthread_mutex_init_flags(&local.mutex, 8) != EINVAL ||
+       mthread_mutex_init_flags(&local.mutex, MTHREAD_MUTEX_ROBUST) != EINVAL ||
+       mthread_mutex_robust_init(&local, MTHREAD_MUTEX_PI) != EINVAL)
+        errors++;
+
+    /* Plain mutexes carry no robust list link */
+    if(sizeof(mthread_mutex_t) != 2 * sizeof(int))
+        errors++;
+
+    /* Ping-pong */
+    sem_pingpong();
+    cond_pingpong();
+    pipe_pingpong();
+
+    /* Contention */
+    MCHECK(mthread_mutex_robust_init(&local, MTHREAD_MUTEX_DEFAULT));
+    robust_contention(&local);
+
+    /* Owner dies, state repaired */
+    die_holding();
+    if(mthread_mutex_lock(&shm->robust.mutex) != EOWNERDEAD || shm->counter != -1)
+        errors++;
+    shm->counter = 0;
+    MCHECK(mthread_mutex_consistent(&shm->robust.mutex));
+    MCHECK(mthread_mutex_unlock(&shm->robust.mutex));
+    MCHECK(mthread_mutex_lock(&shm->robust.mutex));
+    if(mthread_mutex_consistent(&shm->robust.mutex) != EINVAL)
+        errors++;
+    MCHECK(mthread_mutex_unlock(&shm->robust.mutex));
+    fprintf(stdout, "Robust mutex recovered after its owner died\n");
+
+    /* Owner dies, state not repaired */
+    die_holding();
+    if(mthread_mutex_trylock(&shm->robust.mutex) != EOWNERDEAD)
+        errors++;
+    MCHECK(mthread_mutex_unlock(&shm->robust.mutex));
+    if(mthread_mutex_lock(&shm->robust.mutex) != ENOTRECOVERABLE ||
+       mthread_mutex_trylock(&shm->robust.mutex) != ENOTRECOVERABLE)
+        errors++;
+    fprintf(stdout, "Robust mutex unrecoverable when not made consistent\n");
+
+    /* Thread exits holding a private robust mutex */
+    MCHECK(mthread_mutex_robust_init(&local, MTHREAD_MUTEX_DEFAULT));
+    MCHECK(mthread_create(&tid, NULL, thread_die_holding, &local.mutex));
+    MCHECK(mthread_join(tid, NULL));
+    if(mthread_mutex_lock(&local.mutex) != EOWNERDEAD)
+        errors++;
+    MCHECK(mthread_mutex_consistent(&local.mutex));
+    MCHECK(mthread_mutex_unlock(&local.mutex));
+    if(mthread_mutex_unlock(&local.mutex) != EPERM)
+        errors++;
+    fprintf(stdout, "Robust mutex recovered after its thread exited\n");
+
+    munmap(shm, sizeof(struct shared));
+    close(fd);
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Process-shared Primitives\n");
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * Benchmark of RCU against reader-writer locks for a read-mostly,
+ * pointer-swapped structure. Reader threads look up a shared config record
+ * while a writer replaces it every millisecond, reclaiming the old record
+ * with mthread_call_rcu() and, every other time, mthread_synchronize_rcu().
+ * Reclaimed records are poisoned and kept until the end of the run, so a
+ * reader that is handed one after its grace period is caught. Read
+ * throughput is reported for the epoch and QSBR flavors and the rwlock, for
+ * up to twice the number of online CPUs.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define MAX_THREADS 64
+#define CONFIG_VALUES 6
+#define LIVE 0x1c0ffee
+#define DEAD 0xdeadbee
+
+enum { EPOCH, QSBR, RWLOCK, NMODES };
+
+const char *mode_names[NMODES] = { "RCU epoch", "RCU QSBR", "mthread_rwlock_t" };
+
+/* Config record, replaced as a whole */
+struct config {
+    mthread_rcu_head_t rcu;
+    long magic;
+    long generation;
+    long values[CONFIG_VALUES];
+    struct config *next_dead;
+};
+
+/* Per-reader counters, each on its own cache line */
+struct reader {
+    long reads;
+    long bad;
+    int mode;
+} __attribute__((aligned(64)));
+
+struct config *current;
+struct config *graveyard;
+long replaced, reclaimed;
+struct reader readers[MAX_THREADS];
+mthread_rwlock_t rwlock;
+volatile int running;
+
+struct config *new_config(long generation) {
+    struct config *c = malloc(sizeof(struct config));
+
+    c->magic = LIVE;
+    c->generation = generation;
+    for(int i = 0; i < CONFIG_VALUES; i++)
+        c->values[i] = generation + i;
+    return c;
+}
+
+/* Poisons the record but keeps it, so a late reader is caught */
+void bury(struct config *c) {
+    c->magic = DEAD;
+    c->next_dead = graveyard;
+    graveyard = c;
+    reclaimed++;
+}
+
+void reclaim_config(mthread_rcu_head_t *head) {
+    bury((struct config *)head);
+}
+
+int valid(struct config *c) {
+    if(c->magic != LIVE)
+        return 0;
+    for(int i = 0; i < CONFIG_VALUES; i++)
+        if(c->values[i] != c->generation + i)
+            return 0;
+    return 1;
+}
+
+void *reader(void *arg) {
+    struct reader *r = arg;
+    struct config *c;
+
+    if(r->mode == QSBR)
+        mthread_rcu_thread_online();
+
+    while(running) {
+        if(r->mode == RWLOCK) {
+            mthread_rwlock_rdlock(&rwlock);
+            if(!valid(current))
+                r->bad++;
+            mthread_rwlock_unlock(&rwlock);
+        }
+        else {
+            mthread_rcu_read_lock();
+            c = mthread_rcu_dereference(current);
+            if(!valid(c))
+                r->bad++;
+            mthread_rcu_read_unlock();
+            if(r->mode == QSBR && (r->reads & 63) == 0)
+                mthread_rcu_quiescent_state();
+        }
+        r->reads++;
+    }
+
+    if(r->mode == QSBR)
+        mthread_rcu_thread_offline();
+    return NULL;
+}
+
+void *writer(void *arg) {
+    int mode = (long)arg;
+    long generation = 0;
+    struct config *old, *next;
+
+    while(running) {
+        next = new_config(++generation);
+        if(mode == RWLOCK) {
+            mthread_rwlock_wrlock(&rwlock);
+            old = current;
+            current = next;
+            mthread_rwlock_unlock(&rwlock);
+            bury(old);
+        }
+        else {
+            old = current;
+            mthread_rcu_assign_pointer(current, next);
+            if(generation & 1) {
+                MCHECK(mthread_call_rcu(&old->rcu, reclaim_config));
+            }
+            else {
+                MCHECK(mthread_synchronize_rcu());
+                bury(old);
+            }
+        }
+        replaced++;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+long run(int mode, int nthreads, int ms, int *errors) {
+    mthread_t tid[MAX_THREADS], writer_tid;
+    struct config *c;
+    long reads = 0;
+    int i;
+
+    current = new_config(0);
+    replaced = reclaimed = 0;
+    running = 1;
+    for(i = 0; i < nthreads; i++) {
+        memset(&readers[i], 0, sizeof(struct reader));
+        readers[i].mode = mode;
+        MCHECK(mthread_create(&tid[i], NULL, reader, &readers[i]));
+    }
+    MCHECK(mthread_create(&writer_tid, NULL, writer, (void *)(long)mode));
+
+    usleep(ms * 1000);
+    running = 0;
+
+    MCHECK(mthread_join(writer_tid, NULL));
+    for(i = 0; i < nthreads; i++) {
+        MCHECK(mthread_join(tid[i], NULL));
+        reads   += readers[i].reads;
+        *errors += readers[i].bad;
+    }
+
+    /* Every replaced record has been reclaimed once the callbacks ran */
+    if(mode != RWLOCK)
+        MCHECK(mthread_rcu_barrier());
+    if(reclaimed != replaced)
+        (*errors)++;
+
+    while((c = graveyard) != NULL) {
+        graveyard = c->next_dead;
+        free(c);
+    }
+    free(current);
+    return reads * 1000 / ms;
+}
+
+int main(int argc, char **argv) {
+    int ms = 200, mode, n, max_threads, errors = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(argc == 2)
+        ms = atoi(argv[1]);
+
+    max_threads = 2 * cpus < MAX_THREADS ? 2 * cpus : MAX_THREADS;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Read-Copy-Update\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Online CPUs = %ld, %d ms per run\n", cpus, ms);
+
+    mthread_init();
+    MCHECK(mthread_rwlock_init(&rwlock, MTHREAD_RWLOCK_PREFER_READER));
+
+    if(mthread_rcu_init(2) != EINVAL)
+        errors++;
+
+    /* A grace period can not complete inside a critical section of its own */
+    MCHECK(mthread_rcu_init(MTHREAD_RCU_EPOCH));
+    mthread_rcu_read_lock();
+    mthread_rcu_read_lock();
+    mthread_rcu_read_unlock();
+    if(mthread_synchronize_rcu() != EDEADLK)
+        errors++;
+    mthread_rcu_read_unlock();
+    MCHECK(mthread_synchronize_rcu());
+
+    fprintf(stdout, "%-20s", "Readers");
+    for(n = 1; n <= max_threads; n *= 2)
+        fprintf(stdout, "%12d", n);
+    fprintf(stdout, "\n");
+
+    for(mode = 0; mode < NMODES; mode++) {
+        if(mode != RWLOCK)
+            MCHECK(mthread_rcu_init(mode == QSBR ? MTHREAD_RCU_QSBR : MTHREAD_RCU_EPOCH));
+        fprintf(stdout, "%-20s", mode_names[mode]);
+        for(n = 1; n <= max_threads; n *= 2) {
+            fprintf(stdout, "%12ld", run(mode, n, ms, &errors));
+            fflush(stdout);
+        }
+        fprintf(stdout, "  reads/s\n");
+    }
+
+    MCHECK(mthread_rwlock_destroy(&rwlock));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Read-Copy-Update\n");
+    return 0;
+}
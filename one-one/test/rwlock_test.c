@@ -0,0 +1,180 @@
+/**
+ * Example code and benchmark for reader-writer locks. Threads look up a
+ * shared table, and update it 1% of the time. Every entry of the table is
+ * updated together, so a reader that ever sees differing entries means the
+ * lock failed to exclude a writer. The same workload is run under a mutex and
+ * under every reader-writer lock mode, with increasing numbers of threads.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define MAX_THREADS 16
+#define TABLE_SIZE  16
+#define WRITE_PCT   1
+
+enum { MUTEX, READER, WRITER, SCALABLE, NLOCKS };
+
+const char *lock_names[NLOCKS] = {
+    "mutex", "rwlock (prefer reader)", "rwlock (prefer writer)", "rwlock (scalable)"
+};
+
+/* Per-thread counters, each on its own cache line */
+struct worker {
+    long ops;
+    long torn;
+    unsigned seed;
+    int lock;
+} __attribute__((aligned(64)));
+
+struct worker workers[MAX_THREADS];
+volatile int running;
+volatile long table[TABLE_SIZE];
+mthread_mutex_t mutex;
+mthread_rwlock_t rwlock;
+
+static inline unsigned next_rand(unsigned *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+void *worker(void *arg) {
+    struct worker *w = arg;
+    int i, write;
+
+    while(running) {
+        write = next_rand(&w->seed) % 100 < WRITE_PCT;
+
+        if(w->lock == MUTEX)
+            mthread_mutex_lock(&mutex);
+        else if(write)
+            mthread_rwlock_wrlock(&rwlock);
+        else
+            mthread_rwlock_rdlock(&rwlock);
+
+        if(write) {
+            for(i = 0; i < TABLE_SIZE; i++)
+                table[i]++;
+        }
+        else {
+            for(i = 1; i < TABLE_SIZE; i++)
+                if(table[i] != table[0])
+                    w->torn++;
+        }
+
+        if(w->lock == MUTEX)
+            mthread_mutex_unlock(&mutex);
+        else
+            mthread_rwlock_unlock(&rwlock);
+
+        w->ops++;
+    }
+    return NULL;
+}
+
+long run(int lock, int nthreads, int ms, long *torn) {
+    mthread_t tid[MAX_THREADS];
+    long ops = 0;
+    int i;
+
+    mthread_mutex_init(&mutex);
+    if(lock == READER)
+        MCHECK(mthread_rwlock_init(&rwlock, MTHREAD_RWLOCK_PREFER_READER));
+    if(lock == WRITER)
+        MCHECK(mthread_rwlock_init(&rwlock, MTHREAD_RWLOCK_PREFER_WRITER));
+    if(lock == SCALABLE)
+        MCHECK(mthread_rwlock_init(&rwlock, MTHREAD_RWLOCK_SCALABLE));
+
+    running = 1;
+    for(i = 0; i < nthreads; i++) {
+        memset(&workers[i], 0, sizeof(struct worker));
+        workers[i].seed = i + 1;
+        workers[i].lock = lock;
+        MCHECK(mthread_create(&tid[i], NULL, worker, &workers[i]));
+    }
+
+    usleep(ms * 1000);
+    running = 0;
+
+    for(i = 0; i < nthreads; i++) {
+        MCHECK(mthread_join(tid[i], NULL));
+        ops   += workers[i].ops;
+        *torn += workers[i].torn;
+    }
+
+    if(lock != MUTEX)
+        MCHECK(mthread_rwlock_destroy(&rwlock));
+
+    return ops * 1000 / ms;
+}
+
+int main(int argc, char **argv) {
+    int ms = 200, lock, n;
+    long torn = 0;
+    mthread_rwlock_t rw;
+
+    if(argc == 2)
+        ms = atoi(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Thread Reader-Writer Locks\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Online CPUs = %ld, %d%% writes, %d ms per run\n",
+            sysconf(_SC_NPROCESSORS_ONLN), WRITE_PCT, ms);
+
+    mthread_init();
+
+    MCHECK(mthread_rwlock_init(&rw, MTHREAD_RWLOCK_SCALABLE));
+    MCHECK(mthread_rwlock_rdlock(&rw));
+    MCHECK(mthread_rwlock_tryrdlock(&rw));
+    if(mthread_rwlock_trywrlock(&rw) != EBUSY)
+        torn++;
+    MCHECK(mthread_rwlock_unlock(&rw));
+    MCHECK(mthread_rwlock_unlock(&rw));
+    MCHECK(mthread_rwlock_trywrlock(&rw));
+    if(mthread_rwlock_tryrdlock(&rw) != EBUSY)
+        torn++;
+    MCHECK(mthread_rwlock_unlock(&rw));
+    MCHECK(mthread_rwlock_destroy(&rw));
+
+    fprintf(stdout, "%-24s", "Threads");
+    for(n = 1; n <= MAX_THREADS; n *= 2)
+        fprintf(stdout, "%12d", n);
+    fprintf(stdout, "\n");
+
+    for(lock = 0; lock < NLOCKS; lock++) {
+        fprintf(stdout, "%-24s", lock_names[lock]);
+        for(n = 1; n <= MAX_THREADS; n *= 2) {
+            fprintf(stdout, "%12ld", run(lock, n, ms, &torn));
+            fflush(stdout);
+        }
+        fprintf(stdout, "  ops/s\n");
+    }
+
+    if(torn == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Torn reads = %ld\n", torn);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Thread Reader-Writer Locks\n");
+    return 0;
+}
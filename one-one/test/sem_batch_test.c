@@ -0,0 +1,127 @@
+/**
+ * Throughput comparison of batched and single-item semaphore operations.
+ * A producer and a consumer pass items through a bounded buffer guarded by
+ * two counting semaphores, one counting free slots and one counting items.
+ * In single-item mode every item costs a wait and a post on each side; in
+ * batch mode each side takes whatever is available (up to BATCH) with
+ * mthread_sem_wait_upto() and hands it over with one mthread_sem_post_n().
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define CAPACITY 1024
+#define BATCH    256
+
+mthread_sem_t slots, items;
+long n_items = 4000000;
+int batch_mode;
+
+void *producer(void *arg) {
+    long sent = 0, got;
+
+    while(sent < n_items) {
+        if(batch_mode) {
+            got = mthread_sem_wait_upto(&slots, BATCH);
+            if(got > n_items - sent) {
+                mthread_sem_post_n(&slots, got - (n_items - sent));
+                got = n_items - sent;
+            }
+            mthread_sem_post_n(&items, got);
+        }
+        else {
+            mthread_sem_wait(&slots);
+            mthread_sem_post(&items);
+            got = 1;
+        }
+        sent += got;
+    }
+    return NULL;
+}
+
+long consume(void) {
+    long received = 0, got;
+
+    while(received < n_items) {
+        if(batch_mode) {
+            got = mthread_sem_wait_upto(&items, BATCH);
+            mthread_sem_post_n(&slots, got);
+        }
+        else {
+            mthread_sem_wait(&items);
+            mthread_sem_post(&slots);
+            got = 1;
+        }
+        received += got;
+    }
+    return received;
+}
+
+double run(int mode, long *received) {
+    struct timespec start, end;
+    mthread_t tid;
+
+    batch_mode = mode;
+    mthread_sem_init(&slots, CAPACITY);
+    mthread_sem_init(&items, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&tid, NULL, producer, NULL));
+    *received = consume();
+    MCHECK(mthread_join(tid, NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    long single_n, batch_n;
+    double single_t, batch_t;
+
+    if(argc == 2)
+        n_items = atol(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Semaphore Batch Operations\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Items = %ld, Capacity = %d, Batch = %d\n",
+            n_items, CAPACITY, BATCH);
+
+    mthread_init();
+
+    single_t = run(0, &single_n);
+    fprintf(stdout, "Single-item wait/post : %8.3f s  %12.0f items/s\n",
+            single_t, single_n / single_t);
+
+    batch_t = run(1, &batch_n);
+    fprintf(stdout, "wait_upto/post_n      : %8.3f s  %12.0f items/s\n",
+            batch_t, batch_n / batch_t);
+
+    if(batch_t > 0)
+        fprintf(stdout, "Speedup = %f\n", single_t / batch_t);
+
+    if(single_n == n_items && batch_n == n_items &&
+       mthread_sem_trywait(&items) == EAGAIN) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Semaphore Batch Operations\n");
+    return 0;
+}
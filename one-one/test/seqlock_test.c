@@ -0,0 +1,191 @@
+/**
+ * Benchmark of sequence locks against reader-writer locks for read-mostly
+ * data. Reader threads copy a 64-byte stats record over and over, while a
+ * writer replaces it every millisecond. Each word of the record is derived
+ * from the same generation, so a torn copy is caught. Read throughput is
+ * reported for up to twice the number of online CPUs.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define MAX_THREADS 64
+#define RECORD_WORDS 8
+
+enum { SEQLOCK, RWLOCK, NLOCKS };
+
+const char *lock_names[NLOCKS] = { "mthread_seqlock_t", "mthread_rwlock_t" };
+
+/* Stats snapshot, alone on its cache line */
+struct stats {
+    uint64_t words[RECORD_WORDS];
+} __attribute__((aligned(64)));
+
+/* Per-reader counters, each on its own cache line */
+struct reader {
+    long reads;
+    long torn;
+    int lock;
+} __attribute__((aligned(64)));
+
+struct stats record;
+struct reader readers[MAX_THREADS];
+mthread_seqlock_t seqlock;
+mthread_rwlock_t rwlock;
+volatile int running;
+
+void fill(struct stats *s, uint64_t generation) {
+    for(int i = 0; i < RECORD_WORDS; i++)
+        s->words[i] = generation * RECORD_WORDS + i;
+}
+
+int consistent(const struct stats *s) {
+    for(int i = 1; i < RECORD_WORDS; i++)
+        if(s->words[i] != s->words[0] + i)
+            return 0;
+    return 1;
+}
+
+void *reader(void *arg) {
+    struct reader *r = arg;
+    struct stats copy;
+
+    while(running) {
+        if(r->lock == SEQLOCK) {
+            mthread_seqlock_read(&seqlock, &copy, &record, sizeof(record));
+        }
+        else {
+            mthread_rwlock_rdlock(&rwlock);
+            memcpy(&copy, &record, sizeof(record));
+            mthread_rwlock_unlock(&rwlock);
+        }
+        if(!consistent(&copy))
+            r->torn++;
+        r->reads++;
+    }
+    return NULL;
+}
+
+void *writer(void *arg) {
+    int lock = (long)arg;
+    uint64_t generation = 0;
+    struct stats next;
+
+    while(running) {
+        fill(&next, ++generation);
+        if(lock == SEQLOCK) {
+            mthread_seqlock_write(&seqlock, &record, &next, sizeof(record));
+        }
+        else {
+            mthread_rwlock_wrlock(&rwlock);
+            memcpy(&record, &next, sizeof(record));
+            mthread_rwlock_unlock(&rwlock);
+        }
+        usleep(1000);
+    }
+    return NULL;
+}
+
+long run(int lock, int nthreads, int ms, int *errors) {
+    mthread_t tid[MAX_THREADS], writer_tid;
+    long reads = 0;
+    int i;
+
+    fill(&record, 0);
+    running = 1;
+    for(i = 0; i < nthreads; i++) {
+        memset(&readers[i], 0, sizeof(struct reader));
+        readers[i].lock = lock;
+        MCHECK(mthread_create(&tid[i], NULL, reader, &readers[i]));
+    }
+    MCHECK(mthread_create(&writer_tid, NULL, writer, (void *)(long)lock));
+
+    usleep(ms * 1000);
+    running = 0;
+
+    MCHECK(mthread_join(writer_tid, NULL));
+    for(i = 0; i < nthreads; i++) {
+        MCHECK(mthread_join(tid[i], NULL));
+        reads   += readers[i].reads;
+        *errors += readers[i].torn;
+    }
+    return reads * 1000 / ms;
+}
+
+int main(int argc, char **argv) {
+    int ms = 200, lock, n, max_threads, errors = 0;
+    unsigned int seq;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    char small[5], copy[5];
+
+    if(argc == 2)
+        ms = atoi(argv[1]);
+
+    max_threads = 2 * cpus < MAX_THREADS ? 2 * cpus : MAX_THREADS;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Sequence Locks\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Online CPUs = %ld, %d ms per run\n", cpus, ms);
+
+    mthread_init();
+    MCHECK(mthread_seqlock_init(&seqlock));
+    MCHECK(mthread_rwlock_init(&rwlock, MTHREAD_RWLOCK_PREFER_READER));
+
+    /* A write overlapping a read sends the reader back */
+    seq = mthread_seqlock_read_begin(&seqlock);
+    if(mthread_seqlock_read_retry(&seqlock, seq))
+        errors++;
+    MCHECK(mthread_seqlock_write_lock(&seqlock));
+    MCHECK(mthread_seqlock_write_unlock(&seqlock));
+    if(!mthread_seqlock_read_retry(&seqlock, seq))
+        errors++;
+
+    /* Records of odd size are copied bytewise */
+    MCHECK(mthread_seqlock_write(&seqlock, small, "abcd", sizeof(small)));
+    MCHECK(mthread_seqlock_read(&seqlock, copy, small, sizeof(small)));
+    if(strcmp(copy, "abcd") != 0)
+        errors++;
+
+    fprintf(stdout, "%-20s", "Readers");
+    for(n = 1; n <= max_threads; n *= 2)
+        fprintf(stdout, "%12d", n);
+    fprintf(stdout, "\n");
+
+    for(lock = 0; lock < NLOCKS; lock++) {
+        fprintf(stdout, "%-20s", lock_names[lock]);
+        for(n = 1; n <= max_threads; n *= 2) {
+            fprintf(stdout, "%12ld", run(lock, n, ms, &errors));
+            fflush(stdout);
+        }
+        fprintf(stdout, "  reads/s\n");
+    }
+
+    MCHECK(mthread_rwlock_destroy(&rwlock));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Sequence Locks\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * Single-producer single-consumer ring. A producer thread sends numbered
+ * messages to a consumer thread, which checks that they arrive in order:
+ * one at a time, in batches, and in blocking mode, and one at a time
+ * through the MPMC channel for comparison. Staged items must stay hidden
+ * from the consumer until committed, and the ring must hold its capacity
+ * and no more.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_MSGS        20000000
+#define CHANNEL_MSGS    (NUM_MSGS / 10)
+#define CAPACITY        4096
+#define BATCH           256
+
+enum { SINGLE, BATCHES, BLOCKING, CHANNEL };
+
+mthread_spsc_t spsc;
+mthread_channel_t channel;
+int mode, errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *produce(void *arg) {
+    long i, j, total = mode == CHANNEL ? CHANNEL_MSGS : NUM_MSGS;
+    void *msgs[BATCH];
+    int n;
+
+    for(i = 1; i <= total; ) {
+        switch(mode) {
+            case SINGLE:
+                if(mthread_spsc_trypush(&spsc, (void *)i) == 0)
+                    i++;
+                else
+                    mthread_yield();
+                break;
+            case BATCHES:
+                for(j = 0; j < BATCH; j++)
+                    msgs[j] = (void *)(i + j);
+                n = NUM_MSGS - i + 1 < BATCH ? NUM_MSGS - i + 1 : BATCH;
+                if(mthread_spsc_push_batch(&spsc, msgs, n, &n) == 0)
+                    i += n;
+                else
+                    mthread_yield();
+                break;
+            case BLOCKING:
+                MCHECK(mthread_spsc_push(&spsc, (void *)i));
+                i++;
+                break;
+            case CHANNEL:
+                MCHECK(mthread_channel_send(&channel, (void *)i));
+                i++;
+                break;
+        }
+    }
+    return NULL;
+}
+
+void *consume(void *arg) {
+    long expected = 1, total = mode == CHANNEL ? CHANNEL_MSGS : NUM_MSGS;
+    void *msgs[BATCH];
+    int i, n;
+
+    while(expected <= total) {
+        switch(mode) {
+            case SINGLE:
+                n = mthread_spsc_trypop(&spsc, msgs) == 0;
+                break;
+            case BATCHES:
+                if(mthread_spsc_pop_batch(&spsc, msgs, BATCH, &n) != 0)
+                    n = 0;
+                break;
+            case BLOCKING:
+                MCHECK(mthread_spsc_pop(&spsc, msgs));
+                n = 1;
+                break;
+            default:
+                MCHECK(mthread_channel_recv(&channel, msgs));
+                n = 1;
+                break;
+        }
+        if(n == 0)
+            mthread_yield();
+        for(i = 0; i < n; i++)
+            if((long)msgs[i] != expected++)
+                errors++;
+    }
+    return NULL;
+}
+
+void run(const char *name, int m) {
+    long total = m == CHANNEL ? CHANNEL_MSGS : NUM_MSGS;
+    struct timespec start, end;
+    mthread_t tid[2];
+
+    mode = m;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&tid[0], NULL, consume, NULL));
+    MCHECK(mthread_create(&tid[1], NULL, produce, NULL));
+    MCHECK(mthread_join(tid[1], NULL));
+    MCHECK(mthread_join(tid[0], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s, %.1f M msgs/s\n", name,
+            seconds(&start, &end), total / seconds(&start, &end) / 1e6);
+}
+
+int main(int argc, char **argv) {
+    void *item;
+    long i;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - SPSC Ring\n");
+    fprintf(stdout, "%d messages, %d through the channel, capacity %d\n",
+            NUM_MSGS, CHANNEL_MSGS, CAPACITY);
+
+    /* Throughput */
+    MCHECK(mthread_spsc_init(&spsc, CAPACITY, 0));
+    run("One at a time", SINGLE);
+    run("Batches", BATCHES);
+    MCHECK(mthread_spsc_destroy(&spsc));
+    MCHECK(mthread_spsc_init(&spsc, CAPACITY, MTHREAD_SPSC_BLOCKING));
+    run("Blocking", BLOCKING);
+    MCHECK(mthread_spsc_destroy(&spsc));
+    MCHECK(mthread_channel_init(&channel, CAPACITY));
+    run("MPMC channel", CHANNEL);
+    MCHECK(mthread_channel_destroy(&channel));
+
+    /* Staging, commit and bounds */
+    if(mthread_spsc_init(&spsc, 0, 0) != EINVAL ||
+       mthread_spsc_init(&spsc, 4, 2) != EINVAL)
+        errors++;
+    MCHECK(mthread_spsc_init(&spsc, 3, 0));
+    for(i = 0; i < 4; i++)
+        MCHECK(mthread_spsc_stage(&spsc, (void *)i));
+    if(mthread_spsc_stage(&spsc, (void *)i) != EAGAIN ||
+       mthread_spsc_trypop(&spsc, &item) != EAGAIN)
+        errors++;
+    MCHECK(mthread_spsc_commit(&spsc));
+    for(i = 0; i < 4; i++)
+        if(mthread_spsc_trypop(&spsc, &item) != 0 || item != (void *)i)
+            errors++;
+    if(mthread_spsc_trypop(&spsc, &item) != EAGAIN)
+        errors++;
+    MCHECK(mthread_spsc_destroy(&spsc));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - SPSC Ring\n");
+    return 0;
+}
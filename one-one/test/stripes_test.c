@@ -0,0 +1,164 @@
+/**
+ * Striped lock table. Each thread locks a key of its own over and over,
+ * first with an array of plain mutexes, where neighbouring mutexes share a
+ * cache line, and then with the table, whose locks are each on a line of
+ * their own. Then threads move amounts between random accounts, locking
+ * both with mthread_lock_stripes_lock_keys(); the total must be conserved
+ * and the run must not deadlock. Sizes of the aligned types are checked.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_THREADS     4
+#define NUM_OPS         2000000
+#define NUM_ACCOUNTS    1000
+#define NUM_TRANSFERS   200000
+
+mthread_lock_stripes_t stripes;
+mthread_mutex_t packed[NUM_THREADS];
+long counts[NUM_THREADS][8];
+long accounts[NUM_ACCOUNTS];
+int use_stripes, errors;
+
+double seconds(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void *own_key(void *arg) {
+    long id = (long)arg;
+    int i;
+
+    for(i = 0; i < NUM_OPS; i++) {
+        if(use_stripes) {
+            mthread_lock_stripes_lock_key(&stripes, id);
+            counts[id][0]++;
+            mthread_lock_stripes_unlock_key(&stripes, id);
+        }
+        else {
+            mthread_mutex_lock(&packed[id]);
+            counts[id][0]++;
+            mthread_mutex_unlock(&packed[id]);
+        }
+    }
+    return NULL;
+}
+
+void *transfer(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg;
+    uint64_t keys[2];
+    int i;
+
+    for(i = 0; i < NUM_TRANSFERS; i++) {
+        keys[0] = rand_r(&seed) % NUM_ACCOUNTS;
+        keys[1] = rand_r(&seed) % NUM_ACCOUNTS;
+        mthread_lock_stripes_lock_keys(&stripes, keys, 2);
+        accounts[keys[0]] -= 7;
+        accounts[keys[1]] += 7;
+        mthread_lock_stripes_unlock_keys(&stripes, keys, 2);
+    }
+    return NULL;
+}
+
+void run(const char *name, void *(*routine)(void *)) {
+    struct timespec start, end;
+    mthread_t tid[NUM_THREADS];
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_create(&tid[i], NULL, routine, (void *)i));
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stdout, "%-16s: %.3f s\n", name, seconds(&start, &end));
+}
+
+int main(int argc, char **argv) {
+    uint64_t keys[64];
+    long total = 0;
+    int i;
+
+    mthread_init();
+
+    fprintf(stdout, "Testcases - Striped Lock Tables\n");
+    fprintf(stdout, "%d threads\n", NUM_THREADS);
+
+    if(sizeof(mthread_mutex_aligned_t) != MTHREAD_CACHE_LINE ||
+       sizeof(mthread_spinlock_aligned_t) != MTHREAD_CACHE_LINE)
+        errors++;
+
+    /* Own key each */
+    for(i = 0; i < NUM_THREADS; i++)
+        MCHECK(mthread_mutex_init(&packed[i]));
+    use_stripes = 0;
+    run("Packed mutexes", own_key);
+    MCHECK(mthread_lock_stripes_init(&stripes, 0));
+    MCHECK(mthread_lock_stripes_destroy(&stripes));
+    MCHECK(mthread_lock_stripes_init(&stripes, 256));
+    use_stripes = 1;
+    run("Lock stripes", own_key);
+    for(i = 0; i < NUM_THREADS; i++)
+        if(counts[i][0] != 2L * NUM_OPS)
+            errors++;
+    MCHECK(mthread_lock_stripes_destroy(&stripes));
+
+    /* Multi-key locking, duplicates included */
+    MCHECK(mthread_lock_stripes_init(&stripes, 64));
+    for(i = 0; i < 64; i++)
+        keys[i] = i % 8;
+    MCHECK(mthread_lock_stripes_lock_keys(&stripes, keys, 64));
+    if(mthread_lock_stripes_trylock_key(&stripes, 3) != EBUSY ||
+       mthread_lock_stripes_destroy(&stripes) != EBUSY)
+        errors++;
+    MCHECK(mthread_lock_stripes_unlock_keys(&stripes, keys, 64));
+    MCHECK(mthread_lock_stripes_trylock_key(&stripes, 3));
+    MCHECK(mthread_lock_stripes_unlock_key(&stripes, 3));
+    if(mthread_lock_stripes_lock_keys(&stripes, keys, -1) != EINVAL)
+        errors++;
+    MCHECK(mthread_lock_stripes_destroy(&stripes));
+
+    /* Unlocking over several windows of stripes, duplicates included */
+    MCHECK(mthread_lock_stripes_init(&stripes, 4096));
+    for(i = 0; i < 64; i++)
+        keys[i] = (uint64_t)(i % 48) << 58;
+    MCHECK(mthread_lock_stripes_lock_keys(&stripes, keys, 64));
+    MCHECK(mthread_lock_stripes_unlock_keys(&stripes, keys, 64));
+    MCHECK(mthread_lock_stripes_destroy(&stripes));
+    MCHECK(mthread_lock_stripes_init(&stripes, 64));
+
+    /* Transfers */
+    run("Transfers", transfer);
+    for(i = 0; i < NUM_ACCOUNTS; i++)
+        total += accounts[i];
+    fprintf(stdout, "Total after %d transfers = %ld\n",
+            NUM_THREADS * NUM_TRANSFERS, total);
+    if(total != 0)
+        errors++;
+    MCHECK(mthread_lock_stripes_destroy(&stripes));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Striped Lock Tables\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * Unit testing for the timed and non-blocking variants of the mutex,
+ * condition variable and semaphore. Deadlines are absolute and measured
+ * against CLOCK_MONOTONIC. Each call is checked both for its return value and
+ * for how long it blocked.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define TIMEOUT_MS 100
+
+mthread_mutex_t mutex;
+mthread_cond_t cond;
+mthread_sem_t sem;
+volatile int holding = 0, release = 0;
+int failed = 0;
+
+/* Absolute CLOCK_MONOTONIC deadline ms milliseconds from now */
+struct timespec deadline(long ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec  += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+long elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 +
+           (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void check(const char *what, int expected, int actual) {
+    fprintf(stdout, "%-45s: Expected %-9s Actual %s\n", what,
+            expected ? strerror(expected) : "0", actual ? strerror(actual) : "0");
+    if(expected != actual)
+        failed = 1;
+}
+
+void check_time(long ms, long lower, long upper) {
+    fprintf(stdout, "%-45s: %ld ms\n", "    Blocked for", ms);
+    if(ms < lower || ms > upper)
+        failed = 1;
+}
+
+/* Holds the mutex until told to release it */
+void *holder(void *arg) {
+    mthread_mutex_lock(&mutex);
+    holding = 1;
+    while(!release);
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/* Posts the semaphore after spinning for TIMEOUT_MS */
+void *poster(void *arg) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(elapsed_ms(&start) < TIMEOUT_MS);
+    mthread_sem_post(&sem);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    struct timespec start, ts;
+    mthread_t tid;
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Timed Synchronisation Primitives\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    mthread_mutex_init(&mutex);
+    mthread_cond_init(&cond);
+    mthread_sem_init(&sem, 0);
+
+    printf("1] Mutex\n");
+    check("Trylock on unlocked mutex", 0, mthread_mutex_trylock(&mutex));
+    check("Trylock on locked mutex", EBUSY, mthread_mutex_trylock(&mutex));
+    mthread_mutex_unlock(&mutex);
+
+    MCHECK(mthread_create(&tid, NULL, holder, NULL));
+    while(!holding);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts = deadline(TIMEOUT_MS);
+    check("Timedlock on mutex held by another thread", ETIMEDOUT,
+          mthread_mutex_timedlock(&mutex, &ts));
+    check_time(elapsed_ms(&start), TIMEOUT_MS, 10 * TIMEOUT_MS);
+
+    release = 1;
+    ts = deadline(10 * TIMEOUT_MS);
+    check("Timedlock on mutex being released", 0,
+          mthread_mutex_timedlock(&mutex, &ts));
+    mthread_mutex_unlock(&mutex);
+    MCHECK(mthread_join(tid, NULL));
+
+    ts.tv_nsec = 1000000000;
+    mthread_mutex_lock(&mutex);
+    check("Timedlock with malformed deadline", EINVAL,
+          mthread_mutex_timedlock(&mutex, &ts));
+    mthread_mutex_unlock(&mutex);
+
+    printf("2] Condition Variable\n");
+    mthread_mutex_lock(&mutex);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts = deadline(TIMEOUT_MS);
+    check("Timedwait without a signal", ETIMEDOUT,
+          mthread_cond_timedwait(&cond, &mutex, &ts));
+    check_time(elapsed_ms(&start), TIMEOUT_MS, 10 * TIMEOUT_MS);
+    check("Mutex is held again after timing out", EBUSY,
+          mthread_mutex_trylock(&mutex));
+    mthread_mutex_unlock(&mutex);
+
+    printf("3] Semaphore\n");
+    check("Trywait on zero semaphore", EAGAIN, mthread_sem_trywait(&sem));
+    mthread_sem_post(&sem);
+    check("Trywait on posted semaphore", 0, mthread_sem_trywait(&sem));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ts = deadline(TIMEOUT_MS);
+    check("Timedwait on zero semaphore", ETIMEDOUT,
+          mthread_sem_timedwait(&sem, &ts));
+    check_time(elapsed_ms(&start), TIMEOUT_MS, 10 * TIMEOUT_MS);
+
+    MCHECK(mthread_create(&tid, NULL, poster, NULL));
+    ts = deadline(50 * TIMEOUT_MS);
+    check("Timedwait on semaphore posted in time", 0,
+          mthread_sem_timedwait(&sem, &ts));
+    MCHECK(mthread_join(tid, NULL));
+
+    if(failed) {
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "TEST PASSED\n");
+    fprintf(stdout, "Exit Testcases - Timed Synchronisation Primitives\n");
+    return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * Example code and benchmark for waiting on several primitives at once. The
+ * main thread waits on two semaphores, an event and a mutex with
+ * mthread_wait_any(), and each one is made available in turn by another
+ * thread. The dispatch latency is then compared against the usual workaround
+ * of one helper thread per semaphore, which forwards the index of its
+ * semaphore to the dispatcher through a shared semaphore: a producer posts
+ * one of the semaphores and waits for the dispatcher to acknowledge it.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_SEMS 4
+
+mthread_sem_t sem_a, sem_b;
+mthread_event_t event;
+mthread_mutex_t mutex;
+int errors;
+
+/* Benchmark state */
+mthread_sem_t sems[NUM_SEMS], ack, forwarded;
+volatile int forwarded_index;
+long rounds = 100000;
+int use_helpers;
+
+void *post_b(void *arg) {
+    usleep(10000);
+    mthread_sem_post(&sem_b);
+    return NULL;
+}
+
+void *set_event(void *arg) {
+    usleep(10000);
+    mthread_event_set(&event);
+    return NULL;
+}
+
+void *hold_mutex(void *arg) {
+    mthread_mutex_lock(&mutex);
+    mthread_sem_post(&sem_a);
+    usleep(20000);
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+/* Run f in a thread and check which object mthread_wait_any() takes */
+void expect(mthread_wait_object_t *objects, int n, void *(*f)(void *), int want) {
+    mthread_t tid;
+    int index = -1;
+
+    MCHECK(mthread_create(&tid, NULL, f, NULL));
+    MCHECK(mthread_wait_any(objects, n, NULL, &index));
+    MCHECK(mthread_join(tid, NULL));
+    if(index != want) {
+        fprintf(stdout, "Expected index %d, got %d\n", want, index);
+        errors++;
+    }
+}
+
+void *producer(void *arg) {
+    long i;
+
+    for(i = 0; i < rounds; i++) {
+        mthread_sem_post(&sems[i % NUM_SEMS]);
+        mthread_sem_wait(&ack);
+    }
+    return NULL;
+}
+
+void *helper(void *arg) {
+    int index = (int)(long)arg;
+
+    for(;;) {
+        mthread_sem_wait(&sems[index]);
+        if(!use_helpers)
+            return NULL;
+        forwarded_index = index;
+        mthread_sem_post(&forwarded);
+    }
+}
+
+double run(int helpers) {
+    mthread_wait_object_t objects[NUM_SEMS];
+    mthread_t tid, helper_tid[NUM_SEMS];
+    struct timespec start, end;
+    int i, index;
+    long r;
+
+    use_helpers = helpers;
+    mthread_sem_init(&ack, 0);
+    mthread_sem_init(&forwarded, 0);
+    for(i = 0; i < NUM_SEMS; i++) {
+        mthread_sem_init(&sems[i], 0);
+        objects[i].type = MTHREAD_WAIT_SEM;
+        objects[i].object = &sems[i];
+        if(helpers)
+            MCHECK(mthread_create(&helper_tid[i], NULL, helper, (void *)(long)i));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MCHECK(mthread_create(&tid, NULL, producer, NULL));
+    for(r = 0; r < rounds; r++) {
+        if(helpers) {
+            mthread_sem_wait(&forwarded);
+            index = forwarded_index;
+        }
+        else {
+            MCHECK(mthread_wait_any(objects, NUM_SEMS, NULL, &index));
+        }
+        if(index != r % NUM_SEMS)
+            errors++;
+        mthread_sem_post(&ack);
+    }
+    MCHECK(mthread_join(tid, NULL));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(helpers) {
+        use_helpers = 0;
+        for(i = 0; i < NUM_SEMS; i++) {
+            mthread_sem_post(&sems[i]);
+            MCHECK(mthread_join(helper_tid[i], NULL));
+        }
+    }
+
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+           / rounds / 1000;
+}
+
+int main(int argc, char **argv) {
+    mthread_wait_object_t objects[4] = {
+        { MTHREAD_WAIT_SEM,   &sem_a },
+        { MTHREAD_WAIT_SEM,   &sem_b },
+        { MTHREAD_WAIT_EVENT, &event },
+        { MTHREAD_WAIT_MUTEX, &mutex }
+    };
+    mthread_mutex_t pi;
+    struct timespec ts;
+    mthread_t tid;
+    int index;
+
+    if(argc == 2)
+        rounds = atol(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Waiting on Multiple Objects\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    mthread_sem_init(&sem_a, 0);
+    mthread_sem_init(&sem_b, 0);
+    MCHECK(mthread_event_init(&event, MTHREAD_EVENT_AUTO_RESET));
+    mthread_mutex_init(&mutex);
+
+    /* The mutex is held by ourselves until the other objects are checked */
+    MCHECK(mthread_mutex_lock(&mutex));
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += 50000000;
+    if(ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    if(mthread_wait_any(objects, 4, &ts, &index) != ETIMEDOUT)
+        errors++;
+
+    expect(objects, 4, post_b, 1);
+    expect(objects, 4, set_event, 2);
+    if(mthread_event_trywait(&event) != EAGAIN)
+        errors++;
+    MCHECK(mthread_mutex_unlock(&mutex));
+
+    /* hold_mutex posts sem_a once it holds the mutex */
+    MCHECK(mthread_create(&tid, NULL, hold_mutex, NULL));
+    MCHECK(mthread_sem_wait(&sem_a));
+    MCHECK(mthread_wait_any(objects, 4, NULL, &index));
+    if(index != 3)
+        errors++;
+    MCHECK(mthread_mutex_unlock(&mutex));
+    MCHECK(mthread_join(tid, NULL));
+
+    mthread_mutex_init_flags(&pi, MTHREAD_MUTEX_PI);
+    objects[3].object = &pi;
+    if(mthread_wait_any(objects, 4, NULL, &index) != EINVAL ||
+       mthread_wait_any(objects, 0, NULL, &index) != EINVAL)
+        errors++;
+
+    fprintf(stdout, "Rounds = %ld, Semaphores = %d\n", rounds, NUM_SEMS);
+    fprintf(stdout, "mthread_wait_any()       : %8.2f us per round\n", run(0));
+    fprintf(stdout, "Helper thread per object : %8.2f us per round\n", run(1));
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Waiting on Multiple Objects\n");
+    return 0;
+}
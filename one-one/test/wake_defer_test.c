@@ -0,0 +1,284 @@
+/**
+ * Benchmark for deferred wakes in a producer/consumer chain. Items flow from
+ * a source thread through a chain of stages to the main thread. Each stage
+ * is a thread that takes an item from one bounded queue and puts it on the
+ * next while it still holds the mutex of the first. Every queue is guarded
+ * by a mutex, and the condition variables are signalled with the mutex
+ * held. Without deferral, a signalled thread is woken while the signaller
+ * still holds the mutex, and may go straight back to sleep on it. With
+ * deferral the wakes are issued at the outermost unlock. The futex
+ * system call is intercepted to count waits on the mutexes and on the
+ * condition variables, and wake calls; context switches are taken from
+ * getrusage(2). Both modes run twice in turn. Over the runs, with
+ * deferral there must be fewer waits on the mutexes,
+ * fewer wake calls, as the two signals of a stage share one FUTEX_WAKE_OP,
+ * and fewer preemptions of a thread holding a mutex by the thread it
+ * woke. Wakes must be deferred only inside a scope opened with
+ * mthread_wake_defer_begin().
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define NUM_STAGES  4
+#define CAPACITY    16
+#define RUNS        2
+
+/* Bounded queue guarded by a mutex */
+struct queue {
+    mthread_mutex_t mutex;
+    mthread_cond_t not_empty;
+    mthread_cond_t not_full;
+    long items[CAPACITY];
+    int head, count;
+} queues[NUM_STAGES + 1];
+
+static long (*real_syscall)(long, ...);
+static atomic_long mutex_waits;
+static atomic_long cond_waits;
+static atomic_long futex_wakes;
+
+/* Whether addr is the mutex of one of the queues */
+int is_mutex(void *addr) {
+    for(int i = 0; i <= NUM_STAGES; i++)
+        if(addr == &queues[i].mutex)
+            return 1;
+    return 0;
+}
+
+/* Interposes the libc wrapper used by the library */
+long syscall(long number, ...) {
+    long a[6];
+    va_list ap;
+
+    va_start(ap, number);
+    for(int i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+
+    if(number == SYS_futex) {
+        int op = a[1] & FUTEX_CMD_MASK;
+        if(op == FUTEX_WAKE || op == FUTEX_WAKE_OP)
+            atomic_fetch_add(&futex_wakes, 1);
+        else if((op == FUTEX_WAIT || op == FUTEX_WAIT_BITSET) && is_mutex((void *)a[0]))
+            atomic_fetch_add(&mutex_waits, 1);
+        else if(op == FUTEX_WAIT || op == FUTEX_WAIT_BITSET)
+            atomic_fetch_add(&cond_waits, 1);
+    }
+
+    return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/* Counts of a run */
+struct counts {
+    long mutex_waits, wake_calls, preempted;
+};
+
+long n_items = 100000;
+int defer, errors;
+
+void put(struct queue *q, long item) {
+    mthread_mutex_lock(&q->mutex);
+    while(q->count == CAPACITY)
+        mthread_cond_wait(&q->not_full, &q->mutex);
+    q->items[(q->head + q->count++) % CAPACITY] = item;
+    mthread_cond_signal(&q->not_empty);
+    mthread_mutex_unlock(&q->mutex);
+}
+
+long take(struct queue *q) {
+    long item;
+
+    mthread_mutex_lock(&q->mutex);
+    while(q->count == 0)
+        mthread_cond_wait(&q->not_empty, &q->mutex);
+    item = q->items[q->head];
+    q->head = (q->head + 1) % CAPACITY;
+    q->count--;
+    mthread_cond_signal(&q->not_full);
+    mthread_mutex_unlock(&q->mutex);
+    return item;
+}
+
+/*
+ * Move an item on, holding the mutex of the queue it came from until it is
+ * on the next one. The signals of both queues are then issued in a row
+ * with that mutex held.
+ */
+void transfer(struct queue *in, struct queue *out) {
+    long item;
+
+    mthread_mutex_lock(&in->mutex);
+    while(in->count == 0)
+        mthread_cond_wait(&in->not_empty, &in->mutex);
+    item = in->items[in->head];
+    in->head = (in->head + 1) % CAPACITY;
+    in->count--;
+    put(out, item + 1);
+    mthread_cond_signal(&in->not_full);
+    mthread_mutex_unlock(&in->mutex);
+}
+
+void *stage(void *arg) {
+    long i, s = (long)arg;
+
+    if(defer)
+        MCHECK(mthread_wake_defer_begin());
+    for(i = 0; i < n_items; i++)
+        transfer(&queues[s], &queues[s + 1]);
+    if(defer)
+        MCHECK(mthread_wake_defer_end());
+    return NULL;
+}
+
+void *source(void *arg) {
+    long i;
+
+    if(defer)
+        MCHECK(mthread_wake_defer_begin());
+    for(i = 0; i < n_items; i++)
+        put(&queues[0], i);
+    if(defer)
+        MCHECK(mthread_wake_defer_end());
+    return NULL;
+}
+
+void run(int mode, struct counts *c) {
+    struct timespec start, end;
+    struct rusage before, after;
+    mthread_t tid[NUM_STAGES], source_tid;
+    long i;
+    double t;
+
+    defer = mode;
+    if(defer)
+        MCHECK(mthread_wake_defer_begin());
+    for(i = 0; i <= NUM_STAGES; i++) {
+        memset(&queues[i], 0, sizeof(struct queue));
+        mthread_mutex_init(&queues[i].mutex);
+        mthread_cond_init(&queues[i].not_empty);
+        mthread_cond_init(&queues[i].not_full);
+    }
+
+    atomic_store(&mutex_waits, 0);
+    atomic_store(&cond_waits, 0);
+    atomic_store(&futex_wakes, 0);
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    MCHECK(mthread_create(&source_tid, NULL, source, NULL));
+    for(i = 0; i < NUM_STAGES; i++)
+        MCHECK(mthread_create(&tid[i], NULL, stage, (void *)i));
+    for(i = 0; i < n_items; i++)
+        if(take(&queues[NUM_STAGES]) != i + NUM_STAGES)
+            errors++;
+    MCHECK(mthread_join(source_tid, NULL));
+    for(i = 0; i < NUM_STAGES; i++)
+        MCHECK(mthread_join(tid[i], NULL));
+    if(defer)
+        MCHECK(mthread_wake_defer_end());
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &after);
+    t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(stdout, "%-12s%8.3f%13ld%12ld%12ld%10ld%11ld\n",
+            mode ? "Deferred" : "Immediate", t, atomic_load(&mutex_waits),
+            atomic_load(&cond_waits), atomic_load(&futex_wakes),
+            (after.ru_nvcsw + after.ru_nivcsw) - (before.ru_nvcsw + before.ru_nivcsw),
+            after.ru_nivcsw - before.ru_nivcsw);
+
+    c->mutex_waits += atomic_load(&mutex_waits);
+    c->wake_calls += atomic_load(&futex_wakes);
+    c->preempted += after.ru_nivcsw - before.ru_nivcsw;
+}
+
+int main(int argc, char **argv) {
+    struct counts immediate = { 0 }, deferred = { 0 };
+    mthread_mutex_t mutex;
+    int word = 0;
+
+    real_syscall = dlsym(RTLD_NEXT, "syscall");
+    if(real_syscall == NULL) {
+        fprintf(stderr, "Unable to resolve syscall(2)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(argc == 2)
+        n_items = atol(argv[1]);
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Deferred Wakes\n");
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Items = %ld, Stages = %d, Capacity = %d\n",
+            n_items, NUM_STAGES, CAPACITY);
+
+    mthread_init();
+    fprintf(stdout, "%-12s%8s%13s%12s%12s%10s%11s\n", "Wakes", "Seconds",
+            "Mutex waits", "Cond waits", "Wake calls", "Switches", "Preempted");
+    /* Alternated, so that both modes see the same background */
+    for(int i = 0; i < RUNS; i++) {
+        run(0, &immediate);
+        run(1, &deferred);
+    }
+    if(deferred.mutex_waits >= immediate.mutex_waits ||
+       deferred.wake_calls >= immediate.wake_calls ||
+       deferred.preempted >= immediate.preempted)
+        errors++;
+    fprintf(stdout, "Fewer mutex waits, wake calls and preemptions deferred: %s\n",
+            errors ? "no" : "yes");
+
+    /* Wakes under a mutex are deferred only inside a scope */
+    mthread_mutex_init(&mutex);
+    mthread_mutex_lock(&mutex);
+    atomic_store(&futex_wakes, 0);
+    mthread_wake_by_address(&word, 1);
+    if(atomic_load(&futex_wakes) != 1)
+        errors++;
+    mthread_mutex_unlock(&mutex);
+
+    MCHECK(mthread_wake_defer_begin());
+    mthread_mutex_lock(&mutex);
+    atomic_store(&futex_wakes, 0);
+    mthread_wake_by_address(&word, 1);
+    if(atomic_load(&futex_wakes) != 0)
+        errors++;
+    mthread_mutex_unlock(&mutex);
+    if(atomic_load(&futex_wakes) != 1)
+        errors++;
+    MCHECK(mthread_wake_defer_end());
+    if(mthread_wake_defer_end() != EPERM)
+        errors++;
+    fprintf(stdout, "Deferral limited to scopes: %s\n", errors ? "no" : "yes");
+
+    if(errors == 0) {
+        fprintf(stdout, "TEST PASSED\n");
+    }
+    else {
+        fprintf(stdout, "Errors = %d\n", errors);
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "Exit Testcases - Deferred Wakes\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * Regression test for wakeup system calls issued by condition variables and
+ * semaphores. The futex system call is intercepted to count FUTEX_WAKE
+ * operations. Signalling or posting with no thread parked must not enter the
+ * kernel at all, while a parked thread must still be woken up.
+ */
+
+#define _GNU_SOURCE
+#include "mthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define MCHECK(FCALL)                                                    \
+    {                                                                    \
+        int result;                                                      \
+        if ((result = (FCALL)) != 0) {                                   \
+            fprintf(stderr, "FATAL: %s (%s)", strerror(result), #FCALL); \
+            exit(-1);                                                    \
+        }                                                                \
+    }
+
+#define ITERATIONS 100000
+
+static long (*real_syscall)(long, ...);
+static atomic_int futex_waits;
+static atomic_int futex_wakes;
+static void *watched;
+
+/* Interposes the libc wrapper used by the library */
+long syscall(long number, ...) {
+    long a[6];
+    va_list ap;
+
+    va_start(ap, number);
+    for(int i = 0; i < 6; i++)
+        a[i] = va_arg(ap, long);
+    va_end(ap);
+
+    if(number == SYS_futex) {
+        int op = a[1] & FUTEX_CMD_MASK;
+        if(op == FUTEX_WAKE && (watched == NULL || (void *)a[0] == watched))
+            atomic_fetch_add(&futex_wakes, 1);
+        else if(op == FUTEX_WAIT || op == FUTEX_WAIT_BITSET)
+            atomic_fetch_add(&futex_waits, 1);
+    }
+
+    return real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+mthread_sem_t sem;
+mthread_cond_t cond;
+mthread_mutex_t mutex;
+int ready = 0;
+int failed = 0;
+
+void *sem_waiter(void *arg) {
+    mthread_sem_wait(&sem);
+    return NULL;
+}
+
+void *cond_waiter(void *arg) {
+    mthread_mutex_lock(&mutex);
+    while(!ready)
+        mthread_cond_wait(&cond, &mutex);
+    mthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+void check(const char *what, int expected, int actual) {
+    fprintf(stdout, "%-40s: Expected %d Actual %d\n", what, expected, actual);
+    if(expected != actual)
+        failed = 1;
+}
+
+/* Spin until a thread has entered FUTEX_WAIT */
+void wait_for_sleeper(void) {
+    while(atomic_load(&futex_waits) == 0)
+        usleep(1000);
+    usleep(10000);
+}
+
+int main(int argc, char **argv) {
+    mthread_t tid;
+    int i;
+
+    real_syscall = dlsym(RTLD_NEXT, "syscall");
+    if(real_syscall == NULL) {
+        fprintf(stderr, "Unable to resolve syscall(2)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(stdout, "-------------------------------------------\n");
+    fprintf(stdout, "Wakeup System Calls\n");
+    fprintf(stdout, "-------------------------------------------\n");
+
+    mthread_init();
+    mthread_sem_init(&sem, 0);
+    mthread_cond_init(&cond);
+    mthread_mutex_init(&mutex);
+
+    atomic_store(&futex_wakes, 0);
+    for(i = 0; i < ITERATIONS; i++)
+        mthread_sem_post(&sem);
+    for(i = 0; i < ITERATIONS; i++)
+        mthread_sem_wait(&sem);
+    check("Semaphore post without waiters", 0, atomic_load(&futex_wakes));
+
+    atomic_store(&futex_wakes, 0);
+    for(i = 0; i < ITERATIONS; i++)
+        mthread_cond_signal(&cond);
+    check("Condvar signal without waiters", 0, atomic_load(&futex_wakes));
+
+    atomic_store(&futex_waits, 0);
+    MCHECK(mthread_create(&tid, NULL, sem_waiter, NULL));
+    wait_for_sleeper();
+    atomic_store(&futex_wakes, 0);
+    mthread_sem_post(&sem);
+    MCHECK(mthread_join(tid, NULL));
+    check("Semaphore post with a parked waiter", 1, atomic_load(&futex_wakes));
+
+    /* Only count wakeups on the condition variable, not on its mutex */
+    watched = &cond;
+    atomic_store(&futex_waits, 0);
+    MCHECK(mthread_create(&tid, NULL, cond_waiter, NULL));
+    wait_for_sleeper();
+    atomic_store(&futex_wakes, 0);
+    mthread_mutex_lock(&mutex);
+    ready = 1;
+    mthread_cond_signal(&cond);
+    mthread_mutex_unlock(&mutex);
+    MCHECK(mthread_join(tid, NULL));
+    check("Condvar signal with a parked waiter", 1, atomic_load(&futex_wakes));
+
+    if(failed) {
+        fprintf(stdout, "TEST FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stdout, "TEST PASSED\n");
+    fprintf(stdout, "Exit Testcases - Wakeup System Calls\n");
+    return 0;
+}